@@ -10,6 +10,10 @@
 #cmakedefine	KOBO_HAVE__VSNPRINTF
 #cmakedefine	KOBO_HAVE_STAT
 #cmakedefine	KOBO_HAVE_LSTAT
+#cmakedefine	KOBO_HAVE_GETTIMEOFDAY
+#cmakedefine	KOBO_HAVE_MMAP
+#cmakedefine	KOBO_HAVE___THREAD
+#cmakedefine	KOBO_HAVE___SYNC
 
 #cmakedefine	KOBO_HAVE_GETEGID
 #cmakedefine	KOBO_HAVE_SETGID
@@ -35,5 +39,7 @@
 #cmakedefine	KOBO_USERDIR	"@KOBO_USERDIR@"
 #cmakedefine	KOBO_EXEFILE	"@KOBO_EXEFILE@"
 #cmakedefine	KOBO_CONFIGFILE	"@KOBO_CONFIGFILE@"
+#cmakedefine	KOBO_SFXCACHEFILE	"@KOBO_SFXCACHEFILE@"
+#cmakedefine	KOBO_EELCACHEFILE	"@KOBO_EELCACHEFILE@"
 
 #cmakedefine	KOBO_SYSCONFDIR "@KOBO_SYSCONFDIR@"
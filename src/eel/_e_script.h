@@ -29,12 +29,14 @@
 
 typedef struct script_t
 {
-	char		*name;
-	unsigned char	*data;
-	unsigned	len;
+	char			*name;
+	unsigned char		*data;
+	unsigned		len;
+	struct eel_token_t	*code;		/* See eel_compile() */
+	int			codelen;
+	char			*strings;	/* Names and literals */
+	int			stringslen;
 } script_t;
 
-extern script_t eel_scripttab[MAX_SCRIPTS];
-
 
 #endif /*_EEL__SCRIPT_H_*/
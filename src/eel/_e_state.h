@@ -0,0 +1,111 @@
+/*(LGPL)
+---------------------------------------------------------------------------
+	_e_state.h - EEL interpreter state (Private)
+---------------------------------------------------------------------------
+ * Copyright (C) 2007 David Olofson
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef _EEL__STATE_H_
+#define _EEL__STATE_H_
+
+#include "config.h"
+#include "eel.h"
+#include "e_util.h"
+#include "e_lexer.h"
+#include "_e_script.h"
+
+#define	MAX_SCOPES	32
+
+#define	STRINGREP_SIZE	128
+
+/* Thread local storage, where available */
+#if defined(_MSC_VER)
+#	define	EEL_TLS	__declspec(thread)
+#elif defined(KOBO_HAVE___THREAD)
+#	define	EEL_TLS	__thread
+#else
+#	define	EEL_TLS
+#endif
+
+struct eel_sblock_t;
+struct eel_scope_t;
+struct eel_string_t;
+union eel_dcell_t;
+
+/*
+ * Everything that changes while compiling and running
+ * scripts. Scopes below 'shared' belong to the state
+ * that created this one, and are only ever read.
+ */
+struct eel_state_t
+{
+	/* Interpreter (e_util.c) */
+	eel_context_t		current;
+	int			last_script;	/* For eel_error() */
+	eel_context_t		*context_stack;
+	eel_context_t		*context_pool;	/* For reuse */
+
+	/* Argument list (e_getargs.c) */
+	eel_data_t		args[EEL_MAX_ARGS];
+	int			arg_tokens[EEL_MAX_ARGS];
+	int			arg_count;
+
+	/* Scripts (e_script.c) */
+	script_t		scripts[MAX_SCRIPTS];
+
+	/*
+	 * Compiler (e_lexer.c). Tokens are copied to the script
+	 * when done. Names and literals go in one block per
+	 * script, sized after the source.
+	 */
+	eel_token_t		*code;
+	int			code_length;
+	int			code_size;
+	char			*strings;
+	int			strings_length;
+	eel_symbol_t		*operators[256];	/* By character */
+
+	/* Symbol table (e_symtab.c) */
+	struct eel_scope_t	*scopes[MAX_SCOPES];
+	struct eel_scope_t	*own_scopes;	/* MAX_SCOPES */
+	int			shared;
+	int			current_scope;
+	int			deepest_scope;
+
+	/* Data containers (e_symtab.c) */
+	struct eel_string_t	*istrings;	/* Interned strings */
+	unsigned		istrings_size;	/* Power of two */
+	unsigned		istrings_count;
+	struct eel_sblock_t	*istring_blocks;
+	union eel_dcell_t	*free_cells;
+	char			d_rep[STRINGREP_SIZE];
+	char			s_rep[STRINGREP_SIZE];
+};
+
+/* State of the calling thread */
+extern EEL_TLS eel_state_t *eel_state;
+
+/* Set up by eel_open(); used by any thread that selects no other state */
+extern eel_state_t eel_default_state;
+
+#define	eel_current	(eel_state->current)
+#define	eel_args	(eel_state->args)
+#define	eel_arg_tokens	(eel_state->arg_tokens)
+#define	eel_arg_count	(eel_state->arg_count)
+#define	eel_scripttab	(eel_state->scripts)
+
+#endif /*_EEL__STATE_H_*/
@@ -26,6 +26,7 @@
 #include "e_builtin.h"
 #include "e_util.h"
 #include "e_lexer.h"
+#include "_e_state.h"
 
 
 /*----------------------------------------------------------
@@ -346,6 +347,10 @@ int eel_dir_define(void)
 	if(res < 0)
 		return -1;
 
+	to = eel_s_own(to);
+	if(!to)
+		return -1;
+
 	switch(res)
 	{
 	  case 1:
@@ -404,7 +409,7 @@ static int _proc_func(void)
 	}
 
 	/* Store the start of the *argument list*... :-) */
-	s->data.value.a = bio_tell(eel_current.bio);
+	s->data.value.a = eel_current.pc;
 	s->token = eel_current.script;
 	eel_push_scope();
 	res = eel_parse_args(",", ')');
@@ -427,36 +432,30 @@ static int _proc_func(void)
 
 int eel_spec_function(void)
 {
-	int c;
-
 	if(_proc_func() < 0)
 		return -1;
 
-	/* QUICK HACK: Skip function body */
-	while((c = bio_getchar(eel_current.bio)) != '}')
-		if(EOF == c)
-		{
-			eel_error("EOF inside function body!");
-			return -1;
-		}
+	/* Skip function body */
+	if(eel_skip_block() < 0)
+	{
+		eel_error("EOF inside function body!");
+		return -1;
+	}
 
 	return 1;
 }
 
 int eel_spec_procedure(void)
 {
-	int c;
-
 	if(_proc_func() < 0)
 		return -1;
 
-	/* QUICK HACK: Skip procedure body */
-	while((c = bio_getchar(eel_current.bio)) != '}')
-		if(EOF == c)
-		{
-			eel_error("EOF inside procedure body!");
-			return -1;
-		}
+	/* Skip procedure body */
+	if(eel_skip_block() < 0)
+	{
+		eel_error("EOF inside procedure body!");
+		return -1;
+	}
 
 	return 1;
 }
@@ -30,6 +30,7 @@
 #include "e_lexer.h"
 #include "e_util.h"
 #include "e_builtin.h"
+#include "_e_state.h"
 
 #define	DBG(x)
 
@@ -38,14 +39,6 @@
 	Argument list parser
 ----------------------------------------------------------*/
 
-eel_data_t eel_arg_table[EEL_MAX_ARGS];
-int eel_arg_token_table[EEL_MAX_ARGS];
-
-int eel_arg_count = 0;
-eel_data_t *eel_args = eel_arg_table;
-int *eel_arg_tokens = eel_arg_token_table;
-
-
 int eel_grab_arg(void)
 {
 	if(eel_arg_count >= EEL_MAX_ARGS)
@@ -64,15 +57,13 @@ int eel_grab_arg(void)
 		}
 
 		/*
-		 * Important:
-		 *	This is a *move* operation! This is
-		 *	to avoid copying external string
-		 *	buffers around, while still making
-		 *	sure the new eel_data_t gains true
-		 *	ownership of them.
+		 * This is a *move* operation. Strings are
+		 * not owned by the eel_data_t (they're
+		 * interned, or point into the script), so
+		 * there is nothing to copy.
 		 */
 		eel_args[eel_arg_count] = *eel_current.lval;
-		free(eel_current.lval);
+		eel_d_free(eel_current.lval);
 		eel_current.lval = NULL;
 	}
 	++eel_arg_count;
@@ -25,6 +25,7 @@
 
 #include "e_lexer.h"
 #include "e_util.h"
+#include "_e_state.h"
 
 
 int eel_get_unique_token()
@@ -34,66 +35,64 @@ int eel_get_unique_token()
 }
 
 
-static char *lexbuf = NULL;
-static int lexbuf_length = 0;
+/*----------------------------------------------------------
+	Compiler
+----------------------------------------------------------*/
 
-
-static int lexbuf_realloc(int len)
-{
-	char *nsb;
-	lexbuf_length = len * 5 / 4;
-	nsb = (char *)realloc(lexbuf, lexbuf_length + 1);
-	if(!nsb)
-	{
-		eel_error("EEL lexer out of memory!");
-		return -1;
-	}
-	lexbuf = nsb;
-	return 0;
-}
-
-
-static inline int lexbuf_bump(int len)
+void eel_lexer_cleanup(void)
 {
-	if(len >= lexbuf_length)
-		return lexbuf_realloc(len);
-	return 0;
+	eel_d_free(eel_current.lval);
+	eel_current.lval = NULL;
+	free(eel_state->code);
+	eel_state->code = NULL;
+	eel_state->code_size = 0;
 }
 
 
-void eel_lexer_cleanup(void)
+static eel_token_t *newtoken(eel_state_t *st)
 {
-	if(eel_current.lval)
+	eel_token_t *t;
+	if(st->code_length >= st->code_size)
 	{
-		eel_d_freestring(eel_current.lval);
-		free(eel_current.lval);
-		eel_current.lval = NULL;
+		int ns = st->code_size ? st->code_size * 2 : 256;
+		eel_token_t *nc = (eel_token_t *)realloc(st->code,
+				ns * sizeof(eel_token_t));
+		if(!nc)
+			return NULL;
+		st->code = nc;
+		st->code_size = ns;
 	}
-	free(lexbuf);
-	lexbuf = NULL;
-	lexbuf_length = 0;
+	t = st->code + st->code_length++;
+	t->token = 0;
+	t->pos = 0;
+	t->jump = -1;
+	t->data.type = EDT_ILLEGAL;
+	return t;
 }
 
 
-static int skipwhite(int report_eoln)
+/* Store an error message, to be reported if the token is ever lexed. */
+static int lex_error(eel_token_t *t, const char *format, const char *arg)
 {
-	int c;
-	/* Ignore whitespace and get first nonwhite character. */
-	while((c = bio_getchar(eel_current.bio)) == ' ' || c == '\t' ||
-			c == '\r' || c == '\n')
-		if((c == '\n') && report_eoln)
-				return c;
-	return c;
+	char msg[128];
+	snprintf(msg, sizeof(msg), format, arg);
+	msg[sizeof(msg) - 1] = 0;
+	eel_d_setstring(&t->data, msg);
+	return TK_ERROR;
 }
 
 
-static eel_data_t *newdata(eel_datatypes_t type)
+/*
+ * Ignore whitespace and get first nonwhite character.
+ * Newlines are returned, so that we can keep them in the
+ * token code for eel_lex(1).
+ */
+static int skipwhite(bio_file_t *h)
 {
-	eel_data_t *d = (eel_data_t *)calloc(1, sizeof(eel_data_t));
-	if(!d)
-		return NULL;
-	d->type = type;
-	return d;
+	int c;
+	while((c = bio_getchar(h)) == ' ' || c == '\t' || c == '\r')
+		;
+	return c;
 }
 
 
@@ -129,35 +128,79 @@ static int get_num(bio_file_t *h, int base, int figures)
 }
 
 
+/*
+ * Parse a number. Plain decimals with up to 15 figures, and
+ * no more than 22 decimals, are exact as integer / 10^n, so
+ * we do those here. Anything else goes to strtod().
+ */
+static double get_real(bio_file_t *h)
+{
+	static const double p10[23] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+		1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19,
+		1e20, 1e21, 1e22
+	};
+	int pos = bio_tell(h);
+	int figures = 0, decimals = -1;
+	double value = 0.0;
+	int c;
+	while(1)
+	{
+		c = bio_getchar(h);
+		if(c >= '0' && c <= '9')
+		{
+			value = value * 10.0 + (c - '0');
+			++figures;
+			if(decimals >= 0)
+				++decimals;
+		}
+		else if((c == '.') && (decimals < 0))
+			decimals = 0;
+		else
+			break;
+	}
+	if(!figures || (figures > 15) || (decimals > 22) ||
+			(c == 'e') || (c == 'E') || (c == 'x') || (c == 'X'))
+	{
+		bio_seek(h, pos, SEEK_SET);
+		return bio_strtod(h);
+	}
+	if(c != EOF)
+		bio_ungetc(h);
+	if(decimals > 0)
+		value /= p10[decimals];
+	return value;
+}
+
+
 /*
  * Parse quoted string.
  * C printf "backslash codes" are supported,
  * as well as "\dXXX", for decimal codes.
  */
-static int parse_string(bio_file_t *h)
+static int parse_string(bio_file_t *h, eel_token_t *t)
 {
-	int c, len = 0;
+	int c;
+	char *str = eel_state->strings + eel_state->strings_length;
+	int len = 0;
 	while((c = bio_getchar(h)) != '"')
 	{
 		switch(c)
 		{
 		  case EOF:
-			eel_error("EOF inside string literal!");
-			return TK_ERROR;
+			return lex_error(t, "EOF inside string literal!", NULL);
 		  case '\\':
 			c = bio_getchar(h);
 			switch(c)
 			{
 			  case EOF:
-				eel_error("EOF inside string escape sequence!");
-				return -1;
+				return lex_error(t, "EOF inside string escape"
+						" sequence!", NULL);
 			  case '0':
 				c = get_num(h, 8, 3);
 				if(c < 0)
-				{
-					eel_error("Illegal octal figure!");
-					return TK_ERROR;
-				}
+					return lex_error(t, "Illegal octal"
+							" figure!", NULL);
 				break;
 			  case 'a':
 				c = '\a';
@@ -171,10 +214,8 @@ static int parse_string(bio_file_t *h)
 			  case 'd':
 				c = get_num(h, 10, 2);
 				if(c < 0)
-				{
-					eel_error("Illegal decimal figure!");
-					return TK_ERROR;
-				}
+					return lex_error(t, "Illegal decimal"
+							" figure!", NULL);
 				break;
 			  case 'f':
 				c = '\f';
@@ -194,10 +235,8 @@ static int parse_string(bio_file_t *h)
 			  case 'x':
 				c = get_num(h, 16, 2);
 				if(c < 0)
-				{
-					eel_error("Illegal hex figure!");
-					return TK_ERROR;
-				}
+					return lex_error(t, "Illegal hex"
+							" figure!", NULL);
 				break;
 			  default:
 				break;
@@ -206,58 +245,34 @@ static int parse_string(bio_file_t *h)
 		  default:
 			break;
 		}
-		lexbuf_bump(len + 1);
-		lexbuf[len++] = c;
+		str[len++] = c;
 	}
-	lexbuf[len] = 0;
-	eel_current.lval = newdata(EDT_STRING);
-	if(!eel_current.lval)
-		return TK_ERROR;
-	eel_d_setstring(eel_current.lval, lexbuf);
+	str[len] = 0;
+	eel_state->strings_length += len + 1;
+	t->data.type = EDT_STRING;
+	t->data.value.s = str;
 	return TK_STRN;
 }
 
 
-static inline int token(int tk)
-{
-	eel_current.token = tk;
-	return tk;
-}
-
 /*
- * Pass 1 for 'report_eoln' to get '\n' back whenever a
- * newline occurs in the source.
+ * Lex one token from 'h' into 't'.
  *
  * Note that newlines inside comments are *always* treated
  * as white space!
  */
-int eel_lex(int report_eoln)
+static int scan(bio_file_t *h, eel_token_t *t)
 {
 	int c, prevc;
-	int negative = 0, directive = 0;
-	bio_file_t *h = eel_current.bio;
+	int directive = 0;
+	char *name;
 	eel_symbol_t *s;
 
-	/* Handle eel_unlex() pushbacks */
-	if(eel_current.unlexed)
-	{
-		eel_current.unlexed = 0;
-		return eel_current.token;
-	}
-
-	/* In case someone should ignore an lval... */
-	if(eel_current.lval)
-	{
-		eel_d_freestring(eel_current.lval);
-		free(eel_current.lval);
-		eel_current.lval = NULL;
-	}
-
 	while(1)
 	{
-		c = skipwhite(report_eoln);
+		c = skipwhite(h);
 		if(c == EOF)
-			return token(0);
+			return 0;
 
 		/* /X comment tokens */
 		if(c == '/')
@@ -295,17 +310,11 @@ int eel_lex(int report_eoln)
 	if(c == '.' || isdigit(c))
 	{
 		bio_ungetc(h);
-		eel_current.lval = newdata(EDT_REAL);
-		if(!eel_current.lval)
-			return token(TK_ERROR);
-		eel_current.lval->value.r = bio_strtod(h);
-		if(negative)
-			eel_current.lval->value.r = -eel_current.lval->value.r;
-		return token(TK_RNUM);
+		t->data.type = EDT_REAL;
+		t->data.value.r = get_real(h);
+		return TK_RNUM;
 	}
 
-	negative = 0;
-
 	/* 
 	 * (Multi)character literal (cast to integer)
 	 * Note that this is always little endian, so
@@ -314,26 +323,25 @@ int eel_lex(int report_eoln)
 	 */
 	if('\'' == c)
 	{
-		eel_current.lval = newdata(EDT_INTEGER);
-		if(!eel_current.lval)
-			return token(TK_ERROR);
-		eel_current.lval->value.i = 0;
+		t->data.type = EDT_INTEGER;
+		t->data.value.i = 0;
 		while((c = bio_getchar(h)) != '\'')
 		{
 			if(EOF == c)
 			{
-				eel_error("EOF inside character literal!");
-				return token(TK_ERROR);
+				t->data.type = EDT_ILLEGAL;
+				return lex_error(t, "EOF inside character"
+						" literal!", NULL);
 			}
-			eel_current.lval->value.i <<= 8;
-			eel_current.lval->value.i |= c;
+			t->data.value.i <<= 8;
+			t->data.value.i |= c;
 		}
-		return token(TK_INUM);
+		return TK_INUM;
 	}
 
 	/* String literal */
 	if('"' == c)
-		return token(parse_string(h));
+		return parse_string(h, t);
 
 	/* Check for "preprocessor" directives */
 	if('#' == c)
@@ -350,66 +358,345 @@ int eel_lex(int report_eoln)
 		while((isalnum(c = bio_getchar(h)) || ('_' == c)) && (EOF != c))
 			++len;
 
-		if(lexbuf_bump(len) < 0)
-			return token(TK_ERROR);
+		name = eel_state->strings + eel_state->strings_length;
 		bio_seek(h, start, SEEK_SET);
-		bio_read(h, lexbuf, len);
-		lexbuf[len] = '\0';
+		bio_read(h, name, len);
+		name[len] = '\0';
 
 		if(directive)
 		{
-			directive = 0;
-			s = eel_s_find_n_t(NULL, lexbuf, EST_DIRECTIVE);
+			s = eel_s_find_n_t(NULL, name, EST_DIRECTIVE);
 			if(!s)
+				return lex_error(t, "Unknown directive '%s'!",
+						name);
+			if(s->type != EST_DIRECTIVE)
+				return lex_error(t, "Preprocessor directive"
+						" expected!", NULL);
+			t->data.type = EDT_SYMREF;
+			t->data.value.sym = s;
+			return TK_SYMREF;
+		}
+
+		/*
+		 * Operators, specials, directives and enums registered
+		 * in the root scope can never be shadowed or redefined
+		 * by scripts, so those are bound right away.
+		 */
+		t->hash = eel_s_hash(name);
+		s = eel_s_find_h(NULL, name, t->hash);
+		if(s && !s->scope)
+			switch(s->type)
 			{
-				eel_error("Unknown directive '%s'!",
-						lexbuf);
-				return token(TK_ERROR);
+			  case EST_OPERATOR:
+			  case EST_DIRECTIVE:
+			  case EST_SPECIAL:
+			  case EST_ENUM:
+				t->data.type = EDT_SYMREF;
+				t->data.value.sym = s;
+				return TK_SYMREF;
+			  default:
+				break;
 			}
-			if(s->type != EST_DIRECTIVE)
+
+		/* Anything else is resolved by eel_lex() */
+		eel_state->strings_length += len + 1;
+		t->data.type = EDT_SYMNAME;
+		t->data.value.s = name;
+		return TK_NEWSYM;
+	}
+
+	/* Look for valid operator characters */
+	if(strchr("+-*/^<>~&%@!|$", (char)c))
+	{
+		char op[2];
+		s = eel_state->operators[c];
+		op[0] = c;
+		op[1] = 0;
+		if(!s)
+			s = eel_state->operators[c] = eel_s_find_n_t(NULL,
+					op, EST_OPERATOR);
+		if(!s)
+			return lex_error(t, "Unknown operator '%s'!", op);
+		t->data.type = EDT_SYMREF;
+		t->data.value.sym = s;
+		return TK_SYMREF;
+	}
+
+	return c;
+}
+
+
+static inline int is_number(eel_token_t *t)
+{
+	switch(t->token)
+	{
+	  case TK_RNUM:
+		return t->data.value.r != 0.0;
+	  case TK_INUM:
+		return t->data.value.i != 0;
+	  default:
+		return 0;
+	}
+}
+
+static inline eel_symbol_t *is_operator(eel_token_t *t)
+{
+	if((TK_SYMREF != t->token) ||
+			(EST_OPERATOR != t->data.value.sym->type))
+		return NULL;
+	return t->data.value.sym;
+}
+
+/*
+ * Fold "<number> <operator> <number>" into a single number,
+ * as soon as the token after the expression shows that the
+ * evaluator would calculate it first, as it is. Only binary
+ * operators right at the start of an expression, after '=',
+ * ',' or '(', are considered. A zero operand is never folded,
+ * so that division by zero is still reported at run time.
+ *
+ * 'n' is the index of the token just scanned. Returns the
+ * new index of that token.
+ */
+static int fold(eel_state_t *st, int n)
+{
+	eel_token_t *code = st->code;
+	while(1)
+	{
+		eel_symbol_t *op, *next;
+		eel_data_t d[2];
+		int a, b, p;
+		for(b = n - 1; (b >= 0) && ('\n' == code[b].token); --b)
+			;
+		a = b - 2;
+		if((a < 0) || !is_number(code + a) || !is_number(code + b))
+			return n;
+		op = is_operator(code + b - 1);
+		if(!op || (op->data.value.op.preargs != 1) ||
+				op->data.value.op.retargs)
+			return n;
+		for(p = a - 1; (p >= 0) && ('\n' == code[p].token); --p)
+			;
+		if(p >= 0)
+			switch(code[p].token)
 			{
-				eel_error("Preprocessor directive expected!");
-				return token(TK_ERROR);
+			  case '=':
+			  case ',':
+			  case '(':
+				break;
+			  default:
+				return n;
 			}
-			eel_current.lval = newdata(EDT_SYMREF);
-			eel_current.lval->value.sym = s;
-			return token(TK_SYMREF);
+		next = is_operator(code + n);
+		if(next && (next->data.value.op.priority >
+				op->data.value.op.priority))
+			return n;
+
+		d[0] = code[a].data;
+		d[1] = code[b].data;
+		if(op->data.value.op.cb(2, d) < 0)
+			return n;
+		switch(d[0].type)
+		{
+		  case EDT_REAL:
+			code[a].token = TK_RNUM;
+			break;
+		  case EDT_INTEGER:
+			code[a].token = TK_INUM;
+			break;
+		  default:
+			return n;
 		}
-		else
+		code[a].data = d[0];
+		code[a].pos = code[b].pos;
+		memmove(code + a + 1, code + b + 1,
+				(n - b) * sizeof(eel_token_t));
+		n -= 2;
+		st->code_length -= 2;
+	}
+}
+
+
+int eel_compile(int handle)
+{
+	eel_state_t *st = eel_state;
+	script_t *scr = st->scripts + handle;
+	bio_file_t *h;
+	int open = -1;		/* Innermost unmatched '{' */
+	int last = 0;
+
+	eel_free_code(handle);
+	h = bio_open(scr->data, scr->len);
+	st->strings = (char *)malloc(scr->len + 1);
+	if(!h || !st->strings)
+	{
+		bio_close(h);
+		free(st->strings);
+		return -1;
+	}
+	st->strings_length = 0;
+	st->code_length = 0;
+	memset(st->operators, 0, sizeof(st->operators));
+	while(1)
+	{
+		eel_token_t *t = newtoken(st);
+		if(!t)
+			break;
+		t->token = scan(h, t);
+		t->pos = bio_tell(h);
+		if(t->token != '\n')
+			t = st->code + fold(st, st->code_length - 1);
+		switch(t->token)
 		{
-			s = eel_s_find(NULL, lexbuf);
-			if(s)
-			{
-				eel_current.lval = newdata(EDT_SYMREF);
-				eel_current.lval->value.sym = s;
-				return token(TK_SYMREF);
-			}
-			else
+		  case 0:
+			/* Report EOF at the end of the last token */
+			t->pos = last;
+			break;
+		  case '{':
+			/* Chain unmatched braces through 'jump' */
+			t->jump = open;
+			open = st->code_length - 1;
+			break;
+		  case '}':
+			if(open >= 0)
 			{
-				eel_current.lval = newdata(EDT_SYMNAME);
-				eel_d_setstring(eel_current.lval, lexbuf);
-				return token(TK_NEWSYM);
+				int o = open;
+				open = st->code[o].jump;
+				st->code[o].jump = st->code_length - 1;
 			}
+			break;
 		}
+		if(!t->token)
+			break;
+		if(t->token != '\n')
+			last = t->pos;
 	}
+	bio_close(h);
 
-	/* Look for valid operator characters */
-	if(strchr("+-*/^<>~&%@!|$", (char)c))
+	/* Unterminated blocks */
+	while(open >= 0)
 	{
-		lexbuf[0] = c;
-		lexbuf[1] = 0;
-		s = eel_s_find_n_t(NULL, lexbuf, EST_OPERATOR);
-		if(!s)
+		int o = open;
+		open = st->code[o].jump;
+		st->code[o].jump = -1;
+	}
+
+	scr->strings = st->strings;
+	scr->stringslen = st->strings_length;
+	st->strings = NULL;
+	scr->code = NULL;
+	if(st->code_length && !st->code[st->code_length - 1].token)
+		scr->code = (eel_token_t *)malloc(st->code_length *
+				sizeof(eel_token_t));
+	scr->codelen = st->code_length;
+	if(!scr->code)
+	{
+		/* Out of memory */
+		scr->code = st->code;
+		eel_free_code(handle);
+		st->code = NULL;
+		st->code_size = 0;
+		return -1;
+	}
+	memcpy(scr->code, st->code, st->code_length * sizeof(eel_token_t));
+	return 0;
+}
+
+
+void eel_free_code(int handle)
+{
+	script_t *scr = eel_scripttab + handle;
+	int i;
+	if(scr->code)
+	{
+		/* Only error messages are allocated per token */
+		for(i = 0; i < scr->codelen; ++i)
+			if(TK_ERROR == scr->code[i].token)
+				eel_d_freestring(&scr->code[i].data);
+		free(scr->code);
+		scr->code = NULL;
+		scr->codelen = 0;
+	}
+	free(scr->strings);
+	scr->strings = NULL;
+	scr->stringslen = 0;
+}
+
+
+/*----------------------------------------------------------
+	Lexer
+----------------------------------------------------------*/
+
+static inline int token(eel_context_t *cur, int tk)
+{
+	cur->token = tk;
+	return tk;
+}
+
+/*
+ * Pass 1 for 'report_eoln' to get '\n' back whenever a
+ * newline occurs in the source.
+ */
+int eel_lex(int report_eoln)
+{
+	eel_context_t *cur = &eel_current;
+	eel_token_t *t;
+	eel_symbol_t *s;
+	int pc = cur->pc;
+
+	/* Handle eel_unlex() pushbacks */
+	if(cur->unlexed)
+	{
+		cur->unlexed = 0;
+		return cur->token;
+	}
+
+	/* In case someone should ignore an lval... */
+	eel_d_free(cur->lval);
+	cur->lval = NULL;
+
+	t = eel_scripttab[cur->script].code;
+	if(!report_eoln)
+		while('\n' == t[pc].token)
+			++pc;
+	t += pc;
+	if(t->token)
+		++pc;	/* Stay at EOF once we get there */
+	cur->pc = pc;
+
+	/*
+	 * Strings are not copied here, but point right into the
+	 * script. Anything that keeps a string beyond the current
+	 * statement interns it through eel_d_setstring().
+	 */
+	switch(t->token)
+	{
+	  case TK_NEWSYM:
+		s = eel_s_find_h(NULL, t->data.value.s, t->hash);
+		if(s)
 		{
-			eel_error("Unknown operator '%s'!", lexbuf);
-			return token(TK_ERROR);
+			cur->lval = eel_d_new(EDT_SYMREF);
+			if(!cur->lval)
+				return token(cur, TK_ERROR);
+			cur->lval->value.sym = s;
+			return token(cur, TK_SYMREF);
 		}
-		eel_current.lval = newdata(EDT_SYMREF);
-		eel_current.lval->value.sym = s;
-		return token(TK_SYMREF);		
+		/* Fall through */
+	  case TK_RNUM:
+	  case TK_INUM:
+	  case TK_STRN:
+	  case TK_SYMREF:
+		cur->lval = eel_d_new(t->data.type);
+		if(!cur->lval)
+			return token(cur, TK_ERROR);
+		*cur->lval = t->data;
+		return token(cur, t->token);
+	  case TK_ERROR:
+		eel_error("%s", t->data.value.s);
+		return token(cur, TK_ERROR);
+	  default:
+		return token(cur, t->token);
 	}
-
-	return token(c);
 }
 
 
@@ -417,3 +704,23 @@ void eel_unlex(void)
 {
 	eel_current.unlexed = 1;
 }
+
+
+int eel_skip_block(void)
+{
+	eel_token_t *t = eel_scripttab[eel_current.script].code;
+	int pc = eel_current.pc;
+	if(!pc || (t[pc - 1].token != '{') || (t[pc - 1].jump < 0))
+		return -1;
+	eel_current.pc = t[pc - 1].jump + 1;
+	return 0;
+}
+
+
+int eel_lex_pos(void)
+{
+	if((eel_current.script < 0) || !eel_current.pc ||
+			!eel_scripttab[eel_current.script].code)
+		return 0;
+	return eel_scripttab[eel_current.script].code[eel_current.pc - 1].pos;
+}
@@ -48,12 +48,58 @@
 int eel_get_unique_token();
 
 
+/*----------------------------------------------------------
+	Token code
+------------------------------------------------------------
+ * Scripts are lexed once, when loaded, into an array of
+ * tokens with literals already decoded, and operators,
+ * directives, specials and enums of the root scope already
+ * looked up. Binary operations on two number literals are
+ * folded where that doesn't change the order of evaluation.
+ * eel_lex() just steps through this array at run time.
+ *
+ * Other identifiers are stored by name, and are resolved
+ * (TK_SYMREF or TK_NEWSYM) when lexed, as that depends on
+ * the symbol table at the time.
+ */
+typedef struct eel_token_t
+{
+	int		token;	/* TK_*, character or '\n'; 0 at EOF */
+	int		pos;	/* Source position after the token */
+	int		jump;	/* '{': index of matching '}', or -1 */
+	unsigned	hash;	/* TK_NEWSYM: eel_s_hash() of the name */
+	eel_data_t	data;	/* Literal, name, symbol or error message */
+} eel_token_t;
+
+/*
+ * Compile the source of script 'handle' into token code.
+ * Lexing errors are stored as TK_ERROR tokens, and are
+ * reported only if execution gets there.
+ *
+ * Returns a negative value if we run out of memory.
+ */
+int eel_compile(int handle);
+
+/* Free the token code of script 'handle'. */
+void eel_free_code(int handle);
+
+
 /*----------------------------------------------------------
 	The Lexer
 ----------------------------------------------------------*/
 /* Get next "token" */
 int eel_lex(int report_eoln);
 
+/*
+ * Skip to after the '}' matching the '{' that was just
+ * returned by eel_lex(). Returns a negative value if
+ * there is no matching '}'.
+ */
+int eel_skip_block(void);
+
+/* Source position of the last token lexed; for error messages. */
+int eel_lex_pos(void);
+
 /*
  * Push back last token + lval.
  * Works only for *one* token per context!
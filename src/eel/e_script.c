@@ -25,18 +25,483 @@
 #include <string.h>
 
 #include "config.h"
-#include "_e_script.h"
+#include "kobolog.h"
+#include "_e_state.h"
 #include "e_util.h"
+#include "e_lexer.h"
 
 #define	DBG(x)
 
 
+/*----------------------------------------------------------
+	Compiled script cache
+------------------------------------------------------------
+ * While the cache is open, eel_load() restores the token
+ * code of unchanged scripts from it, instead of running
+ * the lexer. Entries are keyed by the full name of the
+ * script, and validated by the length and a hash of the
+ * source. As #include loads every file as a script of its
+ * own, each include gets its own entry as well.
+ *
+ * Symbol references (operators, directives, specials and
+ * enums) are stored by name and symbol type, and are looked
+ * up again when restoring. Bump EEL_CACHE_VERSION whenever
+ * a change to the lexer changes the token code!
+ *
+ * Like the AGW render cache, the file is a native endian
+ * dump, and is simply rebuilt if it doesn't match. Only
+ * the default interpreter state uses the cache.
+ */
+#define	EEL_CACHE_VERSION	2
+#define	EEL_CACHE_MAGIC		0x434c4545	/* "EELC" on x86 */
+#define	EEL_CACHE_BYTEORDER	0x01020304
+
+/* eel_token_t, with pointers replaced by pool offsets */
+typedef struct eel_ctoken_t
+{
+	int		token;
+	int		pos;
+	int		jump;
+	unsigned	hash;
+	int		type;		/* eel_datatypes_t */
+	int		i;		/* Integer or pool offset */
+	int		symtype;	/* EDT_SYMREF: eel_symtypes_t */
+	double		r;
+} eel_ctoken_t;
+
+typedef struct eel_centry_t
+{
+	struct eel_centry_t	*next;
+	char		*name;
+	unsigned	hash;		/* Hash of the source */
+	unsigned	srclen;
+	unsigned	codelen;
+	unsigned	poollen;
+	eel_ctoken_t	*code;
+	char		*pool;		/* Strings, symbol names, errors */
+} eel_centry_t;
+
+static char *cache_file = NULL;
+static int cache_dirty = 0;
+static eel_centry_t *cache_entries = NULL;
+
+static int cache_hits, cache_compiles;
+
+
+static unsigned cache_hash(const unsigned char *data, unsigned len)
+{
+	unsigned h = 2166136261u;
+	while(len--)
+	{
+		h ^= *data++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+
+/* Allocate an entry, with code, pool and name, as a single block. */
+static eel_centry_t *cache_alloc(unsigned namelen, unsigned codelen,
+		unsigned poollen)
+{
+	eel_centry_t *ce = (eel_centry_t *)malloc(sizeof(eel_centry_t) +
+			codelen * sizeof(eel_ctoken_t) + poollen +
+			namelen + 1);
+	if(!ce)
+		return NULL;
+	memset(ce, 0, sizeof(eel_centry_t));
+	ce->code = (eel_ctoken_t *)(ce + 1);
+	ce->pool = (char *)(ce->code + codelen);
+	ce->name = ce->pool + poollen;
+	ce->name[namelen] = 0;
+	ce->codelen = codelen;
+	ce->poollen = poollen;
+	return ce;
+}
+
+
+static eel_centry_t *cache_find(const char *name)
+{
+	eel_centry_t *ce;
+	for(ce = cache_entries; ce; ce = ce->next)
+		if(strcmp(ce->name, name) == 0)
+			return ce;
+	return NULL;
+}
+
+
+/* Add 'ce' to the cache, replacing any old entry of the same name. */
+static void cache_add(eel_centry_t *ce)
+{
+	eel_centry_t **cep;
+	for(cep = &cache_entries; *cep; cep = &(*cep)->next)
+		if(strcmp((*cep)->name, ce->name) == 0)
+		{
+			eel_centry_t *old = *cep;
+			*cep = old->next;
+			free(old);
+			break;
+		}
+	ce->next = cache_entries;
+	cache_entries = ce;
+}
+
+
+/* Try to restore the token code of script 'handle' from the cache. */
+static int cache_restore(int handle, unsigned hash)
+{
+	script_t *scr = eel_scripttab + handle;
+	eel_centry_t *ce = cache_find(scr->name);
+	unsigned i;
+	if(!ce || (ce->hash != hash) || (ce->srclen != scr->len) ||
+			!ce->codelen || !ce->poollen ||
+			ce->pool[ce->poollen - 1])
+		return -1;
+
+	scr->code = (eel_token_t *)calloc(ce->codelen, sizeof(eel_token_t));
+	scr->strings = (char *)malloc(ce->poollen);
+	scr->codelen = (int)ce->codelen;
+	scr->stringslen = (int)ce->poollen;
+	if(!scr->code || !scr->strings)
+	{
+		eel_free_code(handle);
+		return -1;
+	}
+	memcpy(scr->strings, ce->pool, ce->poollen);
+	for(i = 0; i < ce->codelen; ++i)
+	{
+		eel_ctoken_t *ct = ce->code + i;
+		eel_token_t *t = scr->code + i;
+		const char *str = scr->strings + ct->i;
+		if((ct->pos < 0) || ((unsigned)ct->pos > scr->len) ||
+				(ct->jump < -1) ||
+				(ct->jump >= (int)ce->codelen) ||
+				((TK_ERROR == ct->token) &&
+				(EDT_STRING != ct->type)))
+			break;
+		t->token = ct->token;
+		t->pos = ct->pos;
+		t->jump = ct->jump;
+		t->hash = ct->hash;
+		switch(ct->type)
+		{
+		  case EDT_ILLEGAL:
+			break;
+		  case EDT_REAL:
+			t->data.value.r = ct->r;
+			break;
+		  case EDT_INTEGER:
+			t->data.value.i = ct->i;
+			break;
+		  case EDT_STRING:
+		  case EDT_SYMNAME:
+		  case EDT_SYMREF:
+			if((ct->i < 0) || ((unsigned)ct->i >= ce->poollen))
+				ct = NULL;
+			else if(TK_ERROR == ct->token)
+			{
+				/* Freed by eel_free_code() */
+				eel_d_setstring(&t->data, str);
+				continue;
+			}
+			else if(EDT_SYMREF == ct->type)
+			{
+				t->data.value.sym = eel_s_find_n_t(NULL, str,
+						(eel_symtypes_t)ct->symtype);
+				if(!t->data.value.sym)
+					ct = NULL;
+			}
+			else
+				t->data.value.s = (char *)str;
+			break;
+		  default:
+			ct = NULL;
+			break;
+		}
+		if(!ct)
+			break;
+		t->data.type = (eel_datatypes_t)ce->code[i].type;
+	}
+	if((i < ce->codelen) || scr->code[ce->codelen - 1].token)
+	{
+		log_printf(WLOG, "EEL cache entry for \"%s\" is broken!\n",
+				scr->name);
+		eel_free_code(handle);
+		return -1;
+	}
+	return 0;
+}
+
+
+/* Add or replace the cache entry for the compiled script 'handle'. */
+static void cache_store(int handle, unsigned hash)
+{
+	script_t *scr = eel_scripttab + handle;
+	eel_centry_t *ce;
+	unsigned poollen = scr->stringslen;
+	char *p;
+	int i;
+
+	/* Symbol names and error messages go after the strings */
+	for(i = 0; i < scr->codelen; ++i)
+	{
+		eel_token_t *t = scr->code + i;
+		if(TK_ERROR == t->token)
+			poollen += strlen(t->data.value.s) + 1;
+		else if(EDT_SYMREF == t->data.type)
+			poollen += strlen(t->data.value.sym->name) + 1;
+	}
+
+	ce = cache_alloc(strlen(scr->name), scr->codelen, poollen);
+	if(!ce)
+		return;
+	strcpy(ce->name, scr->name);
+	ce->hash = hash;
+	ce->srclen = scr->len;
+	memcpy(ce->pool, scr->strings, scr->stringslen);
+	p = ce->pool + scr->stringslen;
+	for(i = 0; i < scr->codelen; ++i)
+	{
+		eel_token_t *t = scr->code + i;
+		eel_ctoken_t *ct = ce->code + i;
+		const char *str = NULL;
+		memset(ct, 0, sizeof(eel_ctoken_t));
+		ct->token = t->token;
+		ct->pos = t->pos;
+		ct->jump = t->jump;
+		ct->hash = t->hash;
+		ct->type = t->data.type;
+		switch(t->data.type)
+		{
+		  case EDT_ILLEGAL:
+			break;
+		  case EDT_REAL:
+			ct->r = t->data.value.r;
+			break;
+		  case EDT_INTEGER:
+			ct->i = t->data.value.i;
+			break;
+		  case EDT_STRING:
+		  case EDT_SYMNAME:
+			if(TK_ERROR == t->token)
+				str = t->data.value.s;
+			else
+				ct->i = t->data.value.s - scr->strings;
+			break;
+		  case EDT_SYMREF:
+			str = t->data.value.sym->name;
+			ct->symtype = t->data.value.sym->type;
+			break;
+		  default:
+			/* Not something the lexer generates! */
+			free(ce);
+			return;
+		}
+		if(str)
+		{
+			ct->i = p - ce->pool;
+			strcpy(p, str);
+			p += strlen(str) + 1;
+		}
+	}
+	cache_add(ce);
+	cache_dirty = 1;
+}
+
+
+/* Compile script 'handle', or restore it from the cache. */
+static int load_code(int handle)
+{
+	script_t *scr = eel_scripttab + handle;
+	unsigned hash;
+	if(!cache_file || (eel_state != &eel_default_state))
+		return eel_compile(handle);
+
+	hash = cache_hash(scr->data, scr->len);
+	if(cache_restore(handle, hash) >= 0)
+	{
+		++cache_hits;
+		return 0;
+	}
+	if(eel_compile(handle) < 0)
+		return -1;
+	++cache_compiles;
+	cache_store(handle, hash);
+	return 0;
+}
+
+
+static int cache_read_entry(FILE *f, long filesize)
+{
+	unsigned v[5];
+	eel_centry_t *ce;
+	long left = filesize - ftell(f);
+	if(fread(v, sizeof(v), 1, f) != 1)
+		return -1;
+	/* namelen, hash, srclen, codelen, poollen */
+	left -= sizeof(v);
+	if((v[0] > 1024) || (v[0] > left) ||
+			(v[3] > (left - v[0]) / sizeof(eel_ctoken_t)) ||
+			(v[4] > left - v[0] - v[3] * sizeof(eel_ctoken_t)))
+		return -1;
+	ce = cache_alloc(v[0], v[3], v[4]);
+	if(!ce)
+		return -1;
+	if((fread(ce->name, v[0], 1, f) != 1) ||
+			(v[3] && (fread(ce->code, v[3] * sizeof(eel_ctoken_t),
+					1, f) != 1)) ||
+			(v[4] && (fread(ce->pool, v[4], 1, f) != 1)))
+	{
+		free(ce);
+		return -1;
+	}
+	ce->name[v[0]] = 0;
+	ce->hash = v[1];
+	ce->srclen = v[2];
+	ce->next = cache_entries;
+	cache_entries = ce;
+	return 0;
+}
+
+
+static int cache_write_entry(FILE *f, eel_centry_t *ce)
+{
+	unsigned v[5];
+	v[0] = strlen(ce->name);
+	v[1] = ce->hash;
+	v[2] = ce->srclen;
+	v[3] = ce->codelen;
+	v[4] = ce->poollen;
+	if(fwrite(v, sizeof(v), 1, f) != 1)
+		return -1;
+	if(fwrite(ce->name, v[0], 1, f) != 1)
+		return -1;
+	if(v[3] && (fwrite(ce->code, v[3] * sizeof(eel_ctoken_t), 1, f) != 1))
+		return -1;
+	if(v[4] && (fwrite(ce->pool, v[4], 1, f) != 1))
+		return -1;
+	return 0;
+}
+
+
+int eel_cache_open(const char *path, int rebuild)
+{
+	FILE *f;
+	unsigned hdr[4];
+	long filesize;
+
+	eel_cache_close();
+
+	cache_file = strdup(path);
+	if(!cache_file)
+		return -1;
+	cache_dirty = rebuild;
+	cache_hits = cache_compiles = 0;
+	if(rebuild)
+		return 0;
+
+	f = fopen(path, "rb");
+	if(!f)
+		return 0;
+	if((fseek(f, 0, SEEK_END) == 0) && ((filesize = ftell(f)) >= 0) &&
+			(fseek(f, 0, SEEK_SET) == 0) &&
+			(fread(hdr, sizeof(hdr), 1, f) == 1) &&
+			(EEL_CACHE_MAGIC == hdr[0]) &&
+			(EEL_CACHE_BYTEORDER == hdr[1]) &&
+			(EEL_CACHE_VERSION == hdr[2]))
+	{
+		unsigned i;
+		for(i = 0; i < hdr[3]; ++i)
+			if(cache_read_entry(f, filesize) < 0)
+			{
+				log_printf(WLOG, "EEL cache \"%s\" is"
+						" truncated!\n", path);
+				cache_dirty = 1;
+				break;
+			}
+	}
+	else
+	{
+		log_printf(DLOG, "EEL cache \"%s\" is empty, outdated or"
+				" from another platform; rebuilding.\n", path);
+		cache_dirty = 1;
+	}
+	fclose(f);
+	return 0;
+}
+
+
+void eel_cache_close(void)
+{
+	if(!cache_file)
+		return;
+
+	log_printf(DLOG, "EEL cache: %d scripts from cache, %d compiled\n",
+			cache_hits, cache_compiles);
+
+	/* Write a new file, and rename it into place when done */
+	if(cache_dirty)
+	{
+		eel_centry_t *ce;
+		FILE *f = NULL;
+		char *tmp = (char *)malloc(strlen(cache_file) + 5);
+		if(tmp)
+		{
+			strcpy(tmp, cache_file);
+			strcat(tmp, ".new");
+			f = fopen(tmp, "wb");
+		}
+		if(f)
+		{
+			unsigned hdr[4];
+			int res = 0;
+			hdr[0] = EEL_CACHE_MAGIC;
+			hdr[1] = EEL_CACHE_BYTEORDER;
+			hdr[2] = EEL_CACHE_VERSION;
+			hdr[3] = 0;
+			for(ce = cache_entries; ce; ce = ce->next)
+				++hdr[3];
+			if(fwrite(hdr, sizeof(hdr), 1, f) != 1)
+				res = -1;
+			for(ce = cache_entries; ce && (res >= 0); ce = ce->next)
+				res = cache_write_entry(f, ce);
+			if(fclose(f) != 0)
+				res = -1;
+#ifdef WIN32
+			if(res >= 0)
+				remove(cache_file);
+#endif
+			if((res >= 0) && (rename(tmp, cache_file) != 0))
+				res = -1;
+			if(res < 0)
+			{
+				log_printf(ELOG, "Could not write EEL cache"
+						" \"%s\"!\n", cache_file);
+				remove(tmp);
+			}
+		}
+		else
+			log_printf(ELOG, "Could not create EEL cache"
+					" \"%s\"!\n", cache_file);
+		free(tmp);
+	}
+
+	while(cache_entries)
+	{
+		eel_centry_t *ce = cache_entries;
+		cache_entries = ce->next;
+		free(ce);
+	}
+	free(cache_file);
+	cache_file = NULL;
+	cache_dirty = 0;
+}
+
+
 /*----------------------------------------------------------
 	Script source management
 ----------------------------------------------------------*/
 
-script_t eel_scripttab[MAX_SCRIPTS];
-
 int eel_script_alloc()
 {
         int h = 0;
@@ -90,6 +555,13 @@ int eel_load(const char *filename)
 						1, f) == 1)
 				{
 					fclose(f);
+					eel_scripttab[h].data[
+						eel_scripttab[h].len] = 0;
+					if(load_code(h) < 0)
+					{
+						eel_free(h);
+						return -2;
+					}
 					DBG(log_printf(DLOG, "Loaded script \"%s\"."
 							" (Handle %d)\n",
 							eel_scripttab[h].name,
@@ -134,6 +606,13 @@ int eel_load_from_mem(const char *script, unsigned len)
 		return -2;
 	}
 	memcpy(eel_scripttab[h].data, script, len);
+	eel_scripttab[h].data[len] = 0;
+	if(eel_compile(h) < 0)
+	{
+		DBG(printf("eel_load_from_mem(): Compile error!\n");)
+		eel_free(h);
+		return -2;
+	}
 	DBG(printf("Loaded script \"%s\" (Handle %d)\n",
 				eel_scripttab[h].name, h);)
 	return h;
@@ -151,6 +630,7 @@ void eel_free(int handle)
 
 	DBG(printf("Freeing script \"%s\". (Handle %d)\n",
 			eel_scripttab[handle].name, handle);)
+	eel_free_code(handle);
 	free(eel_scripttab[handle].data);
 	eel_scripttab[handle].data = NULL;
 	free(eel_scripttab[handle].name);
@@ -22,8 +22,25 @@
 #ifndef _EEL_SCRIPT_H_
 #define _EEL_SCRIPT_H_
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 int eel_load(const char *filename);
 int eel_load_from_mem(const char *script, unsigned len);
 void eel_free(int handle);
 
+/*
+ * Compiled script cache. While open, eel_load() restores
+ * unchanged scripts from it, rather than compiling them.
+ * 'rebuild' discards the old contents. The file is written
+ * back by eel_cache_close(), if anything was compiled.
+ */
+int eel_cache_open(const char *path, int rebuild);
+void eel_cache_close(void);
+
+#ifdef __cplusplus
+};
+#endif
+
 #endif /*_EEL_SCRIPT_H_*/
@@ -27,18 +27,191 @@
 
 #include "kobolog.h"
 #include "e_symtab.h"
+#include "_e_state.h"
 
 #define	DBG(x)
 
-#define	STRINGREP_SIZE	128
 
-#define	MAX_SCOPES	32
+/*------------------------------------------------
+	Memory blocks
+------------------------------------------------*/
+
+/*
+ * Simple arenas; a list of blocks, newest first, which
+ * allocations are cut from. They are only freed as a whole.
+ */
+typedef struct eel_sblock_t
+{
+	struct eel_sblock_t	*next;
+	unsigned		size;
+	unsigned		used;
+} eel_sblock_t;
+
+/* Block header size, rounded up for alignment */
+#define	SBLOCK_HEAD	((sizeof(eel_sblock_t) + 7) & ~7)
+#define	SBLOCK_SIZE	2048
+
+static void *_alloc(eel_sblock_t **blocks, unsigned size)
+{
+	eel_sblock_t *b = *blocks;
+	void *p;
+	size = (size + 7) & ~7;
+	if(!b || (b->used + size > b->size))
+	{
+		unsigned bs = size > SBLOCK_SIZE ? size : SBLOCK_SIZE;
+		b = (eel_sblock_t *)malloc(SBLOCK_HEAD + bs);
+		if(!b)
+			return NULL;
+		b->next = *blocks;
+		b->size = bs;
+		b->used = 0;
+		*blocks = b;
+	}
+	p = (char *)b + SBLOCK_HEAD + b->used;
+	b->used += size;
+	return p;
+}
+
+
+/* Free all allocations. If 'keep' is set, keep one block for reuse. */
+static void _free_blocks(eel_sblock_t **blocks, int keep)
+{
+	eel_sblock_t *b = *blocks, *nb;
+	if(b && keep)
+	{
+		b->used = 0;
+		b = b->next;
+		(*blocks)->next = NULL;
+	}
+	else
+		*blocks = NULL;
+	for(; b; b = nb)
+	{
+		nb = b->next;
+		free(b);
+	}
+}
 
 
 /*------------------------------------------------
 	Data container
 ------------------------------------------------*/
 
+/*
+ * Strings are interned; each interpreter state has only
+ * one copy of each string, which stays around until
+ * eel_d_freeall(). Thus, copying and freeing strings are
+ * only a matter of passing pointers around. The set of
+ * strings is bounded by the names and literals of the
+ * scripts, so the pool stops growing once the scripts
+ * have been run once.
+ */
+typedef struct eel_string_t
+{
+	char		*s;
+	unsigned	hash;
+} eel_string_t;
+
+/*
+ * Data cells for eel_d_new(). Freed cells are kept in a
+ * list for reuse, as the lexer churns through one per
+ * token.
+ */
+typedef union eel_dcell_t
+{
+	eel_data_t		data;
+	union eel_dcell_t	*next;
+} eel_dcell_t;
+
+
+
+static char *_intern(const char *s)
+{
+	eel_state_t *es = eel_state;
+	unsigned hash = eel_s_hash(s);
+	unsigned mask, i, len;
+	eel_string_t *st;
+	if((es->istrings_count + 1) * 2 > es->istrings_size)
+	{
+		eel_string_t *old = es->istrings;
+		unsigned oldsize = es->istrings_size;
+		unsigned size = oldsize ? oldsize * 2 : 256;
+		eel_string_t *ns = (eel_string_t *)calloc(size,
+				sizeof(eel_string_t));
+		if(!ns)
+			return NULL;
+		es->istrings = ns;
+		es->istrings_size = size;
+		mask = size - 1;
+		for(i = 0; i < oldsize; ++i)
+			if(old[i].s)
+			{
+				unsigned j = old[i].hash & mask;
+				while(ns[j].s)
+					j = (j + 1) & mask;
+				ns[j] = old[i];
+			}
+		free(old);
+	}
+	mask = es->istrings_size - 1;
+	for(i = hash & mask; (st = es->istrings + i)->s; i = (i + 1) & mask)
+		if((st->hash == hash) && (strcmp(st->s, s) == 0))
+			return st->s;
+	len = strlen(s) + 1;
+	st->s = (char *)_alloc(&es->istring_blocks, len);
+	if(!st->s)
+		return NULL;
+	memcpy(st->s, s, len);
+	st->hash = hash;
+	++es->istrings_count;
+	return st->s;
+}
+
+
+eel_data_t *eel_d_new(eel_datatypes_t type)
+{
+	eel_dcell_t *c = eel_state->free_cells;
+	if(c)
+		eel_state->free_cells = c->next;
+	else
+	{
+		c = (eel_dcell_t *)malloc(sizeof(eel_dcell_t));
+		if(!c)
+			return NULL;
+	}
+	memset(&c->data, 0, sizeof(eel_data_t));
+	c->data.type = type;
+	return &c->data;
+}
+
+
+void eel_d_free(eel_data_t *data)
+{
+	eel_dcell_t *c = (eel_dcell_t *)data;
+	if(!data)
+		return;
+	eel_d_freestring(data);
+	c->next = eel_state->free_cells;
+	eel_state->free_cells = c;
+}
+
+
+void eel_d_freeall(void)
+{
+	eel_state_t *st = eel_state;
+	while(st->free_cells)
+	{
+		eel_dcell_t *c = st->free_cells;
+		st->free_cells = c->next;
+		free(c);
+	}
+	free(st->istrings);
+	st->istrings = NULL;
+	st->istrings_size = st->istrings_count = 0;
+	_free_blocks(&st->istring_blocks, 0);
+}
+
+
 int eel_d_copy(eel_data_t *data, const eel_data_t *from)
 {
 	eel_d_freestring(data);
@@ -65,38 +238,32 @@ int eel_d_copy(eel_data_t *data, const eel_data_t *from)
 
 int eel_d_setstring(eel_data_t *data, const char *s)
 {
-	if((EDT_STRING == data->type) || (EDT_SYMNAME == data->type))
-		free(data->value.s);
-	else
+	if((EDT_STRING != data->type) && (EDT_SYMNAME != data->type))
 		data->type = EDT_STRING;
-	data->value.s = (char *)malloc(strlen(s) + 1);
-	if(data->value.s < 0)
+	data->value.s = _intern(s);
+	if(!data->value.s)
 		return -1;
-	strcpy(data->value.s, s);
 	return 0;
 }
 
 void eel_d_grabstring(eel_data_t *data, char *s)
 {
-	if((EDT_STRING == data->type) || (EDT_SYMNAME == data->type))
-		free(data->value.s);
-	else
-		data->type = EDT_STRING;
-	data->value.s = s;
+	eel_d_setstring(data, s);
+	free(s);
 }
 
 void eel_d_freestring(eel_data_t *data)
 {
 	if((data->type != EDT_STRING) && (data->type != EDT_SYMNAME))
 		return;
-	free(data->value.s);
+	/* Interned; see eel_d_freeall() */
 	data->value.s = 0;
 }
 
 /* NOTE: Output string only valid until next call. */
 const char *eel_d_stringrep(eel_data_t * data)
 {
-	static char buf[STRINGREP_SIZE];
+	char *buf = eel_state->d_rep;
 	switch (data->type)
 	{
 	  case EDT_ILLEGAL:
@@ -160,18 +327,127 @@ const char *eel_d_stringrep(eel_data_t * data)
 	Symbol table
 ------------------------------------------------*/
 
-/* The symbol table: a chain of `struct symrec'.  */
-static eel_symbol_t *eel_s_table[MAX_SCOPES];
+/*
+ * Each scope has an open addressing hash table, holding the
+ * newest symbol of each name. Older symbols of the same name
+ * in the same scope are chained through 'shadow'. All symbols
+ * of a scope are also chained through 'next', newest first.
+ *
+ * Symbols and their names are allocated from a per scope
+ * arena, which is released all at once when the scope is
+ * popped. The first arena block and the hash table are kept
+ * for the next time the scope is used.
+ */
+#define	STABLE_MIN	16
+
+typedef struct eel_scope_t
+{
+	eel_symbol_t	**table;
+	unsigned	size;		/* Table size; power of two */
+	unsigned	count;		/* Used table entries */
+	eel_symbol_t	*symbols;	/* All symbols, newest first */
+	eel_sblock_t	*blocks;	/* Arena, newest block first */
+} eel_scope_t;
+
+/* Insert 'sym' in the hash table of 'sc'. The table must have room. */
+static void _insert(eel_scope_t *sc, eel_symbol_t *sym)
+{
+	unsigned mask = sc->size - 1;
+	unsigned i = sym->hash & mask;
+	eel_symbol_t *s;
+	while((s = sc->table[i]))
+	{
+		if((s->hash == sym->hash) && (strcmp(s->name, sym->name) == 0))
+		{
+			sym->shadow = s;
+			sc->table[i] = sym;
+			return;
+		}
+		i = (i + 1) & mask;
+	}
+	sc->table[i] = sym;
+	++sc->count;
+}
+
 
-static int _current_scope = 0;
-static int _deepest_scope = 0;
+/* Make sure there's room for one more name in the table of 'sc'. */
+static int _grow(eel_scope_t *sc)
+{
+	eel_symbol_t **old = sc->table;
+	unsigned oldsize = sc->size;
+	unsigned i;
+	if(sc->size && ((sc->count + 1) * 2 <= sc->size))
+		return 0;
+	sc->size = oldsize ? oldsize * 2 : STABLE_MIN;
+	sc->table = (eel_symbol_t **)calloc(sc->size, sizeof(eel_symbol_t *));
+	if(!sc->table)
+	{
+		sc->table = old;
+		sc->size = oldsize;
+		return -1;
+	}
+	sc->count = 0;
+	for(i = 0; i < oldsize; ++i)
+		if(old[i])
+		{
+			/* Reinsert, keeping the 'shadow' chain as is */
+			eel_symbol_t *s = old[i];
+			unsigned mask = sc->size - 1;
+			unsigned j = s->hash & mask;
+			while(sc->table[j])
+				j = (j + 1) & mask;
+			sc->table[j] = s;
+			++sc->count;
+		}
+	free(old);
+	return 0;
+}
 
 
+static eel_symbol_t *_lookup(int scope, const char *name, unsigned hash)
+{
+	eel_scope_t *sc = eel_state->scopes[scope];
+	unsigned mask, i;
+	eel_symbol_t *s;
+	if(!sc->count)
+		return NULL;
+	mask = sc->size - 1;
+	for(i = hash & mask; (s = sc->table[i]); i = (i + 1) & mask)
+		if((s->hash == hash) && (strcmp(s->name, name) == 0))
+			return s;
+	return NULL;
+}
+
+
+unsigned eel_s_hash(const char *name)
+{
+	/* FNV-1a */
+	unsigned h = 2166136261u;
+	while(*name)
+	{
+		h ^= (unsigned char)*name++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+
+/*
+ * Scopes below eel_state->shared are set up by eel_state_new(),
+ * and belong to another state.
+ */
 int eel_s_open(void)
 {
-	memset(eel_s_table, 0, sizeof(eel_s_table));
-	_current_scope = 0;
-	_deepest_scope = 0;
+	eel_state_t *st = eel_state;
+	int i;
+	st->own_scopes = (eel_scope_t *)calloc(MAX_SCOPES,
+			sizeof(eel_scope_t));
+	if(!st->own_scopes)
+		return -1;
+	for(i = st->shared; i < MAX_SCOPES; ++i)
+		st->scopes[i] = st->own_scopes + i;
+	st->current_scope = st->shared;
+	st->deepest_scope = st->shared;
 	return 0;
 }
 
@@ -179,19 +455,39 @@ int eel_s_open(void)
 void eel_s_close(void)
 {
 	eel_s_freeall();
+	free(eel_state->own_scopes);
+	eel_state->own_scopes = NULL;
 }
 
 
-eel_symbol_t *eel_s_new(const char *name, eel_symtypes_t type)
+static eel_symbol_t *_new(const char *name, unsigned hash,
+		eel_symtypes_t type)
 {
+	eel_state_t *st = eel_state;
+	eel_scope_t *sc = st->scopes[st->current_scope];
 	eel_symbol_t *sym;
-	sym = (eel_symbol_t *) calloc(1, sizeof(eel_symbol_t));
+	int len = strlen(name) + 1;
+	if(st->current_scope < st->shared)
+	{
+		log_printf(ELOG, "eel_s_new: Tried to add '%s' to a"
+				" shared scope!\n", name);
+		return NULL;
+	}
+	if(_grow(sc) < 0)
+		sym = NULL;
+	else
+		sym = (eel_symbol_t *)_alloc(&sc->blocks,
+				sizeof(eel_symbol_t) + len);
 	if(!sym)
 	{
 		log_printf(ELOG, "eel_s_new: Out of memory!\n");
 		return 0;
 	}
-	sym->name = strdup(name);
+	memset(sym, 0, sizeof(eel_symbol_t));
+	sym->name = (char *)(sym + 1);
+	memcpy(sym->name, name, len);
+	sym->hash = hash;
+	sym->scope = st->current_scope;
 	sym->type = type;
 	switch (type)
 	{
@@ -223,92 +519,114 @@ eel_symbol_t *eel_s_new(const char *name, eel_symtypes_t type)
 		log_printf(ELOG, "internal error: created"
 				" symbol of undef type\n");
 	}
-	sym->next = (struct eel_symbol_t *)eel_s_table[_current_scope];
-	eel_s_table[_current_scope] = sym;
+	sym->next = sc->symbols;
+	sc->symbols = sym;
+	_insert(sc, sym);
 	return sym;
 }
 
-static void _free_scope(int scope)
+
+eel_symbol_t *eel_s_new(const char *name, eel_symtypes_t type)
 {
-	eel_symbol_t *sym, *nextptr;
-	for(sym = eel_s_table[scope]; sym; sym = nextptr)
-	{
-		nextptr = (eel_symbol_t *) sym->next;
+	return _new(name, eel_s_hash(name), type);
+}
+
+
+/* Free all symbols in 'scope'. If 'release' is 0, keep some memory. */
+static void _free_scope(int scope, int release)
+{
+	eel_scope_t *sc = eel_state->scopes[scope];
+	eel_symbol_t *sym;
+	for(sym = sc->symbols; sym; sym = sym->next)
 		eel_d_freestring(&sym->data);
-		free(sym->name);
-		free(sym);
+	sc->symbols = NULL;
+	if(sc->count)
+		memset(sc->table, 0, sc->size * sizeof(eel_symbol_t *));
+	sc->count = 0;
+	_free_blocks(&sc->blocks, !release);
+	if(release)
+	{
+		free(sc->table);
+		sc->table = NULL;
+		sc->size = 0;
 	}
-	eel_s_table[scope] = (eel_symbol_t *)0;
 }
 
 void eel_s_freeall(void)
 {
 	int scope;
-	for(scope = 0; scope < MAX_SCOPES; ++scope)
-		_free_scope(scope);
+	if(!eel_state->own_scopes)
+		return;
+	for(scope = eel_state->shared; scope < MAX_SCOPES; ++scope)
+		_free_scope(scope, 1);
 }
 
-eel_symbol_t *eel_s_find(eel_symbol_t * sym, const char *eel_s_name)
+
+/*
+ * Generic search. If 'sym' is specified, the search starts
+ * at that symbol, rather than at the current scope. Only
+ * symbols of type 'type' (if >= 0), and with token 'token'
+ * (if 'match_token' is set) are considered.
+ */
+static eel_symbol_t *_find(eel_symbol_t *sym, const char *name,
+		unsigned hash, int type, int match_token, int token)
 {
-	int scope = _current_scope;
-	while(scope >= 0)
+	int scope = eel_state->current_scope;
+	if(sym)
 	{
-		if(!sym)
-			sym = eel_s_table[scope];
-		for(; sym; sym = (eel_symbol_t *) sym->next)
-			if(strcmp(sym->name, eel_s_name) == 0)
+		scope = sym->scope;
+		if(strcmp(sym->name, name) != 0)
+			sym = _lookup(scope, name, hash);
+	}
+	else
+		sym = _lookup(scope, name, hash);
+	while(1)
+	{
+		for(; sym; sym = sym->shadow)
+			if(((type < 0) || (sym->type == type)) &&
+					(!match_token || (sym->token == token)))
 				return sym;
-		sym = NULL;
-		--scope;
+		if(--scope < 0)
+			return NULL;
+		sym = _lookup(scope, name, hash);
 	}
-	return NULL;
 }
 
-eel_symbol_t *eel_s_find_n_tk(eel_symbol_t * sym, const char *eel_s_name, int token)
+eel_symbol_t *eel_s_find_h(eel_symbol_t *sym, const char *eel_s_name,
+		unsigned hash)
 {
-	int scope = _current_scope;
-	while(scope >= 0)
-	{
-		if(!sym)
-			sym = eel_s_table[scope];
-		for(; sym; sym = (eel_symbol_t *) sym->next)
-			if((sym->token == token) &&
-					(strcmp(sym->name, eel_s_name) == 0))
-				return sym;
-		sym = NULL;
-		--scope;
-	}
-	return NULL;
+	return _find(sym, eel_s_name, hash, -1, 0, 0);
 }
 
-eel_symbol_t *eel_s_find_tk(eel_symbol_t * sym, int token)
+eel_symbol_t *eel_s_find(eel_symbol_t *sym, const char *eel_s_name)
 {
-	int scope = _current_scope;
-	while(scope >= 0)
-	{
-		if(!sym)
-			sym = eel_s_table[scope];
-		for(; sym; sym = (eel_symbol_t *) sym->next)
-			if(sym->token == token)
-				return sym;
-		sym = NULL;
-		--scope;
-	}
-	return NULL;
+	return _find(sym, eel_s_name, eel_s_hash(eel_s_name), -1, 0, 0);
+}
+
+eel_symbol_t *eel_s_find_n_tk(eel_symbol_t * sym, const char *eel_s_name, int token)
+{
+	return _find(sym, eel_s_name, eel_s_hash(eel_s_name), -1, 1, token);
 }
 
 eel_symbol_t *eel_s_find_n_t(eel_symbol_t * sym, const char *eel_s_name,
 		eel_symtypes_t type)
 {
-	int scope = _current_scope;
+	return _find(sym, eel_s_name, eel_s_hash(eel_s_name), type, 0, 0);
+}
+
+eel_symbol_t *eel_s_find_tk(eel_symbol_t * sym, int token)
+{
+	int scope = eel_state->current_scope;
+	if(sym)
+		scope = sym->scope;
 	while(scope >= 0)
 	{
 		if(!sym)
-			sym = eel_s_table[scope];
+			sym = eel_state->scopes[scope]->symbols;
 		for(; sym; sym = (eel_symbol_t *) sym->next)
-			if((sym->type == type) &&
-					(strcmp(sym->name, eel_s_name) == 0))
+			if(sym->token == token)
 				return sym;
+		sym = NULL;
 		--scope;
 	}
 	return NULL;
@@ -316,14 +634,17 @@ eel_symbol_t *eel_s_find_n_t(eel_symbol_t * sym, const char *eel_s_name,
 
 eel_symbol_t *eel_s_find_t(eel_symbol_t * sym, eel_symtypes_t type)
 {
-	int scope = _current_scope;
+	int scope = eel_state->current_scope;
+	if(sym)
+		scope = sym->scope;
 	while(scope >= 0)
 	{
 		if(!sym)
-			sym = eel_s_table[scope];
+			sym = eel_state->scopes[scope]->symbols;
 		for(; sym; sym = (eel_symbol_t *) sym->next)
 			if(sym->type == type)
 				return sym;
+		sym = NULL;
 		--scope;
 	}
 	return NULL;
@@ -332,7 +653,7 @@ eel_symbol_t *eel_s_find_t(eel_symbol_t * sym, eel_symtypes_t type)
 /* NOTE: Output string only valid until next call. */
 const char *eel_s_stringrep(eel_symbol_t * sym)
 {
-	static char buf[STRINGREP_SIZE];
+	char *buf = eel_state->s_rep;
 	switch (sym->type)
 	{
 	  case EST_UNDEFINED:
@@ -364,54 +685,56 @@ const char *eel_s_stringrep(eel_symbol_t * sym)
 
 int eel_push_scope(void)
 {
-	if(_deepest_scope >= MAX_SCOPES-1)
+	eel_state_t *st = eel_state;
+	if(st->deepest_scope >= MAX_SCOPES-1)
 	{
 		log_printf(ELOG, "EEL ERROR: Too deep scope nesting!\n");
 		return -1;
 	}
-	++_deepest_scope;
-	_current_scope = _deepest_scope;
-	DBG(log_printf(DLOG, "eel_push_scope(): current scope = %d\n", _current_scope);)
+	++st->deepest_scope;
+	st->current_scope = st->deepest_scope;
+	DBG(log_printf(DLOG, "eel_push_scope(): current scope = %d\n", st->current_scope);)
 	return 0;
 }
 
 
 int eel_pop_scope(void)
 {
-	if(!_deepest_scope)
+	eel_state_t *st = eel_state;
+	if(st->deepest_scope <= st->shared)
 	{
 		log_printf(ELOG, "EEL ERROR: Tried to pop root scope!\n");
 		return -1;
 	}
-	_free_scope(_deepest_scope);
-	--_deepest_scope;
-	_current_scope = _deepest_scope;
-	DBG(log_printf(DLOG, "eel_pop_scope(): current scope = %d\n", _current_scope);)
+	_free_scope(st->deepest_scope, 0);
+	--st->deepest_scope;
+	st->current_scope = st->deepest_scope;
+	DBG(log_printf(DLOG, "eel_pop_scope(): current scope = %d\n", st->current_scope);)
 	return 0;
 }
 
 
 int eel_scope(void)
 {
-	return _current_scope;
+	return eel_state->current_scope;
 }
 
 
 int eel_set_scope(int ns)
 {
-	if(ns < 0 || ns > _deepest_scope)
+	if(ns < 0 || ns > eel_state->deepest_scope)
 	{
 		log_printf(ELOG, "EEL ERROR: Tried to select illegal scope!\n");
 		return -1;
 	}
-	_current_scope = ns;
+	eel_state->current_scope = ns;
 	return 0;
 }
 
 
 void eel_restore_scope(void)
 {
-	_current_scope = _deepest_scope;
+	eel_state->current_scope = eel_state->deepest_scope;
 }
 
 
@@ -419,13 +742,33 @@ void eel_restore_scope(void)
 	Symbol table tools
 ------------------------------------------------*/
 
+eel_symbol_t *eel_s_own(eel_symbol_t *sym)
+{
+	eel_state_t *st = eel_state;
+	eel_symbol_t *s;
+	int scope;
+	if(sym->scope >= st->shared)
+		return sym;
+	scope = st->current_scope;
+	st->current_scope = st->shared;
+	s = _new(sym->name, sym->hash, sym->type);
+	st->current_scope = scope;
+	if(!s)
+		return NULL;
+	s->token = sym->token;
+	if(eel_d_copy(&s->data, &sym->data) < 0)
+		return NULL;
+	return s;
+}
+
+
 eel_symbol_t *eel_s_get(const char *name, eel_symtypes_t type)
 {
 	eel_symbol_t *sym = eel_s_find(NULL, name);
 	if(sym)
 	{
 		if(sym->type == type)
-			return sym;
+			return eel_s_own(sym);
 		else
 		{
 			log_printf(ELOG, "eel_s_integer: '%s' is of"
@@ -440,5 +783,8 @@ eel_symbol_t *eel_s_get(const char *name, eel_symtypes_t type)
 
 int eel_s_set(eel_symbol_t *sym, const eel_data_t *dat)
 {
+	sym = eel_s_own(sym);
+	if(!sym)
+		return -1;
 	return eel_d_copy(&sym->data, dat);
 }
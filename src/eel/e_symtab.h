@@ -83,23 +83,40 @@ typedef struct eel_data_t
 	} value;
 } eel_data_t;
 
+/*
+ * Allocate/free a data container. Freed containers are
+ * recycled, so these rarely call the allocator.
+ */
+eel_data_t *eel_d_new(eel_datatypes_t type);
+void eel_d_free(eel_data_t *data);
+
 int eel_d_copy(eel_data_t *data, const eel_data_t *from);
 
-/* Copy string */
+/*
+ * Copy string
+ *
+ * Strings are interned, so this only allocates memory
+ * the first time a string is seen. The string must not
+ * be modified, and stays valid until eel_d_freeall().
+ */
 int eel_d_setstring(eel_data_t *data, const char *s);
 
 /*
- * Take over string. (No copying)
+ * Take over string.
  *
  * The source string pointer *must* have been returned
  * by malloc(), calloc() or realloc(), and the string
- * MUST NOT be freed after this call. (The string will
- * be owned by the data_t.)
+ * MUST NOT be freed after this call. (The string is
+ * interned and freed right away.)
  */
 void eel_d_grabstring(eel_data_t *data, char *s);
 
+/* Drop string reference. (Interned strings are not freed.) */
 void eel_d_freestring(eel_data_t *data);
 
+/* Free all strings and data containers */
+void eel_d_freeall(void);
+
 /* NOTE: Output string only valid until next call. */
 const char *eel_d_stringrep(eel_data_t *data);
 
@@ -136,8 +153,11 @@ typedef enum eel_symtypes_t
 /* symbol list node */
 typedef struct eel_symbol_t
 {
-	struct eel_symbol_t	*next;
+	struct eel_symbol_t	*next;		/* Next in scope */
+	struct eel_symbol_t	*shadow;	/* Older, same name + scope */
 	char			*name;
+	unsigned		hash;		/* eel_s_hash(name) */
+	int			scope;
 	eel_symtypes_t		type;
 	eel_data_t		data;
 	int			token;
@@ -151,6 +171,15 @@ eel_symbol_t *eel_s_new(const char *name, eel_symtypes_t type);
 
 void eel_s_freeall(void);
 
+/*
+ * Symbols are kept in one hash table per scope. Names can
+ * be hashed once with eel_s_hash() and looked up with
+ * eel_s_find_h(), to avoid rehashing them for every search.
+ */
+unsigned eel_s_hash(const char *sym_name);
+eel_symbol_t *eel_s_find_h(eel_symbol_t *sym, const char *sym_name,
+		unsigned hash);
+
 eel_symbol_t *eel_s_find(eel_symbol_t *sym, const char *sym_name);
 eel_symbol_t *eel_s_find_n_tk(eel_symbol_t *sym, const char *sym_name,
 		int token);
@@ -219,10 +248,20 @@ void eel_restore_scope(void);
 	Symbol table tools
 ------------------------------------------------*/
 
+/*
+ * Returns 'sym', or if 'sym' is in a scope shared with
+ * another interpreter state (see eel_state_new()), a copy
+ * of it in the outermost scope of the current state. Use
+ * this before modifying a symbol.
+ *
+ * Returns NULL in the case of failure.
+ */
+eel_symbol_t *eel_s_own(eel_symbol_t *sym);
+
 /*
  * Find symbol 'name' and verify that it is of of type 'type',
  * or if it doesn't exist, create new symbol 'name' of type
- * 'type'.
+ * 'type'. Shared symbols are copied, as with eel_s_own().
  *
  * Returns the found/new symbol, or NULL in the case of
  * failure.
@@ -230,7 +269,8 @@ void eel_restore_scope(void);
 eel_symbol_t *eel_s_get(const char *name, eel_symtypes_t type);
 
 /*
- * Load 'dat' into symbol 'sym'.
+ * Load 'dat' into symbol 'sym', or into a copy of it, as
+ * with eel_s_own().
  * Returns 0 upon success, or a negative value if the operation
  * fails.
  */
@@ -25,9 +25,10 @@
 
 #include "kobolog.h"
 #include "e_util.h"
+#include "e_lexer.h"
 #include "eel.h"
 
-#include "_e_script.h"
+#include "_e_state.h"
 
 
 /*----------------------------------------------------------
@@ -108,49 +109,64 @@ double bio_strtod(bio_file_t *bio)
 	Context management ("VM stack")
 ----------------------------------------------------------*/
 
-eel_context_t eel_current = {
-	NULL,
-	NULL,
-	-1,
-	0,
-	0,
-	EOF,
-	NULL
+eel_state_t eel_default_state = {
+	{
+		NULL,
+		0,
+		-1,
+		0,
+		0,
+		EOF,
+		NULL
+	},
+	-1
 };
 
-static eel_context_t *context_stack = NULL;
+EEL_TLS eel_state_t *eel_state = &eel_default_state;
 
 
 void eel_push_context(void)
 {
-	eel_context_t *c = malloc(sizeof(eel_context_t));
+	eel_context_t *c = eel_state->context_pool;
+	if(c)
+		eel_state->context_pool = c->previous;
+	else
+		c = malloc(sizeof(eel_context_t));
 	if(!c)
 	{
 		eel_error("INTERNAL ERROR: Failed to push context!");
 		return;
 	}
 	memcpy(c, &eel_current, sizeof(eel_context_t));
-	c->previous = context_stack;
-	context_stack = c;
+	c->previous = eel_state->context_stack;
+	eel_state->context_stack = c;
 }
 
 
 void eel_pop_context(void)
 {
-	eel_context_t *c = context_stack;
+	eel_context_t *c = eel_state->context_stack;
 	if(!c)
 	{
 		eel_error("INTERNAL ERROR: No context to pop!");
 		return;
 	}
 	memcpy(&eel_current, c, sizeof(eel_context_t));
-	context_stack = c->previous;
-	if(c->lval)
+	eel_state->context_stack = c->previous;
+	eel_d_free(c->lval);
+	c->previous = eel_state->context_pool;
+	eel_state->context_pool = c;
+}
+
+
+void eel_context_cleanup(void)
+{
+	while(eel_state->context_pool)
 	{
-		eel_d_freestring(c->lval);
-		free(c->lval);
+		eel_context_t *c = eel_state->context_pool;
+		eel_state->context_pool = c->previous;
+		free(c);
 	}
-	free(c);
 }
 
 
@@ -159,8 +175,6 @@ void eel_pop_context(void)
 	Error handling tools
 ----------------------------------------------------------*/
 
-static int last_script = -1;
-
 int eel_error(const char *format, ...)
 {
 	int count = 0;
@@ -168,17 +182,17 @@ int eel_error(const char *format, ...)
 	int i, pos, line = 1;
 
 	/* Figure out which line we're at... */
-	pos = bio_tell(eel_current.bio);
-	bio_seek(eel_current.bio, 0, SEEK_SET);
+	pos = eel_lex_pos();
 	for(i = 0; i < pos; ++i)
-		if('\n' == bio_getchar(eel_current.bio))
+		if('\n' == eel_scripttab[eel_current.script].data[i])
 			++line;
 
-	if((eel_current.script >= 0) && (eel_current.script != last_script))
+	if((eel_current.script >= 0) &&
+			(eel_current.script != eel_state->last_script))
 	{
 		count = log_printf(ELOG, "(EEL) in file \"%s\":\n",
 				eel_scripttab[eel_current.script].name);
-		last_script = eel_current.script;
+		eel_state->last_script = eel_current.script;
 	}
 	if(eel_current.arg)
 		count += log_printf(ELOG, "(EEL) line %d, arg %d: ",
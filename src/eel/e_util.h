@@ -91,7 +91,7 @@ double bio_strtod(bio_file_t *bio);
 typedef struct eel_context_t
 {
 	struct eel_context_t	*previous;
-	bio_file_t		*bio;
+	int			pc;	/* Token code position */
 	int			script;
 	int			arg;
 	int			unlexed;
@@ -99,9 +99,10 @@ typedef struct eel_context_t
 	eel_data_t		*lval;
 } eel_context_t;
 
-extern eel_context_t eel_current;
-
 void eel_push_context(void);
 void eel_pop_context(void);
 
+/* Free contexts kept around for reuse */
+void eel_context_cleanup(void);
+
 #endif /*_EEL_UTIL_H_*/
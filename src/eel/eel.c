@@ -99,13 +99,207 @@ TODO:
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
+#ifdef KOBO_HAVE_GETTIMEOFDAY
+#	include <sys/time.h>
+#endif
+
+#include "kobolog.h"
 #include "eel.h"
 #include "e_lexer.h"
 #include "e_util.h"
 #include "e_builtin.h"
 
-#include "_e_script.h"
+#include "_e_state.h"
+
+
+/*----------------------------------------------------------
+	Profiler
+------------------------------------------------------------
+ * Entries are keyed by kind and name, so that functions
+ * and scripts are tracked across reloads. Nested entries
+ * are timed on a stack, so that their time can be taken
+ * off the "self" time of the entry they're nested in.
+ * Only the default interpreter state is profiled.
+ */
+
+typedef enum eel_pkinds_t
+{
+	EPK_SCRIPT = 0,
+	EPK_FUNCTION,
+	EPK_OPERATOR
+} eel_pkinds_t;
+
+typedef struct eel_pentry_t
+{
+	struct eel_pentry_t	*next;	/* Hash chain */
+	char			*name;
+	unsigned		hash;
+	eel_pkinds_t		kind;
+	unsigned		calls;
+	double			total;	/* Including nested entries */
+	double			self;
+} eel_pentry_t;
+
+#define	EPROF_BUCKETS	64
+#define	EPROF_DEPTH	64
+
+static int eprof_enabled = 0;
+static eel_pentry_t *eprof_table[EPROF_BUCKETS];
+static int eprof_count = 0;
+
+static struct
+{
+	eel_pentry_t	*entry;
+	double		start;
+	double		nested;		/* Time in nested entries */
+} eprof_stack[EPROF_DEPTH];
+static int eprof_depth = 0;
+
+static const char *eprof_kindnames[] = {
+	"script",
+	"function",
+	"operator"
+};
+
+
+static double eprof_now(void)
+{
+#ifdef KOBO_HAVE_GETTIMEOFDAY
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec * 0.000001;
+#else
+	return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+
+static eel_pentry_t *eprof_entry(eel_pkinds_t kind, const char *name)
+{
+	unsigned hash = eel_s_hash(name) + kind;
+	eel_pentry_t **pe = eprof_table + (hash % EPROF_BUCKETS);
+	eel_pentry_t *e;
+	for(e = *pe; e; e = e->next)
+		if((e->hash == hash) && (e->kind == kind) &&
+				(strcmp(e->name, name) == 0))
+			return e;
+	e = (eel_pentry_t *)calloc(1, sizeof(eel_pentry_t));
+	if(!e)
+		return NULL;
+	e->name = strdup(name);
+	if(!e->name)
+	{
+		free(e);
+		return NULL;
+	}
+	e->hash = hash;
+	e->kind = kind;
+	e->next = *pe;
+	*pe = e;
+	++eprof_count;
+	return e;
+}
+
+
+/*
+ * Start timing an entry. Returns a handle for eprof_end(),
+ * or -1 if the profiler is off.
+ */
+static int eprof_begin(eel_pkinds_t kind, const char *name)
+{
+	eel_pentry_t *e;
+	if(!eprof_enabled || (eprof_depth >= EPROF_DEPTH) ||
+			(eel_state != &eel_default_state))
+		return -1;
+	e = eprof_entry(kind, name);
+	if(!e)
+		return -1;
+	eprof_stack[eprof_depth].entry = e;
+	eprof_stack[eprof_depth].nested = 0.0;
+	eprof_stack[eprof_depth].start = eprof_now();
+	return eprof_depth++;
+}
+
+
+static void eprof_end(int handle)
+{
+	double t;
+	eel_pentry_t *e;
+	/* Ignore any calls that were running at eel_profile_reset() */
+	if((handle < 0) || (handle != eprof_depth - 1))
+		return;
+	t = eprof_now() - eprof_stack[handle].start;
+	e = eprof_stack[handle].entry;
+	++e->calls;
+	e->total += t;
+	e->self += t - eprof_stack[handle].nested;
+	if(--eprof_depth)
+		eprof_stack[eprof_depth - 1].nested += t;
+}
+
+
+void eel_profile(int enable)
+{
+	eprof_enabled = enable;
+}
+
+
+void eel_profile_reset(void)
+{
+	int i;
+	for(i = 0; i < EPROF_BUCKETS; ++i)
+		while(eprof_table[i])
+		{
+			eel_pentry_t *e = eprof_table[i];
+			eprof_table[i] = e->next;
+			free(e->name);
+			free(e);
+		}
+	eprof_count = 0;
+	eprof_depth = 0;
+}
+
+
+static int eprof_cmp(const void *a, const void *b)
+{
+	const eel_pentry_t *ea = *(const eel_pentry_t **)a;
+	const eel_pentry_t *eb = *(const eel_pentry_t **)b;
+	if(ea->self > eb->self)
+		return -1;
+	if(ea->self < eb->self)
+		return 1;
+	return strcmp(ea->name, eb->name);
+}
+
+
+void eel_profile_dump(void)
+{
+	eel_pentry_t **list;
+	eel_pentry_t *e;
+	int i, n = 0;
+	if(!eprof_count)
+		return;
+	list = (eel_pentry_t **)malloc(eprof_count * sizeof(eel_pentry_t *));
+	if(!list)
+		return;
+	for(i = 0; i < EPROF_BUCKETS; ++i)
+		for(e = eprof_table[i]; e; e = e->next)
+			list[n++] = e;
+	qsort(list, n, sizeof(eel_pentry_t *), eprof_cmp);
+
+	log_printf(ULOG, "--- EEL script profile ---------------------\n");
+	log_printf(ULOG, "  %-8s %8s %10s %10s  %s\n",
+			"Kind", "calls", "self ms", "total ms", "Name");
+	for(i = 0; i < n; ++i)
+		log_printf(ULOG, "  %-8s %8u %10.3f %10.3f  %s\n",
+				eprof_kindnames[list[i]->kind],
+				list[i]->calls, list[i]->self * 1000.0,
+				list[i]->total * 1000.0, list[i]->name);
+	log_printf(ULOG, "--------------------------------------------\n");
+	free(list);
+}
 
 
 /*----------------------------------------------------------
@@ -114,6 +308,7 @@ TODO:
 
 static int command(void)
 {
+	int prof, res;
 	eel_symbol_t *sym = eel_current.lval->value.sym;
 
 	if(!sym->data.value.op.cb)
@@ -131,7 +326,10 @@ static int command(void)
 	if(eel_parse_args(",", ';') < 0)
 		return -1;
 
-	return sym->data.value.op.cb(eel_arg_count, eel_args);
+	prof = eprof_begin(EPK_OPERATOR, sym->name);
+	res = sym->data.value.op.cb(eel_arg_count, eel_args);
+	eprof_end(prof);
+	return res;
 }
 
 
@@ -216,12 +414,7 @@ static int function(void)
 
 	/* Enter function */
 	eel_push_context();
-	if(eel_current.script == func->token)
-		eel_current.bio = bio_clone(eel_current.bio);
-	else
-		eel_current.bio = bio_open(eel_scripttab[func->token].data,
-				eel_scripttab[func->token].len);
-	if(!eel_current.bio)
+	if(!eel_scripttab[func->token].code)
 	{
 		eel_error("INTERNAL ERROR: Failed to set up script"
 				" reading at start of function!");
@@ -229,7 +422,10 @@ static int function(void)
 		eel_pop_scope();
 		return -1;
 	}
-	res = bio_seek(eel_current.bio, func->data.value.a, SEEK_SET);
+	eel_current.script = func->token;
+	eel_current.pc = func->data.value.a;
+	eel_current.unlexed = 0;
+	eel_current.lval = NULL;
 
 	/*
 	 * Find out where to stuff the arguments.
@@ -286,6 +482,8 @@ static int function(void)
 
 	if(res >= 0)
 	{
+		int prof = eprof_begin(EPK_FUNCTION, func->name);
+
 		/*
 		 * Execute function
 		 *
@@ -296,11 +494,11 @@ static int function(void)
 		 * to run "the rest of this function" when
 		 * the function ends - and then just return.
 		 */
-		res = eel_call(eel_current.script, bio_tell(eel_current.bio));
+		res = eel_call(eel_current.script, eel_current.pc);
+		eprof_end(prof);
 	}
 
 	/* Leave function */
-	bio_close(eel_current.bio);
 	eel_pop_context();
 	eel_pop_scope();
 
@@ -317,16 +515,14 @@ int eel_call(int handle, int pos)
 	int depth = 0;
 	eel_push_context();
 	eel_current.script = handle;
-	eel_current.bio = bio_open(eel_scripttab[handle].data,
-			eel_scripttab[handle].len);
-	if(!eel_current.bio)
+	if(!eel_scripttab[handle].code)
 	{
 		eel_error("INTERNAL ERROR: Couldn't read script!");
 		eel_pop_context();
 		return -1;
 	}
-	bio_seek(eel_current.bio, pos, SEEK_SET);
-	
+	eel_current.pc = pos;
+	eel_current.unlexed = 0;
 	eel_current.lval = NULL;
 	while(res > 0)
 	{
@@ -404,7 +600,6 @@ int eel_call(int handle, int pos)
 		}
 	}
 	eel_current.arg = 0;
-	bio_close(eel_current.bio);
 	eel_pop_context();
 	return res;
 }
@@ -412,7 +607,14 @@ int eel_call(int handle, int pos)
 
 int eel_run(int handle)
 {
-	return eel_call(handle, 0);
+	int res;
+	int prof = -1;
+	if(eprof_enabled && (handle >= 0) && (handle < MAX_SCRIPTS) &&
+			eel_scripttab[handle].name)
+		prof = eprof_begin(EPK_SCRIPT, eel_scripttab[handle].name);
+	res = eel_call(handle, 0);
+	eprof_end(prof);
+	return res;
 }
 
 
@@ -454,24 +656,83 @@ int eel_open(void)
 	return 0;
 }
 
-void eel_close()
+/* Free everything owned by the current state */
+static void eel_state_cleanup(void)
 {
 	int h;
-	if(!_eel_users)
-		return;
-
 	for(h = 0; h < MAX_SCRIPTS; ++h)
 		eel_free(h);
-
-	eel_s_freeall();
-	eel_set_path(NULL);
 	eel_s_close();
 	eel_lexer_cleanup();
+	eel_context_cleanup();
+	eel_d_freeall();
+}
+
+void eel_close()
+{
+	if(!_eel_users)
+		return;
+
+	eel_state_cleanup();
+	eel_cache_close();
+	eel_set_path(NULL);
 
 	--_eel_users;
 }
 
 
+/*----------------------------------------------------------
+	Interpreter states
+----------------------------------------------------------*/
+
+eel_state_t *eel_state_new(void)
+{
+	eel_state_t *parent = eel_state;
+	eel_state_t *st;
+	int i, res;
+	if(parent->current_scope >= MAX_SCOPES - 1)
+		return NULL;
+	st = (eel_state_t *)calloc(1, sizeof(eel_state_t));
+	if(!st)
+		return NULL;
+	st->current.script = -1;
+	st->current.token = EOF;
+	st->last_script = -1;
+	st->shared = parent->current_scope + 1;
+	for(i = 0; i < st->shared; ++i)
+		st->scopes[i] = parent->scopes[i];
+	eel_state = st;
+	res = eel_s_open();
+	eel_state = parent;
+	if(res < 0)
+	{
+		free(st);
+		return NULL;
+	}
+	return st;
+}
+
+
+eel_state_t *eel_state_select(eel_state_t *st)
+{
+	eel_state_t *old = eel_state;
+	eel_state = st ? st : &eel_default_state;
+	return old;
+}
+
+
+void eel_state_free(eel_state_t *st)
+{
+	eel_state_t *old;
+	if(!st || (st == &eel_default_state))
+		return;
+	old = eel_state_select(st);
+	eel_state_cleanup();
+	eel_state_select(old != st ? old : NULL);
+	free(st);
+}
+
+
 
 /*----------------------------------------------------------
 	EEL variable access
@@ -97,6 +97,8 @@ extern "C" {
 
 #define	EEL_MAX_ARGS		128
 
+typedef struct eel_state_t eel_state_t;
+
 #define _EEL_API_
 
 #include "e_register.h"
@@ -106,12 +108,6 @@ extern "C" {
 	Toolkit for directive callbacks
 ----------------------------------------------------------*/
 
-/*
- * The internal argument list. Avoid using this directly!
- */
-extern int eel_arg_count;
-extern eel_data_t *eel_args;
-
 /*
  * Add the last lval returned from the lexer to the internal
  * argument list.
@@ -313,8 +309,44 @@ const char *eel_path(void);
 int eel_open(void);
 void eel_close();
 
+/*
+ * Interpreter states
+ *
+ * Scopes, contexts, loaded scripts and everything else
+ * that changes while compiling and running scripts is
+ * kept in an interpreter state. eel_open() sets up the
+ * default state, which is used by all threads until they
+ * select another one.
+ *
+ * eel_state_new() creates a state that shares the scopes
+ * of the current state, up to and including the current
+ * scope, read-only. (That is, the EEL builtins and any
+ * operators, enums etc registered before the call.) Writing
+ * to a shared variable creates a local copy in the new
+ * state. Nothing may be added to, changed in or popped from
+ * the shared scopes while the new state is in use, and the
+ * new state must be freed before its creator. Functions
+ * defined by scripts cannot be shared.
+ *
+ * eel_state_select() makes 'st' (or the default state,
+ * if 'st' is NULL) the state of the calling thread, and
+ * returns the previously selected state. A state must only
+ * be used by one thread at a time. Without compiler support
+ * for thread local variables, the selection is global, and
+ * only one thread can use EEL.
+ *
+ * The compiled script cache and the profiler are only used
+ * by the default state, and registering operators, enums
+ * and the like is only safe from one thread at a time.
+ */
+eel_state_t *eel_state_new(void);
+eel_state_t *eel_state_select(eel_state_t *st);
+void eel_state_free(eel_state_t *st);
+
 /*
  * Execute code inside script 'handle', starting at 'pos'.
+ * Note that 'pos' is an index into the token code of the
+ * script (see eel_compile()), rather than a source position.
  *
  * Execution will take place as a "sub procedure", with it's
  * own context, but *not* automatically it's own *scope*.
@@ -341,10 +373,27 @@ int eel_call(int handle, int pos);
 /*
  * Run a script from the start.
  *
- * Currently 100% equivalent to eel_call('handle', 0);
+ * Equivalent to eel_call('handle', 0), except that the
+ * profiler (if enabled) accounts the run to the script.
  */
 int eel_run(int handle);
 
+/*
+ * Script profiler
+ *
+ * eel_profile(1) starts attributing wall time and call
+ * counts to scripts (eel_run(), #include), functions and
+ * operators. eel_profile(0) stops, but keeps the results.
+ * eel_profile_reset() clears all results.
+ *
+ * eel_profile_dump() logs a report, sorted by "self" time;
+ * that is, time not spent in nested scripts, functions or
+ * operators. It prints nothing if nothing was recorded.
+ */
+void eel_profile(int enable);
+void eel_profile_reset(void);
+void eel_profile_dump(void);
+
 /*
  * Create or set variable 'name' to the specified value.
  * Existing symbols *must* be of type ST_VARIABLE, or
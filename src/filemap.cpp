@@ -74,6 +74,11 @@ filemapper_t::filemapper_t()
 	next_buffer = 0;
 	objects = NULL;
 	current_obj = NULL;
+	current_dir = NULL;
+	current_entry = 0;
+	cache = NULL;
+	dirs = NULL;
+	used_count = -1;
 
 	/*
 	 * I'll put this here for now.
@@ -101,6 +106,7 @@ filemapper_t::~filemapper_t()
 		objects = objects->next;
 		delete o;
 	}
+	flush();
 	free(app_path);
 }
 
@@ -238,6 +244,7 @@ void filemapper_t::exepath(const char *appname)
 void filemapper_t::addpath(const char *key, const char *path, int first)
 {
 	fm_key_t *k, *insk;
+	flush_cache();
 	try
 	{
 		k = new fm_key_t;
@@ -340,6 +347,323 @@ int filemapper_t::probe(const char *syspath)
 }
 
 
+/*
+ * Directory snapshots
+ */
+
+#if defined(WIN32)
+#	define	FM_SEPARATOR	'\\'
+#elif defined(MACOS)
+#	define	FM_SEPARATOR	':'
+#else
+#	define	FM_SEPARATOR	'/'
+#endif
+
+// Names are compared like the file system does, more or less.
+#if defined(WIN32) || defined(MACOS) || defined(__APPLE__)
+#	define	fm_namecmp	strcasecmp
+#else
+#	define	fm_namecmp	strcmp
+#endif
+
+static int fm_entry_cmp(const void *a, const void *b)
+{
+	return fm_namecmp(((const fm_entry_t *)a)->name,
+			((const fm_entry_t *)b)->name);
+}
+
+
+void fm_dir_t::clear()
+{
+	for(int i = 0; i < count; ++i)
+		free(entries[i].name);
+	free(entries);
+	entries = NULL;
+	count = 0;
+	exists = 0;
+	listed = 0;
+}
+
+
+fm_dir_t::~fm_dir_t()
+{
+	clear();
+	free(path);
+}
+
+
+fm_cache_t::~fm_cache_t()
+{
+	free(ref);
+	free(path);
+}
+
+
+/*
+ * (Re)read the listing of directory 'd'.
+ */
+void filemapper_t::read_dir(fm_dir_t *d)
+{
+	d->clear();
+	d->stale = 0;
+	d->read_time = d->checked = time(NULL);
+	d->mtime = 0;
+#ifdef KOBO_HAVE_STAT
+	struct stat st;
+	if(::stat(d->path, &st) != 0 || !S_ISDIR(st.st_mode))
+		return;
+	d->mtime = st.st_mtime;
+#endif
+	d->exists = 1;
+
+	DIR *dir = ::opendir(d->path);
+	if(!dir)
+		return;		// Not listable; probe() instead.
+	int size = 0;
+	struct dirent *de;
+	while((de = readdir(dir)))
+	{
+		if(d->count >= size)
+		{
+			int ns = size ? size * 2 : 32;
+			fm_entry_t *ne = (fm_entry_t *)realloc(d->entries,
+					ns * sizeof(fm_entry_t));
+			if(!ne)
+				break;
+			d->entries = ne;
+			size = ns;
+		}
+		fm_entry_t *e = d->entries + d->count;
+		e->name = strdup(de->d_name);
+		if(!e->name)
+			break;
+#if defined(_DIRENT_HAVE_D_TYPE) || defined(DT_DIR)
+		// Symlinks and the like are probed when needed.
+		switch(de->d_type)
+		{
+		  case DT_DIR:
+			e->kind = FM_DIR;
+			break;
+		  case DT_REG:
+			e->kind = FM_FILE;
+			break;
+		  default:
+			e->kind = FM_UNKNOWN;
+			break;
+		}
+#else
+		e->kind = FM_UNKNOWN;
+#endif
+		++d->count;
+	}
+	closedir(dir);
+	qsort(d->entries, d->count, sizeof(fm_entry_t), fm_entry_cmp);
+	d->listed = 1;
+}
+
+
+/*
+ * Get the snapshot of directory 'syspath', reading it if
+ * needed. Snapshots are checked against the directory mtime
+ * at most once per second. A directory modified within the
+ * second it was listed is read again on the next check, as
+ * changes may have been made after the listing.
+ */
+fm_dir_t *filemapper_t::get_dir(const char *syspath)
+{
+	fm_dir_t *d;
+	for(d = dirs; d; d = d->next)
+		if(strcmp(d->path, syspath) == 0)
+			break;
+	if(!d)
+	{
+		try
+		{
+			d = new fm_dir_t;
+		}
+		catch(...)
+		{
+			return NULL;
+		}
+		d->path = strdup(syspath);
+		if(!d->path)
+		{
+			delete d;
+			return NULL;
+		}
+		d->count = 0;
+		d->entries = NULL;
+		d->next = dirs;
+		dirs = d;
+		read_dir(d);
+		return d;
+	}
+	check_dir(d);
+	return d;
+}
+
+
+/*
+ * Read snapshot 'd' again if it is stale, or if the directory
+ * may have changed since it was listed.
+ */
+void filemapper_t::check_dir(fm_dir_t *d)
+{
+	if(d->stale)
+		read_dir(d);
+	else
+	{
+		time_t now = time(NULL);
+		if(now == d->checked)
+			return;
+		d->checked = now;
+#ifdef KOBO_HAVE_STAT
+		struct stat st;
+		int exists = (::stat(d->path, &st) == 0) &&
+				S_ISDIR(st.st_mode);
+		if((exists != d->exists) || (exists &&
+				((st.st_mtime != d->mtime) ||
+				(d->mtime >= d->read_time))))
+			read_dir(d);
+#else
+		read_dir(d);
+#endif
+	}
+}
+
+
+/*
+ * Note that the lookup in progress depends on snapshot 'd',
+ * or if 'd' is NULL, that it depends on a probe() and can't
+ * be cached.
+ */
+void filemapper_t::use_dir(fm_dir_t *d)
+{
+	if(used_count < 0)
+		return;
+	if(!d || (used_count >= FM_CACHE_DIRS))
+	{
+		used_count = -1;
+		return;
+	}
+	for(int i = 0; i < used_count; ++i)
+		if(used_dirs[i] == d)
+			return;
+	used_dirs[used_count] = d;
+	used_read_time[used_count] = d->read_time;
+	++used_count;
+}
+
+
+/*
+ * Get the kind of entry 'e' of 'd', probing it if needed.
+ */
+int filemapper_t::entry_kind(fm_dir_t *d, fm_entry_t *e)
+{
+	if(e->kind == FM_UNKNOWN)
+	{
+		char path[FM_BUFFER_SIZE];
+		snprintf(path, sizeof(path), "%s%c%s", d->path,
+				FM_SEPARATOR, e->name);
+		e->kind = probe(path);
+	}
+	return e->kind;
+}
+
+
+/*
+ * Like probe(), but looks in the snapshot of the parent
+ * directory, if possible.
+ */
+int filemapper_t::lookup(const char *syspath)
+{
+	char parent[FM_BUFFER_SIZE];
+	const char *name = strrchr(syspath, FM_SEPARATOR);
+	if(!name || !name[1] || !strcmp(name + 1, ".") ||
+			!strcmp(name + 1, ".."))
+	{
+		use_dir(NULL);
+		return probe(syspath);
+	}
+	int len = name - syspath;
+	if(len >= FM_BUFFER_SIZE)
+	{
+		use_dir(NULL);
+		return probe(syspath);
+	}
+	if(!len)
+		len = 1;	// Root directory
+	memcpy(parent, syspath, len);
+	parent[len] = 0;
+	++name;
+
+	fm_dir_t *d = get_dir(parent);
+	if(!d || (d->exists && !d->listed))
+	{
+		use_dir(NULL);
+		return probe(syspath);
+	}
+	use_dir(d);
+	if(!d->exists)
+		return FM_ERROR;
+
+	fm_entry_t key;
+	key.name = (char *)name;
+	fm_entry_t *e = (fm_entry_t *)bsearch(&key, d->entries, d->count,
+			sizeof(fm_entry_t), fm_entry_cmp);
+	if(!e)
+		return FM_ERROR;
+	return entry_kind(d, e);
+}
+
+
+/*
+ * Note that 'syspath' has been created.
+ */
+void filemapper_t::changed(const char *syspath)
+{
+	char parent[FM_BUFFER_SIZE];
+	strncpy(parent, syspath, FM_BUFFER_SIZE - 1);
+	parent[FM_BUFFER_SIZE - 1] = 0;
+	char *c = strrchr(parent, FM_SEPARATOR);
+	if(c)
+	{
+		if(c == parent)
+			++c;	// Root directory
+		*c = 0;
+		for(fm_dir_t *d = dirs; d; d = d->next)
+			if(strcmp(d->path, parent) == 0)
+				d->stale = 1;
+	}
+	flush_cache();
+}
+
+
+void filemapper_t::flush_cache()
+{
+	while(cache)
+	{
+		fm_cache_t *c = cache;
+		cache = cache->next;
+		delete c;
+	}
+}
+
+
+void filemapper_t::flush()
+{
+	flush_cache();
+	current_obj = NULL;	// Abort any get_next() scan
+	current_dir = NULL;
+	while(dirs)
+	{
+		fm_dir_t *d = dirs;
+		dirs = dirs->next;
+		delete d;
+	}
+}
+
+
 /*
  * Create a file for writing, or if it exists, test if it
  * can be opened in write mode.
@@ -352,11 +676,13 @@ int filemapper_t::probe(const char *syspath)
  */
 int filemapper_t::test_file_create(const char *syspath)
 {
-	int exists = (probe(syspath) == FM_FILE);
+	int exists = (lookup(syspath) == FM_FILE);
 	FILE *f = ::fopen(syspath, "a");
 	if(f)
 	{
 		fclose(f);
+		if(!exists)
+			changed(syspath);
 		if(exists)
 		{
 //			log_printf(DLOG, "  File iswritable!\n");
@@ -384,7 +710,7 @@ int filemapper_t::test_file_create(const char *syspath)
 
 int filemapper_t::test_file_dir_any(const char *syspath, int kind)
 {
-	int res = probe(syspath);
+	int res = lookup(syspath);
 	switch (res)
 	{
 	  case FM_ERROR:
@@ -641,10 +967,72 @@ const char *filemapper_t::get(const char *ref, int kind)
 		log_printf(DLOG, "Looking for '%s'...", ref);
 #endif
 	char *buffer = salloc();
-	if(recurse_get(buffer, ref, kind, 1, 0))
-		return buffer;
-	else
-		return NULL;
+
+	// Creating files has side effects, so only lookups are cached.
+	if((kind != FM_FILE) && (kind != FM_DIR) && (kind != FM_ANY))
+	{
+		if(recurse_get(buffer, ref, kind, 1, 0))
+			return buffer;
+		else
+			return NULL;
+	}
+
+	// Results are valid for as long as the snapshots of all
+	// directories looked in are.
+	fm_cache_t *c;
+	fm_cache_t **cp;
+	for(cp = &cache; (c = *cp); cp = &c->next)
+		if((c->kind == kind) && (strcmp(c->ref, ref) == 0))
+		{
+			int i;
+			for(i = 0; i < c->ndirs; ++i)
+			{
+				check_dir(c->dirs[i]);
+				if(c->dirs[i]->read_time != c->read_time[i])
+					break;
+			}
+			if(i < c->ndirs)
+			{
+				*cp = c->next;
+				delete c;
+				break;
+			}
+			if(!c->path)
+				return NULL;
+			strncpy(buffer, c->path, FM_BUFFER_SIZE);
+			return buffer;
+		}
+
+	used_count = 0;
+	int res = recurse_get(buffer, ref, kind, 1, 0);
+	int ndirs = used_count;
+	used_count = -1;
+	if(ndirs < 0)
+		return res ? buffer : NULL;
+	try
+	{
+		c = new fm_cache_t;
+		c->ref = strdup(ref);
+		c->kind = kind;
+		c->path = res ? strdup(buffer) : NULL;
+		c->ndirs = ndirs;
+		for(int i = 0; i < ndirs; ++i)
+		{
+			c->dirs[i] = used_dirs[i];
+			c->read_time[i] = used_read_time[i];
+		}
+		if(!c->ref || (res && !c->path))
+			delete c;
+		else
+		{
+			c->next = cache;
+			cache = c;
+		}
+	}
+	catch(...)
+	{
+	}
+	return res ? buffer : NULL;
 }
 
 
@@ -687,7 +1075,7 @@ const char *filemapper_t::get_next()
 			if(!current_obj)
 				return NULL;	//All done.
 
-			switch(probe(current_obj->path))
+			switch(lookup(current_obj->path))
 			{
 			  case FM_FILE:
 			  {
@@ -697,12 +1085,14 @@ const char *filemapper_t::get_next()
 				return res;
 			  }
 			  case FM_DIR:
-				current_dir = ::opendir(current_obj->path);
+				current_dir = get_dir(current_obj->path);
+				current_entry = 0;
 //				log_printf(DLOG, "get_next() found dir '%s'.\n",
 //						current_obj->path);
-				if(!current_dir)
+				if(!current_dir || !current_dir->listed)
 				{
-					//Couldn't opendir()! Skip object...
+					//Couldn't list the dir! Skip object...
+					current_dir = NULL;
 					current_obj = current_obj->next;
 					continue;
 				}
@@ -719,48 +1109,36 @@ const char *filemapper_t::get_next()
 		//
 		// Get first/next dir entry!
 		//
-		struct dirent *d = readdir(current_dir);
-		if(!d)
+		if(current_entry >= current_dir->count)
 		{
-			// Error or end-of-dir ==> try next object
-			closedir(current_dir);
+			// End-of-dir ==> try next object
 			current_dir = NULL;
 			current_obj = current_obj->next;
 //			log_printf(DLOG, "get_next(): end-of-dir\n");
 			continue;
 		}
-
-		// Get dir entry
-		char *path = salloc();
-		if(!path)
-		{
-			log_printf(CELOG, "Out of memory in get_next()!\n", path);
-			return NULL;
-		}
+		fm_entry_t *e = current_dir->entries + current_entry++;
 
 		// Skip "parent dir" links!
 #ifdef MACOS
-		if(!strcmp(d->d_name, "::"))	//???
+		if(!strcmp(e->name, "::"))	//???
 #else
-		if(!strcmp(d->d_name, ".") || !strcmp(d->d_name, ".."))
+		if(!strcmp(e->name, ".") || !strcmp(e->name, ".."))
 #endif
 			continue;
 
 		// Check dir entry!
-		snprintf(path, FM_BUFFER_SIZE,
-#ifdef WIN32
-				 "%s\\%s",
-#elif defined(MACOS)
-				 "%s:%s",
-#else
-				 "%s/%s",
-#endif
-				current_obj->path, d->d_name);
-		switch(probe(path))
+		switch(entry_kind(current_dir, e))
 		{
 		  case FM_FILE:
+		  {
+			char *path = salloc();
+			snprintf(path, FM_BUFFER_SIZE, "%s%c%s",
+					current_dir->path, FM_SEPARATOR,
+					e->name);
 //			log_printf(DLOG, "get_next() found file '%s'.\n", path);
 			return path;
+		  }
 		  case FM_DIR:
 			//We don't do recursive, so skip subdirs...
 //			log_printf(DLOG, "get_next() found dir '%s'.\n", path);
@@ -773,6 +1151,17 @@ const char *filemapper_t::get_next()
 }
 
 
+const char *filemapper_t::get_next_object()
+{
+	const char *res;
+	if(!current_obj)
+		return NULL;
+	res = current_obj->path;
+	current_obj = current_obj->next;
+	return res;
+}
+
+
 FILE *filemapper_t::fopen(const char *ref, const char *mode)
 {
 	const char *path = NULL;
@@ -45,6 +45,7 @@
 #define	FM_DEREF_TOKEN	">>"
 
 #include <stdio.h>
+#include <time.h>
 #include <dirent.h>
 
 #define	FM_BUFFERS	16
@@ -66,7 +67,8 @@ enum
 	FM_DIR,
 	FM_ANY,
 	FM_FILE_CREATE,
-	FM_DIR_CREATE
+	FM_DIR_CREATE,
+	FM_UNKNOWN	// (Not probed yet; fm_entry_t only)
 };
 
 
@@ -81,12 +83,68 @@ struct fm_object_t
 };
 
 
+
+
+// Directory entry of an fm_dir_t
+struct fm_entry_t
+{
+	char		*name;
+	int		kind;		// FM_FILE, FM_DIR or FM_UNKNOWN
+};
+
+
+// Directory snapshot; a sorted listing of the directory,
+// which is checked against the directory mtime no more than
+// once per second.
+struct fm_dir_t
+{
+	fm_dir_t	*next;
+	char		*path;		// System format
+	int		exists;
+	int		listed;		// 0 if the directory can't be read
+	int		stale;		// Must be read again before use
+	time_t		mtime;		// Directory mtime when listed
+	time_t		read_time;	// Time of listing
+	time_t		checked;	// Time of last mtime check
+	int		count;
+	fm_entry_t	*entries;
+	void clear();
+	~fm_dir_t();
+};
+
+
+// Resolved path cache entry. Dropped as soon as any of the
+// directory snapshots the lookup looked in is read again.
+#define	FM_CACHE_DIRS	8
+struct fm_cache_t
+{
+	fm_cache_t	*next;
+	char		*ref;
+	int		kind;
+	char		*path;		// NULL if the lookup failed
+	int		ndirs;
+	fm_dir_t	*dirs[FM_CACHE_DIRS];
+	time_t		read_time[FM_CACHE_DIRS];	// As used
+	~fm_cache_t();
+};
+
+
 class filemapper_t
 {
 	// For get_(first|next)()
 	fm_object_t	*objects;
 	fm_object_t	*current_obj;
-	DIR		*current_dir;
+	fm_dir_t	*current_dir;
+	int		current_entry;
+
+	// Caches of resolved paths and directory listings
+	fm_cache_t	*cache;
+	fm_dir_t	*dirs;
+
+	// Snapshots looked in by the lookup in progress
+	fm_dir_t	*used_dirs[FM_CACHE_DIRS];
+	time_t		used_read_time[FM_CACHE_DIRS];
+	int		used_count;	// -1 if the result can't be cached
 
 	// File mapper keys
 	fm_key_t	*keys;
@@ -104,6 +162,14 @@ class filemapper_t
 	void unix_slashes(char *buf);
 	void sys_slashes(char *buf);
 	int probe(const char *syspath);
+	void read_dir(fm_dir_t *d);
+	fm_dir_t *get_dir(const char *syspath);
+	void check_dir(fm_dir_t *d);
+	void use_dir(fm_dir_t *d);
+	int entry_kind(fm_dir_t *d, fm_entry_t *e);
+	int lookup(const char *syspath);
+	void changed(const char *syspath);
+	void flush_cache();
 	int test_file_create(const char *syspath);
 	int test_file_dir_any(const char *syspath, int kind);
 	int try_get(const char *path, int kind);
@@ -153,11 +219,25 @@ FIXME: every file inside each matching dir should be returned.
 	// Get next object (returns path in system format!)
 	const char *get_next();
 
+	// Get next object matched by get_all(), without looking
+	// inside directories. (Path in system format!) Do not
+	// mix with get_next() in the same scan.
+	const char *get_next_object();
+
 	// Open/create file/dir.
 	FILE *fopen(const char *ref, const char *mode);
 	DIR *opendir(const char *ref);
 	int mkdir(const char *ref, int perm);
 
+	// Forget all resolved paths and directory listings.
+	//	Resolved paths are kept until addpath() is
+	//	called, or a file is created through get() or
+	//	fopen(). Directory listings are checked against
+	//	the directory mtime at most once per second.
+	//	Call this if files are added or removed by
+	//	other means, and lookups must see it at once.
+	void flush();
+
 	// Print out all registered paths of class 'ref'
 	// to stream 'f'. (ref == '*') ==> All classes.
 	void print(FILE *f, const char *ref);
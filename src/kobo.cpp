@@ -2120,6 +2120,15 @@ int main(int argc, char *argv[])
 		cmd_exit = 1;
 	}
 
+	if(prefs->audiorender[0])
+	{
+		char wav[sizeof(prefs->audiorender) + 4];
+		snprintf(wav, sizeof(wav), "%s.wav", prefs->audiorender);
+		if(sound.render(prefs->audiorender, wav) < 0)
+			log_printf(ELOG, "Audio rendering failed!\n");
+		cmd_exit = 1;
+	}
+
 	if(cmd_exit)
 	{
 		km.close_logging();
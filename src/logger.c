@@ -20,15 +20,45 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <stdarg.h>
 #include <assert.h>
 
 #include "config.h"
 #include "logger.h"
 #include "glSDL.h"
+#include "SDL_thread.h"
 
 #define	LOG_BUFFER	1024
 
+/*
+ * Asynchronous output
+ *
+ *	Where atomic operations are available, log_printf()
+ *	and log_puts() only format the message into a slot
+ *	of a ring buffer, and a writer thread does the rest;
+ *	attributes, timestamps, escaping and the actual
+ *	output. Slots are claimed with compare-and-swap, so
+ *	any number of threads, including real time ones, can
+ *	log without locking or waiting. If the ring is full,
+ *	the message is dropped and counted, and the writer
+ *	reports the number of lost messages.
+ *
+ *	Like the audio event butler, the writer polls rather
+ *	than waits for a signal, so that callers never touch
+ *	a lock.
+ */
+#ifdef KOBO_HAVE___SYNC
+#	define	LOG_ASYNC
+#	define	log_cas(p, o, n)	__sync_bool_compare_and_swap(p, o, n)
+#	define	log_add(p, n)		__sync_fetch_and_add(p, n)
+#	define	log_barrier()		__sync_synchronize()
+#endif
+
+#define	LOG_RING_SLOTS	256	/* Power of two! */
+#define	LOG_RING_MASK	(LOG_RING_SLOTS - 1)
+#define	LOG_PERIOD	10	/* ms */
+
 static int i__last;
 #define	for_one_or_all(iterator, index, items)		\
 	if(index < LOG_TARGETS)				\
@@ -76,10 +106,30 @@ typedef struct
 } LOG_level;
 
 
+typedef struct
+{
+	/* Slot sequence number; see log_claim() */
+	volatile unsigned	seq;
+
+	int		level;
+	int		newline;	/* Add a newline (log_puts()) */
+	Uint32		time;
+	char		text[LOG_BUFFER];
+} LOG_record;
+
+
 static LOG_level *l_levels = NULL;
 static LOG_target *l_targets = NULL;
 static char *l_buffer = NULL;
 
+static LOG_record *l_ring = NULL;
+static volatile unsigned l_head = 0;	/* Next slot to claim */
+static volatile unsigned l_tail = 0;	/* Next slot to write */
+static volatile unsigned l_dropped = 0;	/* Messages lost */
+static unsigned l_reported = 0;		/* Losses reported */
+static SDL_Thread *l_writer = NULL;
+static volatile int l_running = 0;
+
 Uint32 start_time;
 
 
@@ -183,12 +233,12 @@ FIXME: Optimize this a little, maybe. :-)
 }
 
 
-static inline void put_timestamp(int level)
+static inline void put_timestamp(int level, Uint32 time)
 {
 	if(l_targets[l_levels[level].target].flags & LOG_TIMESTAMP)
 	{
 		char buf[16];
-		snprintf(buf, sizeof(buf)-1, "[%d] ", SDL_GetTicks() - start_time);
+		snprintf(buf, sizeof(buf)-1, "[%d] ", time - start_time);
 		log_write_raw(l_levels[level].target, buf);
 	}
 }
@@ -307,6 +357,139 @@ static inline int is_active(int level)
 }
 
 
+/* Output a message, with attributes and all, to 'level'. */
+static int log_output(int level, Uint32 time, const char *text, int newline)
+{
+	int result, result2;
+	if(!is_active(level))
+		return 0;
+
+	check_header(l_levels[level].target);
+	set_attr(level);
+	put_timestamp(level, time);
+
+	result = log_write(l_levels[level].target, text);
+	if((result >= 0) && newline)
+	{
+		result2 = log_write_raw(l_levels[level].target, "\n");
+		if(result2 >= 0)
+			result += result2;
+	}
+	reset_attr(level);
+	return result;
+}
+
+
+/*--------------------------------------------------------------------
+	Ring buffer and writer thread
+--------------------------------------------------------------------*/
+
+#ifdef LOG_ASYNC
+/*
+ * Claim the next free slot, or return NULL if the ring is full.
+ *
+ * A slot with sequence number 'pos' is free for the message with
+ * ring position 'pos'. It is ready for the writer when its number
+ * is 'pos + 1', and the writer hands it back by adding
+ * LOG_RING_SLOTS. (Bounded MPMC queue by Dmitry Vyukov.)
+ */
+static LOG_record *log_claim(void)
+{
+	unsigned pos = l_head;
+	while(1)
+	{
+		LOG_record *r = &l_ring[pos & LOG_RING_MASK];
+		int dif = (int)(r->seq - pos);
+		if(!dif)
+		{
+			if(log_cas(&l_head, pos, pos + 1))
+				return r;
+		}
+		else if(dif < 0)
+		{
+			log_add(&l_dropped, 1);
+			return NULL;
+		}
+		pos = l_head;
+	}
+}
+
+
+/* Hand a claimed and filled in slot over to the writer. */
+static inline void log_publish(LOG_record *r)
+{
+	log_barrier();
+	r->seq = r->seq + 1;
+}
+
+
+/* Write all messages in the ring. Returns 1 if anything was written. */
+static int log_drain(void)
+{
+	int i, any = 0;
+	unsigned dropped;
+	while(1)
+	{
+		LOG_record *r = &l_ring[l_tail & LOG_RING_MASK];
+		if(r->seq != l_tail + 1)
+			break;
+		log_barrier();
+		log_output(r->level, r->time, r->text, r->newline);
+		log_barrier();
+		r->seq = l_tail + LOG_RING_SLOTS;
+		++l_tail;
+		any = 1;
+	}
+
+	dropped = l_dropped;
+	if(dropped != l_reported)
+	{
+		char buf[64];
+		snprintf(buf, sizeof(buf), "(%u log messages dropped!)",
+				dropped - l_reported);
+		l_reported = dropped;
+		log_output(WLOG, SDL_GetTicks(), buf, 1);
+		any = 1;
+	}
+
+	if(any)
+		for(i = 0; i < LOG_TARGETS; ++i)
+			if(l_targets[i].use_stream)
+				fflush(l_targets[i].stream);
+	return any;
+}
+
+
+static int log_writer(void *data)
+{
+	while(1)
+	{
+		/* Read first, so nothing is left behind when stopping */
+		int running = l_running;
+		if(!log_drain() && !running)
+			break;
+		if(running)
+			SDL_Delay(LOG_PERIOD);
+	}
+	return 0;
+}
+#endif
+
+
+/*
+ * Wait for the writer to catch up with all messages logged so far,
+ * so that targets and levels can be changed safely.
+ */
+static void log_sync(void)
+{
+#ifdef LOG_ASYNC
+	unsigned head = l_head;
+	while(l_writer && ((int)(l_tail - head) < 0))
+		SDL_Delay(1);
+#endif
+}
+
+
 /*--------------------------------------------------------------------
 	API entry points
 --------------------------------------------------------------------*/
@@ -340,6 +523,28 @@ int log_open(void)
 	log_set_level_attr(-1, LOG_NOCOLOR);
 
 	start_time = SDL_GetTicks();
+
+#ifdef LOG_ASYNC
+	/* If any of this fails, we just log synchronously. */
+	l_ring = calloc(LOG_RING_SLOTS, sizeof(LOG_record));
+	if(l_ring)
+	{
+		unsigned i;
+		for(i = 0; i < LOG_RING_SLOTS; ++i)
+			l_ring[i].seq = i;
+		l_head = l_tail = 0;
+		l_dropped = l_reported = 0;
+		l_running = 1;
+		log_barrier();
+		l_writer = SDL_CreateThread(log_writer, NULL);
+		if(!l_writer)
+		{
+			l_running = 0;
+			free(l_ring);
+			l_ring = NULL;
+		}
+	}
+#endif
 	return 0;
 }
 
@@ -352,6 +557,15 @@ void log_close(void)
 	int i;
 	if(CHECK_INIT < 0)
 		return;
+	if(l_writer)
+	{
+		/* The writer drains the ring before it stops. */
+		l_running = 0;
+		SDL_WaitThread(l_writer, NULL);
+		l_writer = NULL;
+	}
+	free(l_ring);
+	l_ring = NULL;
 	for(i = 0; i < LOG_TARGETS; ++i)
 		check_footer(i);
 	free(l_targets);
@@ -368,6 +582,7 @@ void log_set_target_stream(int target, FILE *stream)
 	int i;
 	if(CHECK_INIT < 0)
 		return;
+	log_sync();
 
 	for_one_or_all(i, target, LOG_TARGETS)
 	{
@@ -384,6 +599,7 @@ void log_set_target_callback(int target,
 	int i;
 	if(CHECK_INIT < 0)
 		return;
+	log_sync();
 
 	for_one_or_all(i, target, LOG_TARGETS)
 	{
@@ -399,6 +615,7 @@ void log_set_target_flags(int target, unsigned flags)
 	int i;
 	if(CHECK_INIT < 0)
 		return;
+	log_sync();
 
 	for_one_or_all(i, target, LOG_TARGETS)
 		l_targets[i].flags = flags;
@@ -410,6 +627,7 @@ void log_set_level_target(int level, int target)
 	int i;
 	if(CHECK_INIT < 0)
 		return;
+	log_sync();
 
 	for_one_or_all(i, level, LOG_LEVELS)
 		l_levels[i].target = target;
@@ -421,6 +639,7 @@ void log_set_level_attr(int level, unsigned attr)
 	int i;
 	if(CHECK_INIT < 0)
 		return;
+	log_sync();
 
 	for_one_or_all(i, level, LOG_LEVELS)
 		l_levels[i].attr = attr;
@@ -429,8 +648,6 @@ void log_set_level_attr(int level, unsigned attr)
 
 int log_puts(int level, const char *text)
 {
-	int result, result2;
-
 	if(CHECK_INIT < 0)
 		return -1;
 
@@ -440,19 +657,24 @@ int log_puts(int level, const char *text)
 	if(!is_active(level))
 		return 0;
 
-	check_header(l_levels[level].target);
-	set_attr(level);
-	put_timestamp(level);
-
-	result = log_write(l_levels[level].target, text);
-	if(result >= 0)
+#ifdef LOG_ASYNC
+	if(l_writer)
 	{
-		result2 = log_write_raw(l_levels[level].target, "\n");
-		if(result2 >= 0)
-			result += result2;
+		int len;
+		LOG_record *r = log_claim();
+		if(!r)
+			return -3;
+		r->level = level;
+		r->newline = 1;
+		r->time = SDL_GetTicks();
+		strncpy(r->text, text, LOG_BUFFER - 1);
+		r->text[LOG_BUFFER - 1] = 0;
+		len = strlen(r->text);
+		log_publish(r);
+		return len + 1;
 	}
-	reset_attr(level);
-	return result;
+#endif
+	return log_output(level, SDL_GetTicks(), text, 1);
 }
 
 
@@ -470,15 +692,29 @@ int log_printf(int level, const char *format, ...)
 	if(!is_active(level))
 		return 0;
 
-	check_header(l_levels[level].target);
-	set_attr(level);
-	put_timestamp(level);
-
+#ifdef LOG_ASYNC
+	if(l_writer)
+	{
+		LOG_record *r = log_claim();
+		if(!r)
+			return -3;
+		r->level = level;
+		r->newline = 0;
+		r->time = SDL_GetTicks();
+		va_start(args, format);
+		result = vsnprintf(r->text, LOG_BUFFER - 1, format, args);
+		va_end(args);
+		if(result < 0)
+			r->text[0] = 0;
+		r->text[LOG_BUFFER - 1] = 0;
+		log_publish(r);
+		return result;
+	}
+#endif
 	va_start(args, format);
 	result = vsnprintf(l_buffer, LOG_BUFFER-1, format, args);
 	va_end(args);
 	if(result >= 0)
-		result = log_write(l_levels[level].target, l_buffer);
-	reset_attr(level);
+		result = log_output(level, SDL_GetTicks(), l_buffer, 0);
 	return result;
 }
@@ -80,6 +80,11 @@ typedef enum
  * without calling it!
  *
  * log_open() returns a negative value in case of failure.
+ *
+ * Where atomic operations are available, log_open() starts a
+ * thread that does the actual output, so that logging never
+ * blocks the caller. log_close() writes any messages still
+ * pending before it stops the thread.
  */
 int log_open(void);
 void log_close(void);
@@ -102,6 +107,9 @@ void log_set_target_stream(int target, FILE *stream);
  * successfully handled, or, in case of failure, a negative
  * value.
  *
+ * Where the logger runs asynchronously, callbacks are called
+ * from the writer thread, not from the thread that logged.
+ *
  * If 'target' is -1, all targets are changed.
  */
 void log_set_target_callback(int target,
@@ -138,7 +146,8 @@ void log_set_level_attr(int level, unsigned attr);
  * level to print to. No formatting will be done, and the
  * output will be followed by a "newline".
  *
- * Returns a negative value in case of failure.
+ * Returns a negative value in case of failure. -3 means the
+ * message was dropped, as the writer has fallen behind.
  */
 int log_puts(int level, const char *text);
 
@@ -147,7 +156,8 @@ int log_puts(int level, const char *text);
  * Format and print to 'level'. 'level' is the index of the
  * log level to print to.
  *
- * Returns a negative value in case of failure.
+ * Returns a negative value in case of failure. -3 means the
+ * message was dropped, as the writer has fallen behind.
  */
 int log_printf(int level, const char *format, ...);
 
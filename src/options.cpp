@@ -305,6 +305,7 @@ void audio_options_t::build()
 			item("Normal", AQ_NORMAL);
 			item("High", AQ_HIGH);
 			item("Very High", AQ_VERY_HIGH);
+		yesno("Adaptive Quality", &prf->autoquality, OS_UPDATE_AUDIO);
 		list("Sound Latency", &prf->latency, OS_RESTART_AUDIO);
 		{
 			char buf[10];
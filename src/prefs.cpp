@@ -64,6 +64,7 @@ void prefs_t::init()
 	yesno("sound", use_sound, 1); desc("Enable Sound");
 	yesno("music", use_music, 1); desc("Enable Music");
 	yesno("cached_sounds", cached_sounds, 0); desc("Use Cached Sounds");
+	yesno("compact_sounds", compact_sounds, 0); desc("Compress Sounds in Memory");
 #ifdef HAVE_OSS
 	yesno("oss", use_oss, 0);
 #else
@@ -73,6 +74,8 @@ void prefs_t::init()
 	key("samplerate", samplerate, 44100); desc("Sample Rate");
 	key("latency", latency, 50); desc("Sound Latency");
 	key("mixquality", mixquality, AQ_HIGH); desc("Mixing Quality");
+	yesno("autoquality", autoquality, 1); desc("Adaptive Mixing Quality");
+	yesno("floatmix", floatmix, 0); desc("Floating Point Mixing");
 	key("vol", volume, 100); desc("Master Volume");
 	key("intro_vol", intro_vol, 100); desc("Intro Music Volume");
 	key("sfx_vol", sfx_vol, 100); desc("Sound Effects Volume");
@@ -141,10 +144,16 @@ void prefs_t::init()
 	command("pushmove", cmd_pushmove); desc("Enable Push Move Mode");
 	command("noparachute", cmd_noparachute); desc("Disable SDL Parachute");
 	command("pollaudio", cmd_pollaudio); desc("Use Polling Audio Output");
+	command("audioprofile", cmd_audioprofile); desc("Profile Audio Engine");
+	command("eelprofile", cmd_eelprofile); desc("Profile Sound Scripts");
 	command("autoshot", cmd_autoshot); desc("Ingame screenshots/movie");
 	command("help", cmd_help); desc("Print usage info and exit");
 	command("options_man", cmd_options_man);
 			desc("Print options for 'man'");
+	key("audiorecord", audiorecord, "", 0);
+			desc("Record Audio Commands To File");
+	key("audiorender", audiorender, "", 0);
+			desc("Render Audio Command File To WAV");
 }
 
 
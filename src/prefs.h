@@ -58,10 +58,13 @@ class prefs_t : public config_parser_t
 	int	use_sound;	//Enable sound
 	int	use_music;	//Enable "real" music
 	int	cached_sounds;	//Use prerendered waveforms
+	int	compact_sounds;	//Keep waveforms as 8 bit mu-law
 	int	use_oss;	//Use OSS audio driver
 	int	samplerate;
 	int	latency;	//Audio latency in ms
 	int	mixquality;	//Mixer quality control
+	int	autoquality;	//Lower mixquality under CPU load
+	int	floatmix;	//Float busses and master
 	int	volume;		//Digital master volume
 	//Sound: Mixer
 	int	intro_vol;	//Intro music volume
@@ -129,9 +132,13 @@ class prefs_t : public config_parser_t
 	int cmd_pushmove;	//Stop when not holding any direction down
 	int cmd_noparachute;	//Disable SDL parachute
 	int cmd_pollaudio;	//Use polling based audio instead of thread
+	int cmd_audioprofile;	//Record and log audio engine timing
+	int cmd_eelprofile;	//Log time spent in sound scripts
 	int cmd_autoshot;	//Take ingame screenshots
 	int cmd_help;		//Show help and exit
 	int cmd_options_man;	//Output OPTIONS doc in Un*x man source format
+	cfg_string_t	audiorecord;	//Record audio commands to file
+	cfg_string_t	audiorender;	//Render audio command file to WAV
 };
 
 #endif	//_KOBO_PREFS_H_
@@ -29,6 +29,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <time.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
@@ -123,6 +124,100 @@ void s_hiscore_t::write(pfile_t &pf)
 }
 
 
+/*----------------------------------------------------------
+	s_journal_t - Profile journal entry
+----------------------------------------------------------*/
+
+struct s_journal_t
+{
+	unsigned int	best_score;
+	int		last_scene;
+	int		skill;
+	int		handicap;
+	int		color1;
+	int		color2;
+	int		slot;
+	s_hiscore_t	hiscore;
+
+	unsigned int sum();
+	int read(pfile_t &pf);
+	void write(pfile_t &pf);
+};
+
+// FNV-1a of 'x', as stored; 32 bit little endian
+static inline unsigned int journal_hash(unsigned int h, unsigned int x)
+{
+	for(int i = 0; i < 32; i += 8)
+		h = (h ^ ((x >> i) & 0xff)) * 16777619;
+	return h;
+}
+
+unsigned int s_journal_t::sum()
+{
+	unsigned int h = 2166136261U;
+	h = journal_hash(h, best_score);
+	h = journal_hash(h, last_scene);
+	h = journal_hash(h, skill);
+	h = journal_hash(h, handicap);
+	h = journal_hash(h, color1);
+	h = journal_hash(h, color2);
+	h = journal_hash(h, slot);
+	if(slot < 0)
+		return h;
+	h = journal_hash(h, hiscore.start_date);
+	h = journal_hash(h, hiscore.end_date);
+	h = journal_hash(h, hiscore.skill);
+	h = journal_hash(h, hiscore.score);
+	h = journal_hash(h, hiscore.start_scene);
+	h = journal_hash(h, hiscore.end_scene);
+	h = journal_hash(h, hiscore.end_lives);
+	h = journal_hash(h, hiscore.end_health);
+	h = journal_hash(h, hiscore.playtime);
+	h = journal_hash(h, hiscore.saves);
+	h = journal_hash(h, hiscore.loads);
+	h = journal_hash(h, hiscore.gametype);
+	return h;
+}
+
+// Returns 0, or -1 if the chunk is truncated or corrupt.
+int s_journal_t::read(pfile_t &pf)
+{
+	unsigned int s;
+	if(pf.chunk_size() < 8 * 4)
+		return -1;
+	pf.read(best_score);
+	pf.read(last_scene);
+	pf.read(skill);
+	pf.read(handicap);
+	pf.read(color1);
+	pf.read(color2);
+	pf.read(slot);
+	if(slot >= 0)
+	{
+		if(pf.chunk_size() < 8 * 4 + 12 * 4)
+			return -1;
+		hiscore.read(pf);
+	}
+	if(pf.read(s) != 4)
+		return -1;
+	return s == sum() ? 0 : -1;
+}
+
+void s_journal_t::write(pfile_t &pf)
+{
+	pf.write(best_score);
+	pf.write(last_scene);
+	pf.write(skill);
+	pf.write(handicap);
+	pf.write(color1);
+	pf.write(color2);
+	pf.write(slot);
+	if(slot >= 0)
+		hiscore.write(pf);
+	pf.write(sum());
+}
+
+
 /*----------------------------------------------------------
 	s_profile_t
 ----------------------------------------------------------*/
@@ -132,6 +227,8 @@ s_profile_t::s_profile_t()
 	for(int i = 0; i < HISCORE_SAVE_MAX; ++i)
 		hiscoretab[i].profile = this;
 	filename = NULL;
+	journal = 0;
+	appendable = 0;
 }
 
 s_profile_t::~s_profile_t()
@@ -152,6 +249,8 @@ void s_profile_t::clear()
 	hiscores = 0;
 	for(int i = 0; i < HISCORE_SAVE_MAX; ++i)
 		hiscoretab[i].clear();
+	journal = 0;
+	appendable = 0;
 }
 
 int s_profile_t::load(const char *fn)
@@ -200,6 +299,8 @@ int s_profile_t::load(const char *fn)
 
 	//Kobo Deluxe profile file format 1+
 	int chunks = 0;
+	int broken = 0;
+	long good_end = ftell(f);	// End of last good chunk
 	while(!feof(f))
 	{
 		if(pf.chunk_read() < 0)
@@ -232,6 +333,34 @@ int s_profile_t::load(const char *fn)
 			if(hiscores < HISCORE_SAVE_MAX)
 				hiscoretab[hiscores++].read(pf);
 			break;
+		  case MAKE_4CC('J', 'R', 'N', 'L'):
+		  {
+			s_journal_t j;
+			if((j.read(pf) < 0) || (j.slot >= HISCORE_SAVE_MAX) ||
+					(j.slot > (int)hiscores))
+			{
+				log_printf(WLOG, "WARNING: Broken journal entry"
+						" in player profile '%s'!"
+						" (Ignoring the rest.)\n", fn);
+				broken = 1;
+				break;
+			}
+			best_score = j.best_score;
+			last_scene = j.last_scene;
+			skill = j.skill;
+			handicap = j.handicap;
+			color1 = j.color1;
+			color2 = j.color2;
+			if(j.slot >= 0)
+			{
+				hiscoretab[j.slot] = j.hiscore;
+				hiscoretab[j.slot].profile = this;
+				if(j.slot == (int)hiscores)
+					++hiscores;
+			}
+			++journal;
+			break;
+		  }
 		  default:
 			{
 				char tp[5];
@@ -248,8 +377,19 @@ int s_profile_t::load(const char *fn)
 		}
 		++chunks;
 		pf.chunk_end();
+		if(broken)
+		{
+			pf.status();
+			break;
+		}
+		good_end = ftell(f);
 	}
 
+	// Journal entries can only be appended to a file that
+	// ends with a good chunk.
+	fseek(f, 0, SEEK_END);
+	appendable = chunks && (ftell(f) == good_end);
+
 	if(!chunks)
 	{
 		log_printf(D2LOG, "Old scorefile.\n");
@@ -268,18 +408,9 @@ int s_profile_t::load(const char *fn)
 }
 
 
-int s_profile_t::save()
+// Returns -1 if 'filename' must not be written.
+static int profile_check_symlink(const char *filename)
 {
-	log_printf(D3LOG, "s_profile_t::save('%s')\n", filename);
-#ifndef	WIN32
-	umask(022);
-#endif
-	if(!filename)
-	{
-		log_printf(ELOG, "Failed to save player profile - no file name!\n");
-		return -1;
-	}
-
 //The "safe list"; platforms that do not have symlinks:
 #if !defined(WIN32)
 #ifdef KOBO_HAVE_STAT
@@ -309,17 +440,38 @@ int s_profile_t::save()
 #error (Remove this line to compile anyway.)
 #endif	/* KOBO_HAVE_STAT */
 #endif	/* "Safe list" */
+	return 0;
+}
+
+
+int s_profile_t::save()
+{
+	log_printf(D3LOG, "s_profile_t::save('%s')\n", filename);
+#ifndef	WIN32
+	umask(022);
+#endif
+	if(!filename)
+	{
+		log_printf(ELOG, "Failed to save player profile - no file name!\n");
+		return -1;
+	}
 
-	FILE *f = fopen(filename, "wb");
+	if(profile_check_symlink(filename) < 0)
+		return -1;
+
+	// Write a complete new file, and replace the old one with
+	// it, so there is always an intact profile on disk.
+	char tmp[FM_BUFFER_SIZE + 4];
+	snprintf(tmp, sizeof(tmp), "%s.new", filename);
+	remove(tmp);
+	FILE *f = fopen(tmp, "wb");
 	if(!f)
 	{
 		log_printf(ELOG, "Failed to create player profile '%s'!\n",
-				filename);
+				tmp);
 		return -1;
 	}
 
-	fseek(f, 0, SEEK_SET);
-
 	pfile_t pf(f);
 
 	// Write old XKobo stuff
@@ -332,6 +484,7 @@ int s_profile_t::save()
 	if(pf.chunk_write(MAKE_4CC('P', 'R', 'O', 'F')) < 0)
 	{
 		fclose(f);
+		remove(tmp);
 		return pf.status();
 	}
 	pf.write((unsigned int)PROFILE_VERSION);
@@ -347,14 +500,81 @@ int s_profile_t::save()
 		if(pf.chunk_write(MAKE_4CC('H', 'I', 'S', 'C')) < 0)
 		{
 			fclose(f);
+			remove(tmp);
 			return pf.status();
 		}
 		hiscoretab[i].write(pf);
 		pf.chunk_end();
 	}
 
-	fclose(f);
-	return pf.status();
+	if(fclose(f) != 0)
+		pf.status(-1);
+	int res = pf.status();
+	if(res < 0)
+	{
+		log_printf(ELOG, "Failed to write player profile '%s'!\n",
+				tmp);
+		remove(tmp);
+		return res;
+	}
+#ifdef WIN32
+	remove(filename);
+#endif
+	if(rename(tmp, filename) < 0)
+	{
+		log_printf(ELOG, "Failed to replace player profile '%s'!\n",
+				filename);
+		remove(tmp);
+		return -1;
+	}
+	journal = 0;
+	appendable = 1;
+	return res;
+}
+
+
+// Appends a JRNL chunk with the header, profile settings and
+// hiscore 'slot' (unless -1) to the file; about 90 bytes. The
+// whole profile is rewritten instead if the file is not intact,
+// or the journal is full.
+int s_profile_t::append(int slot)
+{
+	log_printf(D3LOG, "s_profile_t::append('%s', %d)\n", filename, slot);
+	if(!filename || !appendable || (journal >= PROFILE_JOURNAL_MAX))
+		return save();
+	if(profile_check_symlink(filename) < 0)
+		return -1;
+
+	FILE *f = fopen(filename, "ab");
+	if(!f)
+		return save();
+
+	pfile_t pf(f);
+	s_journal_t j;
+	j.best_score = best_score;
+	j.last_scene = last_scene;
+	j.skill = skill;
+	j.handicap = handicap;
+	j.color1 = color1;
+	j.color2 = color2;
+	j.slot = slot;
+	if(slot >= 0)
+		j.hiscore = hiscoretab[slot];
+	pf.chunk_write(MAKE_4CC('J', 'R', 'N', 'L'));
+	j.write(pf);
+	pf.chunk_end();
+	if(fclose(f) != 0)
+		pf.status(-1);
+	if(pf.status() < 0)
+	{
+		// We may have left half a chunk behind. Start over.
+		log_printf(WLOG, "Failed to append to player profile '%s'!"
+				" Rewriting it.\n", filename);
+		appendable = 0;
+		return save();
+	}
+	++journal;
+	return 0;
 }
 
 
@@ -372,17 +592,504 @@ s_hiscore_t *s_profile_t::best_hiscore()
 }
 
 
+/*----------------------------------------------------------
+	s_hsindex_t
+----------------------------------------------------------*/
+
+static unsigned int hsindex_hash(const char *s)
+{
+	unsigned int h = 5381;
+	while(*s)
+		h = h * 33 + (unsigned char)*s++;
+	return h % HSINDEX_BUCKETS;
+}
+
+s_hsindex_t::s_hsindex_t(const char *path)
+{
+	next = NULL;
+	dir = strdup(path);
+	dir_mtime = 0;
+	scan_time = 0;
+	idx_mtime = 0;
+	dirty = 0;
+	gathered = 0;
+	count = 0;
+	for(int i = 0; i < HSINDEX_BUCKETS; ++i)
+		table[i] = NULL;
+}
+
+s_hsindex_t::~s_hsindex_t()
+{
+	clear();
+	free(dir);
+}
+
+void s_hsindex_t::clear()
+{
+	for(int i = 0; i < HSINDEX_BUCKETS; ++i)
+		while(table[i])
+		{
+			s_hsentry_t *e = table[i];
+			table[i] = e->next;
+			free(e->file);
+			delete e;
+		}
+	count = 0;
+}
+
+void s_hsindex_t::path(char *buf, int size, const char *file)
+{
+	snprintf(buf, size,
+#ifdef WIN32
+			"%s\\%s",
+#elif defined(MACOS)
+			"%s:%s",
+#else
+			"%s/%s",
+#endif
+			dir, file);
+}
+
+s_hsentry_t *s_hsindex_t::find(const char *file)
+{
+	s_hsentry_t *e = table[hsindex_hash(file)];
+	while(e && strcmp(e->file, file))
+		e = e->next;
+	return e;
+}
+
+s_hsentry_t *s_hsindex_t::add(const char *file)
+{
+	s_hsentry_t *e = new s_hsentry_t;
+	e->file = strdup(file);
+	if(!e->file)
+	{
+		delete e;
+		return NULL;
+	}
+	e->index = this;
+	e->mtime = 0;
+	e->size = 0;
+	e->valid = 0;
+	e->seen = 1;
+	unsigned int h = hsindex_hash(file);
+	e->next = table[h];
+	table[h] = e;
+	++count;
+	dirty = 1;
+	return e;
+}
+
+void s_hsindex_t::remove(s_hsentry_t *e)
+{
+	s_hsentry_t **ep = &table[hsindex_hash(e->file)];
+	while(*ep != e)
+		ep = &(*ep)->next;
+	*ep = e->next;
+	free(e->file);
+	delete e;
+	--count;
+	dirty = 1;
+}
+
+// Update entry 'e' from profile 'p', as loaded from a file
+// with the specified mtime and size.
+void s_hsindex_t::set(s_hsentry_t *e, s_profile_t *p,
+		unsigned int mtime, unsigned int size)
+{
+	s_hiscore_t *hs = p->best_hiscore();
+	if(hs)
+	{
+		e->best = *hs;
+		e->valid = 1;
+	}
+	else
+	{
+		e->best.clear();
+		e->valid = 0;
+	}
+	memcpy(e->best.name, p->name, SCORE_NAME_LEN);
+	e->best.name[SCORE_NAME_LEN - 1] = 0;
+	e->best.profile = NULL;
+	e->mtime = mtime;
+	e->size = size;
+	dirty = 1;
+}
+
+// Check the file of entry 'e', and reload it (using 'p') if
+// it has changed since it was indexed. Returns 1 if the entry
+// was updated, 0 if it is up to date, or -1 if the file is
+// gone.
+int s_hsindex_t::refresh(s_hsentry_t *e, s_profile_t *p)
+{
+	char fn[FM_BUFFER_SIZE];
+	struct stat st;
+	path(fn, sizeof(fn), e->file);
+	if(stat(fn, &st) < 0 || !S_ISREG(st.st_mode))
+		return -1;
+	if(((unsigned int)st.st_mtime == e->mtime) &&
+			((unsigned int)st.st_size == e->size))
+		return 0;
+	log_printf(D2LOG, "Hiscore index: '%s' changed.\n", fn);
+	if(p->load(fn) < 0)
+		p->clear();
+	set(e, p, st.st_mtime, st.st_size);
+	return 1;
+}
+
+// Sync the index with the directory listing; files not seen
+// before are loaded, and entries of removed files are dropped.
+// 'mtime' is the directory mtime, as checked before the scan.
+void s_hsindex_t::rescan(s_profile_t *p, unsigned int mtime)
+{
+	DIR *d = opendir(dir);
+	if(!d)
+		return;
+	scan_time = time(NULL);
+	log_printf(D2LOG, "Hiscore index: Scanning '%s'...\n", dir);
+
+	int i;
+	s_hsentry_t *e;
+	for(i = 0; i < HSINDEX_BUCKETS; ++i)
+		for(e = table[i]; e; e = e->next)
+			e->seen = 0;
+
+	int loaded = 0;
+	struct dirent *de;
+	while((de = readdir(d)))
+	{
+		char fn[FM_BUFFER_SIZE];
+		struct stat st;
+		const char *name = de->d_name;
+		int len = strlen(name);
+		if(!strcmp(name, ".") || !strcmp(name, ".."))
+			continue;
+		if(!strcmp(name, HISCORE_INDEX_NAME))
+			continue;
+		if((len > 4) && !strcmp(name + len - 4, ".new"))
+			continue;
+		if((e = find(name)))
+		{
+			e->seen = 1;
+			continue;
+		}
+		path(fn, sizeof(fn), name);
+		if(stat(fn, &st) < 0 || !S_ISREG(st.st_mode))
+			continue;
+		if(!(e = add(name)))
+			break;
+		if(p->load(fn) < 0)
+			p->clear();
+		set(e, p, st.st_mtime, st.st_size);
+		++loaded;
+	}
+	closedir(d);
+
+	for(i = 0; i < HSINDEX_BUCKETS; ++i)
+	{
+		s_hsentry_t **ep = &table[i];
+		while(*ep)
+			if(!(*ep)->seen)
+				remove(*ep);
+			else
+				ep = &(*ep)->next;
+	}
+
+	// Save the new directory state, even if no entries have
+	// changed, so that the next load can skip the scan.
+	dir_mtime = mtime;
+	dirty = 1;
+	log_printf(D2LOG, "Hiscore index: %d profiles; %d loaded.\n",
+			count, loaded);
+}
+
+static void hsindex_read_entry(s_hsindex_t *idx, pfile_t &pf)
+{
+	unsigned int len;
+	char file[256];
+	if(pf.read(len) != 4 || len >= sizeof(file))
+		return;
+	if(pf.chunk_size() < (int)(4 + len + 12 + SCORE_NAME_LEN + 48))
+		return;
+	pf.read(file, len);
+	file[len] = 0;
+	if(idx->find(file))
+		return;
+	s_hsentry_t *e = idx->add(file);
+	if(!e)
+		return;
+	pf.read(e->mtime);
+	pf.read(e->size);
+	pf.read(e->valid);
+	pf.read(e->best.name, SCORE_NAME_LEN);
+	e->best.name[SCORE_NAME_LEN - 1] = 0;
+	e->best.read(pf);
+	e->best.profile = NULL;
+}
+
+int s_hsindex_t::load()
+{
+	char fn[FM_BUFFER_SIZE];
+	struct stat st;
+	int version = -1;
+	unsigned int fresh = 0;
+
+	clear();
+	dir_mtime = 0;
+	scan_time = 0;
+	dirty = 0;
+	path(fn, sizeof(fn), HISCORE_INDEX_NAME);
+	if(stat(fn, &st) < 0)
+		return -1;
+	idx_mtime = st.st_mtime;
+	FILE *f = fopen(fn, "rb");
+	if(!f)
+		return -1;
+
+	log_printf(D2LOG, "Hiscore index: Loading '%s'...\n", fn);
+	pfile_t pf(f);
+	char header[72];
+	pf.read(header, sizeof(header));
+	while(!feof(f))
+	{
+		if(pf.chunk_read() < 0)
+		{
+			pf.status();	// EOF, or truncated
+			break;
+		}
+		switch(pf.chunk_type())
+		{
+		  case MAKE_4CC('H', 'I', 'D', 'X'):
+			if(pf.chunk_size() >= 8)
+			{
+				pf.read(version);
+				pf.read(dir_mtime);
+			}
+			if(pf.chunk_size() >= 16)
+			{
+				unsigned int n;
+				pf.read(n);
+				pf.read(scan_time);
+			}
+			if(pf.chunk_size() >= 20)
+				pf.read(fresh);
+			break;
+		  case MAKE_4CC('H', 'E', 'N', 'T'):
+			if(version == HISCORE_INDEX_VERSION)
+				hsindex_read_entry(this, pf);
+			break;
+		}
+		pf.chunk_end();
+	}
+	fclose(f);
+
+	if(version != HISCORE_INDEX_VERSION)
+	{
+		// Unknown version; start over.
+		clear();
+		dir_mtime = 0;
+		scan_time = 0;
+	}
+	else if(fresh)
+	{
+		// Nothing else had touched the directory when the index
+		// was renamed into place. If that rename is still the
+		// last change, the index is complete. (If rename() does
+		// not update the ctime, we just scan again.)
+		struct stat dst;
+		if((stat(dir, &dst) == 0) && (dst.st_mtime == st.st_ctime))
+		{
+			dir_mtime = dst.st_mtime;
+			scan_time = dir_mtime + 1;
+		}
+	}
+	dirty = 0;
+	return 0;
+}
+
+int s_hsindex_t::save()
+{
+	char fn[FM_BUFFER_SIZE];
+	char tmp[FM_BUFFER_SIZE + 4];
+	struct stat st;
+
+#ifndef	WIN32
+	umask(022);
+#endif
+	path(fn, sizeof(fn), HISCORE_INDEX_NAME);
+	snprintf(tmp, sizeof(tmp), "%s.new", fn);
+
+	// Has anything touched the directory since it was scanned?
+	unsigned int fresh = (stat(dir, &st) == 0) &&
+			((unsigned int)st.st_mtime == dir_mtime) &&
+			(dir_mtime < scan_time);
+
+#if !defined(WIN32) && defined(KOBO_HAVE_STAT)
+	// We will not write via symlinks!
+	if((lstat(tmp, &st) == 0) && S_ISLNK(st.st_mode))
+	{
+		log_printf(ELOG, "Hiscore index '%s' is a symlink! "
+				"I will NOT write through symlinks.\n", tmp);
+		return -1;
+	}
+#endif
+
+	FILE *f = fopen(tmp, "wb");
+	if(!f)
+	{
+		log_printf(DLOG, "Could not create hiscore index '%s'.\n",
+				tmp);
+		return -1;
+	}
+
+	pfile_t pf(f);
+	char header[72];
+	memset(header, 0, sizeof(header));
+	pf.write(header, sizeof(header));
+	pf.buffer_write();
+
+	pf.chunk_write(MAKE_4CC('H', 'I', 'D', 'X'));
+	pf.write((unsigned int)HISCORE_INDEX_VERSION);
+	pf.write(dir_mtime);
+	pf.write(count);
+	pf.write(scan_time);
+	pf.write(fresh);
+	pf.chunk_end();
+
+	for(int i = 0; i < HSINDEX_BUCKETS; ++i)
+		for(s_hsentry_t *e = table[i]; e; e = e->next)
+		{
+			unsigned int len = strlen(e->file);
+			pf.chunk_write(MAKE_4CC('H', 'E', 'N', 'T'));
+			pf.write(len);
+			pf.write(e->file, len);
+			pf.write(e->mtime);
+			pf.write(e->size);
+			pf.write(e->valid);
+			pf.write(e->best.name, SCORE_NAME_LEN);
+			e->best.write(pf);
+			pf.chunk_end();
+		}
+
+	if((fclose(f) != 0) || (pf.status() < 0))
+	{
+		log_printf(WLOG, "Could not write hiscore index '%s'!\n",
+				tmp);
+		::remove(tmp);
+		return -1;
+	}
+#ifdef WIN32
+	::remove(fn);
+#endif
+	if(rename(tmp, fn) < 0)
+	{
+		log_printf(WLOG, "Could not replace hiscore index '%s'!\n",
+				fn);
+		::remove(tmp);
+		return -1;
+	}
+	dirty = 0;
+
+	// The rename touched the directory. Unless something else
+	// did too, the index is complete as of the rename.
+	if(fresh && (stat(dir, &st) == 0))
+	{
+		dir_mtime = st.st_mtime;
+		scan_time = dir_mtime + 1;
+	}
+	if(stat(fn, &st) == 0)
+		idx_mtime = st.st_mtime;
+	log_printf(D2LOG, "Hiscore index: Saved '%s'.\n", fn);
+	return 0;
+}
+
+
 /*----------------------------------------------------------
 	score_manager_t
 ----------------------------------------------------------*/
 
 score_manager_t::score_manager_t()
 {
+	indexes = NULL;
 }
 
 
 score_manager_t::~score_manager_t()
 {
+	while(indexes)
+	{
+		s_hsindex_t *idx = indexes;
+		indexes = idx->next;
+		delete idx;
+	}
+}
+
+
+// Get the hiscore index of score directory 'dir', (re)loading
+// it if the index file has been changed by someone else.
+s_hsindex_t *score_manager_t::get_index(const char *dir)
+{
+	s_hsindex_t *idx;
+	for(idx = indexes; idx; idx = idx->next)
+		if(!strcmp(idx->dir, dir))
+			break;
+	if(!idx)
+	{
+		idx = new s_hsindex_t(dir);
+		if(!idx->dir)
+		{
+			delete idx;
+			return NULL;
+		}
+		idx->next = indexes;
+		indexes = idx;
+	}
+
+	char fn[FM_BUFFER_SIZE];
+	struct stat st;
+	idx->path(fn, sizeof(fn), HISCORE_INDEX_NAME);
+	if(!idx->dirty && (stat(fn, &st) == 0) &&
+			((unsigned int)st.st_mtime != idx->idx_mtime))
+		idx->load();
+	return idx;
+}
+
+
+// Update the hiscore index entry of profile 'p', which has
+// just been saved.
+void score_manager_t::update_index(s_profile_t *p)
+{
+	if(!p->filename)
+		return;
+#ifdef WIN32
+	const char *file = strrchr(p->filename, '\\');
+#elif defined(MACOS)
+	const char *file = strrchr(p->filename, ':');
+#else
+	const char *file = strrchr(p->filename, '/');
+#endif
+	if(!file)
+		return;
+
+	char dir[FM_BUFFER_SIZE];
+	int len = file - p->filename;
+	if(len >= (int)sizeof(dir))
+		return;
+	memcpy(dir, p->filename, len);
+	dir[len] = 0;
+	++file;
+
+	struct stat st;
+	if(stat(p->filename, &st) < 0)
+		return;
+	s_hsindex_t *idx = get_index(dir);
+	if(!idx)
+		return;
+	s_hsentry_t *e = idx->find(file);
+	if(!e && !(e = idx->add(file)))
+		return;
+	idx->set(e, p, st.st_mtime, st.st_size);
+	idx->save();
 }
 
 
@@ -516,6 +1223,8 @@ int score_manager_t::addPlayer(const char *name)
 	// Try to create the high score file.
 	if(profiles[numProfiles].save() < 0)
 		ret = -3;
+	else
+		update_index(profiles + numProfiles);
 
 	numProfiles++;
 	return ret;
@@ -592,7 +1301,8 @@ void score_manager_t::record(s_hiscore_t *entry, int force)
 	{
 		log_printf(DLOG, "Writing file %s for player %s...\n",
 				p->filename, p->name);
-		p->save();
+		if(p->append(si) >= 0)
+			update_index(p);
 		gather_high_scores();
 		print_high_scores();
 		log_printf(DLOG, "  Done!\n");
@@ -600,6 +1310,18 @@ void score_manager_t::record(s_hiscore_t *entry, int force)
 }
 
 
+static int s_hsentry_cmp(const void *_a, const void *_b)
+{
+	s_hsentry_t *a = *(s_hsentry_t **)_a;
+	s_hsentry_t *b = *(s_hsentry_t **)_b;
+	if(a->best.score < b->best.score)
+		return 1;
+	else if(a->best.score > b->best.score)
+		return -1;
+	return 0;
+}
+
+
 int s_table_cmp(const void *_a, const void *_b)
 {
 	s_hiscore_t *a = (s_hiscore_t *)_a;
@@ -646,32 +1368,98 @@ void score_manager_t::gather_high_scores(int placeholders)
 	for(int i = 0; i < MAX_HIGHSCORES; ++i)
 		high_tbl[i].clear();
 
+	// Bring the indexes of all score directories up to date.
+	// Only new files are loaded here.
 	s_profile_t p;
-	highs = 0;
+	s_hsindex_t *idx;
+	int i, n = 0;
+	for(idx = indexes; idx; idx = idx->next)
+		idx->gathered = 0;
 	fmap->get_all("SCORES>>", FM_DIR);
-	while(highs < MAX_HIGHSCORES)
+	while(1)
 	{
-		const char *path = fmap->get_next();
-		if(!path)
+		struct stat st;
+		const char *dir = fmap->get_next_object();
+		if(!dir)
 			break;
-
-		if(p.load(path) < 0)
+		if(stat(dir, &st) < 0 || !S_ISDIR(st.st_mode))
 			continue;
 
-		s_hiscore_t *hs = p.best_hiscore();
-		if(!hs)
+		// The same directory may be registered more than once.
+		idx = get_index(dir);
+		if(!idx || idx->gathered)
 			continue;
+		idx->gathered = 1;
+
+		if(((unsigned int)st.st_mtime != idx->dir_mtime) ||
+				(idx->dir_mtime >= idx->scan_time))
+			idx->rescan(&p, st.st_mtime);
+		n += idx->count;
+	}
+
+	// Sort all valid entries by score, and pick the best ones.
+	// Only those are checked against their files, and reloaded
+	// if they have changed since they were indexed.
+	s_hsentry_t **ents = NULL;
+	if(n)
+		ents = (s_hsentry_t **)malloc(n * sizeof(s_hsentry_t *));
+	n = 0;
+	if(ents)
+		for(idx = indexes; idx; idx = idx->next)
+		{
+			if(!idx->gathered)
+				continue;
+			for(i = 0; i < HSINDEX_BUCKETS; ++i)
+				for(s_hsentry_t *e = idx->table[i]; e;
+						e = e->next)
+					if(e->valid)
+						ents[n++] = e;
+		}
+	if(n)
+		qsort(ents, n, sizeof(s_hsentry_t *), s_hsentry_cmp);
 
-		high_tbl[highs] = *hs;
-		memcpy(high_tbl[highs].name, p.name, SCORE_NAME_LEN);
+	highs = 0;
+	i = 0;
+	while((i < n) && (highs < MAX_HIGHSCORES))
+	{
+		s_hsentry_t *e = ents[i];
+		unsigned int score = e->best.score;
+		switch(e->index->refresh(e, &p))
+		{
+		  case -1:
+			e->index->remove(e);	// Gone!
+			++i;
+			continue;
+		  case 1:
+			if(!e->valid)
+			{
+				++i;
+				continue;
+			}
+			if(e->best.score != score)
+			{
+				// Moved; sort the rest and try again.
+				qsort(ents + i, n - i, sizeof(s_hsentry_t *),
+						s_hsentry_cmp);
+				continue;
+			}
+			break;
+		}
+		high_tbl[highs] = e->best;
 		high_tbl[highs].profile = NULL;
 		++highs;
+		++i;
 	}
+	free(ents);
+
+	for(idx = indexes; idx; idx = idx->next)
+		if(idx->gathered && idx->dirty)
+			idx->save();
 
 	if(placeholders)
 	{
 		//Throw some nice looking names in, if there's room. ;-)
-		int i = 0;
+		i = 0;
 		while(highs < MAX_HIGHSCORES)
 		{
 			if(!sc[i])
@@ -35,6 +35,9 @@
 
 #define	PROFILE_VERSION		1
 
+// Max # of JRNL chunks before a profile is rewritten
+#define	PROFILE_JOURNAL_MAX	32
+
 //DO NOT CHANGE! (Will break the file format.)
 #define	SCORE_NAME_LEN		64
 
@@ -99,6 +102,23 @@
 //		Sint32	loads;
 //		Sint32	gametype;
 //
+//	JRNL:	//Journal entry; appended to the file on updates
+//		Uint32	best_score;
+//		Sint32	last_scene;
+//		Sint32	skill;
+//		Sint32	handicap;
+//		Sint32	color1;
+//		Sint32	color2;
+//		Sint32	slot;		//Hiscore updated, or -1
+//		(Hiscore data, as HISC; only if slot >= 0)
+//		Uint32	checksum;	//FNV-1a of the above, as stored
+//
+//	JRNL chunks override the header and the PROF chunk, and
+//	replace or add HISC entries, in file order. A chunk that
+//	fails the checksum ends the file. Whenever the journal
+//	gets long, or the file has a broken tail, the profile is
+//	rewritten without a journal.
+//
 
 struct s_profile_t;
 
@@ -155,17 +175,115 @@ struct s_profile_t
 	// The fields below this line are not saved to file.
 	unsigned int	hiscores;	//# of hiscores stored
 	char		*filename;
+	int		journal;	//# of JRNL chunks in the file
+	int		appendable;	//File is intact and up to date
 
 	s_profile_t();
 	~s_profile_t();
 	void clear();			//Reset and clear all fields.
 	int load(const char *fn);	//Load from file 'fn'.
 	int save();			//Save back to file.
+	int append(int slot = -1);	//Append header and hiscore
+					//'slot' to the file.
 
 	s_hiscore_t *best_hiscore();
 };
 
 
+/*----------------------------------------------------------
+	s_hsindex_t - High score index
+----------------------------------------------------------*/
+// One index file per score directory, holding the best
+// hiscore of each profile file found there, so that the
+// high score table can be built without loading every
+// profile. The index is rebuilt incrementally; only files
+// that are new since the last scan (directory mtime
+// changed), or that end up in the table and have changed
+// since they were indexed, are actually loaded.
+//
+// As mtimes only have a resolution of one second, the
+// directory is scanned again whenever its mtime is not
+// older than the previous scan, like the directory
+// snapshots of filemapper_t. Renaming a new index into
+// place changes the directory mtime as well, but if
+// nothing else has changed since the scan, the new mtime
+// is taken as is.
+//
+// File format:
+//	* 72 zero bytes, like the header of an XKobo score
+//	  file, followed by chunks. Older versions loading
+//	  this as a profile will find no "HISC" chunks, and
+//	  thus no hiscores.
+//
+//	* The index is written to "<name>.new", which is then
+//	  renamed over the old index.
+//
+// Version 1 chunks:
+//
+//	HIDX:	//Index header
+//		Uint32	version;
+//		Uint32	dir_mtime;	//Directory mtime as indexed
+//		Uint32	count;		//# of HENT chunks
+//		Uint32	scan_time;	//Time of the scan (optional)
+//		Uint32	fresh;		//1 if the directory had not
+//					//changed since the scan when
+//					//saved (optional)
+//
+//	HENT:	//Index entry (one per profile file)
+//		Uint32	namelen;
+//		char	file[namelen];	//File name; no path, no null
+//		Uint32	mtime;		//File mtime as indexed
+//		Uint32	size;		//File size as indexed
+//		Sint32	valid;		//0 if the profile has no hiscores
+//		char	name[64];	//Player name
+//		(Best hiscore of the profile; as HISC)
+//
+#define	HISCORE_INDEX_NAME	"hiscores.idx"
+#define	HISCORE_INDEX_VERSION	1
+#define	HSINDEX_BUCKETS		256
+
+struct s_hsindex_t;
+
+struct s_hsentry_t
+{
+	s_hsentry_t	*next;		//Next in hash bucket
+	s_hsindex_t	*index;		//Index this entry belongs to
+	char		*file;		//File name, without path
+	unsigned int	mtime;
+	unsigned int	size;
+	int		valid;		//0 if the profile has no hiscores
+	int		seen;		//(Used by rescan())
+	s_hiscore_t	best;		//Best hiscore, with player name
+};
+
+struct s_hsindex_t
+{
+	s_hsindex_t	*next;
+	char		*dir;		//Score directory (system format)
+	unsigned int	dir_mtime;	//Directory mtime as indexed
+	unsigned int	scan_time;	//Time of the last scan
+	unsigned int	idx_mtime;	//Index file mtime as loaded/saved
+	int		dirty;		//Changed since last saved
+	int		gathered;	//(Used by gather_high_scores())
+	int		count;		//# of entries
+	s_hsentry_t	*table[HSINDEX_BUCKETS];
+
+	s_hsindex_t(const char *path);
+	~s_hsindex_t();
+	void clear();
+	void path(char *buf, int size, const char *file);
+	s_hsentry_t *find(const char *file);
+	s_hsentry_t *add(const char *file);
+	void remove(s_hsentry_t *e);
+	void set(s_hsentry_t *e, s_profile_t *p,
+			unsigned int mtime, unsigned int size);
+	int refresh(s_hsentry_t *e, s_profile_t *p);
+	void rescan(s_profile_t *p, unsigned int mtime);
+	int load();
+	int save();
+};
+
+
 /*----------------------------------------------------------
 	score_manager_t
 ----------------------------------------------------------*/
@@ -174,6 +292,9 @@ class score_manager_t
 {
 	s_profile_t profiles[MAX_PROFILES];
 	unsigned int currentProfile;
+	s_hsindex_t *indexes;	//One per score directory
+	s_hsindex_t *get_index(const char *dir);
+	void update_index(s_profile_t *p);
   public:
 	unsigned int highs;
 	s_hiscore_t high_tbl[MAX_HIGHSCORES];
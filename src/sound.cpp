@@ -25,6 +25,8 @@
 #include "kobolog.h"
 #include "random.h"
 #include "audio.h"
+#include "a_agw.h"
+#include "eel.h"
 
 int KOBO_sound::sounds_loaded = 0;
 int KOBO_sound::music_loaded = 0;
@@ -40,6 +42,13 @@ int KOBO_sound::panscale = 65536 / 700;
 int KOBO_sound::firing = 0;
 int KOBO_sound::overheat = 0;
 unsigned KOBO_sound::rumble = 0;
+KOBO_sound::pending_t KOBO_sound::pending[SOUND_MAX_PENDING];
+int KOBO_sound::npending = 0;
+int KOBO_sound::stat_triggers = 0;
+int KOBO_sound::stat_culled = 0;
+int KOBO_sound::stat_merged = 0;
+int KOBO_sound::stat_voices = 0;
+int KOBO_sound::stat_commands = 0;
 
 
 KOBO_sound::KOBO_sound()
@@ -62,6 +71,7 @@ int KOBO_sound::load(int (*prog)(const char *msg), int force)
 {
 	int res;
 	int save_to_disk = 0;
+	int wave_cache = 0;
 	const char *ap = fmap->get("SFX>>", FM_DIR);
 	if(!ap)
 	{
@@ -69,13 +79,44 @@ int KOBO_sound::load(int (*prog)(const char *msg), int force)
 		return -1;
 	}
 	audio_set_path(ap);
+	if(prefs->cmd_eelprofile)
+		eel_profile(1);
+
+	/*
+	 * Per-wave render cache. Only waves whose scripts have
+	 * changed are rendered. If we can't find a place for the
+	 * cache file, we fall back to the old *_c.agw files.
+	 * Scripts that still need to run are restored from the
+	 * compiled script cache, if unchanged.
+	 */
+	if(prefs->cached_sounds)
+	{
+		const char *cp = fmap->get("CONFIG>>" KOBO_SFXCACHEFILE,
+				FM_FILE_CREATE);
+		if(cp && (agw_cache_open(cp, force) >= 0))
+			wave_cache = 1;
+		cp = fmap->get("CONFIG>>" KOBO_EELCACHEFILE, FM_FILE_CREATE);
+		if(cp)
+			eel_cache_open(cp, force);
+	}
+
+	/*
+	 * Render the waves loaded by sfx.agw and music.agw on one
+	 * worker thread per CPU.
+	 */
+	agw_batch_begin(-1);
 
 	if(!sounds_loaded || force)
 	{
 		if(prog("Loading sound effects"))
+		{
+			agw_batch_end();
+			agw_cache_close();
+			eel_cache_close();
 			return -999;
+		}
 		res = -1;
-		if(prefs->cached_sounds && !force)
+		if(prefs->cached_sounds && !force && !wave_cache)
 		{
 			res = audio_wave_load(0, "sfx_c.agw", 0);
 			if(res < 0)
@@ -93,9 +134,14 @@ int KOBO_sound::load(int (*prog)(const char *msg), int force)
 	if(prefs->use_music && !music_loaded || force)
 	{
 		if(prog("Loading music"))
+		{
+			agw_batch_end();
+			agw_cache_close();
+			eel_cache_close();
 			return -999;
+		}
 		res = -1;
-		if(prefs->cached_sounds && !force)
+		if(prefs->cached_sounds && !force && !wave_cache)
 		{
 			res = audio_wave_load(0, "music_c.agw", 0);
 			if(res < 0)
@@ -110,6 +156,11 @@ int KOBO_sound::load(int (*prog)(const char *msg), int force)
 		prog(NULL);
 	}
 
+	agw_batch_end();
+	if(wave_cache)
+		agw_cache_close();
+	eel_cache_close();
+
 	if(save_to_disk)
 		if(prog("Preparing audio engine"))
 			return -999;
@@ -124,6 +175,9 @@ int KOBO_sound::load(int (*prog)(const char *msg), int force)
 			log_printf(ELOG, "Could not save sounds to disk!\n");
 	}
 
+	if(prefs->compact_sounds)
+		audio_wave_compress(-1);
+
 	audio_wave_info(-1);
 
 	return prog(NULL);
@@ -144,6 +198,7 @@ void KOBO_sound::prefschange()
 			(float)prefs->music_vol/100.0);
 	set_boost(prefs->vol_boost);
 	audio_quality((audio_quality_t)prefs->mixquality);
+	audio_adaptive_quality(prefs->autoquality);
 
 	// Bus 7: Our "Master Reverb Bus"
 	master_reverb((float)prefs->reverb/100.0);
@@ -158,6 +213,7 @@ int KOBO_sound::open()
 		return 0;
 	}
 
+	audio_float_mix(prefs->floatmix);
 	if(audio_start(prefs->samplerate, prefs->latency, prefs->use_oss, prefs->cmd_midi,
 			prefs->cmd_pollaudio) < 0)
 	{
@@ -166,6 +222,21 @@ int KOBO_sound::open()
 		return -1;
 	}
 
+	if(prefs->cmd_audioprofile)
+		audio_profile(1);
+
+	setup();
+
+	if(prefs->audiorecord[0])
+		audio_record(prefs->audiorecord);
+
+	time = SDL_GetTicks();
+	return 0;
+}
+
+
+void KOBO_sound::setup()
+{
 	// Channel grouping. We use only one chanel per group here, so we
 	// just assign the first channels to the available groups.
 	for(int i = 0; i < AUDIO_MAX_GROUPS; ++i)
@@ -198,20 +269,54 @@ int KOBO_sound::open()
 	audio_bus_controlf(1, 0, ABC_SEND_BUS_7, 0.1);
 
 	prefschange();
+}
 
-	time = SDL_GetTicks();
+
+static int render_progress(const char *msg)
+{
+	if(msg)
+		log_printf(VLOG, "%s...\n", msg);
 	return 0;
 }
 
 
+int KOBO_sound::render(const char *script, const char *wavfile)
+{
+	int res;
+	audio_float_mix(prefs->floatmix);
+	if(audio_start_offline(prefs->samplerate) < 0)
+	{
+		log_printf(ELOG, "Couldn't initialize audio engine"
+				" for offline rendering!\n");
+		return -1;
+	}
+	setup();
+	res = load(render_progress, 0);
+	if(res >= 0)
+		res = audio_render_script(script, wavfile, 2000);
+	close();
+	return res;
+}
+
+
 void KOBO_sound::stop()
 {
+	npending = 0;
 	audio_stop();
 }
 
 
 void KOBO_sound::close()
 {
+	npending = 0;
+	audio_record(NULL);
+	if(stat_triggers)
+		log_printf(DLOG, "In-game sfx: %d triggers, %d culled, "
+				"%d merged; %d voices, %d commands\n",
+				stat_triggers, stat_culled, stat_merged,
+				stat_voices, stat_commands);
+	stat_triggers = stat_culled = stat_merged = 0;
+	stat_voices = stat_commands = 0;
 	audio_close();
 	sounds_loaded = 0;
 	music_loaded = 0;
@@ -300,6 +405,9 @@ void KOBO_sound::frame()
 	else if (aaa == 20)
 		g_play(SOUND_OVERHEAT, listener_x - 128, listener_y, 32768, 67<<16);
 #endif
+	// Sounds from the last frame still belong before the bump
+	flush2d();
+
 	// Advance to next game logic frame
 	int nc = audio_next_callback();
 	if(time < nc)
@@ -316,6 +424,7 @@ void KOBO_sound::frame()
 
 void KOBO_sound::run()
 {
+	flush2d();
 	audio_run();
 }
 
@@ -361,9 +470,78 @@ void KOBO_sound::g_scale(int maxrange, int pan_maxrange)
 }
 
 
+void KOBO_sound::queue2d(int wid, int pitch, int vol, int volume, int pan)
+{
+	int i;
+	int level = (vol >> 4) * (volume >> 4) >> 8;
+	if(level < SOUND_CULL_LEVEL)
+	{
+		++stat_culled;
+		return;
+	}
+
+	for(i = 0; i < npending; ++i)
+	{
+		pending_t *p = &pending[i];
+		if((p->wid != wid) || (p->pitch != pitch) ||
+				(abs(p->pan - pan) > SOUND_MERGE_PAN))
+			continue;
+
+		/*
+		 * Same wave and pitch from about the same place, in
+		 * the same frame: Merge into one voice. Pan is
+		 * weighted by level, and the level is approximated
+		 * as max + min / 2, so that multiple triggers sound
+		 * louder, without blowing up. Stereo pairs and
+		 * detuned pairs are played as they are.
+		 */
+		p->pan = (int)(((float)p->pan * p->level + (float)pan * level) /
+				(p->level + level));
+		if(level > p->level)
+			p->level = level + (p->level >> 1);
+		else
+			p->level += level >> 1;
+		if(p->level > SOUND_MAX_LEVEL)
+			p->level = SOUND_MAX_LEVEL;
+		p->vol = p->level;
+		p->volume = 65536;
+		++stat_merged;
+		return;
+	}
+
+	if(npending >= SOUND_MAX_PENDING)
+		flush2d();
+
+	pending_t *p = &pending[npending++];
+	p->wid = wid;
+	p->pitch = pitch;
+	p->vol = vol;
+	p->volume = volume;
+	p->pan = pan;
+	p->level = level;
+}
+
+
+void KOBO_sound::flush2d()
+{
+	for(int i = 0; i < npending; ++i)
+	{
+		pending_t *p = &pending[i];
+		if(audio_channel_play2d(SOUND_GROUP_SFX, sfx2d_tag, p->wid,
+				p->pitch, p->vol, p->pan, p->volume) >= 0)
+			++stat_commands;
+		sfx2d_tag = (sfx2d_tag + 1) & 0xffff;
+	}
+	stat_voices += npending;
+	npending = 0;
+}
+
+
 void KOBO_sound::g_play(int wid, int x, int y, int vol, int pitch)
 {
 	int volume, vx, vy, pan;
+	++stat_triggers;
+
 	/* Calculate volume */
 	x -= listener_x;
 	y -= listener_y;
@@ -388,7 +566,10 @@ void KOBO_sound::g_play(int wid, int x, int y, int vol, int pitch)
 	vx = abs(x * scale);
 	vy = abs(y * scale);
 	if((vx | vy) & 0xffff0000)
+	{
+		++stat_culled;
 		return;
+	}
 
 	vx = (65536 - vx) >> 1;
 	vy = (65536 - vy) >> 1;
@@ -401,21 +582,14 @@ void KOBO_sound::g_play(int wid, int x, int y, int vol, int pitch)
 	else if(pan > 65536)
 		pan = 65536;
 
-	audio_channel_control(SOUND_GROUP_SFX, AVT_FUTURE, ACC_PATCH, wid);
-	audio_channel_control(SOUND_GROUP_SFX, AVT_FUTURE, ACC_PAN, pan);
-	audio_channel_control(SOUND_GROUP_SFX, AVT_FUTURE, ACC_VOLUME, volume);
-	audio_channel_play(SOUND_GROUP_SFX, sfx2d_tag, pitch, vol);
-	sfx2d_tag = (sfx2d_tag + 1) & 0xffff;
+	queue2d(wid, pitch, vol, volume, pan);
 }
 
 
 void KOBO_sound::g_play0(int wid, int vol, int pitch)
 {
-	audio_channel_control(SOUND_GROUP_SFX, AVT_FUTURE, ACC_PATCH, wid);
-	audio_channel_control(SOUND_GROUP_SFX, AVT_FUTURE, ACC_PAN, 0);
-	audio_channel_control(SOUND_GROUP_SFX, AVT_FUTURE, ACC_VOLUME, 65536);
-	audio_channel_play(SOUND_GROUP_SFX, sfx2d_tag, 60<<16, vol);
-	sfx2d_tag = (sfx2d_tag + 1) & 0xffff;
+	++stat_triggers;
+	queue2d(wid, 60<<16, vol, 65536, 0);
 }
 
 
@@ -30,6 +30,18 @@
 #define	SOUND_GROUP_UIMUSIC	2
 #define	SOUND_GROUP_BGMUSIC	3
 
+/* Max number of different waves triggered in one logic frame */
+#define	SOUND_MAX_PENDING	32
+
+/* In-game sounds weaker than this (16:16) are not played at all */
+#define	SOUND_CULL_LEVEL	64
+
+/* Max pan difference (16:16) of in-game sounds that may be merged */
+#define	SOUND_MERGE_PAN		8192
+
+/* Upper limit for the level of merged in-game sounds (16:16) */
+#define	SOUND_MAX_LEVEL		131072
+
 
 class KOBO_sound
 {
@@ -50,6 +62,35 @@ class KOBO_sound
 	static int	overheat;
 	static unsigned	rumble;
 
+	/*
+	 * In-game sounds triggered during a logic frame. Triggers of
+	 * the same wave at the same pitch, and with similar pan, are
+	 * merged into a single, louder voice.
+	 */
+	struct pending_t
+	{
+		int	wid;
+		int	pitch;
+		int	vol;		/* Velocity */
+		int	volume;		/* Distance attenuation */
+		int	pan;
+		int	level;		/* Effective level; vol * volume */
+	};
+	static pending_t	pending[SOUND_MAX_PENDING];
+	static int		npending;
+
+	/* Statistics */
+	static int	stat_triggers;
+	static int	stat_culled;
+	static int	stat_merged;
+	static int	stat_voices;
+	static int	stat_commands;
+
+	static void setup();
+
+	static void queue2d(int wid, int pitch, int vol, int volume, int pan);
+	static void flush2d();
+
   public:
 	KOBO_sound();
 	~KOBO_sound();
@@ -63,6 +104,10 @@ class KOBO_sound
 	static void stop();
 	static void close();
 
+	// Render command list 'script' to 'wavfile', without
+	// an output device. Returns 0 on success.
+	static int render(const char *script, const char *wavfile);
+
 	/*--------------------------------------------------
 		Main controls
 	--------------------------------------------------*/
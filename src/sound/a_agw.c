@@ -22,13 +22,22 @@
 #define	DBG(x)
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "kobolog.h"
 #include "config.h"
+#ifdef WIN32
+#	include <windows.h>
+#else
+#	include <unistd.h>
+#endif
+#include "SDL_thread.h"
 #include "eel.h"
 #include "a_types.h"
 #include "a_wca.h"
 #include "a_control.h"
+#include "a_agw.h"
 
 
 /* Enum class handles */
@@ -39,6 +48,666 @@ static int enum_amixmode, enum_aresample;
 static int enum_pparam, enum_pdriver;
 
 
+/*----------------------------------------------------------
+	Render cache
+------------------------------------------------------------
+ * Every agw_load() is treated as a separate rendering job.
+ * A job that does nothing but render its own target wave
+ * (and set patch parameters) can be cached. Anything else,
+ * like w_load, w_save or touching other waves, makes the
+ * job uncacheable - though the scripts it loads may still
+ * be cached individually.
+ *
+ * Cache entries are keyed by script name, and validated by
+ * a hash of the script, all files it #includes, the target
+ * wave id and AGW_CACHE_VERSION. Bump the latter whenever
+ * a change to the engine changes the rendered output!
+ *
+ * The cache file is a native endian dump, and is simply
+ * rebuilt if it was written on a different platform.
+ * Wave data, including the end extension, is page aligned,
+ * so audio_wave_map() can map restored waves straight from
+ * the file. The file is only ever replaced, never rewritten
+ * in place, as other processes may have it mapped.
+ */
+#define	AGW_CACHE_VERSION	4
+#define	AGW_CACHE_ALIGN		4096
+#define	AGW_CACHE_MAGIC		0x43574741	/* "AGWC" on x86 */
+#define	AGW_CACHE_BYTEORDER	0x01020304
+#define	AGW_MAX_PARAMS		64
+#define	AGW_MAX_INCLUDE_DEPTH	8
+
+typedef enum
+{
+	AGWJ_INLINE = 0,	/* Run right away by the calling thread */
+	AGWJ_QUEUED,		/* Waiting for a worker */
+	AGWJ_RUNNING,		/* Being rendered by a worker */
+	AGWJ_DONE		/* Finished by a worker */
+} agw_jstates_t;
+
+struct agw_plog_t;
+
+typedef struct agw_job_t
+{
+	struct agw_job_t	*parent;
+	struct agw_job_t	*next;		/* Batch job list */
+	struct agw_job_t	*qnext;		/* Worker queue */
+	struct agw_plog_t	*plog;		/* Parameter placeholder */
+	char		*name;		/* Script (queued jobs only) */
+	Uint32		hash;
+	int		hashed;		/* 'hash' is valid */
+	int		target;
+	int		cacheable;
+	int		worker;		/* Rendered by a worker thread */
+	int		rerun;		/* Must run on the main thread */
+	int		state;		/* agw_jstates_t (batch_mutex) */
+	int		collected;	/* Taken care of by the main thread */
+	int		result;
+	int		nparams;
+	int		params[AGW_MAX_PARAMS * 3];	/* patch, param, value */
+} agw_job_t;
+
+typedef struct agw_centry_t
+{
+	struct agw_centry_t	*next;
+	char		*name;
+	Uint32		hash;
+	int		format, rate, looped;
+	int		nparams;
+	int		*params;
+	unsigned	size, xsize;
+	void		*data;		/* NULL if still in the file... */
+	long		offset;		/* ...at this position */
+} agw_centry_t;
+
+static WCA_TLS agw_job_t *agw_job = NULL;	/* Innermost running job */
+
+static char *cache_file = NULL;
+static FILE *cache_f = NULL;		/* Kept open for audio_wave_map() */
+static int cache_rebuild = 0;
+static int cache_dirty = 0;
+static agw_centry_t *cache_entries = NULL;
+
+static int cache_hits, cache_renders, cache_uncached;
+static Uint32 cache_start;
+
+
+/*----------------------------------------------------------
+	Parallel rendering
+------------------------------------------------------------
+ * Between agw_batch_begin() and agw_batch_end(), scripts
+ * loaded by other scripts are not run right away, but are
+ * queued as jobs for a pool of worker threads. Each worker
+ * has its own EEL state, and the WCA keeps its state in
+ * thread local variables. The loading script (sfx.agw,
+ * music.agw...) continues as soon as the job is queued.
+ *
+ * A job on a worker may only touch its own target wave. If
+ * it tries to do anything else, like w_load, w_convert or
+ * rendering into other waves, it is stopped, and run again
+ * on the main thread when it's collected. Operations on the
+ * main thread wait for any job rendering the wave they use.
+ *
+ * Patch parameters are logged while the batch is running,
+ * with a placeholder for the parameters of each job, and are
+ * applied in the original order when the batch ends.
+ */
+#ifdef WCA_REENTRANT
+#	define	AGW_PARALLEL
+#endif
+#define	AGW_MAX_WORKERS		16
+
+typedef struct agw_plog_t
+{
+	struct agw_plog_t	*next;
+	agw_job_t	*job;			/* Parameters of a job, or... */
+	int		patch, param, value;	/* ...a single parameter */
+} agw_plog_t;
+
+static int batch_active = 0;
+static int batch_workers = 0;
+static int batch_running = 0;
+static int batch_queued, batch_reruns;
+static SDL_Thread *batch_threads[AGW_MAX_WORKERS];
+static eel_state_t *batch_states[AGW_MAX_WORKERS];
+static SDL_mutex *batch_mutex = NULL;
+static SDL_cond *batch_wake = NULL;	/* Job queued, or stopping */
+static SDL_cond *batch_done = NULL;	/* Job finished */
+static agw_job_t *batch_jobs = NULL;	/* All jobs, in queue order */
+static agw_job_t **batch_jobs_end = &batch_jobs;
+static agw_job_t *batch_queue = NULL;	/* Jobs waiting for workers */
+static agw_job_t **batch_queue_end = &batch_queue;
+static agw_plog_t *plog = NULL;
+static agw_plog_t **plog_at = &plog;	/* Where to log the next entry */
+
+static void agw_wait(int wid);
+
+
+static inline int agw_on_worker(void)
+{
+	return agw_job && agw_job->worker;
+}
+
+
+/*
+ * Check that the current job may touch wave 'wid'. The job is
+ * marked uncacheable if 'wid' is not its target, and on the
+ * main thread, we wait for any job still rendering 'wid'.
+ * (-1 means all waves.) Jobs on workers may only touch their
+ * target waves.
+ *
+ * Returns 0 if the operation can proceed, or -1 if it can not,
+ * in which case the operation should end the script.
+ */
+static int agw_touch(int wid)
+{
+	if(agw_on_worker())
+	{
+		if(wid == agw_job->target)
+			return 0;
+		agw_job->rerun = 1;
+		return -1;
+	}
+	if(agw_job && (wid != agw_job->target))
+		agw_job->cacheable = 0;
+	agw_wait(wid);
+	return 0;
+}
+
+
+/* As agw_touch(), for operations that only the main thread can do. */
+static int agw_main_only(int wid)
+{
+	if(agw_on_worker())
+	{
+		agw_job->rerun = 1;
+		return -1;
+	}
+	return agw_touch(wid);
+}
+
+
+/* As agw_main_only(), for operations that can never be cached. */
+static int agw_taint(int wid)
+{
+	if(agw_main_only(wid) < 0)
+		return -1;
+	if(agw_job)
+		agw_job->cacheable = 0;
+	return 0;
+}
+
+
+/* Set patch parameter; later if a batch is running. */
+static void agw_set_param(int patch, int param, int value)
+{
+	agw_plog_t *pl;
+	if(batch_active &&
+			(pl = (agw_plog_t *)calloc(1, sizeof(agw_plog_t))))
+	{
+		pl->patch = patch;
+		pl->param = param;
+		pl->value = value;
+		pl->next = *plog_at;
+		*plog_at = pl;
+		plog_at = &pl->next;
+	}
+	else
+		audio_patch_param(patch, param, value);
+}
+
+
+/*
+ * Set patch parameter, recording it for the cache. Jobs on
+ * workers only record parameters, so they are applied by the
+ * main thread. Returns -1 if the job must be run again on the
+ * main thread.
+ */
+static int agw_patch_param(int patch, int param, int value)
+{
+	if(!agw_on_worker())
+		agw_set_param(patch, param, value);
+	if(!agw_job)
+		return 0;
+	if(agw_job->nparams >= AGW_MAX_PARAMS)
+	{
+		agw_job->cacheable = 0;
+		if(!agw_job->worker)
+			return 0;
+		agw_job->rerun = 1;
+		return -1;
+	}
+	agw_job->params[agw_job->nparams * 3] = patch;
+	agw_job->params[agw_job->nparams * 3 + 1] = param;
+	agw_job->params[agw_job->nparams * 3 + 2] = value;
+	++agw_job->nparams;
+	return 0;
+}
+
+
+static Uint32 agw_hash_bytes(Uint32 h, const void *data, unsigned len)
+{
+	const unsigned char *p = (const unsigned char *)data;
+	while(len--)
+	{
+		h ^= *p++;
+		h *= 16777619;
+	}
+	return h;
+}
+
+
+/*
+ * Hash script 'name' and, recursively, any files it
+ * #includes. Returns a negative value if any of the
+ * files cannot be read.
+ */
+static int agw_hash_script(const char *name, Uint32 *h, int depth)
+{
+	char path[1024];
+	FILE *f;
+	long len;
+	char *buf, *p;
+	int res = 0;
+
+	if(depth > AGW_MAX_INCLUDE_DEPTH)
+		return -1;
+
+	if(strlen(eel_path()) + strlen(name) + 2 > sizeof(path))
+		return -1;
+	strcpy(path, eel_path());
+#ifdef WIN32
+	strcat(path, "\\");
+#elif defined MACOS
+	strcat(path, ":");
+#else
+	strcat(path, "/");
+#endif
+	strcat(path, name);
+
+	f = fopen(path, "rb");
+	if(!f)
+		return -1;
+	if(fseek(f, 0, SEEK_END) != 0 || (len = ftell(f)) < 0 ||
+			fseek(f, 0, SEEK_SET) != 0)
+	{
+		fclose(f);
+		return -1;
+	}
+	buf = (char *)malloc(len + 1);
+	if(!buf)
+	{
+		fclose(f);
+		return -1;
+	}
+	if(len && (fread(buf, len, 1, f) != 1))
+	{
+		fclose(f);
+		free(buf);
+		return -1;
+	}
+	fclose(f);
+	buf[len] = 0;
+
+	*h = agw_hash_bytes(*h, name, strlen(name) + 1);
+	*h = agw_hash_bytes(*h, buf, (unsigned)len);
+
+	/* Follow '#include "file"' directives */
+	for(p = buf; p && (res >= 0); p = strchr(p, '\n'))
+	{
+		char *fn, *end;
+		while(*p == '\n' || *p == '\r' || *p == ' ' || *p == '\t')
+			++p;
+		if(strncmp(p, "#include", 8) != 0)
+			continue;
+		fn = strchr(p, '"');
+		end = fn ? strchr(fn + 1, '"') : NULL;
+		if(!end || memchr(fn, '\n', end - fn))
+			continue;
+		*end = 0;
+		res = agw_hash_script(fn + 1, h, depth + 1);
+		p = end + 1;
+	}
+
+	free(buf);
+	return res;
+}
+
+
+static agw_centry_t *agw_cache_find(const char *name)
+{
+	agw_centry_t *ce;
+	for(ce = cache_entries; ce; ce = ce->next)
+		if(strcmp(ce->name, name) == 0)
+			return ce;
+	return NULL;
+}
+
+
+static void agw_cache_free_entry(agw_centry_t *ce)
+{
+	free(ce->name);
+	free(ce->params);
+	free(ce->data);
+	free(ce);
+}
+
+
+/* Try to restore wave 'wid' from the cache. */
+static int agw_cache_restore(int wid, const char *name, Uint32 hash)
+{
+	int i;
+	agw_centry_t *ce = agw_cache_find(name);
+	if(!ce || (ce->hash != hash))
+		return -1;
+
+	if(audio_wave_format(wid, ce->format, ce->rate) < 0)
+		return -1;
+	if(ce->data)
+	{
+		if(audio_wave_load_mem(wid, ce->data, ce->size,
+				ce->looped) < 0)
+			return -1;
+	}
+	else if(audio_wave_map(wid, cache_f, ce->offset, ce->size,
+			ce->xsize, ce->looped) < 0)
+		return -1;
+	for(i = 0; i < ce->nparams; ++i)
+		agw_set_param(ce->params[i * 3], ce->params[i * 3 + 1],
+				ce->params[i * 3 + 2]);
+	return 0;
+}
+
+
+/* Add or replace the cache entry for script 'name'. */
+static void agw_cache_store(agw_job_t *job, const char *name, Uint32 hash)
+{
+	agw_centry_t *ce, **cep;
+	audio_wave_t *w = audio_wave_get(job->target);
+	if(!w || !w->data.si8 || (AF_MIDI == w->format))
+		return;
+
+	ce = (agw_centry_t *)calloc(1, sizeof(agw_centry_t));
+	if(!ce)
+		return;
+	ce->name = strdup(name);
+	ce->params = (int *)malloc(sizeof(int) * 3 * (job->nparams + 1));
+	ce->data = malloc(w->size + w->xsize + 1);
+	if(!ce->name || !ce->params || !ce->data)
+	{
+		agw_cache_free_entry(ce);
+		return;
+	}
+	ce->hash = hash;
+	ce->format = w->format;
+	ce->rate = w->rate;
+	ce->looped = w->looped;
+	ce->nparams = job->nparams;
+	memcpy(ce->params, job->params, sizeof(int) * 3 * job->nparams);
+	ce->size = w->size;
+	ce->xsize = w->xsize;
+	memcpy(ce->data, w->data.si8, w->size + w->xsize);
+
+	/* Replace any old entry */
+	for(cep = &cache_entries; *cep; cep = &(*cep)->next)
+		if(strcmp((*cep)->name, name) == 0)
+		{
+			agw_centry_t *old = *cep;
+			*cep = old->next;
+			agw_cache_free_entry(old);
+			break;
+		}
+	ce->next = cache_entries;
+	cache_entries = ce;
+	cache_dirty = 1;
+}
+
+
+static int agw_read32(FILE *f, Uint32 *v)
+{
+	return fread(v, sizeof(Uint32), 1, f) == 1 ? 0 : -1;
+}
+
+
+static long agw_align(long pos)
+{
+	return (pos + AGW_CACHE_ALIGN - 1) & ~(long)(AGW_CACHE_ALIGN - 1);
+}
+
+
+/*
+ * Read an entry header. The wave data is left in the file, and is
+ * only skipped, after checking that it's all there.
+ */
+static int agw_read_entry(FILE *f, long filesize)
+{
+	Uint32 v[8];
+	agw_centry_t *ce;
+	int i;
+	for(i = 0; i < 8; ++i)
+		if(agw_read32(f, v + i) < 0)
+			return -1;
+	/* namelen, hash, format, rate, looped, nparams, size, xsize */
+	if((v[0] > 1024) || (v[5] > AGW_MAX_PARAMS))
+		return -1;
+	ce = (agw_centry_t *)calloc(1, sizeof(agw_centry_t));
+	if(!ce)
+		return -1;
+	ce->name = (char *)malloc(v[0] + 1);
+	ce->params = (int *)malloc(sizeof(int) * 3 * (v[5] + 1));
+	if(!ce->name || !ce->params ||
+			(fread(ce->name, v[0], 1, f) != 1) ||
+			(v[5] && (fread(ce->params, sizeof(int) * 3 * v[5],
+					1, f) != 1)))
+	{
+		agw_cache_free_entry(ce);
+		return -1;
+	}
+	ce->offset = agw_align(ftell(f));
+	if((ce->offset + (long)v[6] + (long)v[7] > filesize) ||
+			(fseek(f, ce->offset + v[6] + v[7], SEEK_SET) != 0))
+	{
+		agw_cache_free_entry(ce);
+		return -1;
+	}
+	ce->name[v[0]] = 0;
+	ce->hash = v[1];
+	ce->format = (int)v[2];
+	ce->rate = (int)v[3];
+	ce->looped = (int)v[4];
+	ce->nparams = (int)v[5];
+	ce->size = v[6];
+	ce->xsize = v[7];
+	ce->next = cache_entries;
+	cache_entries = ce;
+	return 0;
+}
+
+
+/* Pull the data of entry 'ce' into memory, if it's still in the file. */
+static int agw_load_data(agw_centry_t *ce)
+{
+	unsigned n = ce->size + ce->xsize;
+	if(ce->data)
+		return 0;
+	ce->data = malloc(n + 1);
+	if(!ce->data)
+		return -1;
+	if((fseek(cache_f, ce->offset, SEEK_SET) != 0) ||
+			(n && (fread(ce->data, n, 1, cache_f) != 1)))
+	{
+		free(ce->data);
+		ce->data = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+
+static int agw_write_entry(FILE *f, agw_centry_t *ce)
+{
+	static const char zeros[AGW_CACHE_ALIGN];
+	Uint32 v[8];
+	long pad;
+	v[0] = strlen(ce->name);
+	v[1] = ce->hash;
+	v[2] = (Uint32)ce->format;
+	v[3] = (Uint32)ce->rate;
+	v[4] = (Uint32)ce->looped;
+	v[5] = (Uint32)ce->nparams;
+	v[6] = ce->size;
+	v[7] = ce->xsize;
+	if(fwrite(v, sizeof(v), 1, f) != 1)
+		return -1;
+	if(fwrite(ce->name, v[0], 1, f) != 1)
+		return -1;
+	if(ce->nparams && (fwrite(ce->params,
+			sizeof(int) * 3 * ce->nparams, 1, f) != 1))
+		return -1;
+	pad = agw_align(ftell(f)) - ftell(f);
+	if(pad && (fwrite(zeros, pad, 1, f) != 1))
+		return -1;
+	if((ce->size + ce->xsize) && (fwrite(ce->data,
+			ce->size + ce->xsize, 1, f) != 1))
+		return -1;
+	return 0;
+}
+
+
+int agw_cache_open(const char *path, int rebuild)
+{
+	FILE *f;
+	Uint32 hdr[4];
+	long filesize;
+
+	agw_cache_close();
+
+	cache_file = strdup(path);
+	if(!cache_file)
+		return -1;
+	cache_rebuild = rebuild;
+	cache_dirty = rebuild;
+	cache_hits = cache_renders = cache_uncached = 0;
+	cache_start = SDL_GetTicks();
+
+	f = fopen(path, "rb");
+	if(!f)
+		return 0;
+	if((fseek(f, 0, SEEK_END) == 0) && ((filesize = ftell(f)) >= 0) &&
+			(fseek(f, 0, SEEK_SET) == 0) &&
+			(fread(hdr, sizeof(hdr), 1, f) == 1) &&
+			(AGW_CACHE_MAGIC == hdr[0]) &&
+			(AGW_CACHE_BYTEORDER == hdr[1]) &&
+			(AGW_CACHE_VERSION == hdr[2]))
+	{
+		Uint32 i;
+		for(i = 0; i < hdr[3]; ++i)
+			if(agw_read_entry(f, filesize) < 0)
+			{
+				log_printf(WLOG, "AGW cache \"%s\" is"
+						" truncated!\n", path);
+				cache_dirty = 1;
+				break;
+			}
+	}
+	else
+	{
+		log_printf(DLOG, "AGW cache \"%s\" is empty, outdated or"
+				" from another platform; rebuilding.\n", path);
+		cache_dirty = 1;
+	}
+	cache_f = f;
+	return 0;
+}
+
+
+void agw_cache_close(void)
+{
+	if(!cache_file)
+		return;
+
+	log_printf(DLOG, "AGW cache: %d waves from cache, %d rendered,"
+			" %d uncached scripts; %d ms\n",
+			cache_hits, cache_renders, cache_uncached,
+			(int)(SDL_GetTicks() - cache_start));
+
+	/*
+	 * Pull in any data still in the old file, and write the new
+	 * one next to it. Renaming it into place leaves the old file
+	 * intact for any processes that still have waves mapped.
+	 */
+	if(cache_dirty)
+	{
+		agw_centry_t *ce;
+		FILE *f = NULL;
+		char *tmp = (char *)malloc(strlen(cache_file) + 5);
+		for(ce = cache_entries; ce; ce = ce->next)
+			if(agw_load_data(ce) < 0)
+				break;
+		if(tmp && !ce)
+		{
+			strcpy(tmp, cache_file);
+			strcat(tmp, ".new");
+			f = fopen(tmp, "wb");
+		}
+		if(f)
+		{
+			Uint32 hdr[4];
+			int res = 0;
+			hdr[0] = AGW_CACHE_MAGIC;
+			hdr[1] = AGW_CACHE_BYTEORDER;
+			hdr[2] = AGW_CACHE_VERSION;
+			hdr[3] = 0;
+			for(ce = cache_entries; ce; ce = ce->next)
+				++hdr[3];
+			if(fwrite(hdr, sizeof(hdr), 1, f) != 1)
+				res = -1;
+			for(ce = cache_entries; ce && (res >= 0); ce = ce->next)
+				res = agw_write_entry(f, ce);
+			if(fclose(f) != 0)
+				res = -1;
+			if(cache_f)
+			{
+				fclose(cache_f);
+				cache_f = NULL;
+			}
+#ifdef WIN32
+			/* No atomic replace; nothing can be mapped here */
+			if(res >= 0)
+				remove(cache_file);
+#endif
+			if((res >= 0) && (rename(tmp, cache_file) != 0))
+				res = -1;
+			if(res < 0)
+			{
+				log_printf(ELOG, "Could not write AGW cache"
+						" \"%s\"!\n", cache_file);
+				remove(tmp);
+			}
+		}
+		else
+			log_printf(ELOG, "Could not create AGW cache"
+					" \"%s\"!\n", cache_file);
+		free(tmp);
+	}
+	if(cache_f)
+	{
+		fclose(cache_f);
+		cache_f = NULL;
+	}
+
+	while(cache_entries)
+	{
+		agw_centry_t *ce = cache_entries;
+		cache_entries = ce->next;
+		agw_cache_free_entry(ce);
+	}
+	free(cache_file);
+	cache_file = NULL;
+	cache_dirty = 0;
+}
+
+
 /*----------------------------------------------------------
 	AGW Command Callbacks
 ----------------------------------------------------------*/
@@ -73,6 +742,8 @@ static int op_w_format(int argc, struct eel_data_t *argv)
 		return -1;
 #endif
 	DBG(log_printf(D2LOG, "w_format %d, %d, %f;\n", target, format, fs);)
+	if(agw_touch(target) < 0)
+		return 0;
 	audio_wave_format(target, format, (int)fs);
 	return 1;
 }
@@ -84,6 +755,8 @@ static int op_w_gain(int argc, struct eel_data_t *argv)
 	if(eel_get_args("i", &target) != 1)
 		return -1;
 	DBG(log_printf(D2LOG, "w_gain %d;\n", target);)
+	if(agw_touch(target) < 0)
+		return 0;
 	wca_gain(target);
 	return 1;
 }
@@ -106,6 +779,9 @@ static int op_w_convert(int argc, struct eel_data_t *argv)
 		interpol = AR_BEST;
 	DBG(log_printf(D2LOG, "w_convert %d, %d, %d, %d, %d;\n", source, target,
 			format, (int)fs, interpol);)
+	/* The wave converter uses global engine state */
+	if((agw_main_only(source) < 0) || (agw_touch(target) < 0))
+		return 0;
 	audio_wave_convert(source, target, format, (int)fs, interpol);
 	return 1;
 }
@@ -118,6 +794,8 @@ static int op_w_enhance(int argc, struct eel_data_t *argv)
 	if(eel_get_args("irr", &target, &f, &level) != 3)
 		return -1;
 	DBG(log_printf(D2LOG, "w_enhance %d, %d, %f;\n", target, (int)f, level);)
+	if(agw_touch(target) < 0)
+		return 0;
 	wca_enhance(target, (int)f, level);
 	return 1;
 }
@@ -132,6 +810,8 @@ static int op_w_gate(int argc, struct eel_data_t *argv)
 		return -1;
 	DBG(log_printf(D2LOG, "w_gate %d, %d, %f, %f, %f;\n",
 			target, (int)f, min, thres, att);)
+	if(agw_touch(target) < 0)
+		return 0;
 	wca_gate(target, (int)f, min, thres, att);
 	return 1;
 }
@@ -147,6 +827,8 @@ static int op_w_blank(int argc, struct eel_data_t *argv)
 	if(argc < 3)
 		loop = 0;
 	DBG(log_printf(D2LOG, "w_blank %d, %d, %d;\n", target, samples, loop);)
+	if(agw_touch(target) < 0)
+		return 0;
 	audio_wave_blank(target, samples, loop);
 	return 1;
 }
@@ -162,6 +844,8 @@ static int op_w_load(int argc, struct eel_data_t *argv)
 	if(argc < 3)
 		loop = 0;
 	DBG(log_printf(D2LOG, "w_load %d, \"%s\", %d;\n", target, fn, loop);)
+	if(agw_taint(target) < 0)
+		return 0;
 	if(audio_wave_load(target, fn, loop) < 0)
 		return -1;
 	return 1;
@@ -175,6 +859,8 @@ static int op_w_save(int argc, struct eel_data_t *argv)
 	if(eel_get_args("is", &target, &fn) != 2)
 		return -1;
 	DBG(log_printf(D2LOG, "w_save %d, \"%s\";\n", target, fn);)
+	if(agw_taint(target) < 0)
+		return 0;
 	if(audio_wave_save(target, fn) < 0)
 		return -1;
 	return 1;
@@ -187,6 +873,8 @@ static int op_w_prepare(int argc, struct eel_data_t *argv)
 	if(eel_get_args("i", &target) < 1)
 		return -1;
 	DBG(log_printf(D2LOG, "w_prepare %d;\n", target);)
+	if(agw_taint(target) < 0)
+		return 0;
 	audio_wave_prepare(target);
 	return 1;
 }
@@ -269,6 +957,8 @@ static int op_w_osc(int argc, struct eel_data_t *argv)
 		return -1;
 	}
 	DBG(log_printf(D2LOG, "w_osc %d, %d, %d;\n", target, wf, mm);)
+	if(agw_touch(target) < 0)
+		return 0;
 	wca_osc(target, wf, mm);
 	return 1;
 }
@@ -281,6 +971,8 @@ static int op_w_filter(int argc, struct eel_data_t *argv)
 	if(eel_get_args("ie", &target, &ft) != 2)
 		return -1;
 	DBG(log_printf(D2LOG, "w_filter %d, %d;\n", target, ft);)
+	if(agw_touch(target) < 0)
+		return 0;
 	wca_filter(target, ft);
 	return 1;
 }
@@ -293,7 +985,7 @@ static int op_w_filter(int argc, struct eel_data_t *argv)
 
 static int op_p_param(int argc, struct eel_data_t *argv)
 {
-	int patch, param;
+	int patch, param, res;
 	double value;
 	param = enum_pparam;
 	if(eel_get_args("ier", &patch, &param, &value) != 3)
@@ -304,14 +996,14 @@ static int op_p_param(int argc, struct eel_data_t *argv)
 	  case APP_WAVE:
 	  case APP_ENV_SKIP:
 	  case APP_LFO_SHAPE:
-		audio_patch_param(patch, param, (int)value);
+		res = agw_patch_param(patch, param, (int)value);
 		break;
 	  default:
-		audio_patch_param(patch, param, (int)(value * 65536.0));
+		res = agw_patch_param(patch, param, (int)(value * 65536.0));
 		break;
 	}
 	DBG(log_printf(D2LOG, "p_param %d, %d, %f;\n", patch, param, value);)
-	return 1;
+	return res < 0 ? 0 : 1;
 }
 
 
@@ -480,6 +1172,8 @@ void agw_close(void)
 	if(!_agw_initialized)
 		return;
 
+	agw_batch_end();
+
 	eel_pop_scope();	/* end AGW extensions scope */
 
 	eel_close();
@@ -489,19 +1183,15 @@ void agw_close(void)
 
 #define	CHECKINIT	if(!_agw_initialized) agw_open();
 
-int agw_load(int wid, const char *name)
+
+/*
+ * Run script 'name' for 'job' in the calling thread, and prepare
+ * the resulting wave. Returns a negative value upon failure.
+ */
+static int agw_run(agw_job_t *job, const char *name)
 {
 	int script, res;
 
-	CHECKINIT
-
-	if(wid < 0)
-	{
-		wid = audio_wave_alloc(wid);
-		if(wid < 0)
-			return wid;
-	}
-
 	script = eel_load(name);
 	if(script < 0)
 		return -1;
@@ -509,20 +1199,358 @@ int agw_load(int wid, const char *name)
 	eel_push_scope();	/* begin script scope */
 
 	/* Initialize "argument" variables */
-	(void)eel_set_integer("target", wid);
+	(void)eel_set_integer("target", job->target);
 
 	/* Reset the waveform construction engine */
 	wca_reset();
 
+	job->parent = agw_job;
+	agw_job = job;
 	res = eel_run(script);
+	agw_job = job->parent;
 	eel_free(script);
 
 	eel_pop_scope();	/* end script scope */
 
 	if(res < 0)
 		return -1;
+	if(job->rerun)
+		return 0;
+
+	/* Prepare first, as the cache stores the end extension as well */
+	audio_wave_prepare(job->target);
+	return 0;
+}
+
+
+/* Cache and count a successfully rendered job. */
+static void agw_finish(agw_job_t *job, const char *name)
+{
+	if(!cache_file)
+		return;
+	if(job->cacheable)
+	{
+		agw_cache_store(job, name, job->hash);
+		++cache_renders;
+	}
+	else
+		++cache_uncached;
+}
+
+
+#ifdef AGW_PARALLEL
+static int agw_worker(void *data)
+{
+	eel_state_select((eel_state_t *)data);
+	SDL_LockMutex(batch_mutex);
+	while(1)
+	{
+		agw_job_t *job;
+		while(!batch_queue && batch_running)
+			SDL_CondWait(batch_wake, batch_mutex);
+		if(!batch_queue)
+			break;
+		job = batch_queue;
+		batch_queue = job->qnext;
+		if(!batch_queue)
+			batch_queue_end = &batch_queue;
+		job->state = AGWJ_RUNNING;
+		SDL_UnlockMutex(batch_mutex);
+
+		job->result = agw_run(job, job->name);
+
+		SDL_LockMutex(batch_mutex);
+		job->state = AGWJ_DONE;
+		SDL_CondBroadcast(batch_done);
+	}
+	SDL_UnlockMutex(batch_mutex);
+	eel_state_select(NULL);
+	return 0;
+}
+#endif
+
+
+/*
+ * Queue a copy of 'job' for the workers. Returns a negative value
+ * if that's not possible, in which case the job must be run inline.
+ */
+static int agw_queue(agw_job_t *job, const char *name)
+{
+	agw_job_t *j = (agw_job_t *)malloc(sizeof(agw_job_t));
+	agw_plog_t *pl = (agw_plog_t *)calloc(1, sizeof(agw_plog_t));
+	char *n = strdup(name);
+	if(!j || !pl || !n || (audio_wave_alloc(job->target) < 0))
+	{
+		free(j);
+		free(pl);
+		free(n);
+		return -1;
+	}
+	memcpy(j, job, sizeof(agw_job_t));
+	j->next = j->qnext = NULL;
+	j->name = n;
+	j->worker = 1;
+	j->state = AGWJ_QUEUED;
+
+	/* Parameter placeholder */
+	pl->job = j;
+	pl->next = *plog_at;
+	*plog_at = pl;
+	plog_at = &pl->next;
+	j->plog = pl;
+
+	*batch_jobs_end = j;
+	batch_jobs_end = &j->next;
+	++batch_queued;
+
+	SDL_LockMutex(batch_mutex);
+	*batch_queue_end = j;
+	batch_queue_end = &j->qnext;
+	SDL_CondSignal(batch_wake);
+	SDL_UnlockMutex(batch_mutex);
+	return 0;
+}
+
+
+/*
+ * Wait for 'job' to finish, and take care of the result. Jobs that
+ * couldn't be rendered by a worker are run again here, with any
+ * parameters they set logged in place of their placeholders.
+ */
+static void agw_collect(agw_job_t *job)
+{
+	SDL_LockMutex(batch_mutex);
+	while(AGWJ_DONE != job->state)
+		SDL_CondWait(batch_done, batch_mutex);
+	SDL_UnlockMutex(batch_mutex);
+	job->collected = 1;
+
+	if(job->rerun)
+	{
+		agw_plog_t **at = plog_at;
+		plog_at = &job->plog->next;
+		job->worker = 0;
+		job->rerun = 0;
+		job->nparams = 0;
+		job->cacheable = job->hashed;
+		job->result = agw_run(job, job->name);
+		if(at != &job->plog->next)
+			plog_at = at;
+		++batch_reruns;
+	}
+
+	if(job->result < 0)
+		log_printf(ELOG, "Could not render \"%s\"!\n", job->name);
+	else
+		agw_finish(job, job->name);
+}
+
+
+/* Wait for, and collect, any jobs rendering 'wid'; all jobs if -1. */
+static void agw_wait(int wid)
+{
+	agw_job_t *j;
+	if(!batch_active)
+		return;
+	for(j = batch_jobs; j; j = j->next)
+		if(!j->collected &&
+				((wid < 0) || (j->target == wid)))
+			agw_collect(j);
+}
+
+
+#ifdef AGW_PARALLEL
+static int agw_cpu_count(void)
+{
+#if defined(WIN32)
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	return (int)si.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? (int)n : 1;
+#else
+	return 1;
+#endif
+}
+#endif
+
+
+int agw_batch_begin(int workers)
+{
+#ifdef AGW_PARALLEL
+	int i;
+	CHECKINIT
+	if(batch_active)
+		return 0;
+	if(workers < 0)
+	{
+		workers = agw_cpu_count();
+		if(workers < 2)
+			workers = 0;
+	}
+	if(workers > AGW_MAX_WORKERS)
+		workers = AGW_MAX_WORKERS;
+	if(!workers)
+		return 0;
+
+	batch_mutex = SDL_CreateMutex();
+	batch_wake = SDL_CreateCond();
+	batch_done = SDL_CreateCond();
+	if(!batch_mutex || !batch_wake || !batch_done)
+	{
+		agw_batch_end();
+		return -1;
+	}
+	batch_running = 1;
+	batch_queued = batch_reruns = 0;
+	for(i = 0; i < workers; ++i)
+	{
+		eel_state_t *prev;
+		batch_states[i] = eel_state_new();
+		if(!batch_states[i])
+			break;
+		/*
+		 * Give the state its own "target" now, so the worker
+		 * never reads the shared one, which the main thread
+		 * keeps changing.
+		 */
+		prev = eel_state_select(batch_states[i]);
+		(void)eel_set_integer("target", -1);
+		eel_state_select(prev);
+		batch_threads[i] = SDL_CreateThread(agw_worker,
+				batch_states[i]);
+		if(!batch_threads[i])
+		{
+			eel_state_free(batch_states[i]);
+			batch_states[i] = NULL;
+			break;
+		}
+		++batch_workers;
+	}
+	if(!batch_workers)
+	{
+		log_printf(WLOG, "Could not start AGW worker threads!"
+				" Rendering sounds serially.\n");
+		agw_batch_end();
+		return -1;
+	}
+	batch_active = 1;
+	log_printf(DLOG, "AGW: Rendering on %d worker threads.\n",
+			batch_workers);
+#endif
+	return 0;
+}
+
+
+void agw_batch_end(void)
+{
+	int i;
+	agw_plog_t *pl;
+
+	/* Collect all jobs, including any queued while doing so */
+	agw_wait(-1);
+	batch_active = 0;
+
+	if(batch_mutex)
+	{
+		SDL_LockMutex(batch_mutex);
+		batch_running = 0;
+		SDL_CondBroadcast(batch_wake);
+		SDL_UnlockMutex(batch_mutex);
+	}
+	for(i = 0; i < batch_workers; ++i)
+	{
+		SDL_WaitThread(batch_threads[i], NULL);
+		eel_state_free(batch_states[i]);
+		batch_threads[i] = NULL;
+		batch_states[i] = NULL;
+	}
+	if(batch_workers)
+		log_printf(DLOG, "AGW: %d jobs on %d workers; %d run again"
+				" on the main thread.\n", batch_queued,
+				batch_workers, batch_reruns);
+	batch_workers = 0;
+
+	/* Apply patch parameters in the original order */
+	while((pl = plog))
+	{
+		plog = pl->next;
+		if(!pl->job)
+			audio_patch_param(pl->patch, pl->param, pl->value);
+		else if(pl->job->worker)
+			for(i = 0; i < pl->job->nparams; ++i)
+				audio_patch_param(pl->job->params[i * 3],
+						pl->job->params[i * 3 + 1],
+						pl->job->params[i * 3 + 2]);
+		free(pl);
+	}
+	plog_at = &plog;
+
+	while(batch_jobs)
+	{
+		agw_job_t *j = batch_jobs;
+		batch_jobs = j->next;
+		free(j->name);
+		free(j);
+	}
+	batch_jobs_end = &batch_jobs;
+	batch_queue = NULL;
+	batch_queue_end = &batch_queue;
+
+	if(batch_done)
+		SDL_DestroyCond(batch_done);
+	if(batch_wake)
+		SDL_DestroyCond(batch_wake);
+	if(batch_mutex)
+		SDL_DestroyMutex(batch_mutex);
+	batch_done = batch_wake = NULL;
+	batch_mutex = NULL;
+}
 
-	audio_wave_prepare(wid);
 
+int agw_load(int wid, const char *name)
+{
+	agw_job_t job;
+
+	CHECKINIT
+
+	if(wid < 0)
+	{
+		wid = audio_wave_alloc(wid);
+		if(wid < 0)
+			return wid;
+	}
+
+	/* Don't render over a wave that's still being rendered! */
+	agw_wait(wid);
+
+	memset(&job, 0, sizeof(job));
+	job.target = wid;
+	if(cache_file)
+	{
+		Uint32 v = AGW_CACHE_VERSION;
+		job.hash = 2166136261U;
+		job.hash = agw_hash_bytes(job.hash, &v, sizeof(v));
+		v = (Uint32)wid;
+		job.hash = agw_hash_bytes(job.hash, &v, sizeof(v));
+		job.hashed = (agw_hash_script(name, &job.hash, 0) >= 0);
+		job.cacheable = job.hashed;
+		if(job.cacheable && !cache_rebuild &&
+				(agw_cache_restore(wid, name, job.hash) >= 0))
+		{
+			++cache_hits;
+			audio_wave_prepare(wid);
+			return wid;
+		}
+	}
+
+	/* Scripts loaded by scripts go to the workers, if any */
+	if(batch_active && agw_job && (agw_queue(&job, name) >= 0))
+		return wid;
+
+	if(agw_run(&job, name) < 0)
+		return -1;
+	agw_finish(&job, name);
 	return wid;
 }
@@ -352,6 +352,46 @@ void agw_close(void);
  */
 int agw_load(int wid, const char *name);
 
+/*
+ * Open the render cache file 'path'. While the cache is
+ * open, agw_load() restores waves from the cache instead of
+ * running their scripts, as long as the script, any files it
+ * #includes and the target wave id are unchanged. Newly
+ * rendered waves are added to the cache.
+ *
+ * If 'rebuild' is nonzero, existing entries are ignored, and
+ * all cacheable waves are rendered and stored again.
+ *
+ * Returns 0, or a negative value upon failure.
+ */
+int agw_cache_open(const char *path, int rebuild);
+
+/* Write the cache back to disk if changed, and close it. */
+void agw_cache_close(void);
+
+/*
+ * Start rendering scripts on 'workers' threads, or one per CPU
+ * if 'workers' is negative. Until agw_batch_end() is called,
+ * scripts loaded by other scripts through w_load are queued for
+ * the workers instead of being run right away. Scripts that
+ * need anything but their own target wave are run again on the
+ * calling thread. Patch parameters are applied when the batch
+ * ends, in the same order as when rendering serially.
+ *
+ * Call from the thread that loads the scripts, outside any
+ * script. Does nothing if there is only one CPU, or if the
+ * compiler has no support for thread local variables.
+ *
+ * Returns 0, or a negative value upon failure.
+ */
+int agw_batch_begin(int workers);
+
+/*
+ * Wait for all queued scripts to finish, apply patch parameters,
+ * and stop the worker threads.
+ */
+void agw_batch_end(void);
+
 #ifdef __cplusplus
 };
 #endif
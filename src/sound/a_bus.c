@@ -35,9 +35,12 @@ static inline int __bus_run_fx(int bus, int slot, int *busses[], unsigned frames
 	--slot;	/* No IFX on slot 0! */
 	switch(b->insert[slot].current_state)
 	{
+	  case FX_STATE_RESTING:
+		if(!b->in_use)
+			return 0;	/* Tail ended, and no input. */
+		/* Fall through */
 	  case FX_STATE_RUNNING:
 	  case FX_STATE_SILENT:
-	  case FX_STATE_RESTING:
 		if(b->in_use)	/* Do we have input? */
 			b->insert[slot].process(&b->insert[slot],
 					busses[bus], frames);
@@ -56,10 +59,11 @@ static inline int __bus_run_fx(int bus, int slot, int *busses[], unsigned frames
 }
 
 
-static inline void __bus_process(int bus, int *busses[], int *master, unsigned frames)
+static inline int __bus_process(int bus, int *busses[], int *master, unsigned frames)
 {
 	audio_bus_t *b = &bustab[bus];
 	int i, s;
+	int mixed = 0;
 
 	/* Tail detection hack for the DC supression filter... */
 	if(!b->in_use)
@@ -75,7 +79,8 @@ static inline void __bus_process(int bus, int *busses[], int *master, unsigned f
 		dcf6s_process(&b->dcfilter, busses[bus], frames);
 
 		/* Mix pre-insert sends */
-		s32mix(busses[bus], master, b->bctl[0][ABC_SEND_MASTER], frames);
+		mixed |= s32mix(busses[bus], master,
+				b->bctl[0][ABC_SEND_MASTER], frames);
 		for(i = bus + 1; i < AUDIO_MAX_BUSSES; ++i)
 			if(s32mix(busses[bus], busses[i],
 					b->bctl[0][ABC_SEND_BUS_0 + i],
@@ -90,7 +95,8 @@ static inline void __bus_process(int bus, int *busses[], int *master, unsigned f
 		if(!__bus_run_fx(bus, s, busses, frames))
 			continue;	/* No output, no sends! */
 
-		s32mix(busses[bus], master, b->bctl[s][ABC_SEND_MASTER], frames);
+		mixed |= s32mix(busses[bus], master,
+				b->bctl[s][ABC_SEND_MASTER], frames);
 		for(i = bus + 1; i < AUDIO_MAX_BUSSES; ++i)
 			if(s32mix(busses[bus], busses[i],
 					b->bctl[s][ABC_SEND_BUS_0 + i],
@@ -104,14 +110,176 @@ static inline void __bus_process(int bus, int *busses[], int *master, unsigned f
 		s32clear(busses[bus], frames);
 		b->in_use = 0;
 	}
+	return mixed;
 }
 
 
-void bus_process_all(int *bufs[], int *master, unsigned frames)
+/*
+ * Returns 1 if any insert on the bus may still produce output
+ * without input. RESTING inserts have reported that their
+ * tails have ended.
+ */
+static inline int __bus_tail(audio_bus_t *b)
+{
+	int s;
+	for(s = 0; s < AUDIO_MAX_INSERTS; ++s)
+		switch(b->insert[s].current_state)
+		{
+		  case FX_STATE_RUNNING:
+		  case FX_STATE_SILENT:
+			return 1;
+		  default:
+			break;
+		}
+	return 0;
+}
+
+
+/*
+ * Figure out which busses need processing this cycle. A bus is
+ * live if it has input, a DC filter or insert tail, or if a live
+ * bus sends to it. Sends only go to higher numbered busses, so
+ * one pass in index order covers the whole graph.
+ */
+static unsigned __bus_live(void)
 {
 	int i;
+	unsigned live = 0;
 	for(i = 0; i < AUDIO_MAX_BUSSES; ++i)
-		__bus_process(i, bufs, master, frames);
+	{
+		audio_bus_t *b = &bustab[i];
+		if((live & (1 << i)) || b->in_use ||
+				!dcf6s_silent(&b->dcfilter) ||
+				__bus_tail(b))
+			live |= (1 << i) | b->sends;
+	}
+	return live;
+}
+
+
+int bus_process_all(int *bufs[], int *master, unsigned frames)
+{
+	int i;
+	int mixed = 0;
+	unsigned live = __bus_live();
+	for(i = 0; live; ++i, live >>= 1)
+		if(live & 1)
+			mixed |= __bus_process(i, bufs, master, frames);
+	return mixed;
+}
+
+
+
+/*----------------------------------------------------------
+	Float bus pipeline
+------------------------------------------------------------
+ * Same as the above, but the voice mixer output is moved
+ * into float busses before DC filtering, sends and inserts.
+ */
+
+static inline int __bus_run_fx_f(int bus, int slot, float *busses[],
+		unsigned frames)
+{
+	audio_bus_t *b = &bustab[bus];
+	audio_plugin_t *p = &b->insert[slot - 1];
+	switch(p->current_state)
+	{
+	  case FX_STATE_RESTING:
+		if(!b->in_use)
+			return 0;
+		/* Fall through */
+	  case FX_STATE_RUNNING:
+	  case FX_STATE_SILENT:
+		if(!p->process_f || !p->process_r_f)
+			return 0;	/* No float support */
+		if(b->in_use)
+			p->process_f(p, busses[bus], frames);
+		else
+		{
+			p->process_r_f(p, NULL, busses[bus], frames);
+			b->in_use = 1;
+		}
+		return (FX_STATE_RUNNING == p->current_state);
+	  default:
+		return 0;
+	}
+}
+
+
+static inline int __bus_process_f(int bus, int *vbusses[], float *busses[],
+		float *master, unsigned frames)
+{
+	audio_bus_t *b = &bustab[bus];
+	int i, s;
+	int mixed = 0;
+
+	/* Tail detection hack for the DC supression filter... */
+	if(!b->in_use)
+		if(!dcf6s_silent(&b->dcfilter))
+			b->in_use = 1;
+
+	if(b->in_use)
+	{
+		/* Voice mixer output; other busses may have sent here */
+		s32tof32move(vbusses[bus], busses[bus], frames);
+
+		dcf6s_process_f(&b->dcfilter, busses[bus], frames);
+
+		mixed |= f32mix(busses[bus], master,
+				b->bctl[0][ABC_SEND_MASTER], frames);
+		for(i = bus + 1; i < AUDIO_MAX_BUSSES; ++i)
+			if(f32mix(busses[bus], busses[i],
+					b->bctl[0][ABC_SEND_BUS_0 + i],
+					frames))
+				bustab[i].in_use = 1;
+	}
+
+	for(s = 1; s <= AUDIO_MAX_INSERTS; ++s)
+	{
+		if(!__bus_run_fx_f(bus, s, busses, frames))
+			continue;
+
+		mixed |= f32mix(busses[bus], master,
+				b->bctl[s][ABC_SEND_MASTER], frames);
+		for(i = bus + 1; i < AUDIO_MAX_BUSSES; ++i)
+			if(f32mix(busses[bus], busses[i],
+					b->bctl[s][ABC_SEND_BUS_0 + i],
+					frames))
+				bustab[i].in_use = 1;
+	}
+
+	if(b->in_use)
+	{
+		f32clear(busses[bus], frames);
+		b->in_use = 0;
+	}
+	return mixed;
+}
+
+
+int bus_process_all_f(int *vbufs[], float *bufs[], float *master,
+		unsigned frames)
+{
+	int i;
+	int mixed = 0;
+	unsigned live = __bus_live();
+	for(i = 0; live; ++i, live >>= 1)
+		if(live & 1)
+			mixed |= __bus_process_f(i, vbufs, bufs, master,
+					frames);
+	return mixed;
+}
+
+/* Update the connection table of 'bus' from its send controls */
+static void __update_sends(unsigned bus)
+{
+	audio_bus_t *b = &bustab[bus];
+	unsigned i, s;
+	b->sends = 0;
+	for(s = 0; s <= AUDIO_MAX_INSERTS; ++s)
+		for(i = bus + 1; i < AUDIO_MAX_BUSSES; ++i)
+			if(b->bctl[s][ABC_SEND_BUS_0 + i] >> 8)
+				b->sends |= 1 << i;
 }
 
 
@@ -252,12 +420,10 @@ void bus_ctl_set(unsigned bus, unsigned slot, unsigned ctl, int arg)
 		if(ctl > ABC_LAST)
 			break;
 		bustab[bus].bctl[slot][ctl] = arg;
+		if(ctl >= ABC_SEND_BUS_0)
+			__update_sends(bus);
 		break;
 	}
-	/*
-	 * This is where the "connection table" would be
-	 * updated in a more optimized implementation.
-	 */
 }
 
 
@@ -278,6 +444,7 @@ void audio_bus_open(void)
 		dcf6s_init(&bustab[i].dcfilter, a_settings.samplerate);
 		dcf6s_set_f(&bustab[i].dcfilter, 10);
 		bustab[i].in_use = 0;
+		__update_sends(i);
 	}
 	_is_open = 1;
 }
@@ -36,6 +36,7 @@ typedef struct
 	dcf6s_t		dcfilter;
 
 	int		in_use;		/* Set by whoever sends to the bus */
+	unsigned	sends;		/* Mask of busses we send to */
 
 	/* Insert FX plugins */
 	audio_plugin_t	insert[AUDIO_MAX_INSERTS];
@@ -44,7 +45,19 @@ typedef struct
 void audio_bus_open(void);
 void audio_bus_close(void);
 
-void bus_process_all(int *bufs[], int *master, unsigned frames);
+/*
+ * Process all busses that have input or tails, and mix the
+ * results into 'master'. Returns 0 if nothing was mixed into
+ * 'master', which is then left untouched.
+ */
+int bus_process_all(int *bufs[], int *master, unsigned frames);
+
+/*
+ * Float version; moves the voice mixer output in 'vbufs' into
+ * the float busses 'bufs', and mixes into 'master'.
+ */
+int bus_process_all_f(int *vbufs[], float *bufs[], float *master,
+		unsigned frames);
 void bus_ctl_set(unsigned bus, unsigned slot, unsigned ctl, int arg);
 
 #endif /*_A_BUS_H_*/
@@ -111,6 +111,7 @@ static inline void channel_process(audio_channel_t *c, unsigned frames)
 			  {
 				aev_event_t *del_ev = ev;
 SDBG(log_printf(D3LOG, "(patch) ");)
+				aev_forget(&c->port, del_ev);
 				if(c->ctl[ACC_PATCH] == c->rctl[ACC_PATCH])
 				{
 SDBG(log_printf(D3LOG, "[IGNORE]\n");)
@@ -119,6 +120,8 @@ SDBG(log_printf(D3LOG, "[IGNORE]\n");)
 						prev_ev->next = ev;
 					else
 						c->port.first = ev;
+					if(c->port.last == del_ev)
+						c->port.last = prev_ev;
 				}
 				else if(ev == first_ev)
 				{
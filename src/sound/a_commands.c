@@ -31,20 +31,24 @@
 #include "a_struct.h"
 #include "a_sequencer.h"
 #include "a_control.h"
+#include "a_render.h"
 
 #undef	DBG2D
 
 sfifo_t commands;
 
-static inline void __push_command(command_t *cmd)
+static inline int __push_command(command_t *cmd)
 {
 	if(sfifo_space(&commands) < sizeof(command_t))
 	{
 		if(_audio_running)
 			log_printf(WLOG, "Audio command FIFO overflow!\n");
-		return;
+		return -1;
 	}
 	sfifo_write(&commands, cmd, (unsigned)sizeof(command_t));
+	if(arender_recording)
+		arender_record(cmd);
+	return 0;
 }
 
 
@@ -160,6 +164,45 @@ void audio_channel_play(int cid, int tag, int pitch, int velocity)
 }
 
 
+int audio_channel_play2d(int cid, int tag, int patch, int pitch,
+		int velocity, int pan, int volume)
+{
+	command_t cmd;
+#ifdef AUDIO_SAFE
+	if(cid < 0 || cid >= AUDIO_MAX_CHANNELS)
+	{
+		log_printf(ELOG, "audio_play2d(): Channel out of range!\n");
+		return -1;
+	}
+	if(patch < 0 || patch >= AUDIO_MAX_PATCHES)
+	{
+		log_printf(ELOG, "audio_play2d(): Patch out of range!\n");
+		return -1;
+	}
+#endif
+	/* Pan: [-1, 1] ==> Sint16; Volume: [0, 2] ==> Uint16 */
+	pan >>= 1;
+	if(pan < -32768)
+		pan = -32768;
+	else if(pan > 32767)
+		pan = 32767;
+	volume >>= 1;
+	if(volume < 0)
+		volume = 0;
+	else if(volume > 65535)
+		volume = 65535;
+
+	cmd.action = CMD_PLAY2D;
+	cmd.cid = cid;
+	cmd.index = (unsigned char)patch;
+	cmd.tag = tag;
+	cmd.arg1 = pitch;
+	cmd.arg2 = velocity;
+	cmd.arg3 = (int)(((unsigned)pan << 16) | (unsigned)volume);
+	return __push_command(&cmd);
+}
+
+
 void audio_channel_controlf(int cid, int tag, int ctl, float arg)
 {
 	if(ACC_IS_FIXEDPOINT(ctl))
@@ -41,6 +41,7 @@ typedef struct
 		CMD_STOP = 0,
 		CMD_STOP_ALL,
 		CMD_PLAY,
+		CMD_PLAY2D,	/* Patch + Pan + Volume + Play */
 		CMD_CCONTROL,	/* Channel Control */
 		CMD_GCONTROL,	/* Group Control */
 		CMD_MCONTROL,	/* Mixer Control */
@@ -51,6 +52,7 @@ typedef struct
 	int		tag;
 	int		arg1;
 	int		arg2;
+	int		arg3;
 } command_t;
 
 extern sfifo_t commands;
@@ -77,6 +79,22 @@ void audio_group_control(unsigned gid, unsigned ctl, int arg);
 	Channel Control
 ----------------------------------------------------------*/
 void audio_channel_play(int cid, int tag, int pitch, int velocity);
+
+/*
+ * Select patch, set pan and volume for future voices, and then
+ * start a voice, all through a single command. Same result as
+ * sending ACC_PATCH, ACC_PAN and ACC_VOLUME with AVT_FUTURE,
+ * followed by audio_channel_play(), but using one FIFO slot
+ * instead of four.
+ *
+ * 'pan' and 'volume' are packed into 16 bits each, as the
+ * engine only uses the top bits of them anyway.
+ *
+ * Returns 0 if the command was queued, or a negative value if
+ * it was rejected, or the command FIFO was full.
+ */
+int audio_channel_play2d(int cid, int tag, int patch, int pitch,
+		int velocity, int pan, int volume);
 void audio_channel_controlf(int cid, int tag, int ctl, float arg);
 void audio_channel_control(int cid, int tag, int ctl, int arg);
 void audio_channel_stop(int cid, int tag);	/* -1 to stop all */
@@ -20,6 +20,8 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
 #include "a_globals.h"
 #include "a_delay.h"
 #include "a_tools.h"
@@ -28,27 +30,53 @@
 #define	DELAY_MAX_TAPS		16
 #define	DELAY_MAX_TAIL_TAPS	8
 
+/*
+ * Frames per block for the block processing code. Taps are
+ * read as whole blocks, so all taps must be at least this
+ * long, or we fall back to the per-sample code.
+ */
+#define	DELAY_BLOCK		MAX_BUFFER_SIZE
+
 typedef struct dtap_t
 {
 	unsigned	delay;
 	int		shift;
+	float		gain;		/* For float mode */
 } dtap_t;
 
 typedef struct delay_t
 {
 	int		*delaybuf;
+	float		*fdelaybuf;	/* Float mode; delaybuf is unused */
 	int		inspos;
 	int		cl, cr, lpf;	/* LPF */
+	float		fcl, fcr, flpf;	/* Float mode LPF */
 	int		level;
 	unsigned	taps, tailtaps;
 	int		ttimer;
 	float		tlevel;
+	int		thold;		/* Min tail time before RESTING */
 	dtap_t		tap[DELAY_MAX_TAPS];
 	dtap_t		tailtap[DELAY_MAX_TAIL_TAPS];
+
+	/* Block processing */
+	int		blocks;		/* Taps allow block processing */
+	int		tl[DELAY_BLOCK], tr[DELAY_BLOCK];	/* Tail */
+	int		el[DELAY_BLOCK], er[DELAY_BLOCK];	/* Early */
+	float		ftl[DELAY_BLOCK], ftr[DELAY_BLOCK];
+	float		fel[DELAY_BLOCK], fer[DELAY_BLOCK];
 } delay_t;
 
 #define	DELAY_MASK	(DELAY_BUFSIZE-1)
 
+/*
+ * The buffer holds one ring per channel; left in the first half,
+ * right in the second. Tap delays are still in samples of the
+ * interleaved signal, so bit 0 selects the channel.
+ */
+#define	DELAY_FRAMES	(DELAY_BUFSIZE/2)
+#define	DELAY_FMASK	(DELAY_FRAMES-1)
+
 #define	INTERNAL_BITS	8
 
 static int _init(delay_t *d)
@@ -56,13 +84,23 @@ static int _init(delay_t *d)
 	d->inspos = 0;
 	d->cl = 0;
 	d->cr = 0;
+	d->fcl = 0.0f;
+	d->fcr = 0.0f;
+	if(a_settings.float_mix)
+	{
+		d->fdelaybuf = calloc(1, sizeof(float)*DELAY_BUFSIZE);
+		if(!d->fdelaybuf)
+			return -2;
+		return 0;
+	}
 	d->delaybuf = calloc(1, sizeof(int)*DELAY_BUFSIZE);
 	if(!d->delaybuf)
 		return -2;
 	return 0;
 }
 
-#define	DB(x)	delaybuf[(inspos-(x)) & DELAY_MASK]
+#define	DB(x)	delaybuf[((x) & 1) * DELAY_FRAMES +			\
+			((inspos - ((x) >> 1)) & DELAY_FMASK)]
 #define	TAP(n)	(DB(d->tap[n].delay) >> d->tap[n].shift)
 #define	TTAP(n)	(DB(d->tailtap[n].delay) >> d->tailtap[n].shift)
 
@@ -105,7 +143,7 @@ static void o_delay_process_mix_s(delay_t *d, int *in, int *out, unsigned frames
 		out[0] += (outl*vm)>>8;
 		out[1] += (outr*vm)>>8;
 
-		inspos += 2;
+		++inspos;
 		in += 2;
 		out += 2;
 	}
@@ -166,7 +204,7 @@ static void o_delay_process_r_s(delay_t *d, int *in, int *out, unsigned frames)
 		out[0] = outl >> INTERNAL_BITS;
 		out[1] = outr >> INTERNAL_BITS;
 
-		inspos += 2;
+		++inspos;
 		in += 2;
 		out += 2;
 	}
@@ -223,7 +261,7 @@ static void o_delay_process_s(delay_t *d, int *buf, unsigned frames)
 		buf[s] = outl >> INTERNAL_BITS;
 		buf[s+1] = outr >> INTERNAL_BITS;
 
-		inspos += 2;
+		++inspos;
 	}
 	d->cl = cl;
 	d->cr = cr;
@@ -282,7 +320,7 @@ static int o_delay_process_tail_s(delay_t *d, int *out, unsigned frames)
 		/* Level meter */
 		level |= labs(outl) | labs(outr);
 
-		inspos += 2;
+		++inspos;
 	}
 	d->cl = cl;
 	d->cr = cr;
@@ -329,7 +367,7 @@ void o_delay_process_mix_ms(delay_t *d, int *in, int *out, unsigned frames)
 		out[0] += (outl*vm)>>8;
 		out[1] += (outr*vm)>>8;
 
-		inspos += 2;
+		++inspos;
 		in += 1;
 		out += 2;
 	}
@@ -339,9 +377,381 @@ void o_delay_process_mix_ms(delay_t *d, int *in, int *out, unsigned frames)
 }
 #endif
 
+/*
+ * Float versions of the above, for the float bus pipeline.
+ * No INTERNAL_BITS here; the buffers are in output units.
+ */
+#define	FTAP(n)		(DB(d->tap[n].delay) * d->tap[n].gain)
+#define	FTTAP(n)	(DB(d->tailtap[n].delay) * d->tailtap[n].gain)
+
+static void o_delay_process_r_f(delay_t *d, float *in, float *out,
+		unsigned frames)
+{
+	float *delaybuf = d->fdelaybuf;
+	int inspos = d->inspos;
+	float cl = d->fcl;
+	float cr = d->fcr;
+	float outl, outr;
+	unsigned i, s;
+	frames <<= 1;
+	for(s = 0; s < frames; s += 2)
+	{
+		/* Tail taps */
+		outl = outr = 0.0f;
+		for(i = 0; i < d->tailtaps; i += 2)
+		{
+			outl += FTTAP(i);
+			outr += FTTAP(i+1);
+		}
+
+		/* LP filters */
+		cl += (outl - cl) * d->flpf;
+		cr += (outr - cr) * d->flpf;
+
+		/* Input + Feedback */
+		DB(0) = cl + in[s];
+		DB(1) = cr + in[s+1];
+
+		/* Early Reflection Taps */
+		outl = outr = 0.0f;
+		for(i = 0; i < d->taps; i += 2)
+		{
+			outl += FTAP(i);
+			outr += FTAP(i+1);
+		}
+
+		/* "Tap 0" - the Feedback Signal */
+		outl += cl;
+		outr += cr;
+
+		/* Output */
+		out[s] = outl;
+		out[s+1] = outr;
+
+		++inspos;
+	}
+	d->fcl = f32flush(cl);
+	d->fcr = f32flush(cr);
+	d->inspos = inspos;
+}
+
+/* Returns the approximate peak level of the generated output. */
+static int o_delay_process_tail_f(delay_t *d, float *out, unsigned frames)
+{
+	float level = 0.0f;
+	float *delaybuf = d->fdelaybuf;
+	int inspos = d->inspos;
+	float cl = d->fcl;
+	float cr = d->fcr;
+	float outl, outr;
+	unsigned i, s;
+	frames <<= 1;
+	for(s = 0; s < frames; s += 2)
+	{
+		/* Tail taps */
+		outl = outr = 0.0f;
+		for(i = 0; i < d->tailtaps; i += 2)
+		{
+			outl += FTTAP(i);
+			outr += FTTAP(i+1);
+		}
+
+		/* LP filters */
+		cl += (outl - cl) * d->flpf;
+		cr += (outr - cr) * d->flpf;
+
+		/* Feedback (No input!) */
+		DB(0) = cl;
+		DB(1) = cr;
+
+		/* Early Reflection Taps */
+		outl = outr = 0.0f;
+		for(i = 0; i < d->taps; i += 2)
+		{
+			outl += FTAP(i);
+			outr += FTAP(i+1);
+		}
+
+		/* "Tap 0" - the Feedback Signal */
+		outl += cl;
+		outr += cr;
+
+		/* Output */
+		out[s] = outl;
+		out[s+1] = outr;
+
+		/* Level meter */
+		if(fabs(outl) > level)
+			level = fabs(outl);
+		if(fabs(outr) > level)
+			level = fabs(outr);
+
+		++inspos;
+	}
+	d->fcl = f32flush(cl);
+	d->fcr = f32flush(cr);
+	d->inspos = inspos;
+	return (int)level;
+}
+
+#undef	FTAP
+#undef	FTTAP
 #undef	DB
 #undef	TAP
 
+/*
+ * Block processing
+ *
+ *	Same algorithm as above, but one tap at a time over
+ *	a block of frames, rather than one frame at a time
+ *	over all taps. Each tap is then a plain loop over a
+ *	contiguous part of one of the rings, which the
+ *	compiler can vectorize. What remains is one loop for
+ *	the LP filters, feedback and output.
+ *
+ *	All taps are read before anything is written, so this
+ *	only works if no tap reads anything written in the same
+ *	block. _check_blocks() makes sure of that, and then the
+ *	results are identical to the per-sample code.
+ */
+
+/* First ring index read by tap 't' for a block starting at 'pos' */
+#define	TAPSTART(t, pos)	(((pos) - ((t)->delay >> 1)) & DELAY_FMASK)
+#define	TAPRING(t, buf)		((buf) + ((t)->delay & 1) * DELAY_FRAMES)
+
+static inline void __tap_add(int *acc, int *src, int shift, unsigned frames)
+{
+	unsigned s;
+	for(s = 0; s < frames; ++s)
+		acc[s] += src[s] >> shift;
+}
+
+/* Add 'frames' frames of tap 't' into 'acc' */
+static inline void _tap_add(int *acc, int *delaybuf, dtap_t *t, unsigned pos,
+		unsigned frames)
+{
+	int *ring = TAPRING(t, delaybuf);
+	unsigned start = TAPSTART(t, pos);
+	unsigned n = frames;
+	if(start + frames > DELAY_FRAMES)
+		n = DELAY_FRAMES - start;	/* Wrap! */
+	__tap_add(acc, ring + start, t->shift, n);
+	if(n < frames)
+		__tap_add(acc + n, ring, t->shift, frames - n);
+}
+
+static inline void __ftap_add(float *acc, float *src, float gain,
+		unsigned frames)
+{
+	unsigned s;
+	for(s = 0; s < frames; ++s)
+		acc[s] += src[s] * gain;
+}
+
+static inline void _ftap_add(float *acc, float *delaybuf, dtap_t *t,
+		unsigned pos, unsigned frames)
+{
+	float *ring = TAPRING(t, delaybuf);
+	unsigned start = TAPSTART(t, pos);
+	unsigned n = frames;
+	if(start + frames > DELAY_FRAMES)
+		n = DELAY_FRAMES - start;
+	__ftap_add(acc, ring + start, t->gain, n);
+	if(n < frames)
+		__ftap_add(acc + n, ring, t->gain, frames - n);
+}
+
+#undef	TAPSTART
+#undef	TAPRING
+
+/*
+ * Stereo, replacing, without level control. 'in' may be
+ * NULL for silent input, and may be the same as 'out'.
+ * Returns the approximate peak level of the output.
+ */
+static int o_delay_process_block_s(delay_t *d, int *in, int *out,
+		unsigned frames)
+{
+	int *delaybuf = d->delaybuf;
+	unsigned pos = d->inspos & DELAY_FMASK;
+	int *tl = d->tl, *tr = d->tr;
+	int *el = d->el, *er = d->er;
+	int cl = d->cl;
+	int cr = d->cr;
+	int lpf = d->lpf;
+	int outl, outr;
+	int level = 0;
+	unsigned i, s;
+
+	/* Tail taps */
+	memset(tl, 0, frames * sizeof(int));
+	memset(tr, 0, frames * sizeof(int));
+	for(i = 0; i < d->tailtaps; i += 2)
+	{
+		_tap_add(tl, delaybuf, &d->tailtap[i], pos, frames);
+		_tap_add(tr, delaybuf, &d->tailtap[i+1], pos, frames);
+	}
+
+	/* Early Reflection Taps */
+	memset(el, 0, frames * sizeof(int));
+	memset(er, 0, frames * sizeof(int));
+	for(i = 0; i < d->taps; i += 2)
+	{
+		_tap_add(el, delaybuf, &d->tap[i], pos, frames);
+		_tap_add(er, delaybuf, &d->tap[i+1], pos, frames);
+	}
+
+	for(s = 0; s < frames; ++s)
+	{
+		unsigned rpos = (pos + s) & DELAY_FMASK;
+
+		/* LP filters */
+		cl += (tl[s] - cl) * lpf >> INTERNAL_BITS;
+		cr += (tr[s] - cr) * lpf >> INTERNAL_BITS;
+
+		/* Input + Feedback */
+		delaybuf[rpos] = cl;
+		delaybuf[rpos + DELAY_FRAMES] = cr;
+		if(in)
+		{
+			delaybuf[rpos] += in[s*2] << INTERNAL_BITS;
+			delaybuf[rpos + DELAY_FRAMES] +=
+					in[s*2+1] << INTERNAL_BITS;
+		}
+
+		/* "Tap 0" - the Feedback Signal + Early Reflections */
+		outl = cl + el[s];
+		outr = cr + er[s];
+
+		/* Output */
+		out[s*2] = outl >> INTERNAL_BITS;
+		out[s*2+1] = outr >> INTERNAL_BITS;
+
+		/* Level meter */
+		level |= abs(outl) | abs(outr);
+	}
+
+	d->cl = cl;
+	d->cr = cr;
+	d->inspos = (pos + frames) & DELAY_FMASK;
+	return level >> INTERNAL_BITS;
+}
+
+/* Float version of o_delay_process_block_s() */
+static int o_delay_process_block_f(delay_t *d, float *in, float *out,
+		unsigned frames)
+{
+	float *delaybuf = d->fdelaybuf;
+	unsigned pos = d->inspos & DELAY_FMASK;
+	float *tl = d->ftl, *tr = d->ftr;
+	float *el = d->fel, *er = d->fer;
+	float cl = d->fcl;
+	float cr = d->fcr;
+	float lpf = d->flpf;
+	float outl, outr;
+	float level = 0.0f;
+	unsigned i, s;
+
+	/* Tail taps */
+	memset(tl, 0, frames * sizeof(float));
+	memset(tr, 0, frames * sizeof(float));
+	for(i = 0; i < d->tailtaps; i += 2)
+	{
+		_ftap_add(tl, delaybuf, &d->tailtap[i], pos, frames);
+		_ftap_add(tr, delaybuf, &d->tailtap[i+1], pos, frames);
+	}
+
+	/* Early Reflection Taps */
+	memset(el, 0, frames * sizeof(float));
+	memset(er, 0, frames * sizeof(float));
+	for(i = 0; i < d->taps; i += 2)
+	{
+		_ftap_add(el, delaybuf, &d->tap[i], pos, frames);
+		_ftap_add(er, delaybuf, &d->tap[i+1], pos, frames);
+	}
+
+	for(s = 0; s < frames; ++s)
+	{
+		unsigned rpos = (pos + s) & DELAY_FMASK;
+
+		/* LP filters */
+		cl += (tl[s] - cl) * lpf;
+		cr += (tr[s] - cr) * lpf;
+
+		/* Input + Feedback */
+		if(in)
+		{
+			delaybuf[rpos] = cl + in[s*2];
+			delaybuf[rpos + DELAY_FRAMES] = cr + in[s*2+1];
+		}
+		else
+		{
+			delaybuf[rpos] = cl;
+			delaybuf[rpos + DELAY_FRAMES] = cr;
+		}
+
+		/* "Tap 0" - the Feedback Signal + Early Reflections */
+		outl = cl + el[s];
+		outr = cr + er[s];
+
+		/* Output */
+		out[s*2] = outl;
+		out[s*2+1] = outr;
+
+		/* Level meter */
+		outl = fabs(outl);
+		outr = fabs(outr);
+		level = outl > level ? outl : level;
+		level = outr > level ? outr : level;
+	}
+
+	d->fcl = f32flush(cl);
+	d->fcr = f32flush(cr);
+	d->inspos = (pos + frames) & DELAY_FMASK;
+	return (int)level;
+}
+
+
+/*
+ * Block processing is only safe if no tap reads anything
+ * written in the same block; that is, all taps must be at
+ * least one block long, and no more than the ring size minus
+ * one block. Taps are read in pairs, so we check the unused
+ * partner of an odd tap as well.
+ *
+ * Also calculates the minimum tail time before the tail
+ * detection is allowed to put the plugin to rest; the longest
+ * tap, but never less than the original two seconds, as the
+ * tail taps feed back, and may leave quiet gaps between the
+ * repeats.
+ */
+static void _check_blocks(delay_t *d, int fs)
+{
+	unsigned i, maxdelay = 0;
+	unsigned mindelay = DELAY_FRAMES;
+	for(i = 0; i < ((d->tailtaps + 1) & ~1); ++i)
+	{
+		unsigned delay = d->tailtap[i].delay >> 1;
+		if(delay < mindelay)
+			mindelay = delay;
+		if(delay > maxdelay)
+			maxdelay = delay;
+	}
+	for(i = 0; i < ((d->taps + 1) & ~1); ++i)
+	{
+		unsigned delay = d->tap[i].delay >> 1;
+		if(delay < mindelay)
+			mindelay = delay;
+		if(delay > maxdelay)
+			maxdelay = delay;
+	}
+	d->blocks = (mindelay >= DELAY_BLOCK) &&
+			(maxdelay <= DELAY_FRAMES - DELAY_BLOCK);
+	d->thold = fs * 2;
+	if((int)maxdelay > d->thold)
+		d->thold = maxdelay;
+}
+
 
 /*
  * New API
@@ -392,9 +802,11 @@ static void _scale_early_taps(struct audio_plugin_t *p)
 		delay |= t & 1;		/* L->L, R->R, L->L, R->R,... */
 		d->tap[t].delay = delay;
 		d->tap[t].shift = shift;
+		d->tap[t].gain = (float)ldexp(1.0, -shift);
 		++t;
 	}
 	d->taps = t;
+	_check_blocks(d, p->ctl[FXC_SAMPLERATE]);
 }
 
 
@@ -424,9 +836,11 @@ static void _scale_tail_taps(struct audio_plugin_t *p)
 		delay |= (t>>1) & 1;	/* L->L, L->R, R->L, R->R,... */
 		d->tailtap[t].delay = delay;
 		d->tailtap[t].shift = shift;
+		d->tailtap[t].gain = (float)ldexp(1.0, -shift);
 		++t;
 	}
 	d->tailtaps = t;
+	_check_blocks(d, p->ctl[FXC_SAMPLERATE]);
 }
 
 
@@ -437,6 +851,7 @@ static inline void __calc_filters(audio_plugin_t *p)
 			p->ctl[FXC_SAMPLERATE] >> (16-INTERNAL_BITS);
 	if(d->lpf > (1<<(16-INTERNAL_BITS)))
 		d->lpf = (1<<(16-INTERNAL_BITS));
+	d->flpf = (float)d->lpf * (1.0f / (1<<INTERNAL_BITS));
 }
 
 
@@ -503,6 +918,8 @@ static int delay_state(struct audio_plugin_t *p, audio_fxstates_t new_state)
 			d = (delay_t *)p->user;
 			free(d->delaybuf);
 			d->delaybuf = NULL;
+			free(d->fdelaybuf);
+			d->fdelaybuf = NULL;
 			break;
 		  case FX_STATE_READY:
 			break;
@@ -544,13 +961,91 @@ static void delay_control(struct audio_plugin_t *p, unsigned ctl, int arg)
 }
 
 
+/*
+ * Run the delay over 'frames' frames, using block processing
+ * if the current tap setup allows it. 'in' may be NULL for
+ * silent input. Returns the approximate peak output level
+ * for silent input; otherwise 0.
+ */
+static int _run(delay_t *d, int *in, int *out, unsigned frames)
+{
+	int level = 0;
+	if(!d->blocks)
+	{
+		if(!in)
+			return o_delay_process_tail_s(d, out, frames);
+		else if(in == out)
+			o_delay_process_s(d, out, frames);
+		else
+			o_delay_process_r_s(d, in, out, frames);
+		return 0;
+	}
+	while(frames)
+	{
+		unsigned n = frames > DELAY_BLOCK ? DELAY_BLOCK : frames;
+		level |= o_delay_process_block_s(d, in, out, n);
+		if(in)
+			in += n * 2;
+		out += n * 2;
+		frames -= n;
+	}
+	return in ? 0 : level;
+}
+
+
+static int _run_f(delay_t *d, float *in, float *out, unsigned frames)
+{
+	int level = 0;
+	if(!d->blocks)
+	{
+		if(!in)
+			return o_delay_process_tail_f(d, out, frames);
+		o_delay_process_r_f(d, in, out, frames);
+		return 0;
+	}
+	while(frames)
+	{
+		unsigned n = frames > DELAY_BLOCK ? DELAY_BLOCK : frames;
+		int l = o_delay_process_block_f(d, in, out, n);
+		if(l > level)
+			level = l;
+		if(in)
+			in += n * 2;
+		out += n * 2;
+		frames -= n;
+	}
+	return level;
+}
+
+
+/*
+ * Tail detection. Once the output has stayed below the
+ * threshold for long enough that nothing audible can be left
+ * in the buffer, we stop processing until we get input again.
+ */
+static void _tail_meter(struct audio_plugin_t *p, int level, unsigned frames)
+{
+	delay_t *d = (delay_t *)p->user;
+	d->tlevel += (float)((level - d->tlevel) * frames) /
+			(float)(p->ctl[FXC_SAMPLERATE] * 0.1);
+	d->ttimer += frames;
+	if(d->ttimer < d->thold)
+		return;
+	if(d->tlevel < 5.0)
+	{
+		d->tlevel = 1000;
+		p->current_state = FX_STATE_RESTING;
+	}
+}
+
+
 static void delay_process(struct audio_plugin_t *p, int *buf, unsigned frames)
 {
 	delay_t *d = (delay_t *)p->user;
 	d->tlevel = 1000;
 	d->ttimer = 0;
 	p->current_state = FX_STATE_RUNNING;
-	o_delay_process_s(d, buf, frames);
+	_run(d, buf, buf, frames);
 }
 
 
@@ -562,26 +1057,40 @@ static void delay_process_r(struct audio_plugin_t *p, int *in, int *out, unsigne
 		d->tlevel = 1000;
 		d->ttimer = 0;
 		p->current_state = FX_STATE_RUNNING;
-		o_delay_process_r_s(d, in, out, frames);
+		_run(d, in, out, frames);
 	}
 	else
 	{
-		int level;
 		if(FX_STATE_RESTING == p->current_state)
 			return;
-		level = o_delay_process_tail_s(d, out, frames);
-		d->tlevel += (float)((level - d->tlevel) * frames) /
-				(float)(p->ctl[FXC_SAMPLERATE] * 0.1);
-		d->ttimer += frames;
-		if(d->ttimer < p->ctl[FXC_SAMPLERATE] * 2)
-			return;
-		if(d->tlevel < 5.0)
-		{
-			d->tlevel = 1000;
-			p->current_state = FX_STATE_RESTING;
-			return;
-		}
+		_tail_meter(p, _run(d, NULL, out, frames), frames);
+	}
+}
+
+
+static void delay_process_f(struct audio_plugin_t *p, float *buf,
+		unsigned frames)
+{
+	delay_t *d = (delay_t *)p->user;
+	d->tlevel = 1000;
+	d->ttimer = 0;
+	p->current_state = FX_STATE_RUNNING;
+	_run_f(d, buf, buf, frames);
+}
+
+
+static void delay_process_r_f(struct audio_plugin_t *p, float *in, float *out,
+		unsigned frames)
+{
+	delay_t *d = (delay_t *)p->user;
+	if(in)
+	{
+		delay_process_f(p, in, frames);
+		return;
 	}
+	if(FX_STATE_RESTING == p->current_state)
+		return;
+	_tail_meter(p, _run_f(d, NULL, out, frames), frames);
 }
 
 
@@ -591,4 +1100,6 @@ void delay_init(struct audio_plugin_t *p)
 	p->control = delay_control;
 	p->process = delay_process;
 	p->process_r = delay_process_r;
+	p->process_f = delay_process_f;
+	p->process_r_f = delay_process_r_f;
 }
@@ -25,6 +25,8 @@
 
 #include "kobolog.h"
 #include "a_events.h"
+#include "sfifo.h"
+#include "SDL_thread.h"
 
 #define	EVENTS_PER_BLOCK	256
 
@@ -55,22 +57,113 @@ typedef struct evblock_t
 
 static evblock_t *blocks = NULL;
 
+/* Number of events in the pool. (Maintained by aev_new()/aev_free().) */
+volatile int aev_pool_free = 0;
 
-int _aev_refill_pool(void)
+/* Statistics */
+static int pool_size = 0;	/* Total number of events owned */
+static int pool_added = 0;	/* Blocks handed over by the butler */
+static int pool_misses = 0;	/* Failed allocations */
+static int pool_peak = 0;	/* Peak use, saved by aev_close() */
+
+
+/*
+ * Butler thread
+ *
+ *	The butler allocates new blocks whenever the number
+ *	of free events, including blocks already waiting in
+ *	the handoff FIFO, drops below the low-water mark.
+ *	Blocks are passed to the engine through an sfifo,
+ *	which is lock-free for a single reader and a single
+ *	writer. The engine only ever takes blocks from the
+ *	FIFO when the pool actually runs dry, so the
+ *	real time side never waits for, or calls, malloc().
+ *
+ *	The butler polls, rather than waiting for a signal,
+ *	as we don't want the engine to touch any locks.
+ */
+#define	BUTLER_PERIOD	10	/* ms */
+#define	HANDOFF_BLOCKS	8
+
+static sfifo_t handoff;
+static SDL_Thread *butler = NULL;
+static volatile int butler_running = 0;
+static int low_water = 0;
+static int max_events = 0;
+
+/* Butler side; allocate and init a block. */
+static evblock_t *new_block(void)
 {
-	/*
-	 * We can't refill in real time context on some
-	 * platforms - and it would be a bad idea anyway...
-	 */
-	log_printf(ELOG, "Audio event pool exhausted!\n");
-	return -1;
+	int i;
+	evblock_t *eb = calloc(1, sizeof(evblock_t));
+	if(!eb)
+		return NULL;
+	for(i = 0; i < EVENTS_PER_BLOCK - 1; ++i)
+	{
+		eb->events[i].next = eb->events + i + 1;
+		eb->events[i].type = AEV_ET_FREE;
+	}
+	eb->events[i].next = NULL;
+	eb->events[i].type = AEV_ET_FREE;
+	return eb;
+}
+
+static int butler_thread(void *data)
+{
+	int warned = 0;
+	while(butler_running)
+	{
+		int pending = sfifo_used(&handoff) / sizeof(evblock_t *);
+		int total = pool_size + pending * EVENTS_PER_BLOCK;
+		if((aev_pool_free + pending * EVENTS_PER_BLOCK < low_water) &&
+				(sfifo_space(&handoff) >= sizeof(evblock_t *)))
+		{
+			evblock_t *eb;
+			if(total + EVENTS_PER_BLOCK > max_events)
+			{
+				if(!warned)
+					log_printf(WLOG, "Audio event pool"
+							" at maximum size!\n");
+				warned = 1;
+			}
+			else if((eb = new_block()))
+			{
+				sfifo_write(&handoff, &eb, sizeof(eb));
+				continue;
+			}
+		}
+		SDL_Delay(BUTLER_PERIOD);
+	}
+	return 0;
 }
 
 
 /*
- * A job for a future butler thread. For now, we only use
- * this during initialization.
+ * Engine side; called by aev_new() when the pool is empty.
+ * Grabs a block from the butler, if there is one.
  */
+int _aev_refill_pool(void)
+{
+	evblock_t *eb;
+	if(sfifo_used(&handoff) < sizeof(evblock_t *))
+	{
+		if(!pool_misses++)
+			log_printf(ELOG, "Audio event pool exhausted!\n");
+		return -1;
+	}
+	sfifo_read(&handoff, &eb, sizeof(eb));
+	eb->next = blocks;
+	blocks = eb;
+	eb->events[EVENTS_PER_BLOCK - 1].next = aev_event_pool;
+	aev_event_pool = eb->events;
+	aev_pool_free += EVENTS_PER_BLOCK;
+	pool_size += EVENTS_PER_BLOCK;
+	++pool_added;
+	return 0;
+}
+
+
+/* Synchronous refill; only used during initialization. */
 static int refill_pool(void)
 {
 	int i;
@@ -88,14 +181,67 @@ static int refill_pool(void)
 		eb->events[i].type = AEV_ET_FREE;
 		aev_free(&eb->events[i]);
 	}
-
+	pool_size += EVENTS_PER_BLOCK;
 	return 0;
 }
 
 
+void aev_pool_stats(aev_poolstats_t *st)
+{
+	st->size = pool_size;
+	st->free = aev_pool_free;
+#ifdef	AEV_TRACKING
+	st->peak = aev_event_counter_max > pool_peak ?
+			aev_event_counter_max : pool_peak;
+#else
+	st->peak = -1;
+#endif
+	st->added = pool_added;
+	st->misses = pool_misses;
+}
+
+
 /*----------------------------------------------------------
 	Event Input Port
 ----------------------------------------------------------*/
+
+/* Index of the highest set bit in 'x', which must not be 0. */
+static inline int _msb64(Uint64 x)
+{
+#if defined(__GNUC__)
+	return 63 - __builtin_clzll(x);
+#else
+	int n = 0;
+	if(x >> 32)
+	{
+		x >>= 32;
+		n += 32;
+	}
+	if(x >> 16)
+	{
+		x >>= 16;
+		n += 16;
+	}
+	if(x >> 8)
+	{
+		x >>= 8;
+		n += 8;
+	}
+	if(x >> 4)
+	{
+		x >>= 4;
+		n += 4;
+	}
+	if(x >> 2)
+	{
+		x >>= 2;
+		n += 2;
+	}
+	return n + (int)(x >> 1);
+#endif
+}
+
+
 void aev_insert(aev_port_t *evp, aev_event_t *ev)
 {
 EVDBG(log_printf(D2LOG, "aev_insert:\n");)
@@ -115,7 +261,46 @@ EVDBG(log_printf(D2LOG, "  last\n");)
 	else
 	{
 		aev_event_t *e_prev = NULL;
-		aev_event_t *e = evp->first;
+		aev_event_t *e;
+		int span = (Sint16)(ev->frame - evp->first->frame);
+		unsigned rot = AEV_WHEEL_MASK - (ev->frame & AEV_WHEEL_MASK);
+		Uint64 hits = evp->used;
+
+		/*
+		 * Look for the closest queued event at or before
+		 * the new event in the timing wheel. Rotate the
+		 * slot map, so that bit 63 - n stands for the slot
+		 * n frames before the new event. As hints are
+		 * overwritten or dropped, what we find may not be
+		 * the exact insertion point, or even from the same
+		 * lap of the wheel, but it's still a queued event
+		 * that we can scan forward from. There's no point
+		 * in looking further back than the first event.
+		 */
+		if(rot)
+			hits = (hits << rot) | (hits >> (AEV_WHEEL_SIZE - rot));
+		if(span < 0)
+			hits = 0;
+		else if(span < AEV_WHEEL_MASK)
+			hits &= ~(Uint64)0 << (AEV_WHEEL_MASK - span);
+		while(hits)
+		{
+			int b = _msb64(hits);
+			e = evp->wheel[(ev->frame - (AEV_WHEEL_MASK - b)) &
+					AEV_WHEEL_MASK];
+			if((Sint16)(e->frame - ev->frame) <= 0)
+			{
+EVDBG(log_printf(D2LOG, "  wheel hit at -%d\n", AEV_WHEEL_MASK - b);)
+				e_prev = e;
+				break;
+			}
+			hits &= ~((Uint64)1 << b);
+		}
+
+		if(e_prev)
+			e = e_prev->next;
+		else
+			e = evp->first;
 EVDBG(log_printf(D2LOG, " scanning...\n");)
 		while((Sint16)(e->frame - ev->frame) <= 0)
 		{
@@ -135,6 +320,8 @@ EVDBG(log_printf(D2LOG, "  first\n");)
 			evp->first = ev;
 		}
 	}
+	evp->wheel[ev->frame & AEV_WHEEL_MASK] = ev;
+	evp->used |= (Uint64)1 << (ev->frame & AEV_WHEEL_MASK);
 #ifdef AEV_TRACKING
 	ev->port = evp;
 #endif
@@ -145,16 +332,34 @@ EVDBG(log_printf(D2LOG, "  first\n");)
 	Open/Close
 ----------------------------------------------------------*/
 
-int aev_open(int pool_size)
+int aev_open(int size)
 {
-	while(pool_size > 0)
-	{
+	int i;
+	pool_size = pool_added = pool_misses = pool_peak = 0;
+	for(i = size; i > 0; i -= EVENTS_PER_BLOCK)
 		if(refill_pool() < 0)
 		{
 			aev_close();
 			return -1;	/* OOM! */
 		}
-		pool_size -= EVENTS_PER_BLOCK;
+
+	/* Start butler */
+	low_water = size / 4;
+	if(low_water < EVENTS_PER_BLOCK)
+		low_water = EVENTS_PER_BLOCK;
+	max_events = size * AEV_MAX_GROWTH;
+	if(sfifo_init(&handoff, sizeof(evblock_t *) * HANDOFF_BLOCKS) < 0)
+	{
+		aev_close();
+		return -1;
+	}
+	butler_running = 1;
+	butler = SDL_CreateThread(butler_thread, NULL);
+	if(!butler)
+	{
+		butler_running = 0;
+		log_printf(WLOG, "Could not start audio event butler!"
+				" Event pool will not grow.\n");
 	}
 #if 0
 	{
@@ -197,8 +402,24 @@ int aev_open(int pool_size)
 
 void aev_close(void)
 {
-	log_printf(DLOG, "aev_close(): max events used: %d\n",
-				aev_event_counter_max);
+	if(butler)
+	{
+		butler_running = 0;
+		SDL_WaitThread(butler, NULL);
+		butler = NULL;
+	}
+	while(sfifo_used(&handoff) >= sizeof(evblock_t *))
+	{
+		evblock_t *eb;
+		sfifo_read(&handoff, &eb, sizeof(eb));
+		free(eb);
+	}
+	sfifo_close(&handoff);
+
+	log_printf(DLOG, "aev_close(): max events used: %d of %d"
+			" (%d blocks added by butler, %d events lost)\n",
+			aev_event_counter_max, pool_size, pool_added,
+			pool_misses);
 #ifdef	AEV_TRACKING
 	if(aev_event_counter)
 	{
@@ -235,7 +456,10 @@ void aev_close(void)
 
 	blocks = NULL;
 	aev_event_pool = NULL;
+	aev_pool_free = 0;
 #ifdef	AEV_TRACKING
+	if(aev_event_counter_max > pool_peak)
+		pool_peak = aev_event_counter_max;
 	aev_event_counter = 0;
 	aev_event_counter_max = 0;
 #endif
@@ -24,15 +24,38 @@
 
 #define	AEV_TRACKING
 
+#include <string.h>
+
 #include "a_globals.h"
 #include "a_types.h"
 
 /*----------------------------------------------------------
 	Open/Close
 ----------------------------------------------------------*/
+/*
+ * 'pool_size' events are preallocated. After that, a butler
+ * thread keeps at least a quarter of that available, up to
+ * a total of AEV_MAX_GROWTH times the initial size.
+ */
+#define	AEV_MAX_GROWTH	16
 int aev_open(int pool_size);
 void aev_close(void);
 
+typedef struct aev_poolstats_t
+{
+	int	size;		/* Total number of events allocated */
+	int	free;		/* Events currently in the pool */
+	int	peak;		/* Max number of events in use */
+	int	added;		/* Blocks added by the butler */
+	int	misses;		/* Allocations failed; events lost */
+} aev_poolstats_t;
+
+/*
+ * Get event pool statistics. Valid after aev_close() as well,
+ * until the next aev_open().
+ */
+void aev_pool_stats(aev_poolstats_t *st);
+
 
 /*----------------------------------------------------------
 	The global event timestamp time base
@@ -83,6 +106,7 @@ typedef struct aev_event_t
 
 /* The global event pool. */
 extern aev_event_t		*aev_event_pool;
+extern volatile int		aev_pool_free;	/* Events in pool */
 
 #ifdef AEV_TRACKING
 extern int aev_event_counter;			//Current number of events in use
@@ -115,6 +139,7 @@ static inline aev_event_t *aev_new(void)
 
 	ev = aev_event_pool;
 	aev_event_pool = ev->next;
+	--aev_pool_free;
 #ifdef AEV_TRACKING
 	ev->type = AEV_ET_ALLOCATED;
 	ev->client = aev_current_client;
@@ -131,6 +156,7 @@ static inline void aev_free(aev_event_t *ev)
 {
 	ev->next = aev_event_pool;
 	aev_event_pool = ev;
+	++aev_pool_free;
 #ifdef AEV_TRACKING
 	ev->type = AEV_ET_FREE;
 	--aev_event_counter;
@@ -141,6 +167,16 @@ static inline void aev_free(aev_event_t *ev)
 /*----------------------------------------------------------
 	Event Input Port
 ----------------------------------------------------------*/
+/*
+ * Timing wheel size. Must be 64, as there is one bit per slot
+ * in aev_port_t.used. Ports keep a reference to the last event
+ * queued for each timestamp (modulo this size), so that
+ * aev_insert() can usually find the insertion point without
+ * scanning the queue.
+ */
+#define	AEV_WHEEL_SIZE		64
+#define	AEV_WHEEL_MASK		(AEV_WHEEL_SIZE - 1)
+
 typedef struct aev_port_t
 {
 	/*
@@ -151,6 +187,15 @@ typedef struct aev_port_t
 	aev_event_t		*first;
 	aev_event_t		*last;
 	const char		*name;
+
+	/*
+	 * Hints for aev_insert(). Entries are either NULL or
+	 * point to events in the queue. Anything that removes
+	 * events from the queue without using aev_read() must
+	 * aev_forget() them, or clear the wheel.
+	 */
+	aev_event_t		*wheel[AEV_WHEEL_SIZE];
+	Uint64			used;	/* Bit n set if wheel[n] is in use */
 } aev_port_t;
 
 
@@ -164,6 +209,24 @@ static inline void aev_port_init(aev_port_t *evp, const char *name)
 {
 	evp->first = evp->last = NULL;
 	evp->name = name;
+	memset(evp->wheel, 0, sizeof(evp->wheel));
+	evp->used = 0;
+}
+
+
+/*
+ * Drop any timing wheel reference to 'ev'. Use this when
+ * removing events from the queue of 'evp' by other means
+ * than aev_read().
+ */
+static inline void aev_forget(aev_port_t *evp, aev_event_t *ev)
+{
+	unsigned slot = ev->frame & AEV_WHEEL_MASK;
+	if(evp->wheel[slot] == ev)
+	{
+		evp->wheel[slot] = NULL;
+		evp->used &= ~((Uint64)1 << slot);
+	}
 }
 
 
@@ -184,6 +247,8 @@ static inline void aev_write(aev_port_t *evp, aev_event_t *ev)
 		evp->last->next = ev;
 		evp->last = ev;
 	}
+	evp->wheel[ev->frame & AEV_WHEEL_MASK] = ev;
+	evp->used |= (Uint64)1 << (ev->frame & AEV_WHEEL_MASK);
 #ifdef AEV_TRACKING
 	ev->port = evp;
 #endif
@@ -195,6 +260,11 @@ static inline void aev_write(aev_port_t *evp, aev_event_t *ev)
  * the specified port. The event will be placed *after*
  * any other events with the same timestamp.
  *
+ * Appending is O(1), and so is inserting, as long as there
+ * are events queued within AEV_WHEEL_SIZE frames before the
+ * new event. Otherwise, the queue is scanned from the closest
+ * hint that's not after the new event, or from the start.
+ *
  * The event will belong to the owner of the port, who is
  * responsible for freeing or reusing the event after
  * reading it.
@@ -223,6 +293,7 @@ static inline aev_event_t *aev_read(aev_port_t *evp)
 		return NULL;
 
 	evp->first = ev->next;
+	aev_forget(evp, ev);
 	return ev;
 }
 
@@ -249,6 +320,8 @@ static inline unsigned aev_next(aev_port_t *evp, unsigned offset)
  */
 static inline void aev_flush(aev_port_t *evp)
 {
+	memset(evp->wheel, 0, sizeof(evp->wheel));
+	evp->used = 0;
 #ifdef AEV_TRACKING
 	while(1)
 	{
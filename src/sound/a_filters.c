@@ -144,12 +144,35 @@ void dcf6s_process(dcf6s_t *fil, int *buf, unsigned frames)
 	fil->dr = dr;
 }
 
+/* Same filter, on float buffers */
+void dcf6s_process_f(dcf6s_t *fil, float *buf, unsigned frames)
+{
+	float k = fil->k;
+	float dl = fil->fdl;
+	float dr = fil->fdr;
+	unsigned s;
+	frames <<= 1;
+	for(s = 0; s < frames; s += 2)
+	{
+		dl += (buf[s] - dl) * k;
+		dr += (buf[s+1] - dr) * k;
+		buf[s] -= dl;
+		buf[s+1] -= dr;
+	}
+	fil->fdl = f32flush(dl);
+	fil->fdr = f32flush(dr);
+}
+
 int dcf6s_silent(dcf6s_t *fil)
 {
 	if(labs(fil->dl) > 4096)
 		return 0;
 	if(labs(fil->dr) > 4096)
 		return 0;
+	if(fabs(fil->fdl) > 1.0f)
+		return 0;
+	if(fabs(fil->fdr) > 1.0f)
+		return 0;
 	return 1;	
 }
 
@@ -158,12 +181,14 @@ void dcf6s_set_f(dcf6s_t *fil, int f)
 	fil->f = int2shift(fil->rate / f) - 13;
 	if(fil->f < 0)
 		fil->f = 0;
+	fil->k = 1.0f / (float)(1 << (fil->f + 12));	/* dl is 20:12 */
 }
 
 void dcf6s_init(dcf6s_t *fil, int fs)
 {
 	fil->rate = fs;
 	fil->dl = fil->dr = 0;
+	fil->fdl = fil->fdr = 0.0f;
 	dcf6s_set_f(fil, 10);
 }
 
@@ -60,11 +60,14 @@ typedef struct dcf6s_t
 	int rate;
 	int f;
 	int dl, dr;
+	float k;		/* Float version of 'f' */
+	float fdl, fdr;		/* Float version state */
 } dcf6s_t;
 
 void dcf6s_init(dcf6s_t *fil, int fs);
 void dcf6s_set_f(dcf6s_t *fil, int f);
 void dcf6s_process(dcf6s_t *fil, int *buf, unsigned frames);
+void dcf6s_process_f(dcf6s_t *fil, float *buf, unsigned frames);
 int dcf6s_silent(dcf6s_t *fil);
 
 /*--------------------------------------------------------------------
@@ -37,7 +37,8 @@ struct settings_t a_settings = {
 	44100,		/* samplerate */
 	256,		/* output_buffersize */
 	32,		/* buffersize */
-	AQ_HIGH		/* quality */
+	AQ_HIGH,	/* quality */
+	AQ_HIGH		/* cur_quality */
 };
 
 
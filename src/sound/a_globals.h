@@ -100,6 +100,9 @@ struct settings_t
 	unsigned	output_buffersize;
 	unsigned	buffersize;
 	audio_quality_t	quality;
+	audio_quality_t	cur_quality;	/* In use; <= quality if adaptive */
+	int		float_mix;	/* Float busses and master */
+	int		adaptive;	/* Quality governor enabled */
 };
 extern struct settings_t a_settings;
 
@@ -20,6 +20,7 @@
  */
 
 #include <stdlib.h>
+#include <math.h>
 #include "a_limiter.h"
 #include "a_types.h"
 
@@ -29,6 +30,7 @@ int lim_open(limiter_t *lim, int samplerate)
 	lim_control(lim, LIM_THRESHOLD, 32768);
 	lim_control(lim, LIM_RELEASE, 300000);
 	lim->peak = (unsigned)(32768<<8);
+	lim->fpeak = 32768.0f;
 	lim->attenuation = 0;
 	return 0;
 }
@@ -46,11 +48,13 @@ void lim_control(limiter_t *lim, int param, int value)
 		lim->threshold = (unsigned)(value << 8);
 		if(lim->threshold < 256)
 			lim->threshold = 256;
+		lim->fthreshold = (float)lim->threshold * (1.0f / 256.0f);
 		break;
 	  case LIM_RELEASE:
 		if(lim->samplerate < 1)
 			lim->samplerate = 44100;
 		lim->release = (value << 8) / lim->samplerate;
+		lim->frelease = (float)value / (float)lim->samplerate;
 		break;
 	}
 }
@@ -138,3 +142,45 @@ void limss_process(limiter_t *lim, int *in, int *out, unsigned frames)
 	}
 	lim->attenuation = (lim->peak - lim->threshold) >> 8;
 }
+
+void limsf_process(limiter_t *lim, float *in, float *out, unsigned frames)
+{
+	unsigned i;
+	float peak = lim->fpeak;
+	float release = lim->frelease;
+	float threshold = lim->fthreshold;
+	frames <<= 1;
+	for(i = 0; i < frames; i += 2)
+	{
+		float gain;
+		float lp = fabs(in[i]);
+		float rp = fabs(in[i+1]);
+		float maxp = lp > rp ? lp : rp;
+		if(maxp > peak)
+		{
+			peak = maxp;
+			gain = 32767.0f / peak;
+		}
+		else
+		{
+			gain = 32767.0f / peak;
+			peak -= release;
+			if(peak < threshold)
+				peak = threshold;
+		}
+		out[i] = in[i] * gain;
+		out[i+1] = in[i+1] * gain;
+	}
+	lim->fpeak = peak;
+	lim->attenuation = (unsigned)(peak - threshold);
+}
+
+int lims_idle(limiter_t *lim)
+{
+	return (lim->peak == lim->threshold) && !lim->attenuation;
+}
+
+int limsf_idle(limiter_t *lim)
+{
+	return (lim->fpeak == lim->fthreshold) && !lim->attenuation;
+}
@@ -29,6 +29,11 @@ typedef struct limiter_t
 	int		release;	/* Release "speed" */
 	unsigned	peak;		/* Filtered peak value */
 	unsigned	attenuation;	/* Current output attenuation */
+
+	/* Float versions of the above (16 bit sample units) */
+	float		fthreshold;
+	float		frelease;	/* Per sample frame */
+	float		fpeak;
 } limiter_t;
 
 enum lim_params_t
@@ -67,4 +72,20 @@ void lims_process(limiter_t *lim, int *in, int *out, unsigned frames);
  */
 void limss_process(limiter_t *lim, int *in, int *out, unsigned frames);
 
+/*
+ * Float version of lims_process(). Output is in 16 bit
+ * sample units, just like the integer versions.
+ */
+void limsf_process(limiter_t *lim, float *in, float *out, unsigned frames);
+
+/*
+ * Returns 1 if the limiter is fully released, so that
+ * processing silence would change neither the buffer nor
+ * the limiter state. The host may then skip the call.
+ * lims_idle() is for lims_process() and limss_process(),
+ * limsf_idle() for limsf_process().
+ */
+int lims_idle(limiter_t *lim);
+int limsf_idle(limiter_t *lim);
+
 #endif /*_A_LIMITER_H_*/
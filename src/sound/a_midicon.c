@@ -33,6 +33,9 @@ static int first_channel = 0;
 
 static float fs = 44100;
 
+/* Event delay (frames into the current buffer) set by the sequencer */
+static unsigned delay = 0;
+
 /* Exponential table which maps [0, 127] ==> [0, 65535] */
 static unsigned short explut[128];
 
@@ -158,7 +161,7 @@ static inline int __is_down(unsigned ch, int key)
 static void midicon_note_off(unsigned ch, unsigned pitch, unsigned vel)
 {
 	__release(ch, pitch);
-	(void)ce_stop(channeltab + MIDI_MAP_CH(ch), 0,
+	(void)ce_stop(channeltab + MIDI_MAP_CH(ch), delay,
 			(int)pitch, (int)explut[vel]);
 }
 
@@ -171,7 +174,7 @@ static void midicon_note_on(unsigned ch, unsigned pitch, unsigned vel)
 		return;
 	}
 	m[ch].velocity[pitch] = (int)explut[vel];
-	(void)ce_start(channeltab + MIDI_MAP_CH(ch), 0, (int)pitch,
+	(void)ce_start(channeltab + MIDI_MAP_CH(ch), delay, (int)pitch,
 			(int)pitch << 16, m[ch].velocity[pitch]);
 	__press(ch, pitch);
 }
@@ -181,7 +184,7 @@ static void midicon_pitch_bend(unsigned ch, int bend)
 {
 	m[ch].bend = bend << 3;
 	m[ch].bend *= m[ch].bend_depth;
-	(void)ce_control(channeltab + MIDI_MAP_CH(ch), 0,
+	(void)ce_control(channeltab + MIDI_MAP_CH(ch), delay,
 			-1, ACC_PITCH, m[ch].bend + (60<<16));
 }
 
@@ -197,11 +200,11 @@ static void midicon_control_change(unsigned ch, unsigned ctrl, unsigned amt)
 		break;
 	  case 7:
 		m[ch].volume = (int)explut[amt];
-		(void)ce_control(c, 0, -1, ACC_VOLUME, m[ch].volume);
+		(void)ce_control(c, delay, -1, ACC_VOLUME, m[ch].volume);
 		break;
 	  case 10:
 		m[ch].pan = (amt << 10) - 65536;
-		(void)ce_control(c, 0, -1, ACC_PAN, m[ch].pan);
+		(void)ce_control(c, delay, -1, ACC_PAN, m[ch].pan);
 		break;
 
 	  /* Bus Control */
@@ -258,14 +261,14 @@ static void midicon_control_change(unsigned ch, unsigned ctrl, unsigned amt)
 		break;
 
 	  case 88:	/* Primary output bus */
-		(void)ce_control(c, 0, -1, ACC_PRIM_BUS, amt-1);
+		(void)ce_control(c, delay, -1, ACC_PRIM_BUS, amt-1);
 		break;
 	  case 89:	/* Send bus */
-		(void)ce_control(c, 0, -1, ACC_SEND_BUS, amt-1);
+		(void)ce_control(c, delay, -1, ACC_SEND_BUS, amt-1);
 		break;
 	  case 91:	/* Send Level ("Reverb") */
 		m[ch].send = (int)explut[amt] << 1;
-		(void)ce_control(c, 0, -1, ACC_SEND, m[ch].send);
+		(void)ce_control(c, delay, -1, ACC_SEND, m[ch].send);
 		break;
 
 	  case 120:	/* All Sound Off */
@@ -289,9 +292,9 @@ static void midicon_control_change(unsigned ch, unsigned ctrl, unsigned amt)
 		m[ch].volume = 100*512;
 		m[ch].send = 0;
 		m[ch].pan = 0;
-		(void)ce_control(c, 0, -1, ACC_VOLUME, m[ch].volume);
-		(void)ce_control(c, 0, -1, ACC_SEND, m[ch].send);
-		(void)ce_control(c, 0, -1, ACC_PAN, m[ch].pan);
+		(void)ce_control(c, delay, -1, ACC_VOLUME, m[ch].volume);
+		(void)ce_control(c, delay, -1, ACC_SEND, m[ch].send);
+		(void)ce_control(c, delay, -1, ACC_PAN, m[ch].pan);
 		midicon_pitch_bend(ch, 0);
 		break;
 	  case 126:	/* Mono */
@@ -308,7 +311,13 @@ static void midicon_control_change(unsigned ch, unsigned ctrl, unsigned amt)
 
 static void midicon_program_change(unsigned ch, unsigned prog)
 {
-	(void)ce_control(channeltab + MIDI_MAP_CH(ch), 0, -2, ACC_PATCH, (int)prog);
+	(void)ce_control(channeltab + MIDI_MAP_CH(ch), delay, -2, ACC_PATCH, (int)prog);
+}
+
+
+static void midicon_timestamp(unsigned frame)
+{
+	delay = frame;
 }
 
 
@@ -319,7 +328,8 @@ midisock_t midicon_midisock = {
 	midicon_control_change,
 	midicon_program_change,
 	NULL,		/* channel_pressure */
-	midicon_pitch_bend
+	midicon_pitch_bend,
+	midicon_timestamp
 };
 
 
@@ -329,6 +339,7 @@ int midicon_open(float framerate, int first_ch)
 	aev_client("midicon_open()");
 	fs = framerate;
 	first_channel = first_ch;
+	delay = 0;
 	__init();
 	for(i = 0; i < 16; ++i)
 		__poly(i, 1);
@@ -77,18 +77,10 @@
  *  SD - the SCI Decoder (to get all .sci out of the Sierra files)
  */
 
-/*
-TODO:
-	* Number of subsongs and other stuff should be checked
-	  in mf_open(), rather than in mp_rewind().
-*/
-
 #undef	TESTING
-#undef	TESTING2
 
 #include <stdlib.h>
 #include <stdio.h>
-#include <math.h>
 #include <string.h>
 #include "kobolog.h"
 #include "a_midifile.h"
@@ -102,88 +94,106 @@ static inline void midiprintf(int level, const char *format, ...)
 }
 #endif
 
-#ifdef TESTING2
-#define midiprintf2 log_printf
-#else
-static inline void midiprintf2(int level, const char *format, ...)
+
+/*----------------------------------------------------------
+	MIDI file compiler
+----------------------------------------------------------*/
+
+/* Intermediate event kinds */
+typedef enum
 {
-}
-#endif
+	MFC_CHANNEL = 0,	/* Channel message */
+	MFC_TEMPO,		/* Set Tempo; 'arg' is us per quarter note */
+	MFC_LOOP_START,		/* "#LOOP_START" marker */
+	MFC_LOOP_END,		/* "#LOOP_END" marker */
+	MFC_END			/* End Of Track */
+} mfc_kinds_t;
+
+/* Intermediate event, timestamped in pulses */
+typedef struct mfc_event_t
+{
+	unsigned	pulse;
+	unsigned	seq;		/* For stable sorting */
+	unsigned	arg;
+	unsigned char	kind;
+	unsigned char	status;
+	unsigned char	data1;
+	unsigned char	data2;
+} mfc_event_t;
+
+typedef struct mf_compiler_t
+{
+	midi_file_t	*mf;
+	unsigned	pos;
+	mfc_event_t	*events;
+	unsigned	nevents;
+	unsigned	size;
+} mf_compiler_t;
+
 
-static inline unsigned char datalook(midi_player_t *mp, unsigned pos)
+static inline unsigned char datalook(mf_compiler_t *mc, unsigned pos)
 {
-	if(pos < 0 || pos > mp->mf->flen)
+	if(pos >= mc->mf->flen)
 		return 0;
-	return mp->mf->data[pos];
+	return mc->mf->data[pos];
 }
 
 
-static inline unsigned getnext(midi_player_t *mp, unsigned num)
+static inline unsigned getnext(mf_compiler_t *mc, unsigned num)
 {
 	unsigned v = 0;
 	unsigned i;
 	for(i = 0; i < num; i++)
 	{
 		v <<= 8;
-		v += datalook(mp, mp->pos);
-		mp->pos++;
+		v += datalook(mc, mc->pos);
+		mc->pos++;
 	}
 	return v;
 }
 
 
-static inline unsigned getval(midi_player_t *mp)
+static inline unsigned getval(mf_compiler_t *mc)
 {
 	unsigned v = 0;
 	unsigned char b;
 
-	b = (unsigned char)getnext(mp, 1);
+	b = (unsigned char)getnext(mc, 1);
 	v = b & 0x7f;
 	while((b & 0x80) != 0)
 	{
-		b = (unsigned char)getnext(mp, 1);
+		b = (unsigned char)getnext(mc, 1);
 		v = (v << 7) + (b & 0x7F);
 	}
 	return v;
 }
 
 
-static inline void set_tempo(midi_player_t *mp, unsigned ppqn, unsigned usqtr)
-{
-	mp->c.ppqn = ppqn;
-	mp->c.usqtr = usqtr;
-	mp->c.spulse = (float)usqtr / (float)ppqn / 1000000.0;
-	midiprintf(D2LOG, "ppqn = %u  ", ppqn);
-	midiprintf(D2LOG, "sqtr = %u  ", usqtr);
-	midiprintf(D2LOG, "spulse = %f  ", mp->c.spulse);
-}
-
-
-static int matchnext(midi_player_t *mp, const char *s, unsigned len)
+static int matchnext(mf_compiler_t *mc, const char *s, unsigned len)
 {
 	while(len--)
-		if(getnext(mp, 1) != (unsigned)(((int)*s++) & 0xff))
+		if(getnext(mc, 1) != (unsigned)(((int)*s++) & 0xff))
 			return 0;
 	return 1;
 }
 
 
-static int readheader(midi_player_t *mp, const char *s)
+static int readheader(mf_compiler_t *mc, const char *s)
 {
-	if(!matchnext(mp, s, 4))
+	if(!matchnext(mc, s, 4))
 		return -1;
 
-	return (int)getnext(mp, 4);
+	return (int)getnext(mc, 4);
 }
 
 
-static int printnext(midi_player_t *mp, unsigned len)
+static int printnext(mf_compiler_t *mc, unsigned len)
 {
 #ifdef TESTING
 	midiprintf(D2LOG, "\"");
 	while(len--)
 	{
-		unsigned int ch = getnext(mp, 1);
+		unsigned int ch = getnext(mc, 1);
 		if(ch < 32)
 			midiprintf(D2LOG, ".");
 		else
@@ -191,38 +201,334 @@ static int printnext(midi_player_t *mp, unsigned len)
 	}
 	midiprintf(D2LOG, "\"");
 #else
-	while(len--)
-		getnext(mp, 1);
+	mc->pos += len;
 #endif
 	return 1;
 }
 
-/* FIXME: This won't work if there are signature changes... */
-static void mp_print_time(midi_player_t *mp, unsigned pulses)
+
+static int mfc_add(mf_compiler_t *mc, unsigned pulse, mfc_kinds_t kind,
+		unsigned status, unsigned data1, unsigned data2, unsigned arg)
 {
-#ifdef TESTING
-	unsigned beatval, beat, tick, bar;
-	if(mp->c.timesig.value)
-		beatval = mp->c.ppqn * 4 / mp->c.timesig.value;
-	else
-		beatval = 120;
-	beat = pulses / beatval;
-	tick = pulses % beatval;
-	if(mp->c.timesig.beats)
+	mfc_event_t *ev;
+	if(mc->nevents >= mc->size)
+	{
+		unsigned size = mc->size ? mc->size * 2 : 256;
+		ev = realloc(mc->events, size * sizeof(mfc_event_t));
+		if(!ev)
+			return -1;
+		mc->events = ev;
+		mc->size = size;
+	}
+	ev = mc->events + mc->nevents;
+	ev->pulse = pulse;
+	ev->seq = mc->nevents++;
+	ev->arg = arg;
+	ev->kind = (unsigned char)kind;
+	ev->status = (unsigned char)status;
+	ev->data1 = (unsigned char)(data1 & 0x7f);
+	ev->data2 = (unsigned char)(data2 & 0x7f);
+	return 0;
+}
+
+
+/* Returns the marker kind for loop markers, or MFC_CHANNEL if ignored. */
+static mfc_kinds_t mfc_parse_command(mf_compiler_t *mc, unsigned len)
+{
+	char buf[128];
+	unsigned i;
+	for(i = 0; i < len; i++)
+	{
+		if(i < 127)
+			buf[i] = (char)datalook(mc, mc->pos);
+		mc->pos++;
+	}
+	buf[len < 127 ? len : 127] = 0;
+
+	if('#' != buf[0])
+	{
+		midiprintf(D2LOG, "Marker: %s", buf);
+		return MFC_CHANNEL;
+	}
+
+	if(!memcmp(buf + 1, "LOOP", 4))
 	{
-		bar = beat / mp->c.timesig.beats;
-		beat = beat % mp->c.timesig.beats;
+		if(!memcmp(buf + 5, "_START", 6))
+			return MFC_LOOP_START;
+		else if(!memcmp(buf + 5, "_END", 4))
+			return MFC_LOOP_END;
+	}
+	return MFC_CHANNEL;
+}
+
+
+/* Parse one track, starting at the current position. */
+static int mfc_track(mf_compiler_t *mc, unsigned tend)
+{
+	unsigned pulse = 0;
+	unsigned pv = 0;
+	unsigned x, l, d1, d2;
+	mfc_kinds_t kind;
+	if(tend > mc->mf->flen)
+		tend = mc->mf->flen;
+	while(mc->pos < tend)
+	{
+		pulse += getval(mc);
+		x = getnext(mc, 1);
+
+		/* This is for MIDI "running status" */
+		if(x < 0x80)
+		{
+			if(!pv)
+			{
+				log_printf(ELOG, "a_midifile.c: Illegal"
+						" status byte!\n");
+				break;
+			}
+			x = pv;
+			mc->pos--;
+		}
+
+		switch (x & 0xf0)
+		{
+		  case 0x80:	/* note off */
+		  case 0x90:	/* note on */
+		  case 0xa0:	/* key aftertouch */
+		  case 0xb0:	/* control change */
+		  case 0xe0:	/* pitch wheel */
+			pv = x;
+			d1 = getnext(mc, 1);
+			d2 = getnext(mc, 1);
+			if(mfc_add(mc, pulse, MFC_CHANNEL, x, d1, d2, 0) < 0)
+				return -1;
+			continue;
+		  case 0xc0:	/* patch change */
+		  case 0xd0:	/* channel aftertouch */
+			pv = x;
+			d1 = getnext(mc, 1);
+			if(mfc_add(mc, pulse, MFC_CHANNEL, x, d1, 0, 0) < 0)
+				return -1;
+			continue;
+		}
+
+		switch (x)
+		{
+		  case 0xf0:
+		  case 0xf7:	/* sysex */
+			mc->pos += getval(mc);
+			break;
+		  case 0xf2:
+			getnext(mc, 2);
+			break;
+		  case 0xf3:
+			getnext(mc, 1);
+			break;
+		  case 0xff:
+			x = getnext(mc, 1);
+			l = getval(mc);
+			midiprintf(D2LOG, " {%X (%X): ", x, l);
+			switch(x)
+			{
+			  case 6:
+				kind = mfc_parse_command(mc, l);
+				if(MFC_CHANNEL == kind)
+					break;
+				if(mfc_add(mc, pulse, kind, 0, 0, 0, 0) < 0)
+					return -1;
+				break;
+			  case 0x2f:	/* End Of Track */
+				midiprintf(D2LOG, "End Of Track");
+				mc->pos = tend;
+				break;
+			  case 0x51:	/* Set Tempo */
+				x = getnext(mc, l);
+				midiprintf(D2LOG, "(usqtr:%u ==> BPM:%f)", x,
+						60.0*1000000.0 / (float)x);
+				if(x && (mfc_add(mc, pulse, MFC_TEMPO,
+						0, 0, 0, x) < 0))
+					return -1;
+				break;
+			  default:
+				printnext(mc, l);
+				break;
+			}
+			midiprintf(D2LOG, "}\n");
+			break;
+		  default:	/* System realtime and undefined */
+			break;
+		}
+	}
+	return mfc_add(mc, pulse, MFC_END, 0, 0, 0, 0);
+}
+
+
+static int mfc_compare(const void *a, const void *b)
+{
+	const mfc_event_t *ea = (const mfc_event_t *)a;
+	const mfc_event_t *eb = (const mfc_event_t *)b;
+	if(ea->pulse != eb->pulse)
+		return ea->pulse < eb->pulse ? -1 : 1;
+	return ea->seq < eb->seq ? -1 : (ea->seq > eb->seq);
+}
+
+
+/*
+ * Merge the tracks and apply the tempo map, to build the
+ * final event array. Anything after a #LOOP_END marker is
+ * dropped, as playback never gets there.
+ */
+static int mfc_build(mf_compiler_t *mc, float fs)
+{
+	midi_file_t *mf = mc->mf;
+	unsigned usqtr = 500000;	/* 120 BPM until told otherwise */
+	unsigned last = 0;
+	double us = 0.0;
+	unsigned i, n = 0;
+
+	qsort(mc->events, mc->nevents, sizeof(mfc_event_t), mfc_compare);
+	for(i = 0; i < mc->nevents; ++i)
+		if(MFC_CHANNEL == mc->events[i].kind)
+			++n;
+	mf->events = malloc((n ? n : 1) * sizeof(mf_event_t));
+	if(!mf->events)
+		return -1;
+
+	mf->rate = fs;
+	mf->nevents = 0;
+	mf->end = 0;
+	mf->looped = 0;
+	mf->loop_start = 0;
+	mf->loop_frame = 0;
+	for(i = 0; i < mc->nevents; ++i)
+	{
+		mfc_event_t *ev = mc->events + i;
+		unsigned frame;
+		us += (double)(ev->pulse - last) * usqtr / mf->ppqn;
+		last = ev->pulse;
+		frame = (unsigned)(us * fs / 1000000.0 + 0.5);
+		switch(ev->kind)
+		{
+		  case MFC_CHANNEL:
+		  {
+			mf_event_t *e = mf->events + mf->nevents++;
+			e->frame = frame;
+			e->status = ev->status;
+			e->data1 = ev->data1;
+			e->data2 = ev->data2;
+			continue;
+		  }
+		  case MFC_TEMPO:
+			usqtr = ev->arg;
+			continue;
+		  case MFC_LOOP_START:
+			mf->loop_start = mf->nevents;
+			mf->loop_frame = frame;
+			continue;
+		  case MFC_LOOP_END:
+			mf->end = frame;
+			mf->looped = 1;
+			break;
+		  case MFC_END:
+			if(frame > mf->end)
+				mf->end = frame;
+			continue;
+		}
+		break;
+	}
+
+	/* All events must be played before we loop or stop! */
+	if(mf->nevents && (mf->end <= mf->events[mf->nevents - 1].frame))
+		mf->end = mf->events[mf->nevents - 1].frame + 1;
+	if(mf->looped && (mf->end <= mf->loop_frame))
+	{
+		log_printf(WLOG, "a_midifile.c: Empty loop ignored!\n");
+		mf->looped = 0;
+	}
+	midiprintf(D2LOG, "%u events; end: %u, loop: %d (%u, %u)\n",
+			mf->nevents, mf->end, mf->looped,
+			mf->loop_start, mf->loop_frame);
+	return 0;
+}
+
+
+static int mf_compile(midi_file_t *mf, float fs)
+{
+	mf_compiler_t mc;
+	unsigned i;
+	int len, res = 0;
+
+	memset(&mc, 0, sizeof(mc));
+	mc.mf = mf;
+
+	len = readheader(&mc, "MThd");
+	if(len < 0)
+	{
+		log_printf(ELOG, "mf_open(): Is this a MIDI file...?\n");
+		return -1;
+	}
+	midiprintf(D2LOG, "header length:%d\n", len);
+	if(len >= 6)
+	{
+		mf->format = getnext(&mc, 2);
+		mf->tracks = getnext(&mc, 2);
+		mf->ppqn = getnext(&mc, 2);
+		midiprintf(D2LOG, "format:%u\n", mf->format);
+		midiprintf(D2LOG, "tracks:%u\n", mf->tracks);
+		midiprintf(D2LOG, "  ppqn:%u\n", mf->ppqn);
+		if(0 == mf->format)
+			mf->tracks = 1;
 	}
 	else
 	{
-		bar = beat / 4;
-		beat = beat % 4;
+		log_printf(ELOG, "mf_open(): WARNING: Short header!\n");
+		mf->format = 0;
+		mf->tracks = 1;
+		mf->ppqn = 250;
 	}
-	midiprintf(D2LOG, "(%u:%u:%u)", bar+1, beat+1, tick);
-#endif
+	if(!mf->ppqn || (mf->ppqn & 0x8000))
+	{
+		log_printf(ELOG, "mf_open(): Unsupported time division!\n");
+		return -1;
+	}
+	if(len > 6)
+		mc.pos += (unsigned)(len - 6); /* Skip rest of header */
+	if(mf->tracks > 16)
+	{
+		log_printf(ELOG, "mf_open(): WARNING: Too many tracks!\n");
+		mf->tracks = 16;
+	}
+	for(i = 0; i < mf->tracks; ++i)
+	{
+		unsigned tend;
+		len = readheader(&mc, "MTrk");
+		if(len < 0)
+		{
+			log_printf(ELOG, "mf_open(): Bad MIDI file!\n");
+			res = -1;
+			break;
+		}
+		tend = mc.pos + len;
+		midiprintf(D2LOG, "track %u; start:%u length:%d\n",
+				i, mc.pos, len);
+		if(mfc_track(&mc, tend) < 0)
+		{
+			res = -1;
+			break;
+		}
+		mc.pos = tend;
+	}
+
+	if(!res)
+		res = mfc_build(&mc, fs);
+	free(mc.events);
+	return res;
 }
 
 
+/*----------------------------------------------------------
+	midi_file_t
+----------------------------------------------------------*/
+
 static long filelength(FILE *f)
 {
 	long buf, size;
@@ -240,7 +546,7 @@ static long filelength(FILE *f)
 }
 
 
-midi_file_t *mf_open(const char *name)
+midi_file_t *mf_open(const char *name, float fs)
 {
 	FILE *f;
 	unsigned char s[6];
@@ -294,6 +600,12 @@ midi_file_t *mf_open(const char *name)
 	}
 
 	fclose(f);
+
+	if(mf_compile(mf, fs) < 0)
+	{
+		mf_close(mf);
+		return NULL;
+	}
 	return mf;
 }
 
@@ -302,11 +614,16 @@ void mf_close(midi_file_t *mf)
 {
 	if(!mf)
 		return;
+	free(mf->events);
 	free(mf->data);
 	free(mf);
 }
 
 
+/*----------------------------------------------------------
+	midi_player_t
+----------------------------------------------------------*/
+
 int mp_select(midi_player_t *mp, midi_file_t *midifile)
 {
 	mp_stop(mp);
@@ -316,370 +633,104 @@ int mp_select(midi_player_t *mp, midi_file_t *midifile)
 }
 
 
-static void mp_mark_loop(midi_player_t *mp)
-{
-	int i;
-	for(i = 0; i < 16; i++)
-		if(mp->track[i].enabled)
-			mp->track[i].loop_start = mp->track[i].c;
-	mp->loop_start = mp->c;
-	mp_print_time(mp, mp->c.time);
-	midiprintf(D2LOG, ": mp_mark_loop\n");
-}
-
-
-static void mp_loop(midi_player_t *mp)
+static inline unsigned mp_transpose(midi_player_t *mp, unsigned note)
 {
-	int i;
-	for(i = 0; i < 16; i++)
-		if(mp->track[i].enabled)
-			mp->track[i].c = mp->track[i].loop_start;
-	mp_print_time(mp, mp->c.time);
-	midiprintf(D2LOG, ": mp_loop\n");
-	mp->c = mp->loop_start;
+	int n = (int)note + (mp->pitch >> 16);
+	if(n > 127)
+		return 127;
+	else if(n < 0)
+		return 0;
+	return (unsigned)n;
 }
 
 
-static int mp_parse_command(midi_player_t *mp, unsigned len)
+static inline void mp_send(midi_player_t *mp, mf_event_t *ev)
 {
-	char buf[128];
-	unsigned i;
-	for(i = 0; i < len; i++)
+	midisock_t *ms = mp->sock;
+	unsigned c = ev->status & 0x0f;
+	switch(ev->status & 0xf0)
 	{
-		if(i < 127)
-			buf[i] = (char)datalook(mp, mp->pos);
-		mp->pos++;
+	  case 0x80:	/* note off */
+		if(ms->note_off)
+			ms->note_off(c, mp_transpose(mp, ev->data1),
+					ev->data2);
+		break;
+	  case 0x90:	/* note on */
+		if(ms->note_on)
+			ms->note_on(c, mp_transpose(mp, ev->data1),
+					ev->data2);
+		break;
+	  case 0xa0:	/* key aftertouch */
+		if(ms->poly_pressure)
+			ms->poly_pressure(c, mp_transpose(mp, ev->data1),
+					ev->data2);
+		break;
+	  case 0xb0:	/* control change */
+		if(ms->control_change)
+			ms->control_change(c, ev->data1, ev->data2);
+		break;
+	  case 0xc0:	/* patch change */
+		if(ms->program_change)
+			ms->program_change(c, ev->data1);
+		break;
+	  case 0xd0:	/* channel aftertouch */
+		if(ms->channel_pressure)
+			ms->channel_pressure(c, ev->data1);
+		break;
+	  case 0xe0:	/* pitch wheel */
+		if(ms->pitch_bend)
+			ms->pitch_bend(c, (int)(ev->data1 |
+					(ev->data2 << 7)) - 8192);
+		break;
 	}
-	buf[len < 127 ? len : 127] = 0;
-
-	if('#' != buf[0])
-	{
-		midiprintf(D2LOG, "Marker: %s", buf);
-		return 0;
-	}
-
-	if(!memcmp(buf + 1, "LOOP", 4))
-	{
-		if(!memcmp(buf + 5, "_START", 6))
-			mp_mark_loop(mp);
-		else if(!memcmp(buf + 5, "_END", 4))
-		{
-			mp_loop(mp);
-			return 1;
-		}
-	}
-	return 0;
 }
 
 
-static void mp_read_time_sig(midi_player_t *mp)
+int mp_play(midi_player_t *mp, unsigned frames)
 {
-	mp_timesig_t *ts = &mp->c.timesig;
-	ts->beats = getnext(mp, 1);
-	ts->value = 1 << getnext(mp, 1);
-	ts->clock = getnext(mp, 1);
-	ts->qn = getnext(mp, 1);
-	midiprintf(D2LOG, "Time Sig: %d/%d;", ts->beats, ts->value);
-	midiprintf(D2LOG, " %d clock %d qn", ts->clock, ts->qn);
-}
-
-
-#define	FOR_TRACKS_ON	for(trk = 0; trk < 16; trk++)	\
-				if(mp->track[trk].c.on)
-int mp_update(midi_player_t *mp)
-{
-	unsigned note, vel, ctrl, x, l;
-	unsigned i, j, c;
-	int trk, ret;
-
-	if(mp->doing == 1)
+	midi_file_t *mf = mp->mf;
+	midisock_t *ms = mp->sock;
+	unsigned done = 0;
+	int res = 1;
+	if(!mf)
+		return 0;
+	while(1)
 	{
-		/* just get the first wait and ignore it :> */
-		midiprintf(D2LOG, "Initial wait: ");
-		FOR_TRACKS_ON
+		unsigned end = mp->time + frames - done;
+		int wrap = 0;
+		if(end >= mf->end)
 		{
-			mp_track_t *mt = mp->track + trk;
-			mp->pos = mt->c.pos;
-			mt->c.iwait += getval(mp);
-			midiprintf(D2LOG, "%d:%u  ", trk, mt->c.iwait);
-			mt->c.pos = mp->pos;
+			end = mf->end;
+			wrap = 1;
 		}
-		mp->doing = 0;
-		midiprintf(D2LOG, "\n\n");
-	}
-
-	do
-	{
-		ret = 0;
-		FOR_TRACKS_ON
+		while((mp->pos < mf->nevents) &&
+				(mf->events[mp->pos].frame < end))
 		{
-			mp_track_t *mt = mp->track + trk;
-			if(mt->c.iwait)
-				continue;
-			if(mt->c.pos >= mt->tend)
-			{
-				midiprintf(D2LOG, "(%d) End Of Track\n", trk);
-				mt->c.on = 0;
-				continue;
-			}
-			ret = 1;
-
-			midiprintf2(D2LOG, "<%u>: ", mt->c.pos);
-
-			mp->pos = mt->c.pos;
-			x = getnext(mp, 1);
-
-			/* This is for MIDI "running status" */
-			if(x < 0x80)
-			{
-				x = mt->c.pv;
-				mp->pos--;
-			}
-			mt->c.pv = (unsigned char)x;
-
-			c = x & 0x0f;
-			midiprintf2(D2LOG, "(%d)[%2X]", trk, x);
-			switch (x & 0xf0)
-			{
-			  case 0x80:	/* note off */
-				note = getnext(mp, 1) + (mp->pitch >> 16);
-				if(note > 127)
-					note = 127;
-				else if(note < 0)
-					note = 0;
-				vel = getnext(mp, 1);
-				if(mp->sock->note_off)
-					mp->sock->note_off(c, note, vel);
-				break;
-			  case 0x90:	/* note on */
-				/* doing=0; */
-				note = getnext(mp, 1) + (mp->pitch >> 16);
-				if(note > 127)
-					note = 127;
-				else if(note < 0)
-					note = 0;
-				vel = getnext(mp, 1);
-				if(mp->sock->note_on)
-					mp->sock->note_on(c, note, vel);
-				break;
-			  case 0xa0:	/* key aftertouch */
-				note = getnext(mp, 1) + (mp->pitch >> 16);
-				if(note > 127)
-					note = 127;
-				else if(note < 0)
-					note = 0;
-				vel = getnext(mp, 1);
-				if(mp->sock->poly_pressure)
-					mp->sock->poly_pressure(c, note,
-							vel);
-				break;
-			  case 0xb0:	/* control change */
-				ctrl = getnext(mp, 1);
-				vel = getnext(mp, 1);
-				if(mp->sock->control_change)
-					mp->sock->control_change(c, ctrl,
-							vel);
-				break;
-			  case 0xc0:	/* patch change */
-				x = getnext(mp, 1);
-				if(mp->sock->program_change)
-					mp->sock->program_change(c, x);
-				break;
-			  case 0xd0:	/* channel aftertouch */
-				x = getnext(mp, 1);
-				if(mp->sock->channel_pressure)
-					mp->sock->channel_pressure(c, x);
-				break;
-			  case 0xe0:	/* pitch wheel */
-				x = getnext(mp, 1);
-				x |= getnext(mp, 1) << 7;
-				if(mp->sock->pitch_bend)
-					mp->sock->pitch_bend(c, (int)x - 8192);
-				break;
-			  case 0xf0:
-				switch (x)
-				{
-				  case 0xf0:
-				  case 0xf7:	/* sysex */
-					l = getval(mp);
-					i = (datalook(mp, mp->pos + l) ==
-							0xf7);
-					midiprintf2(D2LOG, "{%ld}", l);
-					midiprintf2(D2LOG, "\n");
-					for(j = 0; j < l; j++)
-						midiprintf2(D2LOG, "%2lX ", getnext(mp, 1));
-					midiprintf2(D2LOG, "\n");
-					if(i)
-						getnext(mp, 1);
-					break;
-				  case 0xf1:
-					break;
-				  case 0xf2:
-					getnext(mp, 2);
-					break;
-				  case 0xf3:
-					getnext(mp, 1);
-					break;
-				  case 0xf4:
-					break;
-				  case 0xf5:
-					break;
-				  case 0xf6:	/* something */
-				  case 0xf8:
-				  case 0xfa:
-				  case 0xfb:
-				  case 0xfc:
-					break;
-				  case 0xfe:
-					break;
-				  case 0xfd:
-					break;
-				  case 0xff:
-					x = getnext(mp, 1);
-					l = getval(mp);
-					midiprintf(D2LOG, " {%X (%X): ", x, l);
-					switch(x)
-					{
-					  case 1:
-						midiprintf(D2LOG, "Text: ");
-						printnext(mp, l);
-						break;
-					  case 2:
-						midiprintf(D2LOG, "Copyright: ");
-						printnext(mp, l);
-						break;
-					  case 3:
-						midiprintf(D2LOG, "Track Name: ");
-						printnext(mp, l);
-						break;
-					  case 4:
-						midiprintf(D2LOG, "Instrument: ");
-						printnext(mp, l);
-						break;
-					  case 5:
-						midiprintf(D2LOG, "Lyric: ");
-						printnext(mp, l);
-						break;
-					  case 6:
-						if(mp_parse_command(mp, l))
-						{
-							trk = -1;
-							continue;
-						}
-						break;
-					  case 7:
-						midiprintf(D2LOG, "Cue Point: ");
-						printnext(mp, l);
-						break;
-					  case 8:
-					  case 9:
-					  case 10:
-					  case 11:
-					  case 12:
-					  case 13:
-					  case 14:
-					  case 15:
-						midiprintf(D2LOG, "Text event: ");
-						printnext(mp, l);
-						break;
-					  case 0x21:	/* MIDI Port # */
-						x = getnext(mp, 1);
-						midiprintf(D2LOG, "Port %u", x);
-						break;
-					  case 0x2f:	/* End Of Track */
-						mt->c.on = 0;
-						midiprintf(D2LOG, "End Of Track");
-						break;
-					  case 0x51:	/* Set Tempo */
-						x = getnext(mp, l);
-						set_tempo(mp, mp->c.ppqn, x);
-						midiprintf(D2LOG, "(sqtr:%u ==> BPM:%f)",
-								mp->c.usqtr,
-								60.0*1000000.0 /
-								(float)mp->c.usqtr);
-						break;
-					  case 0x58:	/* Time signature */
-						mp_read_time_sig(mp);
-						break;
-					  default:
-						for(i = 0; i < l; i++)
-							midiprintf2(D2LOG, "%2lX ", getnext(mp, 1));
-						break;
-					}
-					midiprintf(D2LOG, "}\n");
-					break;
-				}
-				break;
-			  default:
-				/* if we get down here, an error occurred */
-				log_printf(ELOG, "a_midifile.c: INTERNAL ERROR;"
-						" illegal status byte!\n");
-				break;
-			}
-
-			if(mt->c.on)
-				mt->c.iwait = getval(mp);
-
-			mt->c.pos = mp->pos;
-
-			midiprintf2(D2LOG, "\n");
+			mf_event_t *ev = mf->events + mp->pos++;
+			if(ms->timestamp)
+				ms->timestamp(done + ev->frame - mp->time);
+			mp_send(mp, ev);
 		}
-	} while(ret);
-
-	/* Find first track to play */
-	mp->c.iwait = 1000000000;	/* Bigger than any wait can be! */
-	FOR_TRACKS_ON
-		if(mp->track[trk].c.iwait < mp->c.iwait)
-			mp->c.iwait = mp->track[trk].c.iwait;
-
-	if(1000000000 == mp->c.iwait)
-	{
-		/* No tracks playing! */
-		mp->c.iwait = 0;
-		mp->c.fwait = 1000;
-		return 0;
-	}
-
-	/* Calculate time to next event */
-	mp->c.fwait = mp->c.iwait * mp->c.spulse;
-	midiprintf2(D2LOG, "fwait = %f\n", mp->c.fwait);
-
-	/* Update "track timers" and check if any tracks are playing */
-	ret = 0;
-	midiprintf2(D2LOG, "Wait:  ");
-	FOR_TRACKS_ON
-	{
-		ret = 1;
-		mp->track[trk].c.iwait -= mp->c.iwait;
-		midiprintf2(D2LOG, "%d:%ld  ", trk, mp->track[trk].c.iwait);
-	}
-	midiprintf2(D2LOG, "\n");
-
-	/* Update song time */
-	mp->c.time += mp->c.iwait;
-
-	midiprintf2(D2LOG, "----------------------------\n");
-	return ret;
-}
-#undef	FOR_TRACKS_ON
-
-
-int mp_play(midi_player_t *mp, float dt)
-{
-	if(!mp->mf)
-		return 0;
-	while(dt > 0.0)
-	{
-		if(dt < mp->c.fwait)
+		done += end - mp->time;
+		mp->time = end;
+		if(!wrap)
+			break;
+		if(!mf->looped)
 		{
-			mp->c.fwait -= dt;
-			return 1;
+			midiprintf(D2LOG, "mp_play(): End of song\n");
+			mp->mf = NULL;
+			res = 0;
+			break;
 		}
-		dt -= mp->c.fwait;
-		if(!mp_update(mp))
-			return 0;
+		midiprintf(D2LOG, "mp_play(): Loop\n");
+		mp->pos = mf->loop_start;
+		mp->time = mf->loop_frame;
+		if(done >= frames)
+			break;
 	}
-	return 1;
+	if(ms->timestamp)
+		ms->timestamp(0);
+	return res;
 }
 
 
@@ -702,89 +753,8 @@ void mp_stop(midi_player_t *mp)
 
 void mp_rewind(midi_player_t *mp, unsigned subsong)
 {
-	unsigned i;
-	int len;
-
-	if(!mp->mf)
-		return;
-
 	mp->pos = 0;
-	set_tempo(mp, 250, (unsigned)(1000.0 / (120.0/60.0)));
-	mp->c.time = 0;
-	mp->c.fwait = 0;
-	mp->c.iwait = 0;
-	mp->mf->subsongs = 1;
-
-	for(i = 0; i < 16; i++)
-	{
-		mp->track[i].tend = 0;
-		mp->track[i].spos = 0;
-		mp->track[i].c.pos = 0;
-		mp->track[i].c.iwait = 0;
-		mp->track[i].c.on = 0;
-		mp->track[i].c.pv = 0;
-	}
-
-	len = readheader(mp, "MThd");
-	if(len < 0)
-	{
-		log_printf(ELOG, "mp_rewind(): Is this a MIDI file...?\n");
-		mp->mf = NULL;
-		return;
-	}
-	midiprintf(D2LOG, "header length:%d\n", len);
-	if(len >= 6)
-	{
-		mp->mf->format = getnext(mp, 2);
-		mp->mf->tracks = getnext(mp, 2);
-		set_tempo(mp, getnext(mp, 2), mp->c.usqtr);
-		midiprintf(D2LOG, "format:%u\n", mp->mf->format);
-		midiprintf(D2LOG, "tracks:%u\n", mp->mf->tracks);
-		midiprintf(D2LOG, "  ppqn:%u\n", mp->c.ppqn);
-		if(0 == mp->mf->format)
-			mp->mf->tracks = 1;
-	}
-	else
-	{
-		log_printf(ELOG, "mp_rewind(): WARNING: Short header!\n");
-		mp->mf->format = 0;
-		mp->mf->tracks = 1;
-	}
-	if(len > 6)
-		getnext(mp, (unsigned)(len - 6)); /* Skip rest of header */
-	if(mp->mf->tracks > 16)
-	{
-		log_printf(ELOG, "mp_rewind(): WARNING: Too many tracks!\n");
-		mp->mf->tracks = 16;
-	}
-	for(i = 0; i < mp->mf->tracks; ++i)
-	{
-		len = readheader(mp, "MTrk");
-		if(len < 0)
-		{
-			log_printf(ELOG, "mp_rewind(): Bad MIDI file!\n");
-			mp->mf = NULL;
-			return;
-		}
-		mp->track[i].enabled = 1;
-		mp->track[i].c.on = 1;
-		mp->track[i].spos = mp->pos;
-		mp->track[i].tend = mp->pos + len;
-		midiprintf(D2LOG, "track %u; start:%u length:%d\n",
-				i, mp->track[i].spos, len);
-		getnext(mp, (unsigned)len);
-	}
-
-	for(i = 0; i < 16; i++)
-		if(mp->track[i].enabled)
-		{
-			mp->track[i].c.pos = mp->track[i].spos;
-			mp->track[i].c.pv = 0;
-			mp->track[i].c.iwait = 0;
-			mp->track[i].loop_start = mp->track[i].c;
-		}
-
-	mp->doing = 1;
+	mp->time = 0;
 }
 
 
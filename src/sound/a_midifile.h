@@ -19,6 +19,12 @@
  *		* Fixed various stuff that Splint whines about.
  *		* Added musical time printout function.
  *
+ * 20070402:	Files are now compiled into flat, time sorted
+ *		event arrays at load time, with tempo applied,
+ *		so the player just walks an index. Timestamps
+ *		are passed on to the midisock, for sample
+ *		accurate timing regardless of buffer size.
+ *
  * Below is the original copyright. Of course, the LGPL
  * license still applies.
 ------------------------------------------------------------
@@ -52,6 +58,19 @@
 	midi_file_t
 ----------------------------------------------------------*/
 
+/*
+ * Compiled MIDI event. Tracks are merged and tempo changes
+ * applied at load time, so 'frame' is the absolute time of
+ * the event in audio frames from the start of the song.
+ */
+typedef struct mf_event_t
+{
+	unsigned	frame;
+	unsigned char	status;
+	unsigned char	data1;
+	unsigned char	data2;
+} mf_event_t;
+
 typedef struct midi_file_t
 {
 	const char	*author;
@@ -61,10 +80,24 @@ typedef struct midi_file_t
 	unsigned	subsongs;
 	unsigned	format;
 	unsigned	tracks;
+	unsigned	ppqn;
 	unsigned char	*data;
+
+	/* Compiled event stream */
+	float		rate;		/* Frame rate used for compiling */
+	mf_event_t	*events;	/* Channel events; sorted by time */
+	unsigned	nevents;
+	unsigned	end;		/* End of song (or loop) frame */
+	int		looped;		/* 1 if there's a #LOOP_END marker */
+	unsigned	loop_start;	/* Loop start event index */
+	unsigned	loop_frame;	/* Loop start frame */
 } midi_file_t;
 
-midi_file_t *mf_open(const char *name);
+/*
+ * Load MIDI file 'name' and compile it into an event stream,
+ * with timestamps in frames at frame rate 'fs'.
+ */
+midi_file_t *mf_open(const char *name, float fs);
 void mf_close(midi_file_t *mf);
 
 
@@ -72,54 +105,12 @@ void mf_close(midi_file_t *mf);
 	midi_player_t
 ----------------------------------------------------------*/
 
-typedef struct mp_track_context_t
-{
-	int		on;
-	unsigned	pos;
-	unsigned	iwait;
-	unsigned char	pv;
-} mp_track_context_t;
-
-
-typedef struct mp_track_t
-{
-	int			enabled;
-	unsigned		tend;
-	unsigned		spos;
-	mp_track_context_t	c;
-	mp_track_context_t	loop_start;
-} mp_track_t;
-
-
-typedef struct mp_timesig_t
-{
-	unsigned char	beats;
-	unsigned char	value;
-	unsigned char	clock;
-	unsigned char	qn;
-} mp_timesig_t;
-
-typedef struct mp_context_t
-{
-	unsigned	ppqn;		/* Pulses Per Quarter Note */
-	unsigned	usqtr;		/* microseconds per quarter note */
-	float		spulse;		/* seconds per pulse */
-	mp_timesig_t	timesig;
-	unsigned	time;		/* Current position in pulses */
-	unsigned	iwait;		/* Pulses to next event */
-	float		fwait;		/* Seconds to next event */
-} mp_context_t;
-
-
 typedef struct midi_player_t
 {
 	midisock_t	*sock;
 	midi_file_t	*mf;
-	unsigned	pos;
-	mp_context_t	c;
-	mp_context_t	loop_start;
-	mp_track_t	track[16];
-	int		doing;
+	unsigned	pos;		/* Next event index */
+	unsigned	time;		/* Current song position (frames) */
 	int		pitch;
 } midi_player_t;
 
@@ -130,11 +121,13 @@ void mp_close(midi_player_t *mp);
 /* Select a previously loaded MIDI file for playback */
 int mp_select(midi_player_t *mp, midi_file_t *midifile);
 
-/* Play all events until the next delay */
-int mp_update(midi_player_t *mp);
-
-/* Play all events until current_position + dt seconds */
-int mp_play(midi_player_t *mp, float dt);
+/*
+ * Play all events until current_position + 'frames' frames.
+ * Events are timestamped via the midisock 'timestamp' callback,
+ * if there is one, relative to the start of the current buffer.
+ * Returns 0 when the end of the song is reached.
+ */
+int mp_play(midi_player_t *mp, unsigned frames);
 
 /* Rewind to start of sub song 'subsong' */
 void mp_rewind(midi_player_t *mp, unsigned subsong);
@@ -34,6 +34,7 @@ static void dummy_control_change(unsigned ch, unsigned ctrl, unsigned amt) {}
 static void dummy_program_change(unsigned ch, unsigned prog) {}
 static void dummy_channel_pressure(unsigned ch, unsigned press) {}
 static void dummy_pitch_bend(unsigned ch, int amt) {}
+static void dummy_timestamp(unsigned frame) {}
 
 midisock_t dummy_midisock = {
 	dummy_note_off,
@@ -42,7 +43,8 @@ midisock_t dummy_midisock = {
 	dummy_control_change,
 	dummy_program_change,
 	dummy_channel_pressure,
-	dummy_pitch_bend
+	dummy_pitch_bend,
+	dummy_timestamp
 };
 
 
@@ -223,6 +225,11 @@ static void monitor_pitch_bend(unsigned ch, int amt)
 	log_printf(DLOG, "PitchBend(%u, %d)\n", ch, amt);
 }
 
+static void monitor_timestamp(unsigned frame)
+{
+	log_printf(DLOG, "Timestamp(%u)\n", frame);
+}
+
 midisock_t monitor_midisock = {
 	monitor_note_off,
 	monitor_note_on,
@@ -230,5 +237,6 @@ midisock_t monitor_midisock = {
 	monitor_control_change,
 	monitor_program_change,
 	monitor_channel_pressure,
-	monitor_pitch_bend
+	monitor_pitch_bend,
+	monitor_timestamp
 };
@@ -36,6 +36,11 @@ typedef struct midisock_t
 	void (*program_change)(unsigned ch, unsigned prog);
 	void (*channel_pressure)(unsigned ch, unsigned press);
 	void (*pitch_bend)(unsigned ch, int amt);
+	/*
+	 * Messages following this call are to take effect 'frame'
+	 * frames into the current buffer. Used by the sequencer.
+	 */
+	void (*timestamp)(unsigned frame);
 } midisock_t;
 
 /* These two can be assumed to have all callbacks defined - no NULLs. */
@@ -44,6 +44,17 @@
 #	define	__R		l
 #endif
 
+/*
+ * 8 bit mu-law data is decoded to 16 bits on the fly, by table
+ * lookup, and is otherwise handled exactly like 16 bit data.
+ * (__ULAW implies __16BIT.)
+ */
+#ifdef	__ULAW
+#	define	__IN(x)		ulawtab[in[x]]
+#else
+#	define	__IN(x)		in[x]
+#endif
+
 #ifdef	__16BIT
 #	define	__NORMALIZE	VOL_BITS
 #else
@@ -91,7 +102,9 @@ int vu;
 unsigned s;
 unsigned int sp = ((v->position << FREQ_BITS) & 0x7fffffff) +
 		(v->position_frac >> (32 - FREQ_BITS));
-#ifdef	__16BIT
+#ifdef	__ULAW
+Uint8 *in = (Uint8 *)(wavetab[v->c[VC_WAVE]].data.si8) +
+#elif defined(__16BIT)
 Sint16 *in = (Sint16 *)(wavetab[v->c[VC_WAVE]].data.si16) +
 #else
 Sint8 *in = (Sint8 *)(wavetab[v->c[VC_WAVE]].data.si8) +
@@ -108,9 +121,9 @@ Sint8 *in = (Sint8 *)(wavetab[v->c[VC_WAVE]].data.si8) +
 
 #ifdef AUDIO_USE_VU
 #ifdef __STEREO
-vu = in[__INDEX] + in[__INDEX+1];
+vu = __IN(__INDEX) + __IN(__INDEX+1);
 #else
-vu = in[__INDEX] << 1;
+vu = __IN(__INDEX) << 1;
 #endif
 #ifndef __16BIT
 vu <<= 8;
@@ -136,8 +149,8 @@ switch(v->c[VC_RESAMPLE])
 	__FOR_SAMPLES
 	{
 		unsigned ind = __INDEX;
-		int l = in[ind];
-		__ST(int r = in[ind + 1];)
+		int l = __IN(ind);
+		__ST(int r = __IN(ind + 1);)
 		__SND(int ss;)
 		out[s] += l * lvol >> __NORMALIZE;
 		out[s + 1] += __R * rvol >> __NORMALIZE;
@@ -169,10 +182,10 @@ switch(v->c[VC_RESAMPLE])
 		int l;
 		__ST(int r;)
 		__SND(int ss;)
-		ind = __INDEX; l  = in[ind]; __ST(r  = in[ind + 1];) sp += step;
-		ind = __INDEX; l += in[ind]; __ST(r += in[ind + 1];) sp += step;
-		ind = __INDEX; l += in[ind]; __ST(r += in[ind + 1];) sp += step;
-		ind = __INDEX; l += in[ind]; __ST(r += in[ind + 1];) sp += step;
+		ind = __INDEX; l  = __IN(ind); __ST(r  = __IN(ind + 1);) sp += step;
+		ind = __INDEX; l += __IN(ind); __ST(r += __IN(ind + 1);) sp += step;
+		ind = __INDEX; l += __IN(ind); __ST(r += __IN(ind + 1);) sp += step;
+		ind = __INDEX; l += __IN(ind); __ST(r += __IN(ind + 1);) sp += step;
 
 		l >>= 2;
 		__ST(r >>= 2);
@@ -201,10 +214,10 @@ switch(v->c[VC_RESAMPLE])
 		unsigned ind = __INDEX;
 		int frac = __FRAC;
 		int ifrac = __IFRAC(frac);
-		l = in[ind + __INDINC] * frac;
-		__ST(r = in[ind + 3] * frac;)
-		l += in[ind] * ifrac;
-		__ST(r += in[ind + 1] * ifrac;)
+		l = __IN(ind + __INDINC) * frac;
+		__ST(r = __IN(ind + 3) * frac;)
+		l += __IN(ind) * ifrac;
+		__ST(r += __IN(ind + 1) * ifrac;)
 		l >>= __FRACBITS;
 		__ST(r >>= __FRACBITS;)
 		out[s] += l * lvol >> __NORMALIZE;
@@ -227,19 +240,19 @@ switch(v->c[VC_RESAMPLE])
 		unsigned ind = __INDEX;
 		int frac = __FRAC;
 		int ifrac = __IFRAC(frac);
-		l = in[ind + __INDINC] * frac;
-		__ST(r = in[ind + 3] * frac;)
-		l += in[ind] * ifrac;
-		__ST(r += in[ind + 1] * ifrac;)
+		l = __IN(ind + __INDINC) * frac;
+		__ST(r = __IN(ind + 3) * frac;)
+		l += __IN(ind) * ifrac;
+		__ST(r += __IN(ind + 1) * ifrac;)
 		sp += step1;
 
 		ind = __INDEX;
 		frac = __FRAC;
 		ifrac = __IFRAC(frac);
-		l2 = in[ind + __INDINC] * frac;
-		__ST(r2 = in[ind + 3] * frac;)
-		l2 += in[ind] * ifrac;
-		__ST(r2 += in[ind + 1] * ifrac;)
+		l2 = __IN(ind + __INDINC) * frac;
+		__ST(r2 = __IN(ind + 3) * frac;)
+		l2 += __IN(ind) * ifrac;
+		__ST(r2 += __IN(ind + 1) * ifrac;)
 		sp += step2;
 
 		l = ((l >> 1) + (l2 >> 1)) >> __FRACBITS;
@@ -268,10 +281,10 @@ switch(v->c[VC_RESAMPLE])
 			unsigned ind = __INDEX;
 			int frac = __FRAC;
 			int ifrac = __IFRAC(frac);
-			ll = in[ind + __INDINC] * frac;
-			__ST(rr = in[ind + 3] * frac;)
-			ll += in[ind] * ifrac;
-			__ST(rr += in[ind + 1] * ifrac;)
+			ll = __IN(ind + __INDINC) * frac;
+			__ST(rr = __IN(ind + 3) * frac;)
+			ll += __IN(ind) * ifrac;
+			__ST(rr += __IN(ind + 1) * ifrac;)
 			l += ll >> over_shift;
 			__ST(r += rr >> over_shift;)
 			sp += step;
@@ -299,10 +312,10 @@ switch(v->c[VC_RESAMPLE])
 		int ind = __INDEX;
 		int frac = __FRAC;
 
-		lm1 = in[ind];
-		l = in[ind + __INDINC];
-		l1 = in[ind + __INDINC*2];
-		l2 = in[ind + __INDINC*3];
+		lm1 = __IN(ind);
+		l = __IN(ind + __INDINC);
+		l1 = __IN(ind + __INDINC*2);
+		l2 = __IN(ind + __INDINC*3);
 		a = (3 * (l-l1) - lm1 + l2) >> 1;
 		b = (l1 << 1) + lm1 - ((5*l + l2) >> 1);
 		c = (l1 - lm1) >> 1;
@@ -312,10 +325,10 @@ switch(v->c[VC_RESAMPLE])
 
 		sp += v->step;
 #ifdef	__STEREO
-		rm1 = in[ind + 1];
-		r = in[ind + 3];
-		r1 = in[ind + 5];
-		r2 = in[ind + 7];
+		rm1 = __IN(ind + 1);
+		r = __IN(ind + 3);
+		r1 = __IN(ind + 5);
+		r2 = __IN(ind + 7);
 		a = (3 * (r-r1) - rm1 + r2) >> 1;
 		b = (r1 << 1) + rm1 - ((5*r + r2) >> 1);
 		c = (r1 - rm1) >> 1;
@@ -348,6 +361,7 @@ v->position_frac &= (1<<(32-FREQ_BITS))-1;
 v->position_frac |= sp << (32-FREQ_BITS);
 
 #undef	__FOR_SAMPLES
+#undef	__IN
 #undef	__NORMALIZE
 #undef	__SND
 #undef	__ST
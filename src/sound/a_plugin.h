@@ -309,6 +309,17 @@ typedef struct audio_plugin_t
 			int *in, int *out, unsigned frames);
 	void (*process_m)(struct audio_plugin_t *p,
 			int *in, int *out, unsigned frames);
+
+	/*
+	 * Float versions of process() and process_r(), used
+	 * when the engine runs with float busses. These are
+	 * optional; the host treats plugins without them as
+	 * producing no output in that mode.
+	 */
+	void (*process_f)(struct audio_plugin_t *p,
+			float *buf, unsigned frames);
+	void (*process_r_f)(struct audio_plugin_t *p,
+			float *in, float *out, unsigned frames);
 } audio_plugin_t;
 
 
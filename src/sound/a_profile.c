@@ -0,0 +1,310 @@
+/*(LGPL)
+---------------------------------------------------------------------------
+	a_profile.c - Audio engine profiler
+---------------------------------------------------------------------------
+ * Copyright (C) 2002, 2003, 2007, David Olofson
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include "config.h"
+#include "kobolog.h"
+#include "audio.h"
+#include "a_profile.h"
+#include "a_events.h"
+
+#ifdef KOBO_HAVE_GETTIMEOFDAY
+#	include <sys/time.h>
+#elif defined(WIN32)
+#	include <windows.h>
+#endif
+
+
+int aprof_enabled = 0;
+
+static int aprof_used = 0;		/* Enabled since last reset? */
+static volatile int aprof_reset_pending = 0;
+static char *aprof_filename = NULL;
+
+/* Statistics */
+static Uint32 hist[APS_STAGES][APROF_BUCKETS];
+static Uint32 maxtime[APS_STAGES];
+static double sumtime[APS_STAGES];
+static Uint32 callbacks;
+static double sumperiod;
+static Uint32 late, missed, overloads;
+static Uint32 maxinterval;
+
+/* Callback timing state */
+static int have_last = 0;
+static Uint32 last_begin;
+static Uint32 period;
+
+static const char *stagenames[APS_STAGES] = {
+	"Async. Commands",
+	"MIDI Input",
+	"Sequencer",
+	"MIDI -> Control",
+	"Channel/Patch Proc.",
+	"Voice Mixer",
+	"Clearing Master Buf",
+	"Bus & Mixdown",
+	"Limiter Effect",
+	"32 -> 16 bit Conv",
+	"Total"
+};
+
+
+Uint32 aprof_timestamp(void)
+{
+#ifdef KOBO_HAVE_GETTIMEOFDAY
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (Uint32)tv.tv_sec * 1000000 + (Uint32)tv.tv_usec;
+#elif defined(WIN32)
+	static double scale = 0.0;
+	LARGE_INTEGER t;
+	if(!scale)
+	{
+		LARGE_INTEGER f;
+		if(!QueryPerformanceFrequency(&f) || !f.QuadPart)
+			return SDL_GetTicks() * 1000;
+		scale = 1000000.0 / (double)f.QuadPart;
+	}
+	QueryPerformanceCounter(&t);
+	return (Uint32)((double)t.QuadPart * scale);
+#else
+	return SDL_GetTicks() * 1000;
+#endif
+}
+
+
+static void aprof_clear(void)
+{
+	memset(hist, 0, sizeof(hist));
+	memset(maxtime, 0, sizeof(maxtime));
+	memset(sumtime, 0, sizeof(sumtime));
+	callbacks = 0;
+	sumperiod = 0.0;
+	late = missed = overloads = 0;
+	maxinterval = 0;
+	have_last = 0;
+}
+
+
+void aprof_open(void)
+{
+	aprof_clear();
+	aprof_reset_pending = 0;
+}
+
+
+void aprof_close(void)
+{
+	if(aprof_used && callbacks)
+		audio_profile_dump(aprof_filename);
+	aprof_enabled = 0;
+	aprof_used = 0;
+	aprof_clear();
+}
+
+
+void aprof_callback_begin(Uint32 now, unsigned frames, int samplerate)
+{
+	if(aprof_reset_pending)
+	{
+		aprof_clear();
+		aprof_reset_pending = 0;
+	}
+
+	period = (Uint32)((double)frames * 1000000.0 / samplerate);
+	if(have_last && period)
+	{
+		Uint32 dt = now - last_begin;
+		if(dt > maxinterval)
+			maxinterval = dt;
+		if(dt > period + period / 2)
+		{
+			++late;
+			if(dt >= period * 2)
+				missed += dt / period - 1;
+		}
+	}
+	last_begin = now;
+	have_last = 1;
+}
+
+
+void aprof_callback_end(Uint32 *us)
+{
+	int i;
+	for(i = 0; i < APS_STAGES; ++i)
+	{
+		Uint32 t = us[i];
+		int b = 0;
+		while(t && (b < APROF_BUCKETS - 1))
+		{
+			t >>= 1;
+			++b;
+		}
+		++hist[i][b];
+		if(us[i] > maxtime[i])
+			maxtime[i] = us[i];
+		sumtime[i] += us[i];
+	}
+	if(us[APS_TOTAL] > period)
+		++overloads;
+	sumperiod += period;
+	++callbacks;
+}
+
+
+/*----------------------------------------------------------
+	Public API
+----------------------------------------------------------*/
+
+void audio_profile(int enable)
+{
+	if(enable && !aprof_enabled)
+	{
+		have_last = 0;
+		aprof_used = 1;
+	}
+	aprof_enabled = enable;
+}
+
+
+void audio_profile_reset(void)
+{
+	if(aprof_enabled)
+		aprof_reset_pending = 1;
+	else
+		aprof_clear();
+}
+
+
+void audio_profile_file(const char *filename)
+{
+	free(aprof_filename);
+	aprof_filename = filename ? strdup(filename) : NULL;
+}
+
+
+static void aprof_print(FILE *f, const char *format, ...)
+{
+	char buf[256];
+	va_list args;
+	va_start(args, format);
+	vsnprintf(buf, sizeof(buf), format, args);
+	va_end(args);
+	buf[sizeof(buf) - 1] = 0;
+	if(f)
+		fputs(buf, f);
+	else
+		log_printf(ULOG, "%s", buf);
+}
+
+
+/* Returns the upper bound (us) of the bucket holding percentile 'pc'. */
+static Uint32 aprof_percentile(int stage, double pc)
+{
+	int b;
+	Uint32 n = 0;
+	Uint32 limit = (Uint32)(callbacks * pc);
+	for(b = 0; b < APROF_BUCKETS; ++b)
+	{
+		n += hist[stage][b];
+		if(n > limit)
+			break;
+	}
+	if(b >= APROF_BUCKETS - 1)
+		return maxtime[stage];
+	return b ? (1U << b) - 1 : 0;
+}
+
+
+int audio_profile_dump(const char *filename)
+{
+	int i, b;
+	FILE *f = NULL;
+	aev_poolstats_t ps;
+	if(filename)
+	{
+		f = fopen(filename, "w");
+		if(!f)
+		{
+			log_printf(ELOG, "audio_profile_dump(): Could not"
+					" create \"%s\"!\n", filename);
+			return -1;
+		}
+	}
+
+	aprof_print(f, "--- Audio engine profile -------------------\n");
+	aev_pool_stats(&ps);
+	aprof_print(f, "  Event pool: %d events, peak use %d;"
+			" %d blocks added, %d events lost\n",
+			ps.size, ps.peak, ps.added, ps.misses);
+	if(!callbacks)
+	{
+		aprof_print(f, "  No data recorded.\n");
+		if(f)
+			fclose(f);
+		return 0;
+	}
+	aprof_print(f, "  %u callbacks, average period %.0f us\n",
+			callbacks, sumperiod / callbacks);
+	aprof_print(f, "  %u late, ~%u missed, %u overloaded callbacks;"
+			" longest interval %u us\n",
+			late, missed, overloads, maxinterval);
+	aprof_print(f, "  %-20s %8s %8s %8s\n",
+			"Stage", "avg us", "p99 us", "max us");
+	for(i = 0; i < APS_STAGES; ++i)
+		aprof_print(f, "  %-20s %8.1f %8u %8u\n", stagenames[i],
+				sumtime[i] / callbacks,
+				aprof_percentile(i, 0.99), maxtime[i]);
+
+	aprof_print(f, "  Histograms (callbacks per <N us bucket):\n");
+	for(i = 0; i < APS_STAGES; ++i)
+	{
+		char buf[256];
+		int pos;
+		pos = snprintf(buf, sizeof(buf), "  %-20s", stagenames[i]);
+		for(b = 0; b < APROF_BUCKETS; ++b)
+		{
+			if(!hist[i][b])
+				continue;
+			if(pos >= (int)sizeof(buf) - 24)
+				break;
+			if(b == APROF_BUCKETS - 1)
+				pos += snprintf(buf + pos, sizeof(buf) - pos,
+						" >=%u:%u", 1U << (b - 1),
+						hist[i][b]);
+			else
+				pos += snprintf(buf + pos, sizeof(buf) - pos,
+						" <%u:%u", 1U << b, hist[i][b]);
+		}
+		aprof_print(f, "%s\n", buf);
+	}
+	aprof_print(f, "--------------------------------------------\n");
+
+	if(f)
+		fclose(f);
+	return 0;
+}
@@ -0,0 +1,78 @@
+/*(LGPL)
+---------------------------------------------------------------------------
+	a_profile.h - Audio engine profiler
+---------------------------------------------------------------------------
+ * Copyright (C) 2002, 2003, 2007, David Olofson
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * The profiler is always compiled in, but does nothing
+ * but test 'aprof_enabled' once per engine callback
+ * unless enabled with audio_profile().
+ *
+ * Each callback adds one sample per stage to a histogram
+ * with power-of-two microsecond buckets. Bucket 0 counts
+ * 0 us, and bucket n counts times in [2^(n-1), 2^n) us.
+ *
+ * The time between callbacks is checked against the
+ * nominal buffer period, to count late callbacks, and
+ * estimate the number of missed ones. Callbacks taking
+ * longer than the period to process are counted as
+ * overloads.
+ */
+
+#ifndef _A_PROFILE_H_
+#define _A_PROFILE_H_
+
+#include "a_types.h"
+
+typedef enum aprof_stages_t
+{
+	APS_COMMANDS = 0,	/* Async. commands */
+	APS_MIDI,		/* MIDI input */
+	APS_SEQUENCER,		/* MIDI file player */
+	APS_MIDICON,		/* MIDI -> control */
+	APS_CHANNELS,		/* Channel/patch processing */
+	APS_VOICES,		/* Voice mixer */
+	APS_CLEAR,		/* Clearing master buffer */
+	APS_BUSSES,		/* Bus processing & mixdown */
+	APS_LIMITER,		/* Master limiter */
+	APS_CONVERT,		/* 32 -> 16 bit conversion */
+	APS_TOTAL,		/* All of the above */
+	APS_STAGES
+} aprof_stages_t;
+
+#define	APROF_BUCKETS	24
+
+extern int aprof_enabled;
+
+void aprof_open(void);
+void aprof_close(void);
+
+/* Microsecond timestamp. Wraps! */
+Uint32 aprof_timestamp(void);
+
+/*
+ * Call at the start of every engine callback, with the
+ * number of frames to generate and the sample rate.
+ */
+void aprof_callback_begin(Uint32 now, unsigned frames, int samplerate);
+
+/* Add the times in 'us' (one per stage) for one callback. */
+void aprof_callback_end(Uint32 *us);
+
+#endif /* _A_PROFILE_H_ */
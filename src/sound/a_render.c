@@ -0,0 +1,318 @@
+/*(LGPL)
+---------------------------------------------------------------------------
+	a_render.c - Command recording and offline rendering
+---------------------------------------------------------------------------
+ * Copyright (C) 2007, David Olofson
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "kobolog.h"
+#include "a_globals.h"
+#include "a_render.h"
+#include "a_profile.h"
+
+/* Frames per audio_render() call */
+#define	RENDER_FRAMES	1024
+
+/* Indexed by command_t action; CMD_WAIT is never recorded. */
+static const char *arender_actions[] = {
+	"stop",
+	"stopall",
+	"play",
+	"play2d",
+	"cc",
+	"gc",
+	"mc",
+	NULL
+};
+
+
+/*----------------------------------------------------------
+	Recording
+----------------------------------------------------------*/
+
+int arender_recording = 0;
+static FILE *rec_file = NULL;
+static Uint32 rec_start = 0;
+static int rec_count = 0;
+
+void arender_record(command_t *cmd)
+{
+	Uint32 now = SDL_GetTicks();
+	if(!rec_file || (cmd->action == CMD_WAIT))
+		return;
+	if(!rec_count)
+		rec_start = now;
+	fprintf(rec_file, "%u %s %d %d %d %d %d %d\n", now - rec_start,
+			arender_actions[cmd->action], cmd->cid, cmd->tag,
+			cmd->index, cmd->arg1, cmd->arg2, cmd->arg3);
+	++rec_count;
+}
+
+
+int audio_record(const char *filename)
+{
+	if(rec_file)
+	{
+		arender_recording = 0;
+		fclose(rec_file);
+		rec_file = NULL;
+		log_printf(VLOG, "Recorded %d audio commands.\n", rec_count);
+	}
+	if(!filename || !filename[0])
+		return 0;
+
+	rec_file = fopen(filename, "w");
+	if(!rec_file)
+	{
+		log_printf(ELOG, "Couldn't create audio command file"
+				" \"%s\"!\n", filename);
+		return -1;
+	}
+	fprintf(rec_file, "# Audio engine command list\n");
+	fprintf(rec_file, "# <ms> <action> <cid> <tag> <index>"
+			" <arg1> <arg2> <arg3>\n");
+	rec_count = 0;
+	arender_recording = 1;
+	log_printf(VLOG, "Recording audio commands to \"%s\".\n", filename);
+	return 0;
+}
+
+
+/*----------------------------------------------------------
+	WAV output
+----------------------------------------------------------*/
+
+static void put16(Uint8 *p, unsigned v)
+{
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+}
+
+static void put32(Uint8 *p, Uint32 v)
+{
+	put16(p, v & 0xffff);
+	put16(p + 2, v >> 16);
+}
+
+/* 16 bit stereo PCM; RIFF header for 'frames' frames. */
+static int wav_header(FILE *f, int rate, Uint32 frames)
+{
+	Uint8 h[44];
+	memcpy(h, "RIFF", 4);
+	put32(h + 4, 36 + frames * 4);
+	memcpy(h + 8, "WAVEfmt ", 8);
+	put32(h + 16, 16);		/* fmt chunk size */
+	put16(h + 20, 1);		/* PCM */
+	put16(h + 22, 2);		/* Channels */
+	put32(h + 24, rate);
+	put32(h + 28, rate * 4);	/* Bytes per second */
+	put16(h + 32, 4);		/* Bytes per frame */
+	put16(h + 34, 16);		/* Bits per sample */
+	memcpy(h + 36, "data", 4);
+	put32(h + 40, frames * 4);
+	if(fwrite(h, sizeof(h), 1, f) != 1)
+		return -1;
+	return 0;
+}
+
+
+/*----------------------------------------------------------
+	Rendering
+----------------------------------------------------------*/
+
+typedef struct
+{
+	FILE		*f;
+	Uint32		pos;		/* Frames rendered */
+	Uint32		cpu;		/* Time spent rendering (us) */
+	Sint16		buf[RENDER_FRAMES * 2];
+	Uint8		out[RENDER_FRAMES * 4];
+} arender_t;
+
+/* Render up to frame 'target' and write it to the WAV file. */
+static int render_to(arender_t *r, Uint32 target)
+{
+	while(r->pos < target)
+	{
+		unsigned i;
+		Uint32 t;
+		unsigned frames = target - r->pos;
+		if(frames > RENDER_FRAMES)
+			frames = RENDER_FRAMES;
+		t = aprof_timestamp();
+		if(audio_render(r->buf, frames) < 0)
+		{
+			log_printf(ELOG, "Audio engine not started"
+					" for offline rendering!\n");
+			return -1;
+		}
+		r->cpu += aprof_timestamp() - t;
+		for(i = 0; i < frames * 2; ++i)
+			put16(r->out + i * 2, (Uint16)r->buf[i]);
+		if(fwrite(r->out, frames * 4, 1, r->f) != 1)
+		{
+			log_printf(ELOG, "Couldn't write audio output!\n");
+			return -2;
+		}
+		r->pos += frames;
+	}
+	return 0;
+}
+
+
+/* Returns 1 if 'cmd' addresses an existing channel, group or bus. */
+static int check_target(command_t *cmd)
+{
+	switch(cmd->action)
+	{
+	  case CMD_STOP_ALL:
+		return 1;
+	  case CMD_GCONTROL:
+		return (cmd->cid >= 0) && (cmd->cid < AUDIO_MAX_GROUPS);
+	  case CMD_MCONTROL:
+		return (cmd->cid >= 0) && (cmd->cid < AUDIO_MAX_BUSSES);
+	  default:
+		return (cmd->cid >= 0) && (cmd->cid < AUDIO_MAX_CHANNELS);
+	}
+}
+
+
+int audio_render_script(const char *script, const char *wavfile, int tail)
+{
+	FILE *sf;
+	arender_t *r;
+	char line[256];
+	int lineno = 0;
+	int commands_run = 0;
+	int ms = 0;
+	int res = 0;
+	int rate = a_settings.samplerate;
+
+	sf = fopen(script, "r");
+	if(!sf)
+	{
+		log_printf(ELOG, "Couldn't open audio command file"
+				" \"%s\"!\n", script);
+		return -1;
+	}
+	r = (arender_t *)calloc(1, sizeof(arender_t));
+	if(!r)
+	{
+		fclose(sf);
+		return -2;
+	}
+	r->f = fopen(wavfile, "wb");
+	if(!r->f || (wav_header(r->f, rate, 0) < 0))
+	{
+		log_printf(ELOG, "Couldn't create WAV file \"%s\"!\n",
+				wavfile);
+		if(r->f)
+			fclose(r->f);
+		free(r);
+		fclose(sf);
+		return -3;
+	}
+
+	log_printf(VLOG, "Rendering \"%s\" to \"%s\"...\n", script, wavfile);
+	while(fgets(line, sizeof(line), sf))
+	{
+		command_t cmd;
+		char action[16];
+		int cid = 0, tag = 0, index = 0;
+		int n, a;
+		++lineno;
+		if(sscanf(line, " %15s", action) < 1 || action[0] == '#')
+			continue;
+		memset(&cmd, 0, sizeof(cmd));
+		n = sscanf(line, "%d %15s %d %d %d %d %d %d", &ms, action,
+				&cid, &tag, &index,
+				&cmd.arg1, &cmd.arg2, &cmd.arg3);
+		if(n < 2)
+		{
+			log_printf(WLOG, "%s:%d: Syntax error!\n", script,
+					lineno);
+			continue;
+		}
+		for(a = 0; arender_actions[a]; ++a)
+			if(!strcmp(action, arender_actions[a]))
+				break;
+		if(!arender_actions[a])
+		{
+			log_printf(WLOG, "%s:%d: Unknown action \"%s\"!\n",
+					script, lineno, action);
+			continue;
+		}
+		cmd.action = a;
+		cmd.cid = (signed char)cid;
+		cmd.tag = tag;
+		cmd.index = (unsigned char)index;
+		if((cid != cmd.cid) || !check_target(&cmd))
+		{
+			log_printf(WLOG, "%s:%d: Target out of range!\n",
+					script, lineno);
+			continue;
+		}
+
+		/*
+		 * Commands are handled at the start of the next
+		 * callback, so we render right up to the command
+		 * time. If the FIFO is full, we render one frame
+		 * to let the engine drain it.
+		 */
+		if(ms < 0)
+			ms = 0;
+		res = render_to(r, (Uint32)((double)ms * rate / 1000.0));
+		if(!res && (sfifo_space(&commands) < sizeof(command_t)))
+			res = render_to(r, r->pos + 1);
+		if(res < 0)
+			break;
+		sfifo_write(&commands, &cmd, (unsigned)sizeof(command_t));
+		++commands_run;
+	}
+	fclose(sf);
+
+	if(!res)
+	{
+		if(tail < 0)
+			tail = 0;
+		res = render_to(r, r->pos +
+				(Uint32)((double)tail * rate / 1000.0));
+	}
+	if(!res)
+	{
+		rewind(r->f);
+		if(wav_header(r->f, rate, r->pos) < 0)
+			res = -4;
+	}
+	if(fclose(r->f) != 0)
+		res = -4;
+	if(res < 0)
+		log_printf(ELOG, "Rendering to \"%s\" failed!\n", wavfile);
+	else
+		log_printf(ULOG, "Rendered %d commands; %.2f s of audio in"
+				" %.2f s (%.1fx real time)\n",
+				commands_run, (double)r->pos / rate,
+				r->cpu * 0.000001, r->cpu ?
+				(double)r->pos / rate / (r->cpu * 0.000001) :
+				0.0);
+	free(r);
+	return res;
+}
@@ -0,0 +1,33 @@
+/*(LGPL)
+---------------------------------------------------------------------------
+	a_render.h - Command recording and offline rendering
+---------------------------------------------------------------------------
+ * Copyright (C) 2007, David Olofson
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef _A_RENDER_H_
+#define _A_RENDER_H_
+
+#include "a_commands.h"
+
+/* Set while audio_record() is active */
+extern int arender_recording;
+
+/* Write 'cmd' to the recording. (Called from the API thread.) */
+void arender_record(command_t *cmd);
+
+#endif /* _A_RENDER_H_ */
@@ -19,6 +19,7 @@
  * Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
  */
 
+#include "kobolog.h"
 #include "a_globals.h"
 #include "a_struct.h"
 
@@ -66,6 +67,10 @@ int sequencer_play(midi_file_t *mf, int tag, int pitch, int volume)
 	if(!midiplayer)
 		return -1;
 
+	if(mf->rate != fs)
+		log_printf(WLOG, "sequencer_play(): MIDI file compiled for"
+				" %.0f Hz; engine running at %.0f Hz!\n",
+				mf->rate, fs);
 	midiplayer->pitch = pitch - (60 << 16);
 	mp_select(midiplayer, mf);
 	return 0;
@@ -95,10 +100,10 @@ void sequencer_process(unsigned frames)
 {
 	int i;
 	aev_client("sequencer_process()");
-	if(!midiplayer)
+	if(!midiplayer || !midiplayer->mf)
 		return;
 
-	if(mp_play(midiplayer, (float)frames / fs))
+	if(mp_play(midiplayer, frames))
 		return;
 
 	for(i = 0; i < AUDIO_MAX_CHANNELS; ++i)
@@ -263,4 +263,55 @@ static inline void _fastmix32(Sint32 *from, Sint32 *to, int vol, unsigned sample
 	} while(s < samples);
 }
 
+
+/*----------------------------------------------------------
+	Float Buffer Tools
+------------------------------------------------------------
+ * Used by the float32 bus pipeline. Samples are in the
+ * same scale as the integer busses; 1.0 is one 16 bit
+ * output LSB. These are plain loops over flat arrays, so
+ * that the compiler can vectorize them.
+ */
+
+#define	f32clear(buf, frames)		memset((buf), 0, (frames) << 3)
+
+/*
+ * Add stereo integer buffer 'from' to float buffer 'to', and
+ * clear 'from'.
+ */
+static inline void s32tof32move(Sint32 *from, float *to, unsigned frames)
+{
+	unsigned s;
+	frames <<= 1;
+	for(s = 0; s < frames; ++s)
+		to[s] += (float)from[s];
+	memset(from, 0, frames * sizeof(Sint32));
+}
+
+/*
+ * Stereo float version of s32mix(). 'vol' is 16:16 fixp, as
+ * for s32mix(), and the same cutoff level applies.
+ */
+static inline int f32mix(float *from, float *to, int vol, unsigned frames)
+{
+	unsigned s;
+	float g;
+	if(!(vol >> 8))
+		return 0;
+	g = (float)vol * (1.0f / 65536.0f);
+	frames <<= 1;
+	for(s = 0; s < frames; ++s)
+		to[s] += from[s] * g;
+	return 1;
+}
+
+/*
+ * Denormal protection for recursive filter states and the
+ * like. Anything this far below one LSB is just noise.
+ */
+static inline float f32flush(float x)
+{
+	return (x > -1e-10f) && (x < 1e-10f) ? 0.0f : x;
+}
+
 #endif /*_A_TOOLS_H_*/
@@ -261,6 +261,7 @@ static inline void __mix_m8(audio_voice_t *v, int *out, unsigned frames)
 #undef	__SEND
 #undef	__STEREO
 #undef	__16BIT
+#undef	__ULAW
 #include "a_mixers.h"
 }
 
@@ -269,6 +270,7 @@ static inline void __mix_s8(audio_voice_t *v, int *out, unsigned frames)
 #undef	__SEND
 #define	__STEREO
 #undef	__16BIT
+#undef	__ULAW
 #include "a_mixers.h"
 }
 
@@ -277,6 +279,7 @@ static inline void __mix_m16(audio_voice_t *v, int *out, unsigned frames)
 #undef	__SEND
 #undef	__STEREO
 #define	__16BIT
+#undef	__ULAW
 #include "a_mixers.h"
 }
 
@@ -285,6 +288,26 @@ static inline void __mix_s16(audio_voice_t *v, int *out, unsigned frames)
 #undef	__SEND
 #define	__STEREO
 #define	__16BIT
+#undef	__ULAW
+#include "a_mixers.h"
+}
+
+
+static inline void __mix_mu(audio_voice_t *v, int *out, unsigned frames)
+{
+#undef	__SEND
+#undef	__STEREO
+#define	__16BIT
+#define	__ULAW
+#include "a_mixers.h"
+}
+
+static inline void __mix_su(audio_voice_t *v, int *out, unsigned frames)
+{
+#undef	__SEND
+#define	__STEREO
+#define	__16BIT
+#define	__ULAW
 #include "a_mixers.h"
 }
 
@@ -294,6 +317,7 @@ static inline void __mix_m8d(audio_voice_t *v, int *out, int *sout, unsigned fra
 #define	__SEND
 #undef	__STEREO
 #undef	__16BIT
+#undef	__ULAW
 #include "a_mixers.h"
 }
 
@@ -302,6 +326,7 @@ static inline void __mix_s8d(audio_voice_t *v, int *out, int *sout, unsigned fra
 #define	__SEND
 #define	__STEREO
 #undef	__16BIT
+#undef	__ULAW
 #include "a_mixers.h"
 }
 
@@ -310,6 +335,7 @@ static inline void __mix_m16d(audio_voice_t *v, int *out, int *sout, unsigned fr
 #define	__SEND
 #undef	__STEREO
 #define	__16BIT
+#undef	__ULAW
 #include "a_mixers.h"
 }
 
@@ -318,12 +344,32 @@ static inline void __mix_s16d(audio_voice_t *v, int *out, int *sout, unsigned fr
 #define	__SEND
 #define	__STEREO
 #define	__16BIT
+#undef	__ULAW
+#include "a_mixers.h"
+}
+
+static inline void __mix_mud(audio_voice_t *v, int *out, int *sout, unsigned frames)
+{
+#define	__SEND
+#undef	__STEREO
+#define	__16BIT
+#define	__ULAW
+#include "a_mixers.h"
+}
+
+static inline void __mix_sud(audio_voice_t *v, int *out, int *sout, unsigned frames)
+{
+#define	__SEND
+#define	__STEREO
+#define	__16BIT
+#define	__ULAW
 #include "a_mixers.h"
 }
 
 #undef	__SEND
 #undef	__STEREO
 #undef	__16BIT
+#undef	__ULAW
 
 
 /*
@@ -355,7 +401,7 @@ static inline unsigned int __calc_step(audio_voice_t *v)
 			step >>= 1;
 	}
 
-	switch(a_settings.quality)
+	switch(a_settings.cur_quality)
 	{
 	  case AQ_VERY_LOW:
 		mode = AR_NEAREST;
@@ -469,10 +515,16 @@ static inline void __fragment_single(audio_voice_t *v, int *out,
 		__mix_s8(v, out, frames);
 		break;
 	  case AF_MONO16:
-		__mix_m16(v, out, frames);
+		if(wavetab[v->wave].ulaw)
+			__mix_mu(v, out, frames);
+		else
+			__mix_m16(v, out, frames);
 		break;
 	  case AF_STEREO16:
-		__mix_s16(v, out, frames);
+		if(wavetab[v->wave].ulaw)
+			__mix_su(v, out, frames);
+		else
+			__mix_s16(v, out, frames);
 		break;
 	  case AF_MONO32:
 		/*__mix_m32(v, out, frames);*/
@@ -497,10 +549,16 @@ static inline void __fragment_double(audio_voice_t * v, int *out, int *sout,
 		__mix_s8d(v, out, sout, frames);
 		break;
 	  case AF_MONO16:
-		__mix_m16d(v, out, sout, frames);
+		if(wavetab[v->wave].ulaw)
+			__mix_mud(v, out, sout, frames);
+		else
+			__mix_m16d(v, out, sout, frames);
 		break;
 	  case AF_STEREO16:
-		__mix_s16d(v, out, sout, frames);
+		if(wavetab[v->wave].ulaw)
+			__mix_sud(v, out, sout, frames);
+		else
+			__mix_s16d(v, out, sout, frames);
 		break;
 	  case AF_MONO32:
 		/*__mix_m32d(v, out, sout, frames);*/
@@ -676,6 +734,19 @@ void voice_process_all(int *bufs[], unsigned frames)
 }
 
 
+void voice_update_quality(void)
+{
+	int i;
+	for(i = 0; i < AUDIO_MAX_VOICES; ++i)
+	{
+		audio_voice_t *v = voicetab + i;
+		if(VS_STOPPED == v->state)
+			continue;
+		v->step = __calc_step(v);
+	}
+}
+
+
 static int _is_open = 0;
 
 void audio_voice_open(void)
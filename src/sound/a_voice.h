@@ -193,6 +193,12 @@ void voice_process_mix(audio_voice_t *v, int *busses[], unsigned frames);
 /* Process all voices. Simple, eh? */
 void voice_process_all(int *busses[], unsigned frames);
 
+/*
+ * Reselect resampling modes for all playing voices, after
+ * a_settings.cur_quality has been changed.
+ */
+void voice_update_quality(void);
+
 void audio_voice_open(void);
 void audio_voice_close(void);
 
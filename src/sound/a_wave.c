@@ -23,6 +23,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "config.h"
+#ifdef KOBO_HAVE_MMAP
+#	include <sys/mman.h>
+#	include <unistd.h>
+#endif
 #include "kobolog.h"
 #include "a_globals.h"
 #include "a_wave.h"
@@ -34,12 +39,16 @@
 
 static int _was_init = 0;
 
+static void _ulaw_init(void);
+static void _free_data(int wid);
+
 void audio_wave_open(void)
 {
 	if(_was_init)
 		return;
 
 	memset(wavetab, 0, sizeof(wavetab));
+	_ulaw_init();
 	_was_init = 1;
 }
 
@@ -118,6 +127,114 @@ static void _calc_info(int wid)
 }
 
 
+/*
+ * mu-law (G.711) compression. 14 bits of dynamic range in 8 bit
+ * codes, with the quantization step growing with the signal level,
+ * and cheap random access decoding through a 256 entry table, which
+ * is what the voice mixers need for resampling and looping.
+ */
+Sint16 ulawtab[256];
+
+static void _ulaw_init(void)
+{
+	int i;
+	for(i = 0; i < 256; ++i)
+	{
+		int u = ~i;
+		int e = (u >> 4) & 7;
+		int s = ((((u & 0x0f) << 3) + 0x84) << e) - 0x84;
+		ulawtab[i] = (u & 0x80) ? -s : s;
+	}
+}
+
+
+/*
+ * Encode one sample. ulawtab[] decodes to the middle of each step,
+ * so truncating is right, except just above segment boundaries,
+ * where the last code of the segment below may be closer.
+ */
+static Uint8 _ulaw_encode(int s)
+{
+	int e, m, a;
+	int sign = 0;
+	if(s < 0)
+	{
+		s = -s;
+		sign = 0x80;
+	}
+	if(s > 32635)
+		s = 32635;
+	a = s;
+	s += 0x84;
+	for(e = 7; (e > 0) && !(s & (0x80 << e)); --e)
+		;
+	m = (e << 4) | ((s >> (e + 3)) & 0x0f);
+
+	/* ulawtab[0xff - m] is the decoded magnitude of 'm' */
+	if((m > 0) && (a - ulawtab[0x100 - m] < ulawtab[0xff - m] - a))
+		--m;
+	return (Uint8)~(sign | m);
+}
+
+
+/* Give a mapped wave a private copy of its data. */
+static int _unmap(int wid)
+{
+#ifdef KOBO_HAVE_MMAP
+	unsigned n;
+	void *data;
+	if(HTF_UNMAP != wavetab[wid].howtofree)
+		return 0;
+
+	n = wavetab[wid].size + wavetab[wid].xsize;
+	data = malloc(n);
+	if(!data)
+	{
+		log_printf(ELOG, "Couldn't copy mapped wave %d!\n", wid);
+		return -1;
+	}
+	memcpy(data, wavetab[wid].data.si8, n);
+	munmap(wavetab[wid].data.si8, n);
+	wavetab[wid].data.si8 = (Sint8 *)data;
+	wavetab[wid].howtofree = HTF_FREE;
+#endif
+	return 0;
+}
+
+
+/*
+ * Make sure the data of wave 'wid' is private, writable and in the
+ * format the wave claims to be in, by expanding mu-law back to 16 bits,
+ * and copying mapped data.
+ */
+static int _expand(int wid)
+{
+	unsigned i, n;
+	Uint8 *src;
+	Sint16 *dst;
+	if(_unmap(wid) < 0)
+		return -1;
+	if(!wavetab[wid].ulaw)
+		return 0;
+
+	n = (wavetab[wid].size + wavetab[wid].xsize) >> 1;
+	dst = (Sint16 *)malloc(n * sizeof(Sint16));
+	if(!dst)
+	{
+		log_printf(ELOG, "Couldn't expand compressed wave %d!\n", wid);
+		return -1;
+	}
+	src = (Uint8 *)wavetab[wid].data.si8;
+	for(i = 0; i < n; ++i)
+		dst[i] = ulawtab[src[i]];
+	free(src);
+	wavetab[wid].data.si16 = dst;
+	wavetab[wid].ulaw = 0;
+	log_printf(DLOG, "Expanded compressed wave %d to 16 bits.\n", wid);
+	return 0;
+}
+
+
 void audio_wave_prepare(int wid)
 {
 	int w, first, last;
@@ -133,7 +250,55 @@ void audio_wave_prepare(int wid)
 		if(!wavetab[w].allocated)
 			continue;
 		_calc_info(w);
+		/*
+		 * Compressed waves have their extensions encoded already,
+		 * and mapped waves have them in the file.
+		 */
+		if(!wavetab[w].ulaw && (HTF_UNMAP != wavetab[w].howtofree))
+			_render_extension(w);
+	}
+}
+
+
+void audio_wave_compress(int wid)
+{
+	int w, first, last;
+	CHECKINIT
+	if(wid < 0)
+	{
+		first = 0;
+		last = AUDIO_MAX_WAVES - 1;
+	}
+	else
+		first = last = wid;
+	for(w = first; w <= last; ++w)
+	{
+		unsigned i, n;
+		Sint16 *src;
+		Uint8 *dst;
+		if(!wavetab[w].data.si8 || wavetab[w].ulaw)
+			continue;
+		if(HTF_FREE != wavetab[w].howtofree)
+			continue;
+		if((AF_MONO16 != wavetab[w].format) &&
+				(AF_STEREO16 != wavetab[w].format))
+			continue;
+
+		_calc_info(w);
 		_render_extension(w);
+		n = (wavetab[w].size + wavetab[w].xsize) >> 1;
+		dst = (Uint8 *)malloc(n);
+		if(!dst)
+		{
+			log_printf(WLOG, "Couldn't compress wave %d!\n", w);
+			continue;
+		}
+		src = wavetab[w].data.si16;
+		for(i = 0; i < n; ++i)
+			dst[i] = _ulaw_encode(src[i]);
+		free(src);
+		wavetab[w].data.si8 = (Sint8 *)dst;
+		wavetab[w].ulaw = 1;
 	}
 }
 
@@ -382,8 +547,14 @@ int audio_wave_alloc(int wid)
 	if(wid < 0)
 		return -2;
 
-	audio_wave_free(wid);
-	wavetab[wid].allocated = 1;
+	/*
+	 * Never clear 'allocated' here, as another thread may
+	 * be looking for a free wave while AGW workers (re)format
+	 * their target waves.
+	 */
+	_free_data(wid);
+	if(!wavetab[wid].allocated)
+		wavetab[wid].allocated = 1;
 	return wid;
 }
 
@@ -421,6 +592,8 @@ audio_wave_t *audio_wave_get(int wid)
 		return NULL;
 	if(wid >= AUDIO_MAX_WAVES)
 		return NULL;
+	if(_expand(wid) < 0)
+		return NULL;
 	return &wavetab[wid];
 }
 
@@ -432,6 +605,9 @@ int audio_wave_format(int wid, audio_formats_t fmt, int fs)
 	if(wid < 0)
 		return wid;
 
+	if(_expand(wid) < 0)
+		return -3;
+
 	old_xsize = wavetab[wid].xsize;
 	wavetab[wid].format = fmt;
 	wavetab[wid].rate = fs;
@@ -502,6 +678,47 @@ int audio_wave_load_mem(int wid, void *data, unsigned size, int looped)
 }
 
 
+int audio_wave_map(int wid, FILE *f, long offset, unsigned size,
+		unsigned xsize, int looped)
+{
+#ifdef KOBO_HAVE_MMAP
+	void *data;
+#endif
+	wid = audio_wave_alloc(wid);
+	if(wid < 0)
+		return wid;
+
+#ifdef KOBO_HAVE_MMAP
+	wavetab[wid].size = size;
+	wavetab[wid].looped = looped;
+	if((_calc_xsize(wid) == size + xsize) &&
+			!(offset % sysconf(_SC_PAGESIZE)))
+	{
+		data = mmap(NULL, size + xsize, PROT_READ, MAP_SHARED,
+				fileno(f), (off_t)offset);
+		if(data != MAP_FAILED)
+		{
+			wavetab[wid].data.si8 = (Sint8 *)data;
+			wavetab[wid].howtofree = HTF_UNMAP;
+			_calc_info(wid);
+			return wid;
+		}
+	}
+#endif
+	/* Fall back to reading the data */
+	wid = audio_wave_load_mem(wid, NULL, size, looped);
+	if(wid < 0)
+		return wid;
+	if((fseek(f, offset, SEEK_SET) != 0) ||
+			(size && (fread(wavetab[wid].data.si8, size, 1, f) != 1)))
+	{
+		audio_wave_free(wid);
+		return -2;
+	}
+	return wid;
+}
+
+
 int audio_wave_blank(int wid, unsigned samples, int looped)
 {
 	int bps = 0;
@@ -714,6 +931,8 @@ int audio_wave_clone(int wid, int new_wid)
 		return -1;
 	if(wid < 0)
 		return -2;
+	if(_expand(wid) < 0)
+		return -3;
 	new_wid = audio_wave_format(new_wid, wavetab[wid].format,
 			wavetab[wid].rate);
 	if(new_wid < 0)
@@ -744,7 +963,7 @@ static int load_midi(int wid, const char *name)
 	if(wid < 0)
 		return wid;
 
-	mf = mf_open(name);
+	mf = mf_open(name, (float)a_settings.samplerate);
 	if(!mf)
 	{
 		log_printf(ELOG, "load_midi(): Failed to load file"
@@ -761,11 +980,11 @@ static int load_midi(int wid, const char *name)
 	wavetab[wid].howtofree = HTF_FREE;
 
 	wavetab[wid].format = AF_MIDI;
-	wavetab[wid].rate = 120;	/* PPQN? */
-	wavetab[wid].looped = 0;	/* Not yet implemented */
+	wavetab[wid].rate = mf->ppqn;
+	wavetab[wid].looped = mf->looped;
 
 	wavetab[wid].speed = 120;	/* ? */
-	wavetab[wid].samples = 1;	/* Number of events? */
+	wavetab[wid].samples = mf->nevents;
 
 	log_printf(DLOG, ".------------------------------------------------------\n");
 	log_printf(DLOG, "| MIDI File: %s\n", name);
@@ -897,6 +1116,40 @@ int audio_wave_save(int wid, const char *name)
 }
 
 
+/* Free the data of wave 'wid', leaving the slot allocated. */
+static void _free_data(int wid)
+{
+	if(!wavetab[wid].data.si8)
+		return;
+#ifdef KOBO_HAVE_MMAP
+	if(HTF_UNMAP == wavetab[wid].howtofree)
+		munmap(wavetab[wid].data.si8,
+				wavetab[wid].size + wavetab[wid].xsize);
+	else
+#endif
+	if(HTF_FREE == wavetab[wid].howtofree)
+		switch(wavetab[wid].format)
+		{
+		  case AF_MONO8:
+		  case AF_STEREO8:
+		  case AF_MONO16:
+		  case AF_STEREO16:
+		  case AF_MONO32:
+		  case AF_STEREO32:
+			free(wavetab[wid].data.si8);
+			break;
+		  case AF_MIDI:
+			mf_close(wavetab[wid].data.midi);
+			break;
+		}
+	wavetab[wid].data.si8 = NULL;
+	wavetab[wid].size = 0;
+	wavetab[wid].xsize = 0;
+	wavetab[wid].ulaw = 0;
+	wavetab[wid].howtofree = HTF_DONT;
+}
+
+
 void audio_wave_free(int wid)
 {
 	int w, first, last;
@@ -912,24 +1165,7 @@ void audio_wave_free(int wid)
 	{
 		if(!wavetab[w].data.si8)
 			continue;
-		if(HTF_FREE == wavetab[w].howtofree)
-			switch(wavetab[w].format)
-			{
-			  case AF_MONO8:
-			  case AF_STEREO8:
-			  case AF_MONO16:
-			  case AF_STEREO16:
-			  case AF_MONO32:
-			  case AF_STEREO32:
-				free(wavetab[w].data.si8);
-				break;
-			  case AF_MIDI:
-				mf_close(wavetab[w].data.midi);
-				break;
-			}
-		wavetab[w].data.si8 = NULL;
-		wavetab[w].size = 0;
-		wavetab[w].xsize = 0;
+		_free_data(w);
 		wavetab[w].allocated = 0;
 	}
 }
@@ -941,6 +1177,7 @@ void audio_wave_info(int wid)
 	int count = 0;
 	int total_size = 0;
 	int total_time = 0;
+	int resident = 0;
 	if(wid < 0)
 	{
 		first = 0;
@@ -968,20 +1205,28 @@ void audio_wave_info(int wid)
 		if(wavetab[w].format == AF_MIDI)
 			log_printf(VLOG, "  (%3d: %s %s, %d PPQN,\t%d events)\n",
 					w, f, wavetab[w].data.midi->title,
-					wavetab[w].rate, wavetab[w].size);
+					wavetab[w].rate, wavetab[w].samples);
 		else
 		{
 			float d = (float)wavetab[w].samples / wavetab[w].rate;
+			int bytes = wavetab[w].size + wavetab[w].xsize;
+			if(wavetab[w].ulaw)
+				bytes >>= 1;
 			log_printf(VLOG, "   %3d: %s %s, %d Hz,\t%d bytes\t"
-					"(%.2f s)\n",
+					"(%.2f s)%s\n",
 					w, f, wavetab[w].looped ?
 							"LOOPED" : "ONESHOT",
-					wavetab[w].rate, wavetab[w].size, d);
+					wavetab[w].rate, wavetab[w].size, d,
+					wavetab[w].ulaw ? " mu-law" : "");
 			total_size += wavetab[w].size;
+			resident += bytes;
 			total_time += d;
 			++count;
 		}
 	}
 	log_printf(VLOG, "  Total %d waveforms, total size: %d bytes, "
 			"total time: %d s\n", count, total_size, total_time);
+	log_printf(VLOG, "  Resident: %d bytes\n", resident);
+	if(wid < 0)
+		eel_profile_dump();
 }
@@ -40,6 +40,8 @@
 extern "C" {
 #endif
 
+#include <stdio.h>
+
 #include "a_types.h"
 #include "a_midifile.h"
 
@@ -53,7 +55,8 @@ void audio_wave_close(void);
 typedef enum _audio_free_t
 {
 	HTF_DONT = 0,
-	HTF_FREE
+	HTF_FREE,
+	HTF_UNMAP	/* Read-only file mapping; see audio_wave_map() */
 } _audio_free_t;
 
 /*----------------------------------------------------------
@@ -76,6 +79,7 @@ typedef struct
 	} data;
 	unsigned	size;		/* Data size in *bytes* */
 	unsigned	xsize;		/* End extension size in *bytes* */
+	int		ulaw;		/* 16 bit data stored as 8 bit mu-law */
 
 	/* Reference/allocation management */
 	_audio_free_t	howtofree;
@@ -87,6 +91,9 @@ typedef struct
 	unsigned	play_samples;	/* For the voice mixer... */
 } audio_wave_t;
 
+/* mu-law to 16 bit decoding table, for waves with 'ulaw' set */
+extern Sint16 ulawtab[256];
+
 void _audio_wave_init(void);
 
 
@@ -115,6 +122,8 @@ int audio_wave_alloc_range(int first_wid, int last_wid);
 /*
  * Get the low level struct for waveform 'wid'. (This is
  * mostly meant for low level libraries, not applications.)
+ * Compressed waveforms are expanded to 16 bits first, and
+ * mapped waveforms get a private copy of their data.
  *
  * Returns NULL if the waveform doesn't exist.
  */
@@ -178,6 +187,24 @@ int audio_wave_save(int wid, const char *name);
  */
 int audio_wave_load_mem(int wid, void *data, unsigned size, int looped);
 
+/*
+ * Like audio_wave_load_mem(), but maps 'size' bytes of native endian
+ * wave data at 'offset' in 'f' read-only into memory, where possible.
+ * The data must be followed by 'xsize' bytes of prepared end extension
+ * (as written by audio_wave_prepare()), and 'offset' must be page
+ * aligned. Mapped pages are only read from disk as the wave is played,
+ * and are shared by all processes mapping the same file.
+ *
+ * If mapping is not supported, or the data doesn't fit the current
+ * engine build (unaligned offset, 'xsize' mismatch), the data is read
+ * into a private buffer instead.
+ *
+ * Returns the id of the new wave, or a negative value in the
+ * case of failure.
+ */
+int audio_wave_map(int wid, FILE *f, long offset, unsigned size,
+		unsigned xsize, int looped);
+
 /*
  * Removes a waveform from memory, and frees the wave id.
  */
@@ -250,7 +277,23 @@ int audio_wave_clone(int wid, int new_wid);
 void audio_wave_prepare(int wid);
 
 /*
- * Dump waveform info to log.
+ * Converts a 16 bit waveform into compact 8 bit mu-law storage,
+ * halving its memory footprint. The voice mixer decodes on the fly.
+ * The wave is prepared first, if needed, as the loop/interpolation
+ * extension is stored along with the data. 8 and 32 bit waves are
+ * left as is. Passing -1 for 'wid' will compress *all* waveforms.
+ *
+ * mu-law is lossy! Anything that needs the actual data again, such
+ * as audio_wave_get(), audio_wave_save() or audio_wave_clone(), will
+ * expand the waveform back to 16 bits, with the quantization noise
+ * included. Mapped waves (audio_wave_map()) are left as is, as they
+ * are already shared, and only paged in as needed.
+ */
+void audio_wave_compress(int wid);
+
+/*
+ * Dump waveform info to log. For all waves (-1), this
+ * also logs the EEL script profile, if there is one.
  */
 void audio_wave_info(int wid);
 
@@ -42,10 +42,10 @@
 /*
  * Parameters
  */
-static audio_wave_t *s_w = NULL;	/* Target waveform */
-static int s_stereo = 0;		/* 1 if waveform is stereo */
-static float s_fs = 44100.0f;		/* Target sample rate (Hz) */
-static float s_dt = 1.0f/44100.0f;	/* Target delta time (s) */
+static WCA_TLS audio_wave_t *s_w = NULL;	/* Target waveform */
+static WCA_TLS int s_stereo = 0;	/* 1 if waveform is stereo */
+static WCA_TLS float s_fs = 44100.0f;	/* Target sample rate (Hz) */
+static WCA_TLS float s_dt = 1.0f/44100.0f;	/* Target delta time (s) */
 /*
  * State
  */
@@ -59,8 +59,8 @@ static float s_dt = 1.0f/44100.0f;	/* Target delta time (s) */
  * (One could use signs instead, but what's the point?
  * You have no business outside waveforms anyway.)
  */
-static unsigned s_rpos = 0;		/* Current target read position */
-static unsigned s_wpos = 0;		/* Current target write position */
+static WCA_TLS unsigned s_rpos = 0;	/* Current target read position */
+static WCA_TLS unsigned s_wpos = 0;	/* Current target write position */
 
 
 static void _init_processing(audio_wave_t *w)
@@ -704,9 +704,9 @@ FIXME: and/or low sample rates.
 
 
 /*
- * Global envelope generators.
+ * Envelope generators. (One set per thread.)
  */
-static modulator_t env[_WCA_MODTARGETS];
+static WCA_TLS modulator_t env[_WCA_MODTARGETS];
 
 
 static void _env_start_all(void)
@@ -765,13 +765,14 @@ void wca_osc(int wid, wca_waveform_t wf, wca_mixmodes_t mm)
 	unsigned s, frames;
 	char sync[BLOCK_FRAMES];
 	float olev = 1.0f;
-	float nyqvist = s_fs * 0.5f;
+	float nyqvist;
 
 	audio_wave_t *wave = audio_wave_get(wid);
 	if(!wave)
 		return;
 
 	_init_processing(wave);
+	nyqvist = s_fs * 0.5f;
 	_env_start_all();
 	noise_reset();
 	osc_w = 0.0;
@@ -1042,7 +1043,7 @@ void wca_filter(int wid, wca_filtertype_t ft)
 				 */
 				if(fe[s] > s_fs * 0.5f)
 					fe[s] = s_fs * 0.5f;
-				f[s] = 2.0f * sin(M_PI * fe[s] * s_dt * 0.5f);
+				f[s] = 2.0f * _sin2pi_d(fe[s] * s_dt * 0.25f);
 				q[s] = 1.0f / amp[s];
 				if(q[s] > 1.0f)
 					q[s] = 1.0f;
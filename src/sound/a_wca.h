@@ -26,10 +26,26 @@
 extern "C" {
 #endif
 
+#include "config.h"
 #include "a_wave.h"
 
 #define WCA_MAX_ENV_STEPS	32
 
+/*
+ * The WCA keeps its state in thread local variables where
+ * the compiler supports them. Then, each thread can render
+ * its own waveform, and WCA_REENTRANT is defined.
+ */
+#if defined(_MSC_VER)
+#	define	WCA_TLS	__declspec(thread)
+#	define	WCA_REENTRANT
+#elif defined(KOBO_HAVE___THREAD)
+#	define	WCA_TLS	__thread
+#	define	WCA_REENTRANT
+#else
+#	define	WCA_TLS
+#endif
+
 /* Reset all envelopes, modulators etc */
 void wca_reset(void);
 
@@ -24,7 +24,7 @@
  * It is best seen as a huge macro.
  */
 
-static unsigned int rnd = 16576;
+static WCA_TLS unsigned int rnd = 16576;
 
 //Resets the noise generator
 static void noise_reset(void)
@@ -76,37 +76,101 @@ static inline float rolloff(float f, float limit)
 }
 
 
-static double osc_w;		/* Ohmega for most oscillators */
-static float noise_out;		/* S&H accumulator for noise */
-static float osc_yit;		/* State for recursive oscillators */
+static WCA_TLS double osc_w;	/* Ohmega for most oscillators */
+static WCA_TLS float noise_out;	/* S&H accumulator for noise */
+static WCA_TLS float osc_yit;	/* State for recursive oscillators */
+
+
+/*
+ * Fast sin(2 * PI * x) for x in [0, 1).
+ *
+ * Reflects x into [-1/4, 1/4] cycles and evaluates an 11th order
+ * Taylor polynomial. The error is below 1e-7, which is far below
+ * the resolution of 16 bit output. There are no branches or table
+ * lookups, so loops over this can be vectorized by the compiler.
+ */
+static inline float _sin2pi(float x)
+{
+	float y = x - 0.5f;			/* [-1/2, 1/2) */
+	float a = y < 0.0f ? -y : y;
+	float z, z2;
+	a = a > 0.25f ? 0.5f - a : a;		/* [0, 1/4] */
+	z = (float)(M_PI * 2.0) * (y < 0.0f ? a : -a);
+	z2 = z * z;
+	return z * (1.0f + z2 * (-1.0f / 6.0f + z2 * (1.0f / 120.0f +
+			z2 * (-1.0f / 5040.0f + z2 * (1.0f / 362880.0f +
+			z2 * (-1.0f / 39916800.0f))))));
+}
+
+/* sin(2 * PI * x) for any x. */
+static inline float _sin2pi_d(double x)
+{
+	return _sin2pi((float)(x - floor(x)));
+}
+
+/* out[i] = sin(2 * PI * ph[i]), with ph[i] in [0, 1). */
+static void _sin2pi_block(const float *ph, float *out, unsigned n)
+{
+	unsigned i;
+	for(i = 0; i < n; ++i)
+		out[i] = _sin2pi(ph[i]);
+}
+
+/*
+ * Generate 'os' oversampled phases per frame into 'ph', wrapped
+ * to [0, 1). This is the only serial part of the phase based
+ * oscillators; everything else is done on whole blocks.
+ */
+static void _osc_phases(char *sync, float *f, float dt, unsigned os,
+		float *ph, unsigned frames)
+{
+	unsigned s, i;
+	double w = osc_w;
+	for(s = 0; s < frames; ++s)
+	{
+		double dw = f[s] * dt;
+		if(sync[s])
+			w = 0.0;
+		for(i = 0; i < os; ++i)
+		{
+			*ph++ = (float)w;
+			w += dw;
+			if((w >= 1.0) || (w < 0.0))
+				w -= floor(w);
+		}
+	}
+	osc_w = w;
+}
+
 
 static inline void _osc_sine(char *sync, float *f,
 		float *mod1,
 		float *out, unsigned frames)
 {
 	const float onediv8 = 1.0f / 8.0f;
-	unsigned s, os;
-	float dt = s_dt * onediv8;
+	unsigned s, i;
+	int fm = 0;
+	float ph[BLOCK_FRAMES * 8];
+	float v[BLOCK_FRAMES * 8];
+	_osc_phases(sync, f, s_dt * onediv8, 8, ph, frames);
+	_sin2pi_block(ph, v, frames * 8);
 	for(s = 0; s < frames; ++s)
-	{
-		float acc = 0.0f;
-		float dw = f[s] * dt;
-		if(sync[s])
-			osc_w = 0.0f;
 		if(mod1[s])
-			for(os = 8; os; --os)
-			{
-				float mod = sin(M_PI * 2.0f * osc_w) * mod1[s];
-				acc += sin(M_PI * 2.0f * (osc_w + mod));
-				osc_w += dw;
-			}
-		else
-			for(os = 8; os; --os)
-			{
-				acc += sin(M_PI * 2.0f * osc_w);
-				osc_w += dw;
-			}
-		out[s] = acc * onediv8;
+			fm = 1;
+	if(fm)
+	{
+		for(i = 0; i < frames * 8; ++i)
+		{
+			float w = ph[i] + v[i] * mod1[i >> 3];
+			ph[i] = w - floor(w);
+		}
+		_sin2pi_block(ph, v, frames * 8);
+	}
+	for(s = 0; s < frames; ++s)
+	{
+		float *vs = v + s * 8;
+		out[s] = (vs[0] + vs[1] + vs[2] + vs[3] +
+				vs[4] + vs[5] + vs[6] + vs[7]) * onediv8;
 	}
 }
 
@@ -117,27 +181,28 @@ static inline void _osc_halfsine(char *sync, float *f,
 {
 	const float onediv2 = 1.0f / 2.0f;
 	unsigned s, os;
-	float dt = s_dt * onediv2;
+	float ph[BLOCK_FRAMES * 2];
+	float v[BLOCK_FRAMES * 2];
+	_osc_phases(sync, f, s_dt * onediv2, 2, ph, frames);
+	_sin2pi_block(ph, v, frames * 2);
 	for(s = 0; s < frames; ++s)
 	{
 		float acc = 0.0f;
-		float dw = f[s] * dt;
-		if(sync[s])
-			osc_w = 0.0f;
-		for(os = 2; os; --os)
+		float m = mod1[s];
+		if(m >= 1.0f)
 		{
-			float v = sin(M_PI * 2.0f * osc_w);
-			if(v < mod1[s])
-				v = mod1[s];
-			v -= 0.5f + mod1[s] * 0.5f;
-			if(mod1[s] < 1.0f)
-				v *= 2.0f / (1.0f - mod1[s]);
-			else
-				v = 1.0f;
-			acc += v;
-			osc_w += dw;
+			out[s] = 1.0f;
+			continue;
+		}
+		for(os = 0; os < 2; ++os)
+		{
+			float x = v[s * 2 + os];
+			if(x < m)
+				x = m;
+			acc += x;
 		}
-		out[s] = acc * onediv2;
+		acc -= 1.0f + m;
+		out[s] = acc * onediv2 * 2.0f / (1.0f - m);
 	}
 }
 
@@ -148,22 +213,22 @@ static inline void _osc_rectsine(char *sync, float *f,
 {
 	const float onediv4 = 1.0f / 4.0f;
 	unsigned s, os;
-	float dt = s_dt * onediv4;
+	float ph[BLOCK_FRAMES * 4];
+	float v[BLOCK_FRAMES * 4];
+	_osc_phases(sync, f, s_dt * onediv4, 4, ph, frames);
+	_sin2pi_block(ph, v, frames * 4);
 	for(s = 0; s < frames; ++s)
 	{
 		float acc = 0.0f;
-		float dw = f[s] * dt;
-		if(sync[s])
-			osc_w = 0.0f;
-		for(os = 4; os; --os)
+		float m = mod1[s];
+		float am = m < 0.0f ? -m : m;
+		for(os = 0; os < 4; ++os)
 		{
-			float v = fabs(sin(M_PI * 2.0f * osc_w) + mod1[s]);
-			v -= fabs(mod1[s] * 0.5f) + 0.5f;
-			v *= 2.0f - 2.0f * fabs(mod1[s]);
-			acc += v;
-			osc_w += dw;
+			float x = v[s * 4 + os] + m;
+			acc += x < 0.0f ? -x : x;
 		}
-		out[s] = acc * onediv4;
+		acc -= 4.0f * (am * 0.5f + 0.5f);
+		out[s] = acc * onediv4 * (2.0f - 2.0f * am);
 	}
 }
 
@@ -174,19 +239,15 @@ static inline void _osc_pulse(char *sync, float *f,
 {
 	const float onediv8 = 1.0f / 8.0f;
 	unsigned s, os;
-	float dt = s_dt * onediv8;
+	float ph[BLOCK_FRAMES * 8];
+	_osc_phases(sync, f, s_dt * onediv8, 8, ph, frames);
 	for(s = 0; s < frames; ++s)
 	{
 		float acc = 0.0f;
-		float dw = f[s] * dt;
-		if(sync[s])
-			osc_w = 0.0f;
-		for(os = 8; os; --os)
-		{
-			float saw = osc_w - floor(osc_w);
-			acc += saw > mod1[s] ? 1.0f : -1.0f;
-			osc_w += dw;
-		}
+		float m = mod1[s];
+		float *ps = ph + s * 8;
+		for(os = 0; os < 8; ++os)
+			acc += ps[os] > m ? 1.0f : -1.0f;
 		out[s] = acc * onediv8;
 	}
 }
@@ -198,32 +259,27 @@ static inline void _osc_triangle(char *sync, float *f,
 {
 	const float onediv4 = 1.0f / 4.0f;
 	unsigned s, os;
-	float dt = s_dt * onediv4;
+	float ph[BLOCK_FRAMES * 4];
+	_osc_phases(sync, f, s_dt * onediv4, 4, ph, frames);
 	for(s = 0; s < frames; ++s)
 	{
 		float acc = 0.0f;
-		float dw = f[s] * dt;
-		if(sync[s])
-			osc_w = 0.0f;
-		if(0.0f == mod1[s])
-			for(os = 4; os; --os)
-			{
-				acc += (osc_w - floor(osc_w)) * 2.0f - 1.0f;
-				osc_w += dw;
-			}
+		float m = mod1[s];
+		float *ps = ph + s * 4;
+		if(0.0f == m)
+			for(os = 0; os < 4; ++os)
+				acc += ps[os] * 2.0f - 1.0f;
 		else
-			for(os = 4; os; --os)
+		{
+			float up = 2.0f / m;
+			float down = 2.0f / (1.0f - m);
+			for(os = 0; os < 4; ++os)
 			{
-				float v = osc_w - floor(osc_w);
-				if(v < mod1[s])
-					v = v / mod1[s];
-				else
-					v = (1.0f - v) / (1.0f - mod1[s]);
-				v *= 2.0f;
-				v -= 1.0f;
-				acc += v;
-				osc_w += dw;
+				float x = ps[os];
+				acc += (x < m ? x * up : (1.0f - x) * down) -
+						1.0f;
 			}
+		}
 		out[s] = acc * onediv4;
 	}
 }
@@ -283,7 +339,7 @@ FIXME: Frequency sweeping broken!
 			osc_w = 0.0f;
 
 		/* Fundamental */
-		out[s] = sin(M_PI * 2.0f * osc_w * f[s]);
+		out[s] = _sin2pi_d(osc_w * f[s]);
 
 		while(running)
 		{
@@ -293,7 +349,7 @@ FIXME: Frequency sweeping broken!
 			hlimit1 = f[s] * (1.0f - m1) + (limit[s] * m1);
 			if(f[s] * n <= hlimit1)
 			{
-				out[s] += sin(M_PI * 2.0f * osc_w * f[s] * n) *
+				out[s] += _sin2pi_d(osc_w * f[s] * n) *
 						(1.0f / n) *
 						rolloff(f[s] * n, hlimit1);
 				running = 1;
@@ -317,7 +373,7 @@ FIXME: Frequency sweeping broken!
 						rolloff(f[s] * n, hlimit3);
 			if(ha != 0)
 			{
-				out[s] += sin(M_PI * 2.0f * osc_w * f[s] * n)
+				out[s] += _sin2pi_d(osc_w * f[s] * n)
 						* ha;
 				running = 1;
 			}
@@ -348,7 +404,7 @@ FIXME: Frequency sweeping broken!
 			osc_w = 0.0f;
 
 		/* Fundamental */
-		out[s] = sin(M_PI * 2.0f * osc_w * f[s]);
+		out[s] = _sin2pi_d(osc_w * f[s]);
 
 		while(1)
 		{
@@ -357,7 +413,7 @@ FIXME: Frequency sweeping broken!
 				break;
 
 			ha = mod1[s] / n;
-			out[s] += sin(M_PI * 2.0f * osc_w * f[s] * n) * ha *
+			out[s] += _sin2pi_d(osc_w * f[s] * n) * ha *
 					rolloff(f[s] * n, limit[s]);
 			n += 1.0f;
 			if(++count > MAX_SPECTRUM_OSCILLATORS)
@@ -368,7 +424,7 @@ FIXME: Frequency sweeping broken!
 				break;
 
 			ha = (mod1[s] + mod2[s]) / n - mod3[s] / (n*n);
-			out[s] += sin(M_PI * 2.0f * osc_w * f[s] * n) * ha *
+			out[s] += _sin2pi_d(osc_w * f[s] * n) * ha *
 					rolloff(f[s] * n, limit[s]);
 			n += 1.0f;
 			if(++count > MAX_SPECTRUM_OSCILLATORS)
@@ -439,7 +495,7 @@ FIXME: Frequency sweeping broken!
 
 		while(f[s] * sf <= lim)
 		{
-			acc += sin(M_PI * 2.0f * f[s] * osc_w * sf) * sa *
+			acc += _sin2pi_d(f[s] * osc_w * sf) * sa *
 					rolloff(sf, lim);
 			sf *= m1;
 			sa *= mod2[s];
@@ -482,7 +538,7 @@ FIXME: Frequency sweeping broken!
 
 		while(f[s] * sf <= lim)
 		{
-			acc += sin(M_PI * 2.0f * f[s] * osc_w * sf) * sa *
+			acc += _sin2pi_d(f[s] * osc_w * sf) * sa *
 					rolloff(sf, lim);
 			sf += m1;
 			sa *= mod2[s];
@@ -519,7 +575,7 @@ FIXME: Frequency sweeping broken!
 			/* Odd overtones */
 			if(f[s] * n > limit[s])
 				break;
-			acc += sin(M_PI * 2.0f * osc_w * f[s] * n) * sao *
+			acc += _sin2pi_d(osc_w * f[s] * n) * sao *
 					rolloff(f[s] * n, limit[s]);
 			n *= mod1[s];
 			sao *= mod2[s];
@@ -529,7 +585,7 @@ FIXME: Frequency sweeping broken!
 			/* Even overtones */
 			if(f[s] * n > limit[s])
 				break;
-			acc += sin(M_PI * 2.0f * osc_w * f[s] * n) * sae *
+			acc += _sin2pi_d(osc_w * f[s] * n) * sae *
 					rolloff(f[s] * n, limit[s]);
 			n *= mod1[s];
 			sae *= mod3[s];
@@ -566,7 +622,7 @@ FIXME: Frequency sweeping broken!
 			/* Odd overtones */
 			if(f[s] * n > limit[s])
 				break;
-			acc += sin(M_PI * 2.0f * osc_w * f[s] * n) * sao *
+			acc += _sin2pi_d(osc_w * f[s] * n) * sao *
 					rolloff(f[s] * n, limit[s]);
 			n += mod1[s];
 			sao *= mod2[s];
@@ -576,7 +632,7 @@ FIXME: Frequency sweeping broken!
 			/* Even overtones */
 			if(f[s] * n > limit[s])
 				break;
-			acc += sin(M_PI * 2.0f * osc_w * f[s] * n) * sae *
+			acc += _sin2pi_d(osc_w * f[s] * n) * sae *
 					rolloff(f[s] * n, limit[s]);
 			n += mod1[s];
 			sae *= mod3[s];
@@ -55,12 +55,14 @@
 #include "a_pitch.h"
 #include "a_filters.h"
 #include "a_limiter.h"
+#include "a_tools.h"
 #include "a_midicon.h"
 #include "a_midi.h"
 #include "a_midifile.h"
 #include "a_sequencer.h"
 #include "a_agw.h"
 #include "a_events.h"
+#include "a_profile.h"
 
 
 /*----------------------------------------------------------
@@ -75,6 +77,7 @@ static pthread_t engine_thread;
 static int using_oss = 0;
 static int using_midi = 0;
 static int using_polling = 0;
+static int using_offline = 0;
 
 int _audio_pause = 1;
 
@@ -84,6 +87,18 @@ int _audio_pause = 1;
 static int *mixbuf = NULL;
 static int *busbufs[AUDIO_MAX_BUSSES];
 
+/* Float bus pipeline; only allocated if a_settings.float_mix is set */
+static int float_mix_request = 0;
+static float *fmixbuf = NULL;
+static float *fbusbufs[AUDIO_MAX_BUSSES];
+
+/*
+ * Number of frames at the start of the master buffer that may
+ * contain something. Chunks vary in size, so this may well be
+ * more than the last chunk mixed.
+ */
+static unsigned master_dirty = 0;
+
 limiter_t limiter;
 
 /* Silent buffer for plugins */
@@ -177,6 +192,19 @@ static void _run_commands(void)
 			(void)ce_start(channeltab + cmd.cid, 0,
 					cmd.tag, cmd.arg1, cmd.arg2);
 			break;
+		  case CMD_PLAY2D:
+		  {
+			audio_channel_t *c = channeltab + cmd.cid;
+			int pan = (Sint16)(cmd.arg3 >> 16);
+			int volume = cmd.arg3 & 0xffff;
+			DBG2(log_printf(D3LOG, "%d: CMD_PLAY2D\n", get_time());)
+			(void)ce_control(c, 0, AVT_FUTURE, ACC_PATCH, cmd.index);
+			(void)ce_control(c, 0, AVT_FUTURE, ACC_PAN, pan << 1);
+			(void)ce_control(c, 0, AVT_FUTURE, ACC_VOLUME,
+					volume << 1);
+			(void)ce_start(c, 0, cmd.tag, cmd.arg1, cmd.arg2);
+			break;
+		  }
 		  case CMD_CCONTROL:
 			DBG2(log_printf(D3LOG, "%d: CMD_CCONTROL\n", get_time());)
 			(void)ce_control(channeltab + cmd.cid, 0,
@@ -251,6 +279,23 @@ static void _s32tos16(Sint32 *inbuf, Sint16 *outbuf, unsigned frames)
 }
 
 
+/*
+ * Convert float to Sint16, with saturation
+ */
+static void _f32tos16(float *inbuf, Sint16 *outbuf, unsigned frames)
+{
+	unsigned i;
+	frames <<= 1;
+	for(i = 0; i < frames; ++i)
+	{
+		float s = inbuf[i];
+		s = s > 32767.0f ? 32767.0f : s;
+		s = s < -32768.0f ? -32768.0f : s;
+		outbuf[i] = (Sint16)s;
+	}
+}
+
+
 #ifdef DEBUG
 static void _grab(Sint16 *buf, unsigned frames)
 {
@@ -288,50 +333,6 @@ static void _grab(Sint16 *buf, unsigned frames)
 }
 #endif
 
-#ifdef PROFILE_AUDIO
-# define DBGT(x)	x
-/*
- * Replace with something else on non-x86 archs, or
- * compilers that don't understand this. Replacement
- * must have better resolution than 1 ms to be useful.
- * Unit is not important as calculations are relative.
- */
-# if defined(__GNUC__) && defined(i386)
-inline int timestamp(void)
-{
-	unsigned long long int x;
-	__asm__ volatile (".byte 0x0f, 0x31" : "=A" (x));
-	return x >> 8;
-}
-# else
-#  ifdef HAVE_GETTIMEOFDAY
-#	if TIME_WITH_SYS_TIME
-#	 include <sys/time.h>
-#	 include <time.h>
-#	else
-#	 if HAVE_SYS_TIME_H
-#	  include <sys/time.h>
-#	 else
-#	  include <time.h>
-#	 endif
-#	endif
-inline int timestamp(void)
-{
-	struct timeval tv;
-	gettimeofday(&tv, NULL);
-	return tv.tv_sec * 1000000 + tv.tv_usec;
-}
-#  else
-inline int timestamp(void)
-{
-	return SDL_GetTicks();
-}
-#  endif
-# endif
-#else
-# define DBGT(x)
-#endif
-
 #ifdef PROFILE_AUDIO
 int audio_cpu_ticks = 333;
 float audio_cpu_total = 0.0;
@@ -351,29 +352,138 @@ char audio_cpu_funcname[AUDIO_CPU_FUNCTIONS][20] = {
 #endif
 
 
+/*
+ * Mixing quality governor
+ *
+ * Processing time is summed up over windows of about
+ * AGOV_WINDOW us of audio. If the engine is using more
+ * than AGOV_HIGH % of the buffer period, the mixer drops
+ * one quality level right away. It goes back up one level
+ * after AGOV_CALM consecutive windows below AGOV_LOW %,
+ * but never above the audio_quality() setting.
+ */
+#define	AGOV_WINDOW	250000
+#define	AGOV_HIGH	70
+#define	AGOV_LOW	30
+#define	AGOV_CALM	8
+
+static const char *agov_names[] = {
+	"Very Low", "Low", "Normal", "High", "Very High"
+};
+
+static Uint32 agov_busy = 0;	/* Processing time (us) */
+static Uint32 agov_time = 0;	/* Audio time (us) */
+static int agov_calm = 0;	/* Windows in a row below AGOV_LOW */
+
+static void _gov_reset(void)
+{
+	agov_busy = agov_time = 0;
+	agov_calm = 0;
+	a_settings.cur_quality = a_settings.quality;
+}
+
+static void _gov_set(audio_quality_t q, Uint32 load)
+{
+	log_printf(VLOG, "audio.c: Load %u%%; mixing quality %s ==> %s\n",
+			load, agov_names[a_settings.cur_quality],
+			agov_names[q]);
+	a_settings.cur_quality = q;
+	voice_update_quality();
+	agov_calm = 0;
+}
+
+static void _govern(Uint32 busy, unsigned frames)
+{
+	Uint32 load;
+	agov_busy += busy;
+	agov_time += (Uint32)((double)frames * 1000000.0 /
+			a_settings.samplerate);
+	if(agov_time < AGOV_WINDOW)
+		return;
+
+	load = (Uint32)((double)agov_busy * 100.0 / agov_time);
+	agov_busy = agov_time = 0;
+	if(a_settings.cur_quality > a_settings.quality)
+		_gov_set(a_settings.quality, load);
+	else if(load > AGOV_HIGH)
+	{
+		if(a_settings.cur_quality > AQ_VERY_LOW)
+			_gov_set(a_settings.cur_quality - 1, load);
+	}
+	else if((load < AGOV_LOW) &&
+			(a_settings.cur_quality < a_settings.quality))
+	{
+		if(++agov_calm >= AGOV_CALM)
+			_gov_set(a_settings.cur_quality + 1, load);
+	}
+	else
+		agov_calm = 0;
+}
+
+
+/*
+ * Number of frames to clear before mixing a chunk of 'frames'
+ * into the master buffer. Anything beyond that is either clean
+ * already, or left for _master_mixed() to keep track of.
+ */
+static inline unsigned _master_clear(unsigned frames)
+{
+	return master_dirty < frames ? master_dirty : frames;
+}
+
+/*
+ * Update 'master_dirty' after a chunk of 'frames' was cleared,
+ * and, if 'mixed' is set, mixed into.
+ */
+static inline void _master_mixed(unsigned frames, int mixed)
+{
+	if(mixed)
+	{
+		if(frames > master_dirty)
+			master_dirty = frames;
+	}
+	else if(master_dirty <= frames)
+		master_dirty = 0;
+}
+
+
 /*
  * Engine callback for SDL_audio and OSS
  */
 static void _audio_callback(void *ud, Uint8 *stream, int len)
 {
-#ifdef PROFILE_AUDIO
 	int i;
-	int t[AUDIO_CPU_FUNCTIONS+2];
-	static int avgt[AUDIO_CPU_FUNCTIONS+1];
-	static int avgtotal;
-	static int lastt = 0;
+	int profiling = aprof_enabled;
+	int governing = a_settings.adaptive && !using_offline;
+	int timing = profiling || governing;
+	Uint32 begin = 0;
+	Uint32 t[APS_STAGES + 1];
+	Uint32 st[APS_STAGES];
+#ifdef PROFILE_AUDIO
+	static Uint32 avgt[AUDIO_CPU_FUNCTIONS+1];
+	static Uint32 avgtotal;
+	static Uint32 lastt = 0;
 	static int last_out = 0;
-	int adjust;
 	int ticks;
-#define	TS(x)	t[x] = timestamp();
-#else
-#define	TS(x)
 #endif
+#define	TS(x)	if(timing) t[x] = aprof_timestamp();
 	unsigned remaining_frames;
 	Sint16 *outbuf = (Sint16 *)stream;
 
-	audio_last_callback = SDL_GetTicks();
-	sync_time(audio_last_callback);
+	if(!using_offline)
+	{
+		audio_last_callback = SDL_GetTicks();
+		sync_time(audio_last_callback);
+	}
+
+	if(timing)
+		memset(st, 0, sizeof(st));
+	if(profiling)
+	{
+		begin = aprof_timestamp();
+		aprof_callback_begin(begin, len / (sizeof(Sint16) * 2),
+				a_settings.samplerate);
+	}
 
 	if(_audio_pause)
 	{
@@ -386,80 +496,124 @@ static void _audio_callback(void *ud, Uint8 *stream, int len)
 	while(remaining_frames)
 	{
 		unsigned frames;
+		int mixed;
 		if(remaining_frames > a_settings.buffersize)
 			frames = a_settings.buffersize;
 		else
 			frames = remaining_frames;
 		remaining_frames -= frames;
 	  TS(0);
-	  TS(1);
 		aev_client("_run_commands()");
 		_run_commands();
-	  TS(2);
+	  TS(1);
 		aev_client("midi_process()");
 		if(using_midi)
 			midi_process();
-	  TS(3);
+	  TS(2);
 		/* This belongs in the MIDI patch plugin. */
 		aev_client("sequencer_process()");
 		sequencer_process(frames);
-	  TS(4);
+	  TS(3);
 		aev_client("midicon_process()");
 		midicon_process(frames);
-	  TS(5);
+	  TS(4);
 		aev_client("channel_process_all()");
 		channel_process_all(frames);
-	  TS(6);
+	  TS(5);
 		aev_client("voice_process_all()");
 		voice_process_all(busbufs, frames);
+	  TS(6);
+		/*
+		 * If no bus mixes into the master buffer, it stays
+		 * silent, and unless the limiter is still releasing,
+		 * the rest is a no-op as well.
+		 */
+		if(a_settings.float_mix)
+		{
+			if(master_dirty)
+				f32clear(fmixbuf, _master_clear(frames));
+	  TS(7);
+			aev_client("bus_process_all_f()");
+			mixed = bus_process_all_f(busbufs, fbusbufs,
+					fmixbuf, frames);
+			_master_mixed(frames, mixed);
+	  TS(8);
+			if(mixed || !limsf_idle(&limiter))
+				limsf_process(&limiter, fmixbuf, fmixbuf,
+						frames);
+	  TS(9);
+			if(mixed)
+				_f32tos16(fmixbuf, outbuf, frames);
+			else
+				memset(outbuf, 0, frames * sizeof(Sint16) * 2);
+	  TS(10);
+		}
+		else
+		{
+			if(master_dirty)
+				memset(mixbuf, 0, _master_clear(frames) *
+						sizeof(int) * 2);
 	  TS(7);
-		memset(mixbuf, 0, frames * sizeof(int) * 2);
+			aev_client("bus_process_all()");
+			mixed = bus_process_all(busbufs, mixbuf, frames);
+			_master_mixed(frames, mixed);
 	  TS(8);
-		aev_client("bus_process_all()");
-		bus_process_all(busbufs, mixbuf, frames);
+			if(mixed || !lims_idle(&limiter))
+				lims_process(&limiter, mixbuf, mixbuf, frames);
 	  TS(9);
-		lims_process(&limiter, mixbuf, mixbuf, frames);
+			if(mixed)
+				_s32tos16(mixbuf, outbuf, frames);
+			else
+				memset(outbuf, 0, frames * sizeof(Sint16) * 2);
 	  TS(10);
-		_s32tos16(mixbuf, outbuf, frames);
-	  TS(11);
+		}
 #ifdef DEBUG
 		_grab(outbuf, frames);
 #endif
-#ifdef PROFILE_AUDIO
-		adjust = t[1] - t[0];
-
-		avgt[0] += t[1] - lastt;
-		lastt = t[1];
-		if(!avgt[0])
-			avgt[0] = 1;
-
-		for(i = 1; i <= AUDIO_CPU_FUNCTIONS; ++i)
-		{
-			int tt = t[i+1] - t[i] - adjust;
-			if(tt > 0)
+		if(timing)
+			for(i = 0; i < APS_TOTAL; ++i)
 			{
-				avgt[i] += tt;
-				avgtotal += tt;
+				st[i] += t[i + 1] - t[i];
+				st[APS_TOTAL] += t[i + 1] - t[i];
 			}
-		}
-		ticks = SDL_GetTicks();
-		if((ticks-last_out) > audio_cpu_ticks)
-		{
-			for(i = 1; i <= AUDIO_CPU_FUNCTIONS; ++i)
-				audio_cpu_function[i-1] =
-						(float)avgt[i] * 100.0 / avgt[0];
-			audio_cpu_total = (float)avgtotal * 100.0 / avgt[0];
-			memset(avgt, 0, sizeof(avgt));
-			avgtotal = 0;
-			last_out = ticks;
-		}
-#undef	TS
-#endif
 		outbuf += frames * 2;
 		aev_advance_timer(frames);
 		advance_time(frames);
 	}
 	aev_client("Unknown");
+
+	if(governing)
+		_govern(st[APS_TOTAL], len / (sizeof(Sint16) * 2));
+
+	if(!profiling)
+		return;
+
+	aprof_callback_end(st);
+
+#ifdef PROFILE_AUDIO
+	/* Running averages for the debug display */
+	avgt[0] += begin - lastt;
+	lastt = begin;
+	if(!avgt[0])
+		avgt[0] = 1;
+	for(i = 1; i <= AUDIO_CPU_FUNCTIONS; ++i)
+	{
+		avgt[i] += st[i - 1];
+		avgtotal += st[i - 1];
+	}
+	ticks = SDL_GetTicks();
+	if((ticks-last_out) > audio_cpu_ticks)
+	{
+		for(i = 1; i <= AUDIO_CPU_FUNCTIONS; ++i)
+			audio_cpu_function[i-1] =
+					(float)avgt[i] * 100.0 / avgt[0];
+		audio_cpu_total = (float)avgtotal * 100.0 / avgt[0];
+		memset(avgt, 0, sizeof(avgt));
+		avgtotal = 0;
+		last_out = ticks;
+	}
+#endif
+#undef	TS
 }
 
 
@@ -632,6 +786,30 @@ static int _start_SDL_output(void)
 }
 
 
+/*
+ * "Driver" for offline rendering. No device; audio_render()
+ * runs the engine callback directly.
+ */
+static int _start_offline_output(void)
+{
+	a_settings.output_buffersize = MAX_BUFFER_SIZE;
+	a_settings.buffersize = MAX_BUFFER_SIZE;
+
+	free(mixbuf);
+	mixbuf = calloc(1, a_settings.buffersize * sizeof(int) * 2);
+	if(!mixbuf)
+		return -1;
+
+	/* Start from a known state, regardless of wall clock time */
+	audio_timer = 0.0;
+	audio_last_callback = 0;
+	hold_until = 0;
+
+	_audio_running = 1;
+	return 0;
+}
+
+
 static int _mixing_open = 0;
 
 static void _close_mixing(void)
@@ -645,7 +823,11 @@ static void _close_mixing(void)
 	{
 		free(busbufs[i]);
 		busbufs[i] = NULL;
+		free(fbusbufs[i]);
+		fbusbufs[i] = NULL;
 	}
+	free(fmixbuf);
+	fmixbuf = NULL;
 	free(audio_silent_buffer);
 	audio_silent_buffer = NULL;
 	_mixing_open = 0;
@@ -674,6 +856,26 @@ static int _open_mixing(void)
 		return -2;
 	}
 
+	if(a_settings.float_mix)
+	{
+		bytes = a_settings.buffersize * sizeof(float) * 2;
+		for(i = 0; i < AUDIO_MAX_BUSSES; ++i)
+		{
+			fbusbufs[i] = calloc(1, bytes);
+			if(!fbusbufs[i])
+			{
+				_close_mixing();
+				return -4;
+			}
+		}
+		fmixbuf = calloc(1, bytes);
+		if(!fmixbuf)
+		{
+			_close_mixing();
+			return -4;
+		}
+	}
+
 /* KLUDGE */	if(lim_open(&limiter, a_settings.samplerate) < 0)
 /* KLUDGE */	{
 /* KLUDGE */		_close_mixing();
@@ -682,6 +884,7 @@ static int _open_mixing(void)
 /* KLUDGE */	lim_control(&limiter, LIM_THRESHOLD, DEFAULT_LIM_THRESHOLD);
 /* KLUDGE */	lim_control(&limiter, LIM_RELEASE, DEFAULT_LIM_RELEASE);
 
+	master_dirty = a_settings.buffersize;
 	_mixing_open = 1;
 	return 0;
 }
@@ -709,7 +912,7 @@ static void _stop_output(void)
 		oss_outbuf = NULL;
 #endif
 	}
-	else
+	else if(!using_offline)
 		SDL_CloseAudio();
 	free(mixbuf);
 	mixbuf = NULL;
@@ -726,6 +929,8 @@ static void _stop_output(void)
  */
 void audio_lock(void)
 {
+	if(using_offline)
+		return;
 	if(using_oss)
 	{
 #ifdef HAVE_OSS
@@ -743,6 +948,8 @@ void audio_lock(void)
 
 void audio_unlock(void)
 {
+	if(using_offline)
+		return;
 	if(using_oss)
 	{
 #ifdef HAVE_OSS
@@ -782,12 +989,18 @@ int audio_open(void)
 
 	/* NOTE: AGW will auto-initialize if used! */
 
+	aprof_open();
+#ifdef PROFILE_AUDIO
+	audio_profile(1);	/* For the debug display */
+#endif
+
 	_wasinit = 1;
 	return 0;
 }
 
 
-int audio_start(int rate, int latency, int use_oss, int use_midi, int pollaudio)
+static int _start(int rate, int latency, int use_oss, int use_midi,
+		int pollaudio, int offline)
 {
 	int i, fragments;
 	if(audio_open() < 0)
@@ -798,8 +1011,11 @@ int audio_start(int rate, int latency, int use_oss, int use_midi, int pollaudio)
 	aev_client("audio_start()");
 
 	a_settings.samplerate = rate;
+	a_settings.float_mix = float_mix_request;
+	_gov_reset();
 	using_oss = use_oss;
 	using_polling = pollaudio;
+	using_offline = offline;
 
 	if(sfifo_init(&commands, sizeof(command_t) * MAX_COMMANDS) < 0)
 	{
@@ -859,7 +1075,9 @@ int audio_start(int rate, int latency, int use_oss, int use_midi, int pollaudio)
 		using_oss = 1;
 	}
 
-	if(using_oss)
+	if(using_offline)
+		i = _start_offline_output();
+	else if(using_oss)
 		i = _start_oss_output();
 	else
 		i = _start_SDL_output();
@@ -898,6 +1116,27 @@ int audio_start(int rate, int latency, int use_oss, int use_midi, int pollaudio)
 }
 
 
+int audio_start(int rate, int latency, int use_oss, int use_midi, int pollaudio)
+{
+	return _start(rate, latency, use_oss, use_midi, pollaudio, 0);
+}
+
+
+int audio_start_offline(int rate)
+{
+	return _start(rate, 0, 0, 0, 0, 1);
+}
+
+
+int audio_render(Sint16 *buf, unsigned frames)
+{
+	if(!using_offline || !_audio_running)
+		return -1;
+	_audio_callback(NULL, (Uint8 *)buf, frames * sizeof(Sint16) * 2);
+	return 0;
+}
+
+
 void audio_stop(void)
 {
 	if(_audio_running)
@@ -935,6 +1174,7 @@ void audio_close(void)
 
 	audio_stop();
 
+	aprof_close();
 	agw_close();
 	audio_group_close();
 	audio_patch_close();
@@ -951,6 +1191,25 @@ void audio_close(void)
 void audio_quality(audio_quality_t quality)
 {
 	a_settings.quality = quality;
+	if(!a_settings.adaptive)
+		a_settings.cur_quality = quality;
+}
+
+void audio_adaptive_quality(int enable)
+{
+	a_settings.adaptive = enable;
+	if(!enable)
+		a_settings.cur_quality = a_settings.quality;
+}
+
+audio_quality_t audio_current_quality(void)
+{
+	return a_settings.cur_quality;
+}
+
+void audio_float_mix(int enable)
+{
+	float_mix_request = enable;
 }
 
 void audio_set_limiter(float thres, float rels)
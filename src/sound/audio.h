@@ -185,6 +185,27 @@ int audio_open(void);
  */
 int audio_start(int rate, int latency, int use_oss, int use_midi, int pollaudio);
 
+/*
+ * Start the audio engine without an output device, for
+ * rendering faster than real time. Nothing is processed
+ * until audio_render() is called, and the engine time
+ * only advances as audio is rendered, starting at 0 ms.
+ *
+ * Returns 0 on success, or a negative value in the case
+ * of failure.
+ */
+int audio_start_offline(int rate);
+
+/*
+ * Run the engine to generate 'frames' stereo frames of
+ * 16 bit audio into 'buf'. Only valid after
+ * audio_start_offline().
+ *
+ * Returns 0 on success, or a negative value in the case
+ * of failure.
+ */
+int audio_render(Sint16 *buf, unsigned frames);
+
 /*
  * "Driver" call for engine low priority housekeeping
  * work. Call this "frequently" - at least ten times per
@@ -224,8 +245,81 @@ void audio_stop(void);
 void audio_close(void);
 
 void audio_quality(audio_quality_t quality);
+
+/*
+ * Adaptive mixing quality. When enabled, the engine watches
+ * its own CPU load, and steps the voice mixer quality down
+ * under load, and back up when there is headroom again. The
+ * audio_quality() setting is the upper limit. Not used when
+ * rendering offline.
+ */
+void audio_adaptive_quality(int enable);
+
+/* Returns the mixing quality currently in use. */
+audio_quality_t audio_current_quality(void);
+
 void audio_set_limiter(float thres, float rels);
 
+/*
+ * Run busses, inserts, master and limiter in 32 bit float
+ * rather than fixed point. Voices still mix in fixed point.
+ * Takes effect the next time the engine is started.
+ */
+void audio_float_mix(int enable);
+
+/*
+ * Engine profiling
+ *
+ * audio_profile(1) starts recording per-stage processing
+ * time histograms and callback timing statistics.
+ * audio_profile(0) stops recording, but keeps the results.
+ *
+ * audio_profile_reset() clears all results.
+ *
+ * audio_profile_dump() writes a report to file 'filename',
+ * or to the log if 'filename' is NULL. Returns 0 on success.
+ *
+ * If recording has been enabled, audio_close() dumps a
+ * report to the file set with audio_profile_file(), or to
+ * the log, if no file is set.
+ */
+void audio_profile(int enable);
+void audio_profile_reset(void);
+int audio_profile_dump(const char *filename);
+void audio_profile_file(const char *filename);
+
+/*
+ * Command recording and offline rendering
+ *
+ * audio_record() logs all commands sent through the
+ * channel, group and bus control calls to text file
+ * 'filename', one line per command:
+ *
+ *	<ms> <action> <cid> <tag> <index> <arg1> <arg2> <arg3>
+ *
+ * where <ms> is the time since the first recorded
+ * command, and <action> is one of "stop", "stopall",
+ * "play", "play2d", "cc" (channel control), "gc" (group
+ * control) or "mc" (mixer/bus control). Trailing
+ * arguments may be left out, and default to 0. Empty
+ * lines and lines starting with '#' are ignored.
+ * audio_record(NULL) stops recording.
+ *
+ * audio_render_script() replays such a command list
+ * through an engine started with audio_start_offline(),
+ * and writes the output to 16 bit stereo WAV file
+ * 'wavfile'. Rendering continues for 'tail' ms after the
+ * last command. Time taken is logged as a throughput
+ * figure. The output is bit exact for a given set of
+ * sounds, script and engine version, so it can be
+ * compared against a reference rendering.
+ *
+ * Both return 0 on success, or a negative value in the
+ * case of failure.
+ */
+int audio_record(const char *filename);
+int audio_render_script(const char *script, const char *wavfile, int tail);
+
 /*
  * Patch Construction (low level)
  */
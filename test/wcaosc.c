@@ -0,0 +1,351 @@
+/*(LGPL)
+---------------------------------------------------------------------------
+	wcaosc.c - Regression test for the WCA block oscillators
+---------------------------------------------------------------------------
+ * Copyright (C) 2007, David Olofson
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Renders frequency sweeps through the block based oscillators of
+ * a_wcaosc.h, and through the original per-sample oscillators that
+ * use libm sin(), and checks that the results match. Each waveform
+ * is tested with and without MOD1, and with and without SYNC.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#ifndef M_PI
+#	define M_PI	3.14159265358979323846
+#endif
+
+/* The same environment a_wca.c provides for a_wcaosc.h */
+#define BLOCK_FRAMES			64
+#define MAX_SPECTRUM_OSCILLATORS	128
+#define	ONEDIV32K	3.0517578125e-5
+#define	WCA_TLS
+static float s_fs = 44100.0f;
+static float s_dt;
+#include "a_wcaosc.h"
+
+/* Two seconds at 44.1 kHz */
+#define	FRAMES		88200
+
+/* Sync pulse interval, in frames */
+#define	SYNC_PERIOD	3001
+
+/* Largest allowed difference; well below one 16 bit LSB */
+#define	TOLERANCE	1e-5
+
+
+/*----------------------------------------------------------
+	Reference oscillators (per sample, libm sin())
+----------------------------------------------------------*/
+
+static double ref_w;
+
+static void ref_sine(char *sync, float *f, float *mod1, float *out,
+		unsigned frames)
+{
+	const float onediv8 = 1.0f / 8.0f;
+	unsigned s, os;
+	float dt = s_dt * onediv8;
+	for(s = 0; s < frames; ++s)
+	{
+		float acc = 0.0f;
+		float dw = f[s] * dt;
+		if(sync[s])
+			ref_w = 0.0f;
+		if(mod1[s])
+			for(os = 8; os; --os)
+			{
+				float mod = sin(M_PI * 2.0f * ref_w) * mod1[s];
+				acc += sin(M_PI * 2.0f * (ref_w + mod));
+				ref_w += dw;
+			}
+		else
+			for(os = 8; os; --os)
+			{
+				acc += sin(M_PI * 2.0f * ref_w);
+				ref_w += dw;
+			}
+		out[s] = acc * onediv8;
+	}
+}
+
+
+static void ref_halfsine(char *sync, float *f, float *mod1, float *out,
+		unsigned frames)
+{
+	const float onediv2 = 1.0f / 2.0f;
+	unsigned s, os;
+	float dt = s_dt * onediv2;
+	for(s = 0; s < frames; ++s)
+	{
+		float acc = 0.0f;
+		float dw = f[s] * dt;
+		if(sync[s])
+			ref_w = 0.0f;
+		for(os = 2; os; --os)
+		{
+			float v = sin(M_PI * 2.0f * ref_w);
+			if(v < mod1[s])
+				v = mod1[s];
+			v -= 0.5f + mod1[s] * 0.5f;
+			if(mod1[s] < 1.0f)
+				v *= 2.0f / (1.0f - mod1[s]);
+			else
+				v = 1.0f;
+			acc += v;
+			ref_w += dw;
+		}
+		out[s] = acc * onediv2;
+	}
+}
+
+
+static void ref_rectsine(char *sync, float *f, float *mod1, float *out,
+		unsigned frames)
+{
+	const float onediv4 = 1.0f / 4.0f;
+	unsigned s, os;
+	float dt = s_dt * onediv4;
+	for(s = 0; s < frames; ++s)
+	{
+		float acc = 0.0f;
+		float dw = f[s] * dt;
+		if(sync[s])
+			ref_w = 0.0f;
+		for(os = 4; os; --os)
+		{
+			float v = fabs(sin(M_PI * 2.0f * ref_w) + mod1[s]);
+			v -= fabs(mod1[s] * 0.5f) + 0.5f;
+			v *= 2.0f - 2.0f * fabs(mod1[s]);
+			acc += v;
+			ref_w += dw;
+		}
+		out[s] = acc * onediv4;
+	}
+}
+
+
+static void ref_pulse(char *sync, float *f, float *mod1, float *out,
+		unsigned frames)
+{
+	const float onediv8 = 1.0f / 8.0f;
+	unsigned s, os;
+	float dt = s_dt * onediv8;
+	for(s = 0; s < frames; ++s)
+	{
+		float acc = 0.0f;
+		float dw = f[s] * dt;
+		if(sync[s])
+			ref_w = 0.0f;
+		for(os = 8; os; --os)
+		{
+			float saw = ref_w - floor(ref_w);
+			acc += saw > mod1[s] ? 1.0f : -1.0f;
+			ref_w += dw;
+		}
+		out[s] = acc * onediv8;
+	}
+}
+
+
+static void ref_triangle(char *sync, float *f, float *mod1, float *out,
+		unsigned frames)
+{
+	const float onediv4 = 1.0f / 4.0f;
+	unsigned s, os;
+	float dt = s_dt * onediv4;
+	for(s = 0; s < frames; ++s)
+	{
+		float acc = 0.0f;
+		float dw = f[s] * dt;
+		if(sync[s])
+			ref_w = 0.0f;
+		if(0.0f == mod1[s])
+			for(os = 4; os; --os)
+			{
+				acc += (ref_w - floor(ref_w)) * 2.0f - 1.0f;
+				ref_w += dw;
+			}
+		else
+			for(os = 4; os; --os)
+			{
+				float v = ref_w - floor(ref_w);
+				if(v < mod1[s])
+					v = v / mod1[s];
+				else
+					v = (1.0f - v) / (1.0f - mod1[s]);
+				v *= 2.0f;
+				v -= 1.0f;
+				acc += v;
+				ref_w += dw;
+			}
+		out[s] = acc * onediv4;
+	}
+}
+
+
+/*----------------------------------------------------------
+	Test driver
+----------------------------------------------------------*/
+
+typedef void (*osc_cb_t)(char *sync, float *f, float *mod1, float *out,
+		unsigned frames);
+
+typedef struct
+{
+	const char	*name;
+	osc_cb_t	osc;		/* Block oscillator under test */
+	osc_cb_t	ref;		/* Reference oscillator */
+	float		m_off;		/* MOD1 when "off" */
+	float		m_from, m_to;	/* MOD1 sweep when "on" */
+} osc_test_t;
+
+static void blk_sine(char *sync, float *f, float *mod1, float *out,
+		unsigned frames)
+{
+	_osc_sine(sync, f, mod1, out, frames);
+}
+
+static void blk_halfsine(char *sync, float *f, float *mod1, float *out,
+		unsigned frames)
+{
+	_osc_halfsine(sync, f, mod1, out, frames);
+}
+
+static void blk_rectsine(char *sync, float *f, float *mod1, float *out,
+		unsigned frames)
+{
+	_osc_rectsine(sync, f, mod1, out, frames);
+}
+
+static void blk_pulse(char *sync, float *f, float *mod1, float *out,
+		unsigned frames)
+{
+	_osc_pulse(sync, f, mod1, out, frames);
+}
+
+static void blk_triangle(char *sync, float *f, float *mod1, float *out,
+		unsigned frames)
+{
+	_osc_triangle(sync, f, mod1, out, frames);
+}
+
+static osc_test_t tests[] = {
+	{ "SINE",	blk_sine,	ref_sine,	0.0f,	0.0f,	0.3f },
+	{ "HALFSINE",	blk_halfsine,	ref_halfsine,	0.0f,	-0.9f,	0.9f },
+	{ "RECTSINE",	blk_rectsine,	ref_rectsine,	0.0f,	-0.9f,	0.9f },
+	{ "PULSE",	blk_pulse,	ref_pulse,	0.5f,	0.1f,	0.9f },
+	{ "TRIANGLE",	blk_triangle,	ref_triangle,	0.0f,	0.1f,	0.9f },
+	{ NULL,		NULL,		NULL,		0.0f,	0.0f,	0.0f }
+};
+
+static float t_freq[FRAMES];
+static float t_mod1[FRAMES];
+static char t_sync[FRAMES];
+static float t_out[FRAMES];
+static float t_ref[FRAMES];
+
+
+/* Run the block oscillator in BLOCK_FRAMES chunks, like wca_osc() */
+static void run_blocks(osc_cb_t osc)
+{
+	unsigned pos = 0;
+	noise_reset();
+	osc_w = 0.0;
+	osc_yit = 0.0f;
+	noise_out = 0.0f;
+	while(pos < FRAMES)
+	{
+		unsigned frames = FRAMES - pos;
+		if(frames > BLOCK_FRAMES)
+			frames = BLOCK_FRAMES;
+		osc(t_sync + pos, t_freq + pos, t_mod1 + pos, t_out + pos,
+				frames);
+		pos += frames;
+	}
+}
+
+
+static int run_test(osc_test_t *t, int mod, int syn)
+{
+	unsigned s, worst = 0;
+	double maxerr = 0.0;
+	for(s = 0; s < FRAMES; ++s)
+	{
+		float x = (float)s / FRAMES;
+		t_freq[s] = 50.0f + 5000.0f * x;
+		if(mod)
+			t_mod1[s] = t->m_from + (t->m_to - t->m_from) * x;
+		else
+			t_mod1[s] = t->m_off;
+		t_sync[s] = syn && !(s % SYNC_PERIOD);
+	}
+
+	run_blocks(t->osc);
+	ref_w = 0.0;
+	t->ref(t_sync, t_freq, t_mod1, t_ref, FRAMES);
+
+	for(s = 0; s < FRAMES; ++s)
+	{
+		double err = fabs(t_out[s] - t_ref[s]);
+		if(err > maxerr)
+		{
+			maxerr = err;
+			worst = s;
+		}
+	}
+
+	printf("%-9s mod1 %-3s sync %-3s max error %.3g",
+			t->name, mod ? "on" : "off", syn ? "on" : "off",
+			maxerr);
+	if(maxerr > TOLERANCE)
+	{
+		printf(" at frame %u (%f vs %f) FAILED!\n",
+				worst, t_out[worst], t_ref[worst]);
+		return -1;
+	}
+	printf("\n");
+	return 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+	int i, failed = 0;
+	s_dt = 1.0f / s_fs;
+	for(i = 0; tests[i].name; ++i)
+	{
+		int mod, syn;
+		for(mod = 0; mod < 2; ++mod)
+			for(syn = 0; syn < 2; ++syn)
+				if(run_test(&tests[i], mod, syn) < 0)
+					++failed;
+	}
+	if(failed)
+	{
+		printf("%d tests failed!\n", failed);
+		return 1;
+	}
+	printf("All tests passed.\n");
+	return 0;
+}